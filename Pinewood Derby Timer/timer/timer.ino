@@ -29,7 +29,7 @@
 /*-----------------------------------------*
   - TIMER CONFIGURATION -
  *-----------------------------------------*/
-#define NUM_LANES    2                 // number of lanes
+#define NUM_LANES    2                 // number of lanes (1-8)
 #define GATE_RESET   0                 // Enable closing start gate to reset timer
 
 //#define LED_DISPLAY  1                 // Enable lane place/time displays
@@ -60,11 +60,13 @@
 #include <Wire.h>
 #include <VL53L0X.h>
 
+#include <TimingCore.h>
+
 /*-----------------------------------------*
   - static definitions -
  *-----------------------------------------*/
 #define PDT_VERSION  "3.11"            // software version - updated for ESP32
-#define MAX_LANE     6                 // maximum number of lanes (ESP32)
+#define MAX_LANE     timingcore::MAX_LANES  // maximum number of lanes (ESP32)
 #define MAX_DISP     8                 // maximum number of displays (Adafruit)
 
 #define mREADY       0                 // program modes
@@ -107,6 +109,9 @@
 #define SMSG_DEBUG   'D'               // <- toggle debug on/off
 #define SMSG_GNUML   'N'               // <- request number of lanes
 #define SMSG_TINFO   'I'               // <- request timer information
+#define SMSG_TSTAT   'T'               // <- request timing statistics
+#define SMSG_TRSET   'X'               // <- reset timing statistics
+#define SMSG_XRSLT   'E'               // <- toggle extended result records
 
 /*-----------------------------------------*
   - pin assignments -
@@ -114,8 +119,6 @@
 // Pin definitions for ESP32
 #define I2C_SDA             21
 #define I2C_SCL             22
-#define SENSOR1_XSHUT       16  // Address: 0x30
-#define SENSOR2_XSHUT       17  // Address: 0x31
 #define START_GATE          4   // With internal pullup
 #define START_SOL           14  // Always HIGH, goes LOW when activated
 #define RESET_SWITCH        13  // Active LOW
@@ -125,6 +128,10 @@
 
 int  BRIGHT_LEV   = 34;                // brightness level (if connected)
 
+//                Lane #       1     2     3     4     5     6     7     8
+uint8_t LANE_XSHUT [MAX_LANE] = {16,   17,   18,   19,   23,   27,   32,    5};    // sensor XSHUT pins
+                                                        // (I2C addresses 0x30 + lane)
+
 //                Display #    1     2     3     4     5     6     7     8
 int  DISP_ADD [MAX_DISP] = {0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77};    // display I2C addresses
 
@@ -132,23 +139,25 @@ int  DISP_ADD [MAX_DISP] = {0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77};
   - global variables -
  *-----------------------------------------*/
 bool          fDebug = false;          // debug flag
+bool          fExtended = false;       // send extended result records
 bool          ready_first;             // first pass in ready state flag
+bool          racing_first;            // first pass in racing state flag
 bool          finish_first;            // first pass in finish state flag
 
 unsigned long start_time;              // race start time (microseconds)
-unsigned long lane_time  [MAX_LANE];   // lane finish time (microseconds)
-int           lane_place [MAX_LANE];   // lane finish place
-bool          lane_mask  [MAX_LANE];   // lane mask status
 
 int           serial_data;             // serial data
 uint8_t       mode;                    // current program mode
 
 float         display_level = -1.0;    // display brightness level
 
-// VL53L0X sensor objects
-VL53L0X sensor1;
-VL53L0X sensor2;
-uint16_t sensor_distance[2];           // Current distances measured by sensors
+// finish detection timing histograms (microseconds, fixed buckets)
+#define NUM_TBUCKET  12
+const unsigned long TBUCKET_US[NUM_TBUCKET-1] = {50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000};
+
+unsigned long hist_detect [MAX_LANE][NUM_TBUCKET];  // sample capture -> detection
+unsigned long hist_i2c    [MAX_LANE][NUM_TBUCKET];  // I2C range read
+unsigned long hist_gap    [MAX_LANE][NUM_TBUCKET];  // gap between successive samples
 
 #ifdef LARGE_DISP
 unsigned char msgGateC[] = {0x6D, 0x41, 0x00, 0x0F, 0x07};  // S=CL
@@ -178,7 +187,31 @@ void dbg(int, const char * msg, int val=-999);
 void smsg(char msg, bool crlf=true);
 void smsg_str(const char * msg, bool crlf=true);
 void setupSensors();
-bool checkFinishLineCrossed(int lane);
+void record_sample_timing(int lane, uint32_t ready_us, uint32_t i2c_us);
+void record_timing(unsigned long hist[][NUM_TBUCKET], int lane, unsigned long us);
+void update_display(int lane, unsigned char msg[]);
+void update_display(int lane, int display_place, unsigned long display_time, int display_mode);
+
+/*-----------------------------------------*
+  - lane finish core -
+ *-----------------------------------------*/
+unsigned long gap_from [MAX_LANE];     // previous sample time for the gap histogram (micros)
+
+// Lane place/time displays; compiled out without LED_DISPLAY
+struct LaneDisplay
+{
+#ifdef LED_DISPLAY
+  static const bool ENABLED = true;
+#else
+  static const bool ENABLED = false;
+#endif
+
+  void blank(int lane)  { update_display(lane, msgBlank); }
+  void result(int lane, int place, uint32_t time_us)  { update_display(lane, place, time_us, SHOW_PLACE); }
+};
+
+timingcore::VL53L0XLane lane_sensor [NUM_LANES];
+timingcore::LaneCore<NUM_LANES, timingcore::VL53L0XLane, LaneDisplay> lanes(lane_sensor, DISTANCE_THRESHOLD);
 
 /*================================================================================*
   SETUP TIMER
@@ -201,8 +234,6 @@ void setup()
   pinMode(RESET_SWITCH, INPUT_PULLUP);
   pinMode(START_GATE,   INPUT_PULLUP);
   pinMode(BRIGHT_LEV,   INPUT);
-  pinMode(SENSOR1_XSHUT, OUTPUT);
-  pinMode(SENSOR2_XSHUT, OUTPUT);
   
   digitalWrite(RESET_SWITCH, HIGH);    // enable pull-up resistor
   digitalWrite(START_GATE,   HIGH);    // enable pull-up resistor
@@ -255,57 +286,44 @@ void setup()
   SETUP VL53L0X SENSORS
  *================================================================================*/
 void setupSensors() {
-  // Reset both sensors by setting XSHUT pins low
-  digitalWrite(SENSOR1_XSHUT, LOW);
-  digitalWrite(SENSOR2_XSHUT, LOW);
-  delay(10);
-  
-  // Enable sensor 1
-  digitalWrite(SENSOR1_XSHUT, HIGH);
-  delay(10);
-  sensor1.setTimeout(500);
-  if (!sensor1.init()) {
-    Serial.println("Failed to initialize sensor 1!");
-  }
-  
-  // Set sensor 1 address to 0x30
-  sensor1.setAddress(0x30);
-  
-  // Enable sensor 2
-  digitalWrite(SENSOR2_XSHUT, HIGH);
-  delay(10);
-  sensor2.setTimeout(500);
-  if (!sensor2.init()) {
-    Serial.println("Failed to initialize sensor 2!");
+  char tmps[50];
+
+  timingcore::VL53L0XLane::beginAll(lane_sensor, LANE_XSHUT, NUM_LANES);
+
+  for (int n=0; n<NUM_LANES; n++)
+  {
+    if (!lane_sensor[n].isOk())
+    {
+      sprintf(tmps, "Failed to initialize sensor %d!", n+1);
+      Serial.println(tmps);
+    }
+    lane_sensor[n].sensor.setMeasurementTimingBudget(SENSOR_TIMING_BUDGET);
   }
-  
-  // Configure both sensors for better accuracy
-  sensor1.setMeasurementTimingBudget(SENSOR_TIMING_BUDGET);
-  sensor2.setMeasurementTimingBudget(SENSOR_TIMING_BUDGET);
-  
+
   // Start continuous back-to-back measurement
-  sensor1.startContinuous();
-  sensor2.startContinuous();
+  for (int n=0; n<NUM_LANES; n++)
+  {
+    lane_sensor[n].start();
+  }
+  timingcore::VL53L0XLane::onSample(record_sample_timing);
 }
 
+
 /*================================================================================*
-  CHECK IF CAR HAS CROSSED FINISH LINE
+  RECORD SENSOR SAMPLE TIMING (RACING ONLY)
  *================================================================================*/
-bool checkFinishLineCrossed(int lane) {
-  // Read the respective sensor based on lane
-  uint16_t distance = 0;
-  
-  if (lane == 0) {
-    distance = sensor1.readRangeContinuousMillimeters();
-  } else if (lane == 1) {
-    distance = sensor2.readRangeContinuousMillimeters();
+void record_sample_timing(int lane, uint32_t ready_us, uint32_t i2c_us)
+{
+  if (mode != mRACING) return;
+
+  record_timing(hist_i2c, lane, i2c_us);
+  if (gap_from[lane] != 0)
+  {
+    record_timing(hist_gap, lane, ready_us - gap_from[lane]);
   }
-  
-  // Store the current distance
-  sensor_distance[lane] = distance;
-  
-  // Check if distance is below threshold (car is detected)
-  return (distance < DISTANCE_THRESHOLD && !sensor1.timeoutOccurred());
+  gap_from[lane] = ready_us;
+
+  return;
 }
 
 /*================================================================================*
@@ -381,58 +399,51 @@ void timer_ready_state()
  *================================================================================*/
 void timer_racing_state()
 {
-  int lanes_left, finish_order;
-  unsigned long current_time, last_finish_time;
+  timingcore::StepResult step;
 
 
-  set_status_led();
-  clear_displays();
-
-  finish_order = 0;
-  last_finish_time = 0;
-
-  lanes_left = NUM_LANES;
-  for (int n=0; n<NUM_LANES; n++)
+  if (racing_first)
   {
-    if (lane_mask[n]) lanes_left--;
-  }
-
-  while (lanes_left)
-  {
-    current_time = micros();
+    set_status_led();
 
     for (int n=0; n<NUM_LANES; n++)
     {
-      // Check if car has crossed finish line using VL53L0X sensors
-      if (lane_time[n] == 0 && checkFinishLineCrossed(n) && !lane_mask[n])    // car has crossed finish line
-      {
-        lanes_left--;
-
-        lane_time[n] = current_time - start_time;
+      gap_from[n] = 0;
+    }
+    lanes.start(start_time);
 
-        if (lane_time[n] > last_finish_time)
-        {
-          finish_order++;
-          last_finish_time = lane_time[n];
-        }
-        lane_place[n] = finish_order;
+    racing_first = false;
+  }
 
-        update_display(n, lane_place[n], lane_time[n], SHOW_PLACE);
-      }
-    }
-    
-    serial_data = get_serial_data();
+  // one pass over the lanes per call, so loop() keeps serving serial messages;
+  // each lane is timed from its own samples, not from when the pass began
+  step = lanes.step();
 
-    if (serial_data == int(SMSG_FORCE) || serial_data == int(SMSG_RESET) || digitalRead(RESET_SWITCH) == LOW)    // force race to end
+  for (int n=0; step.finished != 0; n++, step.finished >>= 1)
+  {
+    if (step.finished & 1)
     {
-      lanes_left = 0;
-      smsg(SMSG_ACKNW);
+      record_timing(hist_detect, n, micros() - lane_sensor[n].getLastSampleUs());
     }
   }
-    
-  send_race_results();
 
-  mode = mFINISH;
+  if (serial_data == int(SMSG_FORCE) || serial_data == int(SMSG_RESET) || digitalRead(RESET_SWITCH) == LOW)    // force race to end
+  {
+    lanes.end();
+    smsg(SMSG_ACKNW);
+  }
+
+  if (lanes.remaining() == 0)
+  {
+    send_race_results();
+    lanes.flushDisplays(true);
+
+    mode = mFINISH;
+  }
+  else if (!step.sampled)    // sensors take priority over the displays
+  {
+    lanes.flushDisplays(false);
+  }
 
   return;
 }
@@ -500,12 +511,30 @@ void process_general_msgs()
       send_timer_info();
   } 
 
+  else if (serial_data == int(SMSG_TSTAT))    // get timing statistics
+  {
+      send_timing_stats();
+  } 
+
+  else if (serial_data == int(SMSG_TRSET))    // reset timing statistics
+  {
+      reset_timing_stats();
+      smsg(SMSG_ACKNW);
+  } 
+
   else if (serial_data == int(SMSG_DEBUG))    // toggle debug
   {
     fDebug = !fDebug;
     dbg(true, "toggle debug = ", fDebug);
   } 
 
+  else if (serial_data == int(SMSG_XRSLT))    // toggle extended results
+  {
+    fExtended = !fExtended;
+    sprintf(tmps, "xrsl=%d", fExtended);
+    smsg_str(tmps);
+  } 
+
   else if (serial_data == int(SMSG_CGATE))    // check start gate
   {
     if (digitalRead(START_GATE) == START_TRIP)    // gate open
@@ -518,8 +547,8 @@ void process_general_msgs()
     } 
   } 
 
-  else if (serial_data == int(SMSG_RESET) || digitalRead(RESET_SWITCH) == LOW)    // timer reset
-  {
+  else if ((serial_data == int(SMSG_RESET) || digitalRead(RESET_SWITCH) == LOW) && mode != mRACING)    // timer reset
+  {                                                          // (ends the race when racing)
     if (digitalRead(START_GATE) != START_TRIP)    // only reset if gate closed
     {
       initialize();
@@ -538,7 +567,7 @@ void process_general_msgs()
     lane = serial_data - 48;
     if (lane >= 1 && lane <= NUM_LANES)
     {
-      lane_mask[lane-1] = true;
+      lanes.mask(lane-1);
 
       dbg(fDebug, "set mask on lane = ", lane);
     }
@@ -575,7 +604,10 @@ void test_pdt_hw()
     for (int n=0; n<NUM_LANES; n++)
     {
       // Test sensors by using distance readings
-      bool lane_status = checkFinishLineCrossed(n);
+      uint16_t mm;
+      uint32_t capture_us;
+      lane_sensor[n].poll(mm, capture_us);
+      bool lane_status = lane_sensor[n].getDistance() < DISTANCE_THRESHOLD;
       
       if (lane_status)
       {
@@ -684,7 +716,7 @@ void send_race_results()
 
   for (int n=0; n<NUM_LANES; n++)    // send times to computer
   {
-    lane_time_sec = (float)(lane_time[n] / 1000000.0);    // elapsed time (seconds)
+    lane_time_sec = (float)(lanes.result(n).time / 1000000.0);    // elapsed time (seconds)
 
     if (lane_time_sec == 0)    // did not finish
     {
@@ -697,6 +729,32 @@ void send_race_results()
                                                // digits by println function
   }
 
+  // photo finishes are only flagged in the extended records (pf=), so
+  // legacy result parsers see exactly one line per lane
+  if (fExtended) send_extended_results();
+
+  return;
+}
+
+
+/*================================================================================*
+  SEND EXTENDED RESULT RECORDS TO COMPUTER
+ *================================================================================*/
+void send_extended_results()
+{
+  char tmps[100];
+
+  // times in microseconds from the start; t=0 means the lane did not finish
+  for (int n=0; n<NUM_LANES; n++)
+  {
+    const timingcore::LaneResult &r = lanes.result(n);
+
+    sprintf(tmps, "xres=%d t=%lu raw=%lu n=%u pre=%u det=%u conf=%d pf=%d",
+            n+1, (unsigned long)r.time, (unsigned long)r.raw, r.samples,
+            r.pre, r.det, r.conf, r.photo ? 1 : 0);
+    Serial.println(tmps);
+  }
+
   return;
 }
 
@@ -727,7 +785,7 @@ void display_race_results()
 
     for (int n=0; n<NUM_LANES; n++)
     {
-      update_display(n, lane_place[n], lane_time[n], display_mode);
+      update_display(n, lanes.result(n).place, lanes.result(n).time, display_mode);
     }
 
     display_mode = !display_mode;
@@ -1020,11 +1078,7 @@ int get_serial_data()
  *================================================================================*/
 void initialize(bool powerup)
 {  
-  for (int n=0; n<NUM_LANES; n++)
-  {
-    lane_time[n] = 0;
-    lane_place[n] = 0;
-  }
+  lanes.reset();
 
   start_time = 0;
   set_status_led();
@@ -1045,6 +1099,7 @@ void initialize(bool powerup)
   Serial.flush();
 
   ready_first  = true;
+  racing_first = true;
   finish_first  = true;
 
   return;
@@ -1058,10 +1113,7 @@ void unmask_all_lanes()
 {  
   dbg(fDebug, "unmask all lanes");
 
-  for (int n=0; n<NUM_LANES; n++)
-  {
-    lane_mask[n] = false;
-  }  
+  lanes.unmaskAll();
 
   return;
 }  
@@ -1130,6 +1182,71 @@ void smsg_str(const char * msg, bool crlf)
 }
 
 
+/*================================================================================*
+  RECORD TIMING SAMPLE IN HISTOGRAM
+ *================================================================================*/
+void record_timing(unsigned long hist[][NUM_TBUCKET], int lane, unsigned long us)
+{
+  int b = 0;
+
+  while (b < NUM_TBUCKET-1 && us > TBUCKET_US[b]) b++;
+  hist[lane][b]++;
+
+  return;
+}
+
+
+/*================================================================================*
+  RESET TIMING STATISTICS
+ *================================================================================*/
+void reset_timing_stats()
+{
+  memset(hist_detect, 0, sizeof(hist_detect));
+  memset(hist_i2c,    0, sizeof(hist_i2c));
+  memset(hist_gap,    0, sizeof(hist_gap));
+
+  dbg(fDebug, "reset timing stats");
+
+  return;
+}
+
+
+/*================================================================================*
+  SEND TIMING STATISTICS TO COMPUTER
+ *================================================================================*/
+void send_timing_stats()
+{
+  char tmps[50];
+  unsigned long (*hist[3])[NUM_TBUCKET] = {hist_detect, hist_i2c, hist_gap};
+  const char * name[3] = {"det", "i2c", "gap"};
+
+  Serial.print("tbkt");
+  for (int b=0; b<NUM_TBUCKET-1; b++)
+  {
+    sprintf(tmps, " %lu", TBUCKET_US[b]);
+    Serial.print(tmps);
+  }
+  Serial.println("");
+
+  for (int n=0; n<NUM_LANES; n++)
+  {
+    for (int h=0; h<3; h++)
+    {
+      sprintf(tmps, "%d %s", n+1, name[h]);
+      Serial.print(tmps);
+      for (int b=0; b<NUM_TBUCKET; b++)
+      {
+        sprintf(tmps, " %lu", hist[h][n][b]);
+        Serial.print(tmps);
+      }
+      Serial.println("");
+    }
+  }
+
+  return;
+}
+
+
 /*================================================================================*
   SEND TIMER INFORMATION TO COMPUTER
  *================================================================================*/
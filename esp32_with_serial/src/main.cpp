@@ -12,6 +12,7 @@
  #include <Wire.h>
  #include <VL53L0X.h>
  #include <ArduinoJson.h>
+ #include <TimingCore.h>
  
  // Pin definitions
  #define I2C_SDA             21
@@ -25,9 +26,9 @@
  #define LED_GREEN           26  // Active HIGH
  #define LED_BLUE            33  // Active HIGH
  
- // VL53L0X sensors
- VL53L0X sensor1;
- VL53L0X sensor2;
+ // VL53L0X sensors, one per lane, at 0x30 and 0x31
+ const uint8_t SENSOR_XSHUT[2] = { SENSOR1_XSHUT, SENSOR2_XSHUT };
+ timingcore::VL53L0XLane laneSensors[2];
  
  // System state
  enum SystemState {
@@ -65,6 +66,12 @@
  int sensor1DefaultReading = 0;
  int sensor2DefaultReading = 0;
  
+ // Finish timing: lanes trigger DETECTION_THRESHOLD below their baseline and
+ // are timed from the sample that saw the car
+ timingcore::LaneCore<2, timingcore::VL53L0XLane> raceLanes(laneSensors, 0);
+ const timingcore::TiePolicy TIE_POLICY = { timingcore::TIE_EXACT, 0 };   // Identical times (ms) only
+ const char* WINNER_NAMES[] = { "tie", "car1", "car2" };
+ 
  void setup() {
    // Initialize serial communication
    Serial.begin(115200);
@@ -108,9 +115,15 @@
  }
  
  void loop() {
-   // Read sensors
-   int distance1 = sensor1.readRangeSingleMillimeters();
-   int distance2 = sensor2.readRangeSingleMillimeters();
+   // Collect any new sensor results; while racing the timing core does it
+   timingcore::StepResult step = { false, 0 };
+   if (currentState == STATE_RACING) {
+     step = raceLanes.step();
+   } else {
+     pollSensors();
+   }
+   int distance1 = laneSensors[0].getDistance();
+   int distance2 = laneSensors[1].getDistance();
    
    // Handle button presses
    handleButtons();
@@ -141,24 +154,13 @@
        // Race in progress, check for finish
        setLedColor(true, true, false);   // YELLOW
        
-       // Check if car 1 has crossed the finish line
-       if (!raceData.car1_finished && 
-           distance1 < (sensor1DefaultReading - DETECTION_THRESHOLD)) {
-         raceData.car1_finished = true;
-         raceData.car1_time = millis() - raceData.race_start_time;
-         sendRaceUpdate();
-       }
-       
-       // Check if car 2 has crossed the finish line
-       if (!raceData.car2_finished && 
-           distance2 < (sensor2DefaultReading - DETECTION_THRESHOLD)) {
-         raceData.car2_finished = true;
-         raceData.car2_time = millis() - raceData.race_start_time;
-         sendRaceUpdate();
+       // Record any car that crossed the finish line on this pass
+       if (step.finished) {
+         recordFinishes();
        }
        
        // Check if race is complete
-       if (raceData.car1_finished && raceData.car2_finished) {
+       if (raceLanes.remaining() == 0) {
          currentState = STATE_RACE_FINISHED;
          finishRace();
        }
@@ -182,39 +184,38 @@
      sendSensorData(distance1, distance2);
      lastSensorUpdateTime = millis();
    }
-   
-   // Small delay to avoid overwhelming the serial port
-   delay(10);
  }
  
  void initSensors() {
-   // Reset both sensors
-   digitalWrite(SENSOR1_XSHUT, LOW);
-   digitalWrite(SENSOR2_XSHUT, LOW);
-   delay(10);
-   
-   // Initialize first sensor with address 0x30
-   digitalWrite(SENSOR1_XSHUT, HIGH);
-   delay(10);
-   sensor1.init();
-   sensor1.setTimeout(500);
-   sensor1.setAddress(0x30);
-   
-   // Initialize second sensor with address 0x31
-   digitalWrite(SENSOR2_XSHUT, HIGH);
-   delay(10);
-   sensor2.init();
-   sensor2.setTimeout(500);
-   sensor2.setAddress(0x31);
-   
-   // Set long range mode for both sensors
-   sensor1.setSignalRateLimit(0.1);
-   sensor1.setVcselPulsePeriod(VL53L0X::VcselPeriodPreRange, 18);
-   sensor1.setVcselPulsePeriod(VL53L0X::VcselPeriodFinalRange, 14);
-   
-   sensor2.setSignalRateLimit(0.1);
-   sensor2.setVcselPulsePeriod(VL53L0X::VcselPeriodPreRange, 18);
-   sensor2.setVcselPulsePeriod(VL53L0X::VcselPeriodFinalRange, 14);
+   // One at a time on their XSHUT pins, each moved to its own address
+   timingcore::VL53L0XLane::beginAll(laneSensors, SENSOR_XSHUT, 2);
+   
+   for (int n = 0; n < 2; n++) {
+     // Long range mode, back-to-back continuous ranging polled from loop()
+     laneSensors[n].setLongRange();
+     laneSensors[n].start();
+   }
+ }
+ 
+ // Collects new results outside a race, for the sensor readings
+ void pollSensors() {
+   uint16_t distance;
+   uint32_t captureUs;
+   for (int n = 0; n < 2; n++) {
+     laneSensors[n].poll(distance, captureUs);
+   }
+ }
+ 
+ // Copies lane finishes from the timing core into the race data
+ void recordFinishes() {
+   const timingcore::LaneResult& lane1 = raceLanes.result(0);
+   const timingcore::LaneResult& lane2 = raceLanes.result(1);
+   
+   raceData.car1_finished = lane1.time != 0;
+   raceData.car2_finished = lane2.time != 0;
+   raceData.car1_time = lane1.time / 1000;
+   raceData.car2_time = lane2.time / 1000;
+   sendRaceUpdate();
  }
  
  void calibrateSensors() {
@@ -224,14 +225,19 @@
    const int numReadings = 10;
    int sum1 = 0, sum2 = 0;
    
+   // Results are collected through the lanes' poll, so each lane's
+   // data-ready tracking stays in step for the first race
    for (int i = 0; i < numReadings; i++) {
-     sum1 += sensor1.readRangeSingleMillimeters();
-     sum2 += sensor2.readRangeSingleMillimeters();
      delay(50);
+     pollSensors();
+     sum1 += laneSensors[0].getDistance();
+     sum2 += laneSensors[1].getDistance();
    }
    
    sensor1DefaultReading = sum1 / numReadings;
    sensor2DefaultReading = sum2 / numReadings;
+   raceLanes.setFilter(0, timingcore::DetectionFilter::belowBaseline(sensor1DefaultReading, DETECTION_THRESHOLD));
+   raceLanes.setFilter(1, timingcore::DetectionFilter::belowBaseline(sensor2DefaultReading, DETECTION_THRESHOLD));
    
    sensorCalibrated = true;
    
@@ -254,6 +260,7 @@
    raceData.car2_time = 0;
    raceData.race_start_time = 0;
    raceData.winner = "";
+   raceLanes.reset();
  }
  
  void handleButtons() {
@@ -338,6 +345,7 @@
    // Set race state and start time
    currentState = STATE_RACING;
    raceData.race_start_time = millis();
+   raceLanes.start(micros());
    
    // Send race started message
    doc["type"] = "race_started";
@@ -348,14 +356,8 @@
  }
  
  void finishRace() {
-   // Determine winner
-   if (raceData.car1_time < raceData.car2_time) {
-     raceData.winner = "car1";
-   } else if (raceData.car2_time < raceData.car1_time) {
-     raceData.winner = "car2";
-   } else {
-     raceData.winner = "tie";
-   }
+   // Determine winner on the reported (ms) times
+   raceData.winner = WINNER_NAMES[TIE_POLICY.apply(raceData.car1_time, raceData.car2_time).winner];
    
    // Send race results
    StaticJsonDocument<256> doc;
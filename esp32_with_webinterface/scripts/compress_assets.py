@@ -0,0 +1,44 @@
+# PlatformIO pre-script: builds the LittleFS image from a gzipped copy of
+# data/, so the web server can send the assets precompressed (see
+# WebServer::loadStaticAssets). Text assets are stored only as .gz; anything
+# else is copied unchanged. data/ itself is left untouched.
+
+Import("env")
+
+import gzip
+import os
+import shutil
+
+COMPRESSED_TYPES = (".html", ".css", ".js", ".json", ".svg")
+FILESYSTEM_TARGETS = ("buildfs", "uploadfs", "uploadfsota")
+
+
+def stage_assets(source, staging):
+    if os.path.isdir(staging):
+        shutil.rmtree(staging)
+
+    original = compressed = 0
+    for root, _, files in os.walk(source):
+        target_dir = os.path.join(staging, os.path.relpath(root, source))
+        os.makedirs(target_dir, exist_ok=True)
+        for name in files:
+            path = os.path.join(root, name)
+            if not name.endswith(COMPRESSED_TYPES):
+                shutil.copy2(path, target_dir)
+                continue
+            target = os.path.join(target_dir, name + ".gz")
+            # mtime=0 keeps the output, and so the ETag, the same for the same input
+            with open(path, "rb") as src, open(target, "wb") as raw:
+                with gzip.GzipFile(filename=name, mode="wb", fileobj=raw, compresslevel=9, mtime=0) as dst:
+                    shutil.copyfileobj(src, dst)
+            original += os.path.getsize(path)
+            compressed += os.path.getsize(target)
+
+    if original:
+        print("Compressed web assets: %d -> %d bytes" % (original, compressed))
+
+
+if any(target in COMMAND_LINE_TARGETS for target in FILESYSTEM_TARGETS):
+    staging = os.path.join(env.subst("$BUILD_DIR"), "data_gz")
+    stage_assets(env.subst("$PROJECT_DATA_DIR"), staging)
+    env.Replace(PROJECT_DATA_DIR=staging)
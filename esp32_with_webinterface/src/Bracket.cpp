@@ -0,0 +1,230 @@
+#include "Bracket.h"
+#include <SD.h>
+
+using namespace tournament;
+
+const char* Bracket::BRACKET_FILE = "/bracket.bin";
+const char* Bracket::BRACKET_TMP_FILE = "/bracket.tmp";
+
+static const char* const FORMAT_NAMES[] = { "none", "single", "double", "round_robin" };
+static const char* const SIDE_NAMES[] = { "winners", "losers", "final", "round_robin" };
+
+// The state as read from or written to the file, kept off the heap and the
+// task stacks. Loading is done before saves are enabled, and after that only
+// the storage task saves.
+static State fileState;
+
+Bracket::Bracket() : sdAvailable(false) {
+    mutex = xSemaphoreCreateMutex();
+}
+
+void Bracket::begin(bool sdAvailable) {
+    if (!sdAvailable) {
+        Serial.println("⚠ No SD card, brackets will not survive a restart");
+        return;
+    }
+    if (loadFromFile()) {
+        Serial.printf("✅ Resumed %s bracket with %u car(s)\n",
+                      FORMAT_NAMES[engine.getState().format], engine.getState().carCount);
+    }
+    this->sdAvailable = true;
+}
+
+bool Bracket::create(const char* format, const uint16_t* carIds, uint16_t count) {
+    Format parsed = FORMAT_NONE;
+    for (int f = FORMAT_SINGLE_ELIMINATION; f <= FORMAT_ROUND_ROBIN; f++) {
+        if (format && strcmp(format, FORMAT_NAMES[f]) == 0) parsed = (Format)f;
+    }
+    if (parsed == FORMAT_NONE) return false;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool ok = engine.create(parsed, carIds, count);
+    xSemaphoreGive(mutex);
+
+    if (ok) {
+        Serial.printf("🏁 Created %s bracket with %u car(s)\n", format, count);
+        requestSave();
+    }
+    return ok;
+}
+
+void Bracket::clear() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    engine.clear();
+    xSemaphoreGive(mutex);
+    requestSave();
+}
+
+bool Bracket::isActive() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    bool active = engine.isActive();
+    xSemaphoreGive(mutex);
+    return active;
+}
+
+bool Bracket::nextHeat(uint16_t& lane1Car, uint16_t& lane2Car) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    Heat heat;
+    bool found = engine.currentHeat(heat);
+    if (found) {
+        lane1Car = engine.getState().entrants[heat.entrant[0]].carId;
+        lane2Car = engine.getState().entrants[heat.entrant[1]].carId;
+    }
+    xSemaphoreGive(mutex);
+    return found;
+}
+
+bool Bracket::recordRace(const RaceResult& result, uint16_t lane1Car, uint16_t lane2Car) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    Heat heat;
+    bool applied = false;
+    // Ad-hoc races between bracket heats are left alone
+    if (engine.currentHeat(heat) &&
+        engine.getState().entrants[heat.entrant[0]].carId == lane1Car &&
+        engine.getState().entrants[heat.entrant[1]].carId == lane2Car) {
+        // Lane-corrected times, the ones the winner was decided on
+        applied = engine.recordResult(heat, result.winner, result.lane1Corrected, result.lane2Corrected);
+    }
+    bool finished = applied && engine.isFinished();
+    uint16_t champion = finished ? engine.getState().entrants[engine.getState().champion].carId : 0;
+    xSemaphoreGive(mutex);
+
+    if (finished) {
+        Serial.printf("🏆 Bracket won by car %u\n", champion);
+    }
+    if (applied) requestSave();
+    return applied;
+}
+
+void Bracket::toJson(JsonDocument& doc) {
+    doc.clear();
+    doc["type"] = "bracket";
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    const State& state = engine.getState();
+    doc["format"] = FORMAT_NAMES[state.format];
+    doc["active"] = engine.isActive();
+    doc["finished"] = engine.isFinished();
+    doc["cars"] = state.carCount;
+    doc["heats_run"] = state.heatsRun;
+    doc["remaining"] = engine.remainingHeats();
+    if (engine.isFinished()) {
+        doc["champion"] = state.entrants[state.champion].carId;
+    } else {
+        doc["champion"] = nullptr;
+    }
+
+    Heat heat;
+    if (engine.currentHeat(heat)) {
+        JsonObject next = doc.createNestedObject("next");
+        next["lane1"] = state.entrants[heat.entrant[0]].carId;
+        next["lane2"] = state.entrants[heat.entrant[1]].carId;
+        next["side"] = SIDE_NAMES[heat.side];
+        next["round"] = heat.round + 1;
+    } else {
+        doc["next"] = nullptr;
+    }
+
+    JsonArray standings = doc.createNestedArray("standings");
+    if (engine.isActive()) {
+        uint16_t order[STANDINGS_SIZE];
+        uint16_t count = engine.standings(order, STANDINGS_SIZE);
+        for (uint16_t i = 0; i < count; i++) {
+            const Entrant& entrant = state.entrants[order[i]];
+            JsonObject row = standings.createNestedObject();
+            row["car"] = entrant.carId;
+            row["wins"] = entrant.wins;
+            row["losses"] = entrant.losses;
+            row["ties"] = entrant.ties;
+            row["average"] = entrant.finishes ? entrant.totalTime / entrant.finishes : 0;
+        }
+    }
+    xSemaphoreGive(mutex);
+}
+
+void Bracket::requestSave() {
+    if (persistHandler) {
+        persistHandler();
+    } else {
+        saveToFile();
+    }
+}
+
+bool Bracket::loadFromFile() {
+    // A save interrupted between the remove and the rename leaves only the
+    // complete temporary file
+    const char* path = BRACKET_FILE;
+    if (!SD.exists(path)) {
+        if (!SD.exists(BRACKET_TMP_FILE)) {
+            return false;
+        }
+        path = BRACKET_TMP_FILE;
+    }
+    File file = SD.open(path, FILE_READ);
+    if (!file) {
+        Serial.println("❌ Failed to open bracket for reading");
+        return false;
+    }
+
+    FileHeader header;
+    bool ok = file.read((uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+              header.version == FILE_VERSION && header.stateSize == sizeof(State) &&
+              file.read((uint8_t*)&fileState, sizeof(State)) == sizeof(State);
+    file.close();
+    if (!ok) {
+        Serial.println("❌ Bracket file not recognised, starting without a bracket");
+        return false;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    ok = engine.restore(fileState);
+    xSemaphoreGive(mutex);
+    if (!ok) {
+        Serial.println("❌ Bracket file is inconsistent, starting without a bracket");
+    }
+    return ok;
+}
+
+bool Bracket::saveToFile() {
+    if (!sdAvailable) {
+        return true;  // Nowhere to keep it, the bracket runs from memory
+    }
+
+    // Copy the state under the lock, write the file outside it
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    memcpy(&fileState, &engine.getState(), sizeof(State));
+    xSemaphoreGive(mutex);
+
+    if (fileState.format == FORMAT_NONE) {
+        if (SD.exists(BRACKET_TMP_FILE)) SD.remove(BRACKET_TMP_FILE);
+        if (SD.exists(BRACKET_FILE) && !SD.remove(BRACKET_FILE)) {
+            Serial.println("❌ Failed to remove bracket file");
+            return false;
+        }
+        return true;
+    }
+
+    // Write the whole state beside the old file and only then replace it, so
+    // a failed or interrupted write never loses the saved bracket
+    File file = SD.open(BRACKET_TMP_FILE, FILE_WRITE);
+    if (!file) {
+        Serial.println("❌ Failed to open bracket for writing");
+        return false;
+    }
+    FileHeader header = { FILE_VERSION, (uint16_t)sizeof(State) };
+    bool ok = file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+              file.write((const uint8_t*)&fileState, sizeof(State)) == sizeof(State);
+    file.close();
+
+    if (!ok) {
+        Serial.println("❌ Failed to write bracket");
+        SD.remove(BRACKET_TMP_FILE);
+        return false;
+    }
+    if ((SD.exists(BRACKET_FILE) && !SD.remove(BRACKET_FILE)) ||
+        !SD.rename(BRACKET_TMP_FILE, BRACKET_FILE)) {
+        Serial.println("❌ Failed to replace bracket file");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "BracketEngine.h"
+#include "RaceResult.h"
+
+// The on-device tournament: wraps BracketEngine with locking, JSON and SD
+// persistence. declareWinner() feeds every finished race to it; a race counts
+// only when the cars in the lanes are the ones the bracket asked for.
+class Bracket {
+public:
+    static const int STANDINGS_SIZE = 20;
+
+    Bracket();
+    // Resumes the saved tournament, if any
+    void begin(bool sdAvailable);
+
+    // format is "single", "double" or "round_robin"
+    bool create(const char* format, const uint16_t* carIds, uint16_t count);
+    void clear();
+
+    bool isActive();
+    // Car ids for the heat to run next, false when there is none
+    bool nextHeat(uint16_t& lane1Car, uint16_t& lane2Car);
+
+    // Returns true if the race was a bracket heat and has been applied
+    bool recordRace(const RaceResult& result, uint16_t lane1Car, uint16_t lane2Car);
+
+    void toJson(JsonDocument& doc);
+
+    // When set, saves are handed to the handler (e.g. the storage writer)
+    // instead of being written synchronously
+    void setPersistHandler(std::function<void()> handler) { persistHandler = handler; }
+    bool persist() { return saveToFile(); }
+
+private:
+    static const char* BRACKET_FILE;
+    static const char* BRACKET_TMP_FILE;   // Written first, then renamed over BRACKET_FILE
+    static const uint16_t FILE_VERSION = 1;
+
+    struct FileHeader {
+        uint16_t version;
+        uint16_t stateSize;
+    };
+
+    tournament::BracketEngine engine;
+    SemaphoreHandle_t mutex;
+    std::function<void()> persistHandler;
+    volatile bool sdAvailable;
+
+    bool loadFromFile();
+    bool saveToFile();
+    void requestSave();
+};
@@ -0,0 +1,418 @@
+#include "BracketEngine.h"
+#include <string.h>
+#include <algorithm>
+
+namespace tournament {
+
+static uint16_t bracketSizeFor(uint16_t cars) {
+    uint16_t size = 2;
+    while (size < cars) size <<= 1;
+    return size;
+}
+
+static int log2Of(uint16_t size) {
+    int bits = 0;
+    while ((1u << bits) < size) bits++;
+    return bits;
+}
+
+// Matches in a losers' bracket round for a bracket of the given size. Odd
+// rounds take the losers dropping out of the winners' bracket, even rounds
+// halve the field.
+static uint16_t losersRoundSize(uint16_t size, int round) {
+    return round % 2 ? size >> ((round + 1) / 2 + 1) : size >> (round / 2 + 2);
+}
+
+BracketEngine::BracketEngine() {
+    clear();
+}
+
+void BracketEngine::clear() {
+    memset(&state, 0, sizeof(state));
+    state.format = FORMAT_NONE;
+    state.champion = SLOT_OPEN;
+}
+
+bool BracketEngine::create(Format format, const uint16_t* carIds, uint16_t count) {
+    if (format == FORMAT_NONE || format > FORMAT_ROUND_ROBIN) return false;
+    if (count < 2 || count > MAX_CARS) return false;
+    for (uint16_t i = 0; i < count; i++) {
+        if (carIds[i] == 0) return false;
+        for (uint16_t j = 0; j < i; j++) {
+            if (carIds[j] == carIds[i]) return false;
+        }
+    }
+
+    clear();
+    state.format = format;
+    state.carCount = count;
+    for (uint16_t i = 0; i < count; i++) {
+        state.entrants[i].carId = carIds[i];
+    }
+
+    if (format == FORMAT_SINGLE_ELIMINATION) {
+        buildSingle();
+    } else if (format == FORMAT_DOUBLE_ELIMINATION) {
+        buildDouble();
+    }
+    return true;
+}
+
+// Standard seeding: seed 1 meets the lowest seed, and byes go to the top
+// seeds, so two byes never meet in the first round
+void BracketEngine::seedFirstRound(uint16_t matchBase, uint16_t bracketSize) {
+    uint16_t order[MAX_CARS];
+    uint16_t length = 1;
+    order[0] = 1;
+    while (length < bracketSize) {
+        for (int i = length - 1; i >= 0; i--) {
+            order[2 * i] = order[i];
+            order[2 * i + 1] = 2 * length + 1 - order[i];
+        }
+        length *= 2;
+    }
+
+    for (uint16_t i = 0; i < bracketSize / 2; i++) {
+        Match& match = state.matches[matchBase + i];
+        for (int slot = 0; slot < 2; slot++) {
+            uint16_t seed = order[2 * i + slot];
+            match.slot[slot] = seed <= state.carCount ? seed - 1 : SLOT_BYE;
+        }
+    }
+    for (uint16_t i = 0; i < bracketSize / 2; i++) {
+        Match& match = state.matches[matchBase + i];
+        if (match.slot[0] == SLOT_BYE || match.slot[1] == SLOT_BYE) {
+            decide(matchBase + i, match.slot[0] == SLOT_BYE ? match.slot[1] : match.slot[0], SLOT_BYE);
+        }
+    }
+}
+
+static void initMatch(Match& match, Side side, int round) {
+    match.slot[0] = match.slot[1] = SLOT_OPEN;
+    match.winner = SLOT_OPEN;
+    match.next = NO_MATCH;
+    match.loserNext = NO_MATCH;
+    match.nextSlot = 0;
+    match.loserSlot = 0;
+    match.side = side;
+    match.round = round;
+}
+
+void BracketEngine::buildSingle() {
+    uint16_t size = bracketSizeFor(state.carCount);
+    int rounds = log2Of(size);
+
+    uint16_t base = 0;
+    for (int round = 0; round < rounds; round++) {
+        uint16_t count = size >> (round + 1);
+        for (uint16_t i = 0; i < count; i++) {
+            Match& match = state.matches[base + i];
+            initMatch(match, SIDE_WINNERS, round);
+            if (round < rounds - 1) {
+                match.next = base + count + i / 2;
+                match.nextSlot = i % 2;
+            }
+        }
+        base += count;
+    }
+    state.matchCount = base;
+    seedFirstRound(0, size);
+}
+
+// Matches are laid out in playing order, so the first ready match is always
+// the one to run: winners' round r, then the losers' rounds it feeds.
+void BracketEngine::buildDouble() {
+    uint16_t size = bracketSizeFor(state.carCount);
+    int rounds = log2Of(size);
+    int losersRounds = rounds >= 2 ? 2 * rounds - 2 : 0;
+
+    uint16_t winnersBase[16];
+    uint16_t losersBase[32];
+    uint16_t index = 0;
+    for (int stage = 0; stage <= 3 * rounds; stage++) {
+        int j = stage / 3;
+        int losersRound = -1;
+        if (stage % 3 == 0) {
+            if (j < rounds) {
+                winnersBase[j] = index;
+                index += size >> (j + 1);
+            }
+        } else if (stage % 3 == 1) {
+            losersRound = j == 0 ? 0 : 2 * j - 1;
+        } else if (j >= 1) {
+            losersRound = 2 * j;
+        }
+        if (losersRound >= 0 && losersRound < losersRounds) {
+            losersBase[losersRound] = index;
+            index += losersRoundSize(size, losersRound);
+        }
+    }
+    uint16_t grandFinal = index;
+    state.matchCount = index + 2;
+
+    for (int round = 0; round < rounds; round++) {
+        uint16_t count = size >> (round + 1);
+        for (uint16_t i = 0; i < count; i++) {
+            Match& match = state.matches[winnersBase[round] + i];
+            initMatch(match, SIDE_WINNERS, round);
+            if (round < rounds - 1) {
+                match.next = winnersBase[round + 1] + i / 2;
+                match.nextSlot = i % 2;
+            } else {
+                match.next = grandFinal;
+                match.nextSlot = 0;
+            }
+
+            if (losersRounds == 0) {
+                match.loserNext = grandFinal;   // Two cars: straight to the final
+                match.loserSlot = 1;
+            } else if (round == 0) {
+                match.loserNext = losersBase[0] + i / 2;
+                match.loserSlot = i % 2;
+            } else {
+                // Alternate the drop order so cars do not meet again at once
+                uint16_t drop = round % 2 ? count - 1 - i : i;
+                match.loserNext = losersBase[2 * round - 1] + drop;
+                match.loserSlot = 1;
+            }
+        }
+    }
+
+    for (int round = 0; round < losersRounds; round++) {
+        uint16_t count = losersRoundSize(size, round);
+        for (uint16_t i = 0; i < count; i++) {
+            Match& match = state.matches[losersBase[round] + i];
+            initMatch(match, SIDE_LOSERS, round);
+            if (round == losersRounds - 1) {
+                match.next = grandFinal;
+                match.nextSlot = 1;
+            } else if (round % 2 == 0) {
+                match.next = losersBase[round + 1] + i;    // Meets a car dropping down
+                match.nextSlot = 0;
+            } else {
+                match.next = losersBase[round + 1] + i / 2;
+                match.nextSlot = i % 2;
+            }
+        }
+    }
+
+    initMatch(state.matches[grandFinal], SIDE_FINAL, 0);
+    initMatch(state.matches[grandFinal + 1], SIDE_FINAL, 1);
+    seedFirstRound(winnersBase[0], size);
+}
+
+void BracketEngine::place(uint16_t match, uint8_t slot, uint16_t entrant) {
+    Match& m = state.matches[match];
+    m.slot[slot] = entrant;
+    if (m.winner != SLOT_OPEN || m.slot[0] == SLOT_OPEN || m.slot[1] == SLOT_OPEN) return;
+
+    // A car facing a bye goes through without racing
+    if (m.slot[0] == SLOT_BYE || m.slot[1] == SLOT_BYE) {
+        decide(match, m.slot[0] == SLOT_BYE ? m.slot[1] : m.slot[0], SLOT_BYE);
+    }
+}
+
+void BracketEngine::decide(uint16_t match, uint16_t winner, uint16_t loser) {
+    Match& m = state.matches[match];
+    m.winner = winner;
+
+    if (state.format == FORMAT_DOUBLE_ELIMINATION && m.side == SIDE_FINAL && m.round == 0) {
+        // The losers' champion has to beat the unbeaten car twice
+        if (winner == m.slot[0] || loser == SLOT_BYE) {
+            finish(winner);
+        } else {
+            place(match + 1, 0, winner);
+            place(match + 1, 1, loser);
+        }
+        return;
+    }
+    if (m.next == NO_MATCH) {
+        finish(winner);
+        return;
+    }
+    place(m.next, m.nextSlot, winner);
+    if (m.loserNext != NO_MATCH) {
+        place(m.loserNext, m.loserSlot, loser);
+    }
+}
+
+void BracketEngine::finish(uint16_t champion) {
+    state.finished = 1;
+    state.champion = champion;
+}
+
+uint32_t BracketEngine::roundRobinHeats() const {
+    uint32_t field = state.carCount + (state.carCount % 2);
+    return (field - 1) * field;
+}
+
+// Circle method: entrant 0 stays put while the others rotate one place per
+// round. With an odd field the extra position is a bye and its heats are
+// skipped. Each pairing runs twice, swapping lanes.
+bool BracketEngine::roundRobinPair(uint32_t heat, uint16_t& lane1, uint16_t& lane2) const {
+    uint32_t field = state.carCount + (state.carCount % 2);
+    uint32_t round = heat / field;
+    uint32_t pair = (heat % field) / 2;
+
+    uint32_t positions[2] = { pair, field - 1 - pair };
+    uint16_t entrant[2];
+    for (int i = 0; i < 2; i++) {
+        uint32_t p = positions[i];
+        entrant[i] = p == 0 ? 0 : (uint16_t)((p - 1 + round) % (field - 1) + 1);
+        if (entrant[i] >= state.carCount) return false;
+    }
+    bool swap = heat % 2;
+    lane1 = entrant[swap ? 1 : 0];
+    lane2 = entrant[swap ? 0 : 1];
+    return true;
+}
+
+bool BracketEngine::currentHeat(Heat& heat) const {
+    if (state.format == FORMAT_NONE || state.finished) return false;
+
+    if (state.format == FORMAT_ROUND_ROBIN) {
+        uint32_t total = roundRobinHeats();
+        for (uint32_t h = state.nextHeat; h < total; h++) {
+            if (roundRobinPair(h, heat.entrant[0], heat.entrant[1])) {
+                heat.id = h;
+                heat.side = SIDE_ROUND_ROBIN;
+                heat.round = h / (state.carCount + (state.carCount % 2));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    for (uint16_t i = 0; i < state.matchCount; i++) {
+        const Match& m = state.matches[i];
+        if (m.winner == SLOT_OPEN && m.slot[0] < SLOT_BYE && m.slot[1] < SLOT_BYE) {
+            heat.id = i;
+            heat.entrant[0] = m.slot[0];
+            heat.entrant[1] = m.slot[1];
+            heat.side = m.side;
+            heat.round = m.round;
+            return true;
+        }
+    }
+    return false;
+}
+
+void BracketEngine::addTime(uint16_t entrant, float seconds) {
+    if (seconds > 0) {
+        state.entrants[entrant].finishes++;
+        state.entrants[entrant].totalTime += seconds;
+    }
+}
+
+bool BracketEngine::recordResult(const Heat& heat, uint8_t winnerLane, float lane1Time, float lane2Time) {
+    Heat current;
+    if (!currentHeat(current) || current.id != heat.id ||
+        current.entrant[0] != heat.entrant[0] || current.entrant[1] != heat.entrant[1] ||
+        winnerLane > 2) {
+        return false;
+    }
+
+    state.heatsRun++;
+    addTime(heat.entrant[0], lane1Time);
+    addTime(heat.entrant[1], lane2Time);
+
+    if (winnerLane == 0) {
+        state.entrants[heat.entrant[0]].ties++;
+        state.entrants[heat.entrant[1]].ties++;
+    } else {
+        uint16_t winner = heat.entrant[winnerLane - 1];
+        uint16_t loser = heat.entrant[2 - winnerLane];
+        state.entrants[winner].wins++;
+        state.entrants[loser].losses++;
+        if (state.format != FORMAT_ROUND_ROBIN) {
+            decide(heat.id, winner, loser);
+        }
+    }
+
+    // An elimination tie is raced again; a round-robin heat is done either way
+    if (state.format == FORMAT_ROUND_ROBIN) {
+        state.nextHeat = heat.id + 1;
+        Heat next;
+        if (!currentHeat(next)) {
+            uint16_t best;
+            standings(&best, 1);
+            finish(best);
+        }
+    }
+    return true;
+}
+
+uint32_t BracketEngine::remainingHeats() const {
+    if (state.format == FORMAT_NONE || state.finished) return 0;
+
+    uint32_t remaining = 0;
+    if (state.format == FORMAT_ROUND_ROBIN) {
+        uint32_t total = roundRobinHeats();
+        uint32_t field = state.carCount + (state.carCount % 2);
+        uint32_t round = state.nextHeat / field;
+        uint16_t lane1, lane2;
+        // Rest of this round heat by heat; every later round is full but for one bye pairing
+        for (uint32_t h = state.nextHeat; h < (round + 1) * field && h < total; h++) {
+            if (roundRobinPair(h, lane1, lane2)) remaining++;
+        }
+        if (round + 2 < field) {
+            remaining += (field - 2 - round) * (field - (state.carCount % 2 ? 2 : 0));
+        }
+        return remaining;
+    }
+
+    // Matches still to race with no bye in them; a grand final reset only
+    // counts once it is needed
+    for (uint16_t i = 0; i < state.matchCount; i++) {
+        const Match& m = state.matches[i];
+        if (m.winner != SLOT_OPEN || m.slot[0] == SLOT_BYE || m.slot[1] == SLOT_BYE) continue;
+        if (m.side == SIDE_FINAL && m.round == 1 && m.slot[0] == SLOT_OPEN) continue;
+        remaining++;
+    }
+    return remaining;
+}
+
+uint16_t BracketEngine::standings(uint16_t* order, uint16_t limit) const {
+    uint16_t all[MAX_CARS];
+    for (uint16_t i = 0; i < state.carCount; i++) all[i] = i;
+
+    const Entrant* e = state.entrants;
+    std::sort(all, all + state.carCount, [e](uint16_t a, uint16_t b) {
+        if (e[a].wins != e[b].wins) return e[a].wins > e[b].wins;
+        if (e[a].ties != e[b].ties) return e[a].ties > e[b].ties;
+        if (e[a].losses != e[b].losses) return e[a].losses < e[b].losses;
+        // Average time, cars that have finished ahead of those that have not
+        if ((e[a].finishes == 0) != (e[b].finishes == 0)) return e[b].finishes == 0;
+        if (e[a].finishes > 0) {
+            float averageA = e[a].totalTime / e[a].finishes;
+            float averageB = e[b].totalTime / e[b].finishes;
+            if (averageA != averageB) return averageA < averageB;
+        }
+        return e[a].carId < e[b].carId;
+    });
+
+    uint16_t count = state.carCount < limit ? state.carCount : limit;
+    memcpy(order, all, count * sizeof(uint16_t));
+    return count;
+}
+
+bool BracketEngine::restore(const State& saved) {
+    if (saved.format == FORMAT_NONE || saved.format > FORMAT_ROUND_ROBIN) return false;
+    if (saved.carCount < 2 || saved.carCount > MAX_CARS || saved.matchCount > MAX_MATCHES) return false;
+    if (saved.finished && saved.champion >= saved.carCount) return false;
+
+    for (uint16_t i = 0; i < saved.matchCount; i++) {
+        const Match& m = saved.matches[i];
+        for (int slot = 0; slot < 2; slot++) {
+            if (m.slot[slot] >= saved.carCount && m.slot[slot] < SLOT_BYE) return false;
+        }
+        if (m.next != NO_MATCH && m.next >= saved.matchCount) return false;
+        if (m.loserNext != NO_MATCH && m.loserNext >= saved.matchCount) return false;
+        if (m.nextSlot > 1 || m.loserSlot > 1) return false;
+    }
+
+    memcpy(&state, &saved, sizeof(state));
+    return true;
+}
+
+}  // namespace tournament
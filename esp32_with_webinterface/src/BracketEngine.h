@@ -0,0 +1,119 @@
+#pragma once
+
+// Portable core of the on-device tournament: single and double elimination,
+// and round robin where every pairing races once in each lane. No Arduino
+// dependencies. The whole tournament lives in one fixed-size State, so its
+// memory does not depend on the field size and it can be written to storage
+// as-is and resumed after a power cycle.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace tournament {
+
+const uint16_t MAX_CARS = 256;
+const uint16_t MAX_MATCHES = 2 * MAX_CARS;   // Double elimination needs 2P - 1
+const uint16_t SLOT_OPEN = 0xFFFF;           // Feeder match not decided yet
+const uint16_t SLOT_BYE = 0xFFFE;            // No car will come
+const uint16_t NO_MATCH = 0xFFFF;
+
+enum Format : uint8_t {
+    FORMAT_NONE = 0,
+    FORMAT_SINGLE_ELIMINATION = 1,
+    FORMAT_DOUBLE_ELIMINATION = 2,
+    FORMAT_ROUND_ROBIN = 3
+};
+
+enum Side : uint8_t {
+    SIDE_WINNERS = 0,
+    SIDE_LOSERS = 1,
+    SIDE_FINAL = 2,            // Grand final and its reset
+    SIDE_ROUND_ROBIN = 3
+};
+
+// Slots and winners hold entrant indexes, or SLOT_OPEN / SLOT_BYE
+struct Match {
+    uint16_t slot[2];          // Lane 1, lane 2
+    uint16_t winner;
+    uint16_t next;             // Match the winner moves to
+    uint16_t loserNext;        // Match the loser drops to, NO_MATCH if eliminated
+    uint8_t nextSlot;
+    uint8_t loserSlot;
+    uint8_t side;              // Side
+    uint8_t round;             // Within its side, from 0
+};
+
+struct Entrant {
+    uint16_t carId;
+    uint16_t wins;
+    uint16_t losses;
+    uint16_t ties;
+    uint16_t finishes;
+    float totalTime;           // Seconds over all finishes
+};
+
+// The race to run next
+struct Heat {
+    uint16_t id;               // Match index, or round-robin heat number
+    uint16_t entrant[2];       // Lane 1, lane 2
+    uint8_t side;              // Side
+    uint8_t round;
+};
+
+struct State {
+    uint8_t format;            // Format
+    uint8_t finished;
+    uint16_t carCount;
+    uint16_t matchCount;       // Elimination only
+    uint16_t champion;         // Entrant index once finished
+    uint32_t heatsRun;
+    uint32_t nextHeat;         // Round robin: heat number to run next
+    Entrant entrants[MAX_CARS];
+    Match matches[MAX_MATCHES];
+};
+
+class BracketEngine {
+public:
+    BracketEngine();
+
+    // Seeds the cars in the order given. Fails for fewer than 2 or more than
+    // MAX_CARS cars, a car id of 0 or a repeated id.
+    bool create(Format format, const uint16_t* carIds, uint16_t count);
+    void clear();
+
+    bool isActive() const { return state.format != FORMAT_NONE; }
+    bool isFinished() const { return state.finished; }
+
+    // False when there is no bracket or it has finished
+    bool currentHeat(Heat& heat) const;
+
+    // Result of the current heat: winnerLane 1 or 2, or 0 for a tie, which
+    // reruns an elimination heat. Times in seconds, 0 for a DNF.
+    bool recordResult(const Heat& heat, uint8_t winnerLane, float lane1Time, float lane2Time);
+
+    // Heats still to run; elimination counts matches with two real cars to
+    // come, so it can grow by one for a grand final reset
+    uint32_t remainingHeats() const;
+
+    // Entrant indexes ordered best first: wins, then ties, then average time
+    uint16_t standings(uint16_t* order, uint16_t limit) const;
+
+    const State& getState() const { return state; }
+    // Takes over a saved state after checking that it is consistent
+    bool restore(const State& saved);
+
+private:
+    State state;
+
+    void buildSingle();
+    void buildDouble();
+    void seedFirstRound(uint16_t matchBase, uint16_t bracketSize);
+    void place(uint16_t match, uint8_t slot, uint16_t entrant);
+    void decide(uint16_t match, uint16_t winner, uint16_t loser);
+    void finish(uint16_t champion);
+    bool roundRobinPair(uint32_t heat, uint16_t& lane1, uint16_t& lane2) const;
+    uint32_t roundRobinHeats() const;
+    void addTime(uint16_t entrant, float seconds);
+};
+
+}  // namespace tournament
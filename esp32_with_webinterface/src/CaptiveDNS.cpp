@@ -0,0 +1,144 @@
+#include "CaptiveDNS.h"
+
+// DNS header flags
+static const uint16_t DNS_QR = 0x8000;        // Response
+static const uint16_t DNS_OPCODE = 0x7800;
+static const uint16_t DNS_RD = 0x0100;        // Recursion desired (echoed)
+static const uint16_t DNS_RA = 0x0080;        // Recursion available
+static const uint16_t DNS_TYPE_A = 1;
+static const uint16_t DNS_CLASS_IN = 1;
+static const size_t DNS_HEADER_SIZE = 12;
+
+CaptiveDNS::TaskHook CaptiveDNS::taskHook = nullptr;
+
+CaptiveDNS::CaptiveDNS()
+    : taskHandle(nullptr), running(false), restart(false), tokens(BURST),
+      lastRefillMs(0), answered(0), dropped(0) {}
+
+void CaptiveDNS::start(IPAddress ip) {
+    apIP = ip;
+    restart = true;
+    running = true;
+
+    if (!taskHandle) {
+        // Core 0 with the WiFi stack, below it in priority; loop() stays alone on core 1
+        xTaskCreatePinnedToCore(taskEntry, "dns", TASK_STACK_SIZE, this,
+                                TASK_PRIORITY, &taskHandle, 0);
+        if (taskHandle && taskHook) {
+            taskHook("dns", taskHandle);
+        }
+    } else {
+        xTaskNotifyGive(taskHandle);
+    }
+}
+
+void CaptiveDNS::stop() {
+    running = false;
+}
+
+void CaptiveDNS::taskEntry(void* arg) {
+    static_cast<CaptiveDNS*>(arg)->run();
+}
+
+bool CaptiveDNS::takeToken() {
+    uint32_t now = millis();
+    uint32_t refill = (now - lastRefillMs) * RATE_PER_SEC / 1000;
+    if (refill > 0) {
+        tokens = tokens + refill > BURST ? BURST : tokens + refill;
+        lastRefillMs += refill * 1000 / RATE_PER_SEC;
+    }
+    if (tokens == 0) {
+        return false;
+    }
+    tokens--;
+    return true;
+}
+
+void CaptiveDNS::run() {
+    static uint8_t packet[MAX_PACKET];
+    bool listening = false;
+
+    for (;;) {
+        if (!running) {
+            if (listening) {
+                udp.stop();
+                listening = false;
+            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        if (restart) {
+            restart = false;
+            if (listening) udp.stop();
+            listening = udp.begin(PORT);
+            lastRefillMs = millis();
+            if (!listening) {
+                Serial.println("❌ Captive DNS failed to open port 53");
+                running = false;
+                continue;
+            }
+        }
+
+        int size = udp.parsePacket();
+        if (size <= 0) {
+            vTaskDelay(pdMS_TO_TICKS(IDLE_POLL_MS));
+            continue;
+        }
+
+        // Always drain the socket; only answer while the bucket has tokens
+        int length = udp.read(packet, sizeof(packet));
+        if (!takeToken()) {
+            dropped++;
+            continue;
+        }
+        answer(packet, length);
+    }
+}
+
+void CaptiveDNS::answer(uint8_t* packet, int length) {
+    if (length < (int)DNS_HEADER_SIZE) return;
+
+    uint16_t flags = (packet[2] << 8) | packet[3];
+    uint16_t questions = (packet[4] << 8) | packet[5];
+    if ((flags & DNS_QR) || (flags & DNS_OPCODE) || questions != 1) return;
+
+    // Walk the question name to find QTYPE
+    int pos = DNS_HEADER_SIZE;
+    while (pos < length && packet[pos] != 0) {
+        if (packet[pos] & 0xC0) return;  // Compression is not expected in a query
+        pos += packet[pos] + 1;
+    }
+    pos++;  // Terminating zero
+    if (pos + 4 > length) return;
+    uint16_t qtype = (packet[pos] << 8) | packet[pos + 1];
+    uint16_t qclass = (packet[pos + 2] << 8) | packet[pos + 3];
+    int questionEnd = pos + 4;
+
+    bool answerA = qtype == DNS_TYPE_A && qclass == DNS_CLASS_IN;
+    uint16_t responseFlags = DNS_QR | (flags & DNS_RD) | DNS_RA;
+
+    // Header and question are echoed; the answer is appended after the question
+    uint8_t record[16] = {
+        0xC0, 0x0C,                         // Name: pointer to the question
+        0x00, DNS_TYPE_A, 0x00, DNS_CLASS_IN,
+        0x00, 0x00, 0x00, 0x3C,             // TTL 60 s
+        0x00, 0x04,
+        apIP[0], apIP[1], apIP[2], apIP[3]
+    };
+
+    packet[2] = responseFlags >> 8;
+    packet[3] = responseFlags & 0xFF;
+    packet[6] = 0;
+    packet[7] = answerA ? 1 : 0;            // Other types get an empty NOERROR answer
+    packet[8] = packet[9] = 0;              // No authority records
+    packet[10] = packet[11] = 0;            // No additional records
+
+    udp.beginPacket(udp.remoteIP(), udp.remotePort());
+    udp.write(packet, questionEnd);
+    if (answerA) {
+        udp.write(record, sizeof(record));
+    }
+    udp.endPacket();
+    answered++;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Captive-portal DNS responder running in its own low-priority task, so
+// portal probes are answered during a race and never run on the loop task.
+// Every A query resolves to the AP address; a token bucket caps how many
+// queries are answered per second and the rest are dropped.
+class CaptiveDNS {
+public:
+    static const uint16_t PORT = 53;
+    static const uint32_t RATE_PER_SEC = 20;   // Sustained answers per second
+    static const uint32_t BURST = 40;          // Bucket size
+
+    // Called once with the responder task when it is created, e.g. to
+    // register it for stack monitoring
+    typedef void (*TaskHook)(const char* name, TaskHandle_t handle);
+    static void onTaskStarted(TaskHook hook) { taskHook = hook; }
+
+    CaptiveDNS();
+    void start(IPAddress ip);
+    void stop();
+    bool isRunning() const { return running; }
+
+    TaskHandle_t getTaskHandle() const { return taskHandle; }
+    uint32_t getAnswered() const { return answered; }
+    uint32_t getDropped() const { return dropped; }
+
+private:
+    static const uint32_t TASK_STACK_SIZE = 3072;
+    static const UBaseType_t TASK_PRIORITY = 1;
+    static const uint32_t IDLE_POLL_MS = 10;
+    static const size_t MAX_PACKET = 512;
+
+    static TaskHook taskHook;
+
+    static void taskEntry(void* arg);
+    void run();
+    bool takeToken();
+    void answer(uint8_t* packet, int length);
+
+    WiFiUDP udp;
+    TaskHandle_t taskHandle;
+    IPAddress apIP;
+    volatile bool running;
+    volatile bool restart;
+    uint32_t tokens;
+    uint32_t lastRefillMs;
+    volatile uint32_t answered;
+    volatile uint32_t dropped;
+};
@@ -0,0 +1,313 @@
+#include "CarStats.h"
+#include <LittleFS.h>
+#include <algorithm>
+#include <memory>
+
+const char* CarStats::STATS_FILE = "/car_stats.bin";
+const char* CarStats::STATS_TMP_FILE = "/car_stats.tmp";
+
+void RunningStats::add(float x) {
+    count++;
+    float delta = x - mean;
+    mean += delta / count;
+    m2 += delta * (x - mean);
+}
+
+// Chan et al. pairwise combination, so two partial sessions add up exactly
+void RunningStats::merge(const RunningStats& other) {
+    if (other.count == 0) return;
+    if (count == 0) {
+        *this = other;
+        return;
+    }
+    uint16_t total = count + other.count;
+    float delta = other.mean - mean;
+    mean += delta * other.count / total;
+    m2 += other.m2 + delta * delta * ((float)count * other.count / total);
+    count = total;
+}
+
+CarStats::CarStats() : carCount(0), loaded(false) {
+    mutex = xSemaphoreCreateMutex();
+    memset(cars, 0, sizeof(cars));
+    memset(laneCar, 0, sizeof(laneCar));
+}
+
+void CarStats::begin() {
+    std::unique_ptr<CarRecord[]> stored(new CarRecord[MAX_CARS]);
+    uint16_t storedCount = 0;
+    if (!loadFromFile(stored.get(), storedCount)) {
+        storedCount = 0;
+    }
+
+    // Races run before the filesystem was mounted are merged into the stored session
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    std::unique_ptr<CarRecord[]> pending(new CarRecord[MAX_CARS]);
+    uint16_t pendingCount = 0;
+    for (int i = 0; i < MAX_CARS; i++) {
+        if (cars[i].carId != 0) pending[pendingCount++] = cars[i];
+    }
+    memset(cars, 0, sizeof(cars));
+    carCount = 0;
+    for (uint16_t i = 0; i < storedCount; i++) {
+        CarRecord* car = find(stored[i].carId, true);
+        if (car) *car = stored[i];
+    }
+    for (uint16_t i = 0; i < pendingCount; i++) {
+        CarRecord* car = find(pending[i].carId, true);
+        if (!car) continue;
+        car->races += pending[i].races;
+        if (pending[i].best > 0 && (car->best == 0 || pending[i].best < car->best)) {
+            car->best = pending[i].best;
+        }
+        car->time.merge(pending[i].time);
+        for (int lane = 0; lane < NUM_LANES; lane++) {
+            car->lane[lane].merge(pending[i].lane[lane]);
+        }
+    }
+    loaded = true;
+    xSemaphoreGive(mutex);
+
+    Serial.printf("✅ Loaded statistics for %u car(s)\n", storedCount);
+    if (pendingCount > 0) {
+        Serial.printf("🔄 Merged %u car(s) raced during boot into statistics\n", pendingCount);
+        requestSave();
+    }
+}
+
+void CarStats::setLanes(uint16_t lane1Car, uint16_t lane2Car) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    laneCar[0] = lane1Car;
+    laneCar[1] = lane2Car;
+    xSemaphoreGive(mutex);
+}
+
+// Caller holds the mutex
+CarRecord* CarStats::find(uint16_t carId, bool create) {
+    if (carId == 0) return nullptr;
+    // Car numbers are usually handed out in sequence, so the low bits spread them well
+    int slot = carId & (MAX_CARS - 1);
+    for (int probe = 0; probe < MAX_CARS; probe++) {
+        CarRecord& car = cars[(slot + probe) & (MAX_CARS - 1)];
+        if (car.carId == carId) return &car;
+        if (car.carId == 0) {
+            if (!create) return nullptr;
+            memset(&car, 0, sizeof(car));
+            car.carId = carId;
+            carCount++;
+            return &car;
+        }
+    }
+    return nullptr;  // Table full
+}
+
+void CarStats::addFinish(CarRecord& car, int lane, float seconds) {
+    if (car.best == 0 || seconds < car.best) {
+        car.best = seconds;
+    }
+    car.time.add(seconds);
+    car.lane[lane].add(seconds);
+}
+
+bool CarStats::recordRace(const RaceResult& result) {
+    // Measured times, not the tie-adjusted ones
+    const float raw[NUM_LANES] = { result.lane1Raw, result.lane2Raw };
+    bool recorded = false;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int lane = 0; lane < NUM_LANES; lane++) {
+        if (laneCar[lane] == 0) continue;
+        CarRecord* car = find(laneCar[lane], true);
+        if (!car) {
+            Serial.printf("⚠ Car statistics full, car %u not recorded\n", laneCar[lane]);
+            continue;
+        }
+        car->races++;
+        if (raw[lane] > 0) {
+            addFinish(*car, lane, raw[lane]);
+        }
+        recorded = true;
+    }
+    memset(laneCar, 0, sizeof(laneCar));
+    xSemaphoreGive(mutex);
+
+    if (recorded) requestSave();
+    return recorded;
+}
+
+void CarStats::clear() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    memset(cars, 0, sizeof(cars));
+    carCount = 0;
+    xSemaphoreGive(mutex);
+    requestSave();
+}
+
+// Two-sided 95% Student t critical values for 1..30 degrees of freedom
+static const float T_95[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+LaneBiasEstimate CarStats::laneBias() {
+    RunningStats diff;
+    diff.reset();
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CARS; i++) {
+        const CarRecord& car = cars[i];
+        if (car.carId != 0 && car.lane[0].count > 0 && car.lane[1].count > 0) {
+            diff.add(car.lane[1].mean - car.lane[0].mean);
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    LaneBiasEstimate estimate;
+    estimate.cars = diff.count;
+    estimate.offset = diff.mean;
+    estimate.ci95 = 0;
+    if (diff.count > 1) {
+        int df = diff.count - 1;
+        float t = df <= 30 ? T_95[df - 1] : 1.96f;
+        estimate.ci95 = t * sqrtf(diff.variance() / diff.count);
+    }
+    return estimate;
+}
+
+void CarStats::carToJson(const CarRecord& car, JsonObject obj) const {
+    obj["car"] = car.carId;
+    obj["races"] = car.races;
+    obj["finishes"] = car.time.count;
+    obj["best"] = car.best;
+    obj["mean"] = car.time.mean;
+    obj["stddev"] = sqrtf(car.time.variance());
+    obj["lane1_runs"] = car.lane[0].count;
+    obj["lane2_runs"] = car.lane[1].count;
+    // Positive when the car is slower in lane 2
+    if (car.lane[0].count > 0 && car.lane[1].count > 0) {
+        obj["lane_bias"] = car.lane[1].mean - car.lane[0].mean;
+    } else {
+        obj["lane_bias"] = nullptr;
+    }
+}
+
+void CarStats::toJson(JsonDocument& doc, int limit, uint16_t carId) {
+    doc.clear();
+    doc["type"] = "car_stats";
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    doc["total"] = carCount;
+    JsonArray lanes = doc.createNestedArray("lanes");
+    for (int lane = 0; lane < NUM_LANES; lane++) {
+        lanes.add(laneCar[lane]);
+    }
+
+    JsonArray list = doc.createNestedArray("cars");
+    if (carId != 0) {
+        CarRecord* car = find(carId, false);
+        if (car) carToJson(*car, list.createNestedObject());
+        xSemaphoreGive(mutex);
+        return;
+    }
+
+    // Cars that have finished come first, fastest best time on top
+    uint16_t order[MAX_CARS];
+    int count = 0;
+    for (int i = 0; i < MAX_CARS; i++) {
+        if (cars[i].carId != 0) order[count++] = i;
+    }
+    std::sort(order, order + count, [this](uint16_t a, uint16_t b) {
+        float bestA = cars[a].best, bestB = cars[b].best;
+        if ((bestA == 0) != (bestB == 0)) return bestB == 0;
+        if (bestA != bestB) return bestA < bestB;
+        return cars[a].carId < cars[b].carId;
+    });
+    for (int i = 0; i < count && i < limit; i++) {
+        carToJson(cars[order[i]], list.createNestedObject());
+    }
+    xSemaphoreGive(mutex);
+}
+
+void CarStats::requestSave() {
+    if (persistHandler) {
+        persistHandler();
+    } else {
+        saveToFile();
+    }
+}
+
+bool CarStats::loadFromFile(CarRecord* stored, uint16_t& storedCount) {
+    // A save interrupted between the remove and the rename leaves only the
+    // complete temporary file
+    const char* path = STATS_FILE;
+    if (!LittleFS.exists(path)) {
+        if (!LittleFS.exists(STATS_TMP_FILE)) {
+            return false;
+        }
+        path = STATS_TMP_FILE;
+    }
+    File file = LittleFS.open(path, "r");
+    if (!file) {
+        Serial.println("❌ Failed to open car statistics for reading");
+        return false;
+    }
+
+    FileHeader header;
+    if (file.read((uint8_t*)&header, sizeof(header)) != sizeof(header) ||
+        header.version != FILE_VERSION || header.recordSize != sizeof(CarRecord) ||
+        header.count > MAX_CARS) {
+        file.close();
+        Serial.println("❌ Car statistics file not recognised, starting a new session");
+        return false;
+    }
+
+    size_t length = header.count * sizeof(CarRecord);
+    bool ok = file.read((uint8_t*)stored, length) == length;
+    file.close();
+    if (!ok) {
+        Serial.println("❌ Car statistics file is truncated");
+        return false;
+    }
+    storedCount = header.count;
+    return true;
+}
+
+bool CarStats::saveToFile() {
+    if (!loaded) {
+        return true;  // begin() saves once the stored session has been merged
+    }
+
+    // Copy the used slots under the lock, write the file outside it
+    std::unique_ptr<CarRecord[]> records(new CarRecord[MAX_CARS]);
+    FileHeader header = { FILE_VERSION, (uint16_t)sizeof(CarRecord), 0 };
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CARS; i++) {
+        if (cars[i].carId != 0) records[header.count++] = cars[i];
+    }
+    xSemaphoreGive(mutex);
+
+    // Write the whole session beside the old file and only then replace it,
+    // so a failed or interrupted write never loses the saved statistics
+    File file = LittleFS.open(STATS_TMP_FILE, "w");
+    if (!file) {
+        Serial.println("❌ Failed to open car statistics for writing");
+        return false;
+    }
+    size_t length = header.count * sizeof(CarRecord);
+    bool ok = file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header) &&
+              file.write((const uint8_t*)records.get(), length) == length;
+    file.close();
+
+    if (!ok) {
+        Serial.println("❌ Failed to write car statistics");
+        LittleFS.remove(STATS_TMP_FILE);
+        return false;
+    }
+    if ((LittleFS.exists(STATS_FILE) && !LittleFS.remove(STATS_FILE)) ||
+        !LittleFS.rename(STATS_TMP_FILE, STATS_FILE)) {
+        Serial.println("❌ Failed to replace car statistics file");
+        return false;
+    }
+    Serial.printf("✅ Saved statistics for %u car(s)\n", header.count);
+    return true;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "RaceResult.h"
+
+// Welford running mean and variance, O(1) per sample
+struct RunningStats {
+    uint16_t count;
+    float mean;
+    float m2;               // Sum of squared differences from the mean
+
+    void reset() { count = 0; mean = 0; m2 = 0; }
+    void add(float x);
+    void merge(const RunningStats& other);
+    float variance() const { return count > 1 ? m2 / (count - 1) : 0; }
+};
+
+// One car's session, updated once per race it runs in
+struct CarRecord {
+    uint16_t carId;         // 0 marks a free slot
+    uint16_t races;         // Including races it did not finish
+    float best;             // Seconds, 0 until it finishes once
+    RunningStats time;      // All finishes
+    RunningStats lane[2];   // Finishes per lane, for lane bias
+};
+
+// Systematic lane 2 minus lane 1 difference, estimated from cars that have
+// run in both lanes. Each such car contributes one difference of its lane
+// means, so the car's own speed cancels out.
+struct LaneBiasEstimate {
+    uint16_t cars;          // Cars with runs in both lanes
+    float offset;           // Seconds, positive when lane 2 is slower
+    float ci95;             // Half-width of the 95% confidence interval, 0 below 2 cars
+};
+
+// Per-car statistics for the session, keyed by the car numbers the organiser
+// assigns to the lanes before each race. Fixed memory: a hash table with
+// linear probing, so a race costs O(1) no matter how many cars have run.
+class CarStats {
+public:
+    static const int MAX_CARS = 256;   // Power of two
+    static const int NUM_LANES = 2;
+
+    CarStats();
+    void begin();
+
+    // Cars in each lane for the next race, 0 for none
+    void setLanes(uint16_t lane1Car, uint16_t lane2Car);
+    uint16_t getLaneCar(int lane) const { return laneCar[lane]; }
+
+    // Feeds the finished race to the cars assigned to it, then clears the
+    // assignment. Returns false if no car was assigned.
+    bool recordRace(const RaceResult& result);
+    void clear();
+
+    LaneBiasEstimate laneBias();
+
+    // Leaderboard ordered by best time, or a single car if carId is non-zero
+    void toJson(JsonDocument& doc, int limit, uint16_t carId = 0);
+
+    // When set, saves are handed to the handler (e.g. the storage writer)
+    // instead of being written synchronously
+    void setPersistHandler(std::function<void()> handler) { persistHandler = handler; }
+    bool persist() { return saveToFile(); }
+
+private:
+    static const char* STATS_FILE;
+    static const char* STATS_TMP_FILE;     // Written first, then renamed over STATS_FILE
+    static const uint16_t FILE_VERSION = 1;
+
+    struct FileHeader {
+        uint16_t version;
+        uint16_t recordSize;
+        uint16_t count;
+    };
+
+    CarRecord cars[MAX_CARS];
+    uint16_t carCount;
+    uint16_t laneCar[NUM_LANES];
+    SemaphoreHandle_t mutex;
+    std::function<void()> persistHandler;
+    volatile bool loaded;  // Races may be recorded before begin() has read the file
+
+    CarRecord* find(uint16_t carId, bool create);
+    void addFinish(CarRecord& car, int lane, float seconds);
+    void carToJson(const CarRecord& car, JsonObject obj) const;
+    bool loadFromFile(CarRecord* stored, uint16_t& storedCount);
+    bool saveToFile();
+    void requestSave();
+};
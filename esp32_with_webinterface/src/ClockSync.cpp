@@ -0,0 +1,134 @@
+#include "ClockSync.h"
+#include <WiFi.h>
+#include <esp_timer.h>
+
+ClockSync::ClockSync(TimeManager& tm)
+    : timeManager(tm), engine(generateNodeId()), listening(false) {
+    portMUX_TYPE unlocked = portMUX_INITIALIZER_UNLOCKED;
+    lock = unlocked;
+}
+
+uint32_t ClockSync::generateNodeId() {
+    // Low 32 bits of the factory MAC are unique enough within one event
+    uint64_t mac = ESP.getEfuseMac();
+    uint32_t id = (uint32_t)(mac >> 16);
+    return id != 0 ? id : 1;
+}
+
+void ClockSync::begin(ClockSyncRole role) {
+    setRole(role);
+    if (role == CLOCK_SYNC_OFF || listening) {
+        return;
+    }
+
+    if (udp.listen(PORT)) {
+        listening = true;
+        udp.onPacket([this](AsyncUDPPacket packet) {
+            this->onPacket(packet);
+        });
+        Serial.printf("✅ Clock sync listening on UDP %u as %s\n", PORT,
+                      role == CLOCK_SYNC_MASTER ? "master" : "slave");
+    } else {
+        Serial.println("❌ Clock sync failed to open UDP port");
+    }
+}
+
+void ClockSync::setRole(ClockSyncRole role) {
+    portENTER_CRITICAL(&lock);
+    engine.setRole(role);
+    portEXIT_CRITICAL(&lock);
+    masterIP = IPAddress();
+}
+
+void ClockSync::update() {
+    if (!listening || engine.getRole() == CLOCK_SYNC_OFF) {
+        return;
+    }
+
+    // Let slaves convert shared stamps to wall time once NTP has synced
+    if (engine.getRole() == CLOCK_SYNC_MASTER && timeManager.isTimeSet()) {
+        int64_t wallOffset = timeManager.getEpochMicros() - esp_timer_get_time();
+        portENTER_CRITICAL(&lock);
+        engine.setWallOffset(wallOffset);
+        portEXIT_CRITICAL(&lock);
+    }
+
+    uint8_t buffer[sizeof(clocksync::Packet)];
+    portENTER_CRITICAL(&lock);
+    size_t length = engine.poll(esp_timer_get_time(), buffer, sizeof(buffer));
+    portEXIT_CRITICAL(&lock);
+    if (length == 0) {
+        return;
+    }
+
+    if (engine.getRole() == CLOCK_SYNC_MASTER) {
+        udp.broadcastTo(buffer, length, PORT);
+    } else if (masterIP != IPAddress()) {
+        udp.writeTo(buffer, length, masterIP, PORT);
+    }
+}
+
+void ClockSync::onPacket(AsyncUDPPacket& packet) {
+    // Runs in the AsyncUDP task; stamp arrival before anything else
+    int64_t rxUs = esp_timer_get_time();
+    uint8_t reply[sizeof(clocksync::Packet)];
+
+    portENTER_CRITICAL(&lock);
+    uint32_t previousMaster = engine.getMasterId();
+    size_t length = engine.handlePacket(packet.data(), packet.length(), rxUs,
+                                        esp_timer_get_time(), reply, sizeof(reply));
+    bool masterChanged = engine.getMasterId() != previousMaster;
+    portEXIT_CRITICAL(&lock);
+
+    if (masterChanged) {
+        masterIP = packet.remoteIP();
+    }
+    if (length > 0) {
+        udp.writeTo(reply, length, packet.remoteIP(), packet.remotePort());
+    }
+}
+
+int64_t ClockSync::toShared(int64_t localUs) {
+    portENTER_CRITICAL(&lock);
+    int64_t shared = engine.toShared(localUs);
+    portEXIT_CRITICAL(&lock);
+    return shared;
+}
+
+int64_t ClockSync::sharedMicros() {
+    return toShared(esp_timer_get_time());
+}
+
+bool ClockSync::isLocked() {
+    portENTER_CRITICAL(&lock);
+    bool locked = engine.isLocked(esp_timer_get_time());
+    portEXIT_CRITICAL(&lock);
+    return locked;
+}
+
+void ClockSync::toJson(JsonObject obj) {
+    static const char* ROLE_NAMES[] = { "off", "master", "slave" };
+
+    portENTER_CRITICAL(&lock);
+    ClockSyncRole role = engine.getRole();
+    bool locked = engine.isLocked(esp_timer_get_time());
+    uint32_t masterId = engine.getMasterId();
+    int64_t offset = engine.getOffsetUs();
+    int64_t delay = engine.getDelayUs();
+    int64_t jitter = engine.getJitterUs();
+    uint32_t exchanges = engine.getExchanges();
+    portEXIT_CRITICAL(&lock);
+
+    obj["role"] = ROLE_NAMES[role];
+    obj["locked"] = locked;
+    if (role == CLOCK_SYNC_SLAVE) {
+        char id[9];
+        snprintf(id, sizeof(id), "%08X", masterId);
+        obj["master"] = id;
+        obj["master_ip"] = masterIP.toString();
+        obj["offset_us"] = offset;
+        obj["delay_us"] = delay;
+        obj["jitter_us"] = jitter;
+        obj["exchanges"] = exchanges;
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+#include <AsyncUDP.h>
+#include <ArduinoJson.h>
+#include "ClockSyncEngine.h"
+#include "TimeManager.h"
+
+// UDP transport for ClockSyncEngine. Lets several timer units (one per track,
+// or a separate start gate) stamp events in a common timebase: the master's
+// monotonic clock.
+class ClockSync {
+public:
+    static const uint16_t PORT = 5300;
+
+    ClockSync(TimeManager& tm);
+    void begin(ClockSyncRole role);
+    void setRole(ClockSyncRole role);
+    void update();
+
+    // Current time and local-to-shared conversion, in microseconds
+    int64_t sharedMicros();
+    int64_t toShared(int64_t localUs);
+    bool isLocked();
+    ClockSyncRole getRole() const { return engine.getRole(); }
+
+    void toJson(JsonObject obj);
+
+    // Identifies this unit to its peers (derived from the MAC)
+    static uint32_t generateNodeId();
+
+private:
+    void onPacket(AsyncUDPPacket& packet);
+
+    TimeManager& timeManager;
+    AsyncUDP udp;
+    ClockSyncEngine engine;
+    IPAddress masterIP;
+    bool listening;
+    portMUX_TYPE lock;
+};
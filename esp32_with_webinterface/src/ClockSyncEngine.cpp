@@ -0,0 +1,148 @@
+#include "ClockSyncEngine.h"
+#include <string.h>
+
+using namespace clocksync;
+
+ClockSyncEngine::ClockSyncEngine(uint32_t nodeId)
+    : nodeId(nodeId), role(CLOCK_SYNC_OFF), seq(0), lastSendUs(0), wallOffsetUs(0) {
+    setRole(CLOCK_SYNC_OFF);
+}
+
+void ClockSyncEngine::setRole(ClockSyncRole newRole) {
+    role = newRole;
+    masterId = 0;
+    masterWallOffsetUs = 0;
+    pendingSeq = 0;
+    pendingT1 = 0;
+    sampleCount = 0;
+    sampleIndex = 0;
+    offsetUs = 0;
+    delayUs = 0;
+    jitterUs = 0;
+    lastResponseUs = 0;
+    exchanges = 0;
+    lastSendUs = 0;
+}
+
+size_t ClockSyncEngine::buildPacket(MessageType type, uint16_t packetSeq, int64_t t1, int64_t t2, int64_t t3,
+                                    uint8_t* out, size_t capacity) const {
+    if (capacity < sizeof(Packet)) return 0;
+
+    Packet packet;
+    packet.magic = MAGIC;
+    packet.version = PROTOCOL_VERSION;
+    packet.type = type;
+    packet.seq = packetSeq;
+    packet.nodeId = nodeId;
+    packet.t1 = t1;
+    packet.t2 = t2;
+    packet.t3 = t3;
+    packet.wallOffsetUs = wallOffsetUs;
+    memcpy(out, &packet, sizeof(packet));
+    return sizeof(packet);
+}
+
+size_t ClockSyncEngine::poll(int64_t nowUs, uint8_t* out, size_t capacity) {
+    if (role == CLOCK_SYNC_MASTER) {
+        if (lastSendUs != 0 && nowUs - lastSendUs < SYNC_INTERVAL_US) return 0;
+        lastSendUs = nowUs;
+        return buildPacket(MSG_SYNC, ++seq, 0, 0, nowUs, out, capacity);
+    }
+
+    if (role == CLOCK_SYNC_SLAVE && masterId != 0) {
+        if (lastSendUs != 0 && nowUs - lastSendUs < REQUEST_INTERVAL_US) return 0;
+        lastSendUs = nowUs;
+        pendingSeq = ++seq;
+        pendingT1 = nowUs;
+        return buildPacket(MSG_DELAY_REQ, pendingSeq, nowUs, 0, 0, out, capacity);
+    }
+    return 0;
+}
+
+size_t ClockSyncEngine::handlePacket(const uint8_t* data, size_t length, int64_t rxUs, int64_t txUs,
+                                     uint8_t* reply, size_t capacity) {
+    if (length != sizeof(Packet)) return 0;
+
+    Packet packet;
+    memcpy(&packet, data, sizeof(packet));
+    if (packet.magic != MAGIC || packet.version != PROTOCOL_VERSION || packet.nodeId == nodeId) {
+        return 0;
+    }
+
+    switch (packet.type) {
+        case MSG_SYNC:
+            // First master heard wins until it goes quiet
+            if (role == CLOCK_SYNC_SLAVE &&
+                (masterId == 0 || packet.nodeId == masterId || !isLocked(rxUs))) {
+                if (packet.nodeId != masterId) {
+                    uint32_t newMaster = packet.nodeId;
+                    setRole(CLOCK_SYNC_SLAVE);
+                    masterId = newMaster;
+                }
+                masterWallOffsetUs = packet.wallOffsetUs;
+            }
+            return 0;
+
+        case MSG_DELAY_REQ:
+            if (role != CLOCK_SYNC_MASTER) return 0;
+            return buildPacket(MSG_DELAY_RESP, packet.seq, packet.t1, rxUs, txUs, reply, capacity);
+
+        case MSG_DELAY_RESP: {
+            if (role != CLOCK_SYNC_SLAVE || packet.nodeId != masterId) return 0;
+            if (packet.seq != pendingSeq || packet.t1 != pendingT1) return 0;  // Stale or duplicate
+            pendingSeq = 0;
+
+            // t1/t4 on our clock, t2/t3 on the master's
+            int64_t t4 = rxUs;
+            int64_t delay = ((t4 - packet.t1) - (packet.t3 - packet.t2)) / 2;
+            int64_t offset = ((packet.t2 - packet.t1) + (packet.t3 - t4)) / 2;
+            if (delay < 0) delay = 0;
+            addSample(offset, delay, rxUs);
+            return 0;
+        }
+
+        default:
+            return 0;
+    }
+}
+
+void ClockSyncEngine::addSample(int64_t offset, int64_t delay, int64_t nowUs) {
+    samples[sampleIndex].offsetUs = offset;
+    samples[sampleIndex].delayUs = delay;
+    sampleIndex = (sampleIndex + 1) % WINDOW;
+    if (sampleCount < WINDOW) sampleCount++;
+    exchanges++;
+    lastResponseUs = nowUs;
+
+    // Queuing only ever adds delay, so the fastest exchange is the most accurate
+    int best = 0;
+    for (int i = 1; i < sampleCount; i++) {
+        if (samples[i].delayUs < samples[best].delayUs) best = i;
+    }
+
+    int64_t previous = offsetUs;
+    offsetUs = samples[best].offsetUs;
+    delayUs = samples[best].delayUs;
+
+    // RFC 3550 style smoothed jitter of the raw offset
+    if (exchanges > 1) {
+        int64_t deviation = offset - previous;
+        if (deviation < 0) deviation = -deviation;
+        jitterUs += (deviation - jitterUs) / 16;
+    }
+}
+
+int64_t ClockSyncEngine::toShared(int64_t localUs) const {
+    return role == CLOCK_SYNC_SLAVE ? localUs + offsetUs : localUs;
+}
+
+int64_t ClockSyncEngine::sharedToWall(int64_t sharedUs) const {
+    int64_t offset = role == CLOCK_SYNC_SLAVE ? masterWallOffsetUs : wallOffsetUs;
+    return offset != 0 ? sharedUs + offset : 0;
+}
+
+bool ClockSyncEngine::isLocked(int64_t nowUs) const {
+    if (role == CLOCK_SYNC_MASTER) return true;
+    if (role != CLOCK_SYNC_SLAVE) return false;
+    return sampleCount >= MIN_SAMPLES_FOR_LOCK && nowUs - lastResponseUs < LOCK_TIMEOUT_US;
+}
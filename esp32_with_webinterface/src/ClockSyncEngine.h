@@ -0,0 +1,111 @@
+#pragma once
+
+// Portable core of the timer-to-timer clock sync. No Arduino or ESP-IDF
+// dependencies: the caller supplies timestamps and moves the packets, so the
+// same code runs on the ESP32 over UDP and on a PC over loopback.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace clocksync {
+
+const uint32_t MAGIC = 0x43534E43;  // "CSNC"
+const uint8_t PROTOCOL_VERSION = 1;
+
+enum MessageType : uint8_t {
+    MSG_SYNC = 1,        // Master announcement, broadcast periodically
+    MSG_DELAY_REQ = 2,   // Slave -> master, carries t1
+    MSG_DELAY_RESP = 3   // Master -> slave, carries t1, t2, t3
+};
+
+// All times are microseconds on the sender's monotonic clock
+struct __attribute__((packed)) Packet {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t type;
+    uint16_t seq;
+    uint32_t nodeId;
+    int64_t t1;            // Slave transmit time of DELAY_REQ
+    int64_t t2;            // Master receive time of DELAY_REQ
+    int64_t t3;            // Master transmit time of DELAY_RESP
+    int64_t wallOffsetUs;  // Master wall clock minus master monotonic, 0 if unknown
+};
+
+}  // namespace clocksync
+
+enum ClockSyncRole {
+    CLOCK_SYNC_OFF = 0,
+    CLOCK_SYNC_MASTER,
+    CLOCK_SYNC_SLAVE
+};
+
+// PTP-style delay request/response exchange against a single master.
+// The shared timebase is the master's monotonic clock; a slave keeps the
+// offset of its own clock from it, filtered on the lowest round-trip delay.
+class ClockSyncEngine {
+public:
+    static const int WINDOW = 8;                          // Exchanges kept for filtering
+    static const int64_t SYNC_INTERVAL_US = 1000000;      // Master announcement period
+    static const int64_t REQUEST_INTERVAL_US = 500000;    // Slave exchange period
+    static const int64_t LOCK_TIMEOUT_US = 5000000;       // Unlock without a response for this long
+    static const int MIN_SAMPLES_FOR_LOCK = 4;
+
+    explicit ClockSyncEngine(uint32_t nodeId);
+
+    void setRole(ClockSyncRole role);
+    ClockSyncRole getRole() const { return role; }
+    void setWallOffset(int64_t wallOffsetUs) { this->wallOffsetUs = wallOffsetUs; }
+
+    // Builds the next periodic packet (SYNC for a master, DELAY_REQ for a
+    // slave that has heard a master). Returns its length, or 0 if nothing is due.
+    size_t poll(int64_t nowUs, uint8_t* out, size_t capacity);
+
+    // Processes a received packet. Returns the length of a reply to send back
+    // to the sender, or 0. rxUs is the local clock when the packet arrived;
+    // the reply's transmit time is taken from txUs.
+    size_t handlePacket(const uint8_t* data, size_t length, int64_t rxUs, int64_t txUs,
+                        uint8_t* reply, size_t capacity);
+
+    // Converts a local monotonic time to the shared timebase
+    int64_t toShared(int64_t localUs) const;
+    // Converts a shared time to the master's wall clock (0 if the master has none)
+    int64_t sharedToWall(int64_t sharedUs) const;
+
+    bool isLocked(int64_t nowUs) const;
+    bool hasMaster() const { return masterId != 0; }
+    uint32_t getMasterId() const { return masterId; }
+    int64_t getOffsetUs() const { return offsetUs; }
+    int64_t getDelayUs() const { return delayUs; }
+    int64_t getJitterUs() const { return jitterUs; }
+    uint32_t getExchanges() const { return exchanges; }
+
+private:
+    struct Sample {
+        int64_t offsetUs;
+        int64_t delayUs;
+    };
+
+    size_t buildPacket(clocksync::MessageType type, uint16_t seq, int64_t t1, int64_t t2, int64_t t3,
+                       uint8_t* out, size_t capacity) const;
+    void addSample(int64_t offset, int64_t delay, int64_t nowUs);
+
+    uint32_t nodeId;
+    ClockSyncRole role;
+    uint16_t seq;
+    int64_t lastSendUs;
+    int64_t wallOffsetUs;
+
+    // Slave state
+    uint32_t masterId;
+    int64_t masterWallOffsetUs;
+    uint16_t pendingSeq;
+    int64_t pendingT1;
+    Sample samples[WINDOW];
+    int sampleCount;
+    int sampleIndex;
+    int64_t offsetUs;
+    int64_t delayUs;
+    int64_t jitterUs;
+    int64_t lastResponseUs;
+    uint32_t exchanges;
+};
@@ -1,132 +1,274 @@
 #include "Configuration.h"
+#include <TiePolicy.h>
+#include <memory>
 
-const char* Configuration::CONFIG_FILE = "/config.json";
+const char* Configuration::NVS_NAMESPACE = "co2timer";
+const char* Configuration::NVS_KEY = "config";
+const char* Configuration::LEGACY_CONFIG_FILE = "/config.json";
+const char* Configuration::DEFAULT_TIMEZONE = "AEST-10AEDT,M10.1.0,M4.1.0/3";  // Sydney
 
-Configuration::Configuration() :
-    wifiSSID(""),
-    wifiPassword(""),
-    sensorThreshold(150),
-    relayActivationTime(250),
-    tieThreshold(0.002)
-{}
+Configuration::Configuration() : loaded(false) {
+    mutex = xSemaphoreCreateMutex();
+    setDefaults();
+}
+
+void Configuration::setDefaults() {
+    memset(&data, 0, sizeof(data));
+    data.sensorThreshold = 150;
+    data.relayActivationTime = 250;
+    data.tieThreshold = 0.002;
+    data.tieMode = timingcore::TIE_THRESHOLD;
+    strlcpy(data.timezone, DEFAULT_TIMEZONE, sizeof(data.timezone));
+}
 
 void Configuration::begin() {
-    // Don't try to access files if LittleFS isn't mounted
-    if (!LittleFS.begin(false)) {
-        Serial.println("❌ LittleFS not mounted, using default configuration");
+    // Load exactly once per boot
+    if (loaded) {
         return;
     }
-    
-    if (!LittleFS.exists(CONFIG_FILE)) {
-        Serial.println("📄 Creating new configuration file...");
-        saveToFile();
+    loaded = true;
+
+    if (loadFromStore()) {
+        Serial.println("✅ Configuration loaded");
+    } else if (importLegacyFile()) {
+        // One-time migration from the old JSON file on LittleFS
+        if (saveToStore()) {
+            LittleFS.remove(LEGACY_CONFIG_FILE);
+            Serial.println("✅ Configuration migrated from config.json");
+        }
     } else {
-        loadFromFile();
-        // Verify loaded configuration
-        Serial.print("📱 Verifying WiFi SSID: ");
-        Serial.println(wifiSSID);
+        Serial.println("📄 No stored configuration, using defaults");
     }
-    
-    // Save configuration to ensure format is current
-    saveToFile();
+
+    Serial.print("📱 Loaded WiFi SSID: ");
+    Serial.println(data.wifiSSID);
+}
+
+String Configuration::getWiFiSSID() const {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    String ssid(data.wifiSSID);
+    xSemaphoreGive(mutex);
+    return ssid;
+}
+
+String Configuration::getWiFiPassword() const {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    String password(data.wifiPassword);
+    xSemaphoreGive(mutex);
+    return password;
 }
 
 void Configuration::setWiFiCredentials(const String& ssid, const String& password) {
-    wifiSSID = ssid;
-    wifiPassword = password;
-    saveToFile();  // Call saveToFile directly to ensure immediate persistence
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    strlcpy(data.wifiSSID, ssid.c_str(), sizeof(data.wifiSSID));
+    strlcpy(data.wifiPassword, password.c_str(), sizeof(data.wifiPassword));
+    xSemaphoreGive(mutex);
+    save();
     Serial.print("✅ WiFi credentials saved - SSID: ");
-    Serial.println(wifiSSID);
+    Serial.println(ssid);
 }
 
 void Configuration::setSensorThreshold(int threshold) {
-    sensorThreshold = threshold;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    data.sensorThreshold = threshold;
+    xSemaphoreGive(mutex);
     save();
 }
 
 void Configuration::setRelayActivationTime(int ms) {
-    relayActivationTime = ms;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    data.relayActivationTime = ms;
+    xSemaphoreGive(mutex);
     save();
 }
 
 void Configuration::setTieThreshold(float seconds) {
-    tieThreshold = seconds;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    data.tieThreshold = seconds;
+    xSemaphoreGive(mutex);
+    save();
+}
+
+void Configuration::setTieMode(int mode) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    data.tieMode = mode;
+    xSemaphoreGive(mutex);
+    save();
+}
+
+void Configuration::setLaneCorrection(bool enabled) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    data.laneCorrection = enabled;
+    xSemaphoreGive(mutex);
+    save();
+}
+
+void Configuration::getLaneOffsets(float& lane1, float& lane2) const {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    lane1 = data.laneOffset[0];
+    lane2 = data.laneOffset[1];
+    xSemaphoreGive(mutex);
+}
+
+void Configuration::setLaneOffsets(float lane1, float lane2) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    data.laneOffset[0] = lane1;
+    data.laneOffset[1] = lane2;
+    xSemaphoreGive(mutex);
     save();
 }
 
+String Configuration::getTimezone() const {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    String tz(data.timezone);
+    xSemaphoreGive(mutex);
+    return tz;
+}
+
+void Configuration::setTimezone(const String& tz) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    strlcpy(data.timezone, tz.c_str(), sizeof(data.timezone));
+    xSemaphoreGive(mutex);
+    save();
+}
 
+void Configuration::setClockSyncRole(int role) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    data.clockSyncRole = role;
+    xSemaphoreGive(mutex);
+    save();
+}
+
+void Configuration::setRaceNodeRole(int role) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    data.raceNodeRole = role;
+    xSemaphoreGive(mutex);
+    save();
+}
+
+void Configuration::setStorageSync(int policy) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    data.storageSync = policy;
+    xSemaphoreGive(mutex);
+    save();
+}
 
 void Configuration::save() {
-    saveToFile();
+    if (persistHandler) {
+        persistHandler();
+    } else {
+        saveToStore();
+    }
+}
+
+bool Configuration::loadFromStore() {
+    Preferences prefs;
+    if (!prefs.begin(NVS_NAMESPACE, true)) {
+        return false;  // Namespace does not exist yet
+    }
+
+    size_t length = prefs.getBytesLength(NVS_KEY);
+    if (length < sizeof(RecordHeader)) {
+        prefs.end();
+        return false;
+    }
+
+    std::unique_ptr<uint8_t[]> record(new uint8_t[length]);
+    prefs.getBytes(NVS_KEY, record.get(), length);
+    prefs.end();
+
+    RecordHeader header;
+    memcpy(&header, record.get(), sizeof(header));
+    size_t payloadSize = min((size_t)header.size, length - sizeof(header));
+    return migrate(header.version, record.get() + sizeof(header), payloadSize);
+}
+
+bool Configuration::migrate(uint16_t version, const uint8_t* payload, size_t size) {
+    if (version == 0) {
+        Serial.println("❌ Invalid configuration record");
+        return false;
+    }
+    if (version > SCHEMA_VERSION) {
+        Serial.printf("⚠ Configuration schema v%u is newer than v%u, keeping known fields\n",
+                      version, SCHEMA_VERSION);
+    }
+
+    // Fields are append-only: take the prefix the record has, default the rest
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    setDefaults();
+    memcpy(&data, payload, min(size, sizeof(data)));
+    data.wifiSSID[sizeof(data.wifiSSID) - 1] = '\0';
+    data.wifiPassword[sizeof(data.wifiPassword) - 1] = '\0';
+    data.timezone[sizeof(data.timezone) - 1] = '\0';
+    if (data.timezone[0] == '\0') {
+        strlcpy(data.timezone, DEFAULT_TIMEZONE, sizeof(data.timezone));
+    }
+    // Older records can carry a zeroed padding byte where tieMode now lives
+    if (version < 5 || data.tieMode >= timingcore::NUM_TIE_MODES) {
+        data.tieMode = timingcore::TIE_THRESHOLD;
+    }
+    xSemaphoreGive(mutex);
+
+    if (version < SCHEMA_VERSION) {
+        Serial.printf("🔄 Migrating configuration v%u -> v%u\n", version, SCHEMA_VERSION);
+        saveToStore();
+    }
+    return true;
+}
+
+bool Configuration::saveToStore() {
+    uint8_t record[sizeof(RecordHeader) + sizeof(ConfigData)];
+    RecordHeader header = { SCHEMA_VERSION, (uint16_t)sizeof(ConfigData) };
+    memcpy(record, &header, sizeof(header));
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    memcpy(record + sizeof(header), &data, sizeof(data));
+    xSemaphoreGive(mutex);
+
+    // NVS wear-levels its pages and only rewrites entries whose value changed
+    Preferences prefs;
+    if (!prefs.begin(NVS_NAMESPACE, false)) {
+        Serial.println("❌ Failed to open configuration store");
+        return false;
+    }
+    size_t written = prefs.putBytes(NVS_KEY, record, sizeof(record));
+    prefs.end();
+
+    if (written != sizeof(record)) {
+        Serial.println("❌ Failed to write configuration");
+        return false;
+    }
+    Serial.println("✅ Configuration saved");
+    return true;
 }
 
-void Configuration::loadFromFile() {
-    File file = LittleFS.open(CONFIG_FILE, "r");
+bool Configuration::importLegacyFile() {
+    if (!LittleFS.begin(false) || !LittleFS.exists(LEGACY_CONFIG_FILE)) {
+        return false;
+    }
+
+    File file = LittleFS.open(LEGACY_CONFIG_FILE, "r");
     if (!file) {
         Serial.println("❌ Failed to open config file for reading");
-        saveToFile();  // Create default config file
-        return;
+        return false;
     }
-    
+
     StaticJsonDocument<512> doc;
     DeserializationError error = deserializeJson(doc, file);
     file.close();
-    
+
     if (error) {
         Serial.print("❌ Failed to parse config file: ");
         Serial.println(error.c_str());
-        saveToFile();  // Create new config file with current settings
-        return;
-    }
-    
-    // Load WiFi settings if they exist
-    if (doc["wifi"].containsKey("ssid")) {
-        wifiSSID = doc["wifi"]["ssid"].as<String>();
-    }
-    if (doc["wifi"].containsKey("password")) {
-        wifiPassword = doc["wifi"]["password"].as<String>();
+        return false;
     }
-    
-    // Load sensor settings
-    sensorThreshold = doc["sensor"]["threshold"] | sensorThreshold;
-    
-    // Load race timing parameters
-    relayActivationTime = doc["timing"]["relay_ms"] | relayActivationTime;
-    tieThreshold = doc["timing"]["tie_threshold"] | tieThreshold;
-
-    Serial.println("✅ Configuration loaded");
-    
-    // Log loaded WiFi settings
-    Serial.print("📱 Loaded WiFi SSID: ");
-    Serial.println(wifiSSID);
-}
 
-void Configuration::saveToFile() {
-    File file = LittleFS.open(CONFIG_FILE, "w");
-    if (!file) {
-        Serial.println("❌ Failed to open config file for writing");
-        return;
-    }
-    
-    StaticJsonDocument<512> doc;
-    
-    // Save WiFi settings
-    doc["wifi"]["ssid"] = wifiSSID;
-    doc["wifi"]["password"] = wifiPassword;
-    
-    // Save sensor settings
-    doc["sensor"]["threshold"] = sensorThreshold;
-    
-    // Save race timing parameters
-    doc["timing"]["relay_ms"] = relayActivationTime;
-    doc["timing"]["tie_threshold"] = tieThreshold;
-
-    
-    if (serializeJson(doc, file) == 0) {
-        Serial.println("❌ Failed to write config file");
-    } else {
-        Serial.println("✅ Configuration saved");
-    }
-    
-    file.close();
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    strlcpy(data.wifiSSID, doc["wifi"]["ssid"] | "", sizeof(data.wifiSSID));
+    strlcpy(data.wifiPassword, doc["wifi"]["password"] | "", sizeof(data.wifiPassword));
+    data.sensorThreshold = doc["sensor"]["threshold"] | data.sensorThreshold;
+    data.relayActivationTime = doc["timing"]["relay_ms"] | data.relayActivationTime;
+    data.tieThreshold = doc["timing"]["tie_threshold"] | data.tieThreshold;
+    xSemaphoreGive(mutex);
+    return true;
 }
@@ -2,44 +2,112 @@
 
 #include <ArduinoJson.h>
 #include <LittleFS.h>
+#include <Preferences.h>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+// Persisted settings. Fields are only ever appended so older records can be
+// migrated by copying the prefix they contain and defaulting the rest.
+struct ConfigData {
+    // WiFi settings
+    char wifiSSID[33];
+    char wifiPassword[65];
+
+    // Sensor settings
+    int32_t sensorThreshold;      // Distance threshold in mm
+
+    // Race timing parameters
+    int32_t relayActivationTime;  // Time in ms to activate relay
+    float tieThreshold;           // Time difference in seconds to consider a tie
+
+    // Added in schema v2
+    char timezone[48];            // POSIX TZ string, e.g. "AEST-10AEDT,M10.1.0,M4.1.0/3"
+
+    // Added in schema v3
+    uint8_t clockSyncRole;        // 0 = off, 1 = master, 2 = slave
+
+    // Added in schema v4
+    uint8_t raceNodeRole;         // 0 = standalone, 1 = start node, 2 = finish node
+
+    // Added in schema v5
+    uint8_t tieMode;              // timingcore::TieMode; tieThreshold is its window
+
+    // Added in schema v6
+    uint8_t laneCorrection;       // Subtract laneOffset from each lane's raw time
+    float laneOffset[2];          // Seconds, from the lane-swap bias estimate
+
+    // Added in schema v7
+    uint8_t storageSync;          // SyncPolicy of the storage writer
+};
 
 class Configuration {
 public:
+    static const uint16_t SCHEMA_VERSION = 7;
+
     Configuration();
     void begin();
     void save();
-    
+
     // WiFi settings
-    String getWiFiSSID() const { return wifiSSID; }
-    String getWiFiPassword() const { return wifiPassword; }
+    String getWiFiSSID() const;
+    String getWiFiPassword() const;
     void setWiFiCredentials(const String& ssid, const String& password);
-    
+
     // Sensor settings
-    int getSensorThreshold() const { return sensorThreshold; }
+    int getSensorThreshold() const { return data.sensorThreshold; }
     void setSensorThreshold(int threshold);
-    
+
     // Race timing parameters
-    int getRelayActivationTime() const { return relayActivationTime; }
+    int getRelayActivationTime() const { return data.relayActivationTime; }
     void setRelayActivationTime(int ms);
-    float getTieThreshold() const { return tieThreshold; }
+    float getTieThreshold() const { return data.tieThreshold; }
     void setTieThreshold(float seconds);
-    
+    int getTieMode() const { return data.tieMode; }
+    void setTieMode(int mode);
+    bool getLaneCorrection() const { return data.laneCorrection; }
+    void setLaneCorrection(bool enabled);
+    // Both offsets from one read, so a concurrent update is never half applied
+    void getLaneOffsets(float& lane1, float& lane2) const;
+    void setLaneOffsets(float lane1, float lane2);
+
+    // Time settings
+    String getTimezone() const;
+    void setTimezone(const String& tz);
+    int getClockSyncRole() const { return data.clockSyncRole; }
+    void setClockSyncRole(int role);
+    int getRaceNodeRole() const { return data.raceNodeRole; }
+    void setRaceNodeRole(int role);
+
+    // Storage settings
+    int getStorageSync() const { return data.storageSync; }
+    void setStorageSync(int policy);
+
+    // When set, save() hands off to the handler (e.g. the storage writer)
+    // instead of writing to NVS synchronously
+    void setPersistHandler(std::function<void()> handler) { persistHandler = handler; }
+    bool persist() { return saveToStore(); }
 
-    
 private:
-    static const char* CONFIG_FILE;
-    void loadFromFile();
-    void saveToFile();
-    
-    // WiFi settings
-    String wifiSSID;
-    String wifiPassword;
-    
-    // Sensor settings
-    int sensorThreshold;         // Distance threshold in mm
-    
-    // Race timing parameters
-    int relayActivationTime;     // Time in ms to activate relay
-    float tieThreshold;          // Time difference in seconds to consider a tie
+    static const char* NVS_NAMESPACE;
+    static const char* NVS_KEY;
+    static const char* LEGACY_CONFIG_FILE;
+    static const char* DEFAULT_TIMEZONE;
+
+    // Header stored in front of ConfigData in the NVS blob
+    struct RecordHeader {
+        uint16_t version;
+        uint16_t size;
+    };
+
+    void setDefaults();
+    bool loadFromStore();
+    bool saveToStore();
+    bool migrate(uint16_t version, const uint8_t* payload, size_t size);
+    bool importLegacyFile();
 
+    SemaphoreHandle_t mutex;
+    std::function<void()> persistHandler;
+    bool loaded;
+    ConfigData data;
 };
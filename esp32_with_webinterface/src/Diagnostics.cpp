@@ -0,0 +1,346 @@
+#include "Diagnostics.h"
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <algorithm>
+
+const char* Diagnostics::POST_MORTEM_FILE = "/diagnostics/postmortem.log";
+
+// Survives soft resets (watchdog, panic, esp_restart) but not a power cycle
+RTC_NOINIT_ATTR static DiagnosticsSnapshot rtcSnapshot;
+
+static const char* resetReasonName(int reason) {
+    switch (reason) {
+        case ESP_RST_POWERON:  return "power_on";
+        case ESP_RST_SW:       return "software";
+        case ESP_RST_PANIC:    return "panic";
+        case ESP_RST_INT_WDT:  return "interrupt_wdt";
+        case ESP_RST_TASK_WDT: return "task_wdt";
+        case ESP_RST_WDT:      return "other_wdt";
+        case ESP_RST_BROWNOUT: return "brownout";
+        case ESP_RST_DEEPSLEEP: return "deep_sleep";
+        default:               return "unknown";
+    }
+}
+
+static void snapshotToJson(const DiagnosticsSnapshot& s, JsonObject obj) {
+    obj["uptime_ms"] = s.uptimeMs;
+
+    JsonObject heap = obj.createNestedObject("heap");
+    heap["free"] = s.freeHeap;
+    heap["largest_block"] = s.largestFreeBlock;
+    heap["min_free"] = s.minFreeHeap;
+
+    JsonObject loop = obj.createNestedObject("loop_us");
+    loop["min"] = s.loopMinUs;
+    loop["max"] = s.loopMaxUs;
+    loop["p99"] = s.loopP99Us;
+    loop["count"] = s.loopCount;
+
+    JsonArray i2c = obj.createNestedArray("i2c_us");
+    for (int i = 0; i < DiagnosticsSnapshot::NUM_SENSORS; i++) {
+        JsonObject sensor = i2c.createNestedObject();
+        sensor["sensor"] = i + 1;
+        sensor["last"] = s.i2cLastUs[i];
+        sensor["avg"] = s.i2cAvgUs[i];
+        sensor["max"] = s.i2cMaxUs[i];
+    }
+
+    JsonObject stacks = obj.createNestedObject("stack_free");
+    for (int i = 0; i < s.numTasks && i < DiagnosticsSnapshot::MAX_TASKS; i++) {
+        stacks[s.taskNames[i]] = s.stackFreeBytes[i];
+    }
+
+    JsonObject queues = obj.createNestedObject("queues");
+    for (int i = 0; i < s.numQueues && i < DiagnosticsSnapshot::MAX_QUEUES; i++) {
+        queues[s.queueNames[i]] = s.queueDepths[i];
+    }
+    obj["ws_clients"] = s.wsClients;
+
+    JsonObject counters = obj.createNestedObject("counters");
+    for (int i = 0; i < s.numCounters && i < DiagnosticsSnapshot::MAX_COUNTERS; i++) {
+        counters[s.counterNames[i]] = s.counterValues[i];
+    }
+
+    JsonObject gauges = obj.createNestedObject("gauges");
+    for (int i = 0; i < s.numGauges && i < DiagnosticsSnapshot::MAX_GAUGES; i++) {
+        gauges[s.gaugeNames[i]] = s.gaugeValues[i];
+    }
+}
+
+Diagnostics::Diagnostics()
+    : lastSample(0), loopIndex(0), loopFill(0), loopCount(0),
+      numTasks(0), numQueues(0), numCounters(0), counterDropReported(false),
+      numGauges(0), gaugeDropReported(false), wsClients(0),
+      postMortemPending(false), resetReason(0) {
+    memset(&snapshot, 0, sizeof(snapshot));
+    memset(&postMortem, 0, sizeof(postMortem));
+    memset(i2cLast, 0, sizeof(i2cLast));
+    memset(i2cMax, 0, sizeof(i2cMax));
+    memset(i2cSum, 0, sizeof(i2cSum));
+    memset(i2cCount, 0, sizeof(i2cCount));
+}
+
+void Diagnostics::begin() {
+    resetReason = esp_reset_reason();
+
+    // Keep the pre-reset sample if the last reset was not a clean one
+    bool abnormal = resetReason == ESP_RST_PANIC || resetReason == ESP_RST_INT_WDT ||
+                    resetReason == ESP_RST_TASK_WDT || resetReason == ESP_RST_WDT ||
+                    resetReason == ESP_RST_BROWNOUT;
+    if (abnormal && rtcSnapshot.magic == SNAPSHOT_MAGIC) {
+        postMortem = rtcSnapshot;
+        postMortemPending = true;
+        Serial.printf("⚠ Abnormal reset (%s), post-mortem diagnostics available\n",
+                      resetReasonName(resetReason));
+    }
+    rtcSnapshot.magic = 0;
+
+    registerTask("loopTask", xTaskGetCurrentTaskHandle());
+}
+
+void Diagnostics::recordLoopTime(uint32_t us) {
+    loopSamples[loopIndex] = us;
+    loopIndex = (loopIndex + 1) % LOOP_WINDOW;
+    if (loopFill < LOOP_WINDOW) loopFill++;
+    loopCount++;
+}
+
+void Diagnostics::recordI2CRead(int sensor, uint32_t us) {
+    if (sensor < 0 || sensor >= DiagnosticsSnapshot::NUM_SENSORS) return;
+    i2cLast[sensor] = us;
+    if (us > i2cMax[sensor]) i2cMax[sensor] = us;
+    i2cSum[sensor] += us;
+    i2cCount[sensor]++;
+}
+
+void Diagnostics::registerTask(const char* name, TaskHandle_t handle) {
+    if (!handle) return;
+    for (int i = 0; i < numTasks; i++) {
+        if (taskHandles[i] == handle) return;
+    }
+    if (numTasks >= DiagnosticsSnapshot::MAX_TASKS) return;
+    taskNames[numTasks] = name;
+    taskHandles[numTasks] = handle;
+    numTasks++;
+}
+
+void Diagnostics::reportQueueDepth(const char* name, uint32_t depth) {
+    for (int i = 0; i < numQueues; i++) {
+        if (strcmp(queueNames[i], name) == 0) {
+            queueDepths[i] = depth;
+            return;
+        }
+    }
+    if (numQueues >= DiagnosticsSnapshot::MAX_QUEUES) return;
+    queueNames[numQueues] = name;
+    queueDepths[numQueues] = depth;
+    numQueues++;
+}
+
+void Diagnostics::reportCounter(const char* name, uint32_t value) {
+    for (int i = 0; i < numCounters; i++) {
+        if (strcmp(counterNames[i], name) == 0) {
+            counterValues[i] = value;
+            return;
+        }
+    }
+    // Say so once rather than losing a counter, or half its name, unnoticed
+    if (numCounters >= DiagnosticsSnapshot::MAX_COUNTERS ||
+        strlen(name) >= DiagnosticsSnapshot::COUNTER_NAME_SIZE) {
+        if (!counterDropReported) {
+            Serial.printf("⚠ Diagnostics counter \"%s\" not recorded: %s\n", name,
+                          numCounters >= DiagnosticsSnapshot::MAX_COUNTERS ? "table full" : "name too long");
+            counterDropReported = true;
+        }
+        return;
+    }
+    counterNames[numCounters] = name;
+    counterValues[numCounters] = value;
+    numCounters++;
+}
+
+void Diagnostics::reportGauge(const char* name, uint32_t value) {
+    for (int i = 0; i < numGauges; i++) {
+        if (strcmp(gaugeNames[i], name) == 0) {
+            gaugeValues[i] = value;
+            return;
+        }
+    }
+    if (numGauges >= DiagnosticsSnapshot::MAX_GAUGES ||
+        strlen(name) >= DiagnosticsSnapshot::COUNTER_NAME_SIZE) {
+        if (!gaugeDropReported) {
+            Serial.printf("⚠ Diagnostics gauge \"%s\" not recorded: %s\n", name,
+                          numGauges >= DiagnosticsSnapshot::MAX_GAUGES ? "table full" : "name too long");
+            gaugeDropReported = true;
+        }
+        return;
+    }
+    gaugeNames[numGauges] = name;
+    gaugeValues[numGauges] = value;
+    numGauges++;
+}
+
+bool Diagnostics::update() {
+    if (!isSampleDue()) {
+        return false;
+    }
+    lastSample = millis();
+    sample();
+    return true;
+}
+
+void Diagnostics::sample() {
+    snapshot.magic = SNAPSHOT_MAGIC;
+    snapshot.uptimeMs = millis();
+    snapshot.freeHeap = ESP.getFreeHeap();
+    snapshot.largestFreeBlock = ESP.getMaxAllocHeap();
+    snapshot.minFreeHeap = ESP.getMinFreeHeap();
+
+    // Loop timing over the most recent window
+    if (loopFill > 0) {
+        static uint32_t sorted[LOOP_WINDOW];
+        memcpy(sorted, loopSamples, loopFill * sizeof(uint32_t));
+        size_t p99Index = (loopFill * 99 + 99) / 100 - 1;
+        std::nth_element(sorted, sorted + p99Index, sorted + loopFill);
+        snapshot.loopP99Us = sorted[p99Index];
+        snapshot.loopMinUs = *std::min_element(sorted, sorted + loopFill);
+        snapshot.loopMaxUs = *std::max_element(sorted, sorted + loopFill);
+    }
+    snapshot.loopCount = loopCount;
+
+    for (int i = 0; i < DiagnosticsSnapshot::NUM_SENSORS; i++) {
+        snapshot.i2cLastUs[i] = i2cLast[i];
+        snapshot.i2cMaxUs[i] = i2cMax[i];
+        snapshot.i2cAvgUs[i] = i2cCount[i] ? i2cSum[i] / i2cCount[i] : 0;
+        // Max and average are per sample period
+        i2cMax[i] = 0;
+        i2cSum[i] = 0;
+        i2cCount[i] = 0;
+    }
+
+    snapshot.numTasks = numTasks;
+    for (int i = 0; i < numTasks; i++) {
+        strlcpy(snapshot.taskNames[i], taskNames[i], sizeof(snapshot.taskNames[i]));
+        snapshot.stackFreeBytes[i] = uxTaskGetStackHighWaterMark(taskHandles[i]);
+    }
+
+    snapshot.numQueues = numQueues;
+    for (int i = 0; i < numQueues; i++) {
+        strlcpy(snapshot.queueNames[i], queueNames[i], sizeof(snapshot.queueNames[i]));
+        snapshot.queueDepths[i] = queueDepths[i];
+    }
+    snapshot.wsClients = wsClients;
+
+    snapshot.numCounters = numCounters;
+    for (int i = 0; i < numCounters; i++) {
+        strlcpy(snapshot.counterNames[i], counterNames[i], sizeof(snapshot.counterNames[i]));
+        snapshot.counterValues[i] = counterValues[i];
+    }
+
+    snapshot.numGauges = numGauges;
+    for (int i = 0; i < numGauges; i++) {
+        strlcpy(snapshot.gaugeNames[i], gaugeNames[i], sizeof(snapshot.gaugeNames[i]));
+        snapshot.gaugeValues[i] = gaugeValues[i];
+    }
+
+    rtcSnapshot = snapshot;
+}
+
+void Diagnostics::toJson(JsonDocument& doc) const {
+    doc["type"] = "diagnostics";
+    doc["reset_reason"] = resetReasonName(resetReason);
+    snapshotToJson(snapshot, doc.as<JsonObject>());
+}
+
+String Diagnostics::toPrometheus() const {
+    const DiagnosticsSnapshot& s = snapshot;
+    String out;
+    out.reserve(1536);
+    char line[128];
+
+    out += "# TYPE co2timer_uptime_ms counter\n";
+    snprintf(line, sizeof(line), "co2timer_uptime_ms %u\n", s.uptimeMs);
+    out += line;
+
+    out += "# TYPE co2timer_heap_bytes gauge\n";
+    snprintf(line, sizeof(line), "co2timer_heap_bytes{kind=\"free\"} %u\n", s.freeHeap);
+    out += line;
+    snprintf(line, sizeof(line), "co2timer_heap_bytes{kind=\"largest_block\"} %u\n", s.largestFreeBlock);
+    out += line;
+    snprintf(line, sizeof(line), "co2timer_heap_bytes{kind=\"min_free\"} %u\n", s.minFreeHeap);
+    out += line;
+
+    out += "# TYPE co2timer_loop_duration_us gauge\n";
+    snprintf(line, sizeof(line), "co2timer_loop_duration_us{stat=\"min\"} %u\n", s.loopMinUs);
+    out += line;
+    snprintf(line, sizeof(line), "co2timer_loop_duration_us{stat=\"max\"} %u\n", s.loopMaxUs);
+    out += line;
+    snprintf(line, sizeof(line), "co2timer_loop_duration_us{stat=\"p99\"} %u\n", s.loopP99Us);
+    out += line;
+    out += "# TYPE co2timer_loop_iterations counter\n";
+    snprintf(line, sizeof(line), "co2timer_loop_iterations %u\n", s.loopCount);
+    out += line;
+
+    out += "# TYPE co2timer_i2c_read_us gauge\n";
+    for (int i = 0; i < DiagnosticsSnapshot::NUM_SENSORS; i++) {
+        snprintf(line, sizeof(line), "co2timer_i2c_read_us{sensor=\"%d\",stat=\"last\"} %u\n", i + 1, s.i2cLastUs[i]);
+        out += line;
+        snprintf(line, sizeof(line), "co2timer_i2c_read_us{sensor=\"%d\",stat=\"avg\"} %u\n", i + 1, s.i2cAvgUs[i]);
+        out += line;
+        snprintf(line, sizeof(line), "co2timer_i2c_read_us{sensor=\"%d\",stat=\"max\"} %u\n", i + 1, s.i2cMaxUs[i]);
+        out += line;
+    }
+
+    out += "# TYPE co2timer_task_stack_free_bytes gauge\n";
+    for (int i = 0; i < s.numTasks; i++) {
+        snprintf(line, sizeof(line), "co2timer_task_stack_free_bytes{task=\"%s\"} %u\n", s.taskNames[i], s.stackFreeBytes[i]);
+        out += line;
+    }
+
+    out += "# TYPE co2timer_queue_depth gauge\n";
+    for (int i = 0; i < s.numQueues; i++) {
+        snprintf(line, sizeof(line), "co2timer_queue_depth{queue=\"%s\"} %u\n", s.queueNames[i], s.queueDepths[i]);
+        out += line;
+    }
+
+    out += "# TYPE co2timer_websocket_clients gauge\n";
+    snprintf(line, sizeof(line), "co2timer_websocket_clients %u\n", s.wsClients);
+    out += line;
+
+    out += "# TYPE co2timer_events_total counter\n";
+    for (int i = 0; i < s.numCounters; i++) {
+        snprintf(line, sizeof(line), "co2timer_events_total{event=\"%s\"} %u\n", s.counterNames[i], s.counterValues[i]);
+        out += line;
+    }
+
+    out += "# TYPE co2timer_status gauge\n";
+    for (int i = 0; i < s.numGauges; i++) {
+        snprintf(line, sizeof(line), "co2timer_status{gauge=\"%s\"} %u\n", s.gaugeNames[i], s.gaugeValues[i]);
+        out += line;
+    }
+
+    return out;
+}
+
+void Diagnostics::writePostMortem(fs::FS& fs) {
+    if (!postMortemPending) return;
+
+    if (!fs.exists("/diagnostics")) {
+        fs.mkdir("/diagnostics");
+    }
+    File file = fs.open(POST_MORTEM_FILE, FILE_APPEND);
+    if (!file) {
+        Serial.println("❌ Failed to open post-mortem log");
+        return;
+    }
+
+    StaticJsonDocument<1024> doc;
+    snapshotToJson(postMortem, doc.to<JsonObject>());
+    doc["reset_reason"] = resetReasonName(resetReason);
+    serializeJson(doc, file);
+    file.println();
+    file.close();
+
+    postMortemPending = false;
+    Serial.println("✅ Post-mortem diagnostics written to SD");
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Snapshot of the last diagnostics sample. A copy is kept in RTC memory so it
+// survives a watchdog or panic reset and can be written to SD on the next boot.
+struct DiagnosticsSnapshot {
+    static const int MAX_TASKS = 8;
+    static const int NUM_SENSORS = 2;
+    static const int MAX_QUEUES = 4;
+    static const int MAX_COUNTERS = 16;
+    static const int MAX_GAUGES = 4;
+    static const int COUNTER_NAME_SIZE = 20;    // Including the terminator, gauges too
+
+    uint32_t magic;
+    uint32_t uptimeMs;
+    uint32_t freeHeap;
+    uint32_t largestFreeBlock;
+    uint32_t minFreeHeap;
+    uint32_t loopMinUs;
+    uint32_t loopMaxUs;
+    uint32_t loopP99Us;
+    uint32_t loopCount;
+    uint32_t i2cLastUs[NUM_SENSORS];
+    uint32_t i2cMaxUs[NUM_SENSORS];
+    uint32_t i2cAvgUs[NUM_SENSORS];
+    uint16_t wsClients;
+    uint16_t numTasks;
+    char taskNames[MAX_TASKS][16];
+    uint32_t stackFreeBytes[MAX_TASKS];
+    uint16_t numQueues;
+    char queueNames[MAX_QUEUES][12];
+    uint32_t queueDepths[MAX_QUEUES];
+    uint16_t numCounters;
+    char counterNames[MAX_COUNTERS][COUNTER_NAME_SIZE];
+    uint32_t counterValues[MAX_COUNTERS];
+    uint16_t numGauges;
+    char gaugeNames[MAX_GAUGES][COUNTER_NAME_SIZE];
+    uint32_t gaugeValues[MAX_GAUGES];
+};
+
+class Diagnostics {
+public:
+    Diagnostics();
+    void begin();
+    bool update();  // Returns true when a new sample was taken
+    bool isSampleDue() const { return millis() - lastSample >= SAMPLE_INTERVAL; }
+
+    // Hot-path recorders, cheap enough to call every loop iteration
+    void recordLoopTime(uint32_t us);
+    void recordI2CRead(int sensor, uint32_t us);
+
+    void registerTask(const char* name, TaskHandle_t handle);
+    void reportQueueDepth(const char* name, uint32_t depth);
+    // Counters only ever go up (totals since boot); gauges are current
+    // values that can go either way
+    void reportCounter(const char* name, uint32_t value);
+    void reportGauge(const char* name, uint32_t value);
+    void setWebSocketClients(size_t clients) { wsClients = clients; }
+
+    const DiagnosticsSnapshot& getSnapshot() const { return snapshot; }
+    void toJson(JsonDocument& doc) const;
+    String toPrometheus() const;
+
+    // Post-mortem handling for resets caused by the watchdog, panics or brownouts
+    bool hasPostMortem() const { return postMortemPending; }
+    void writePostMortem(fs::FS& fs);
+
+private:
+    static const uint32_t SNAPSHOT_MAGIC = 0xD1A65EEE;  // Bump when the snapshot layout changes
+    static const unsigned long SAMPLE_INTERVAL = 5000;  // Sample every 5 seconds
+    static const int LOOP_WINDOW = 256;                 // Loop samples kept for percentiles
+    static const char* POST_MORTEM_FILE;
+
+    void sample();
+
+    DiagnosticsSnapshot snapshot;
+    DiagnosticsSnapshot postMortem;
+    unsigned long lastSample;
+
+    uint32_t loopSamples[LOOP_WINDOW];
+    uint16_t loopIndex;
+    uint16_t loopFill;
+    uint32_t loopCount;
+
+    uint32_t i2cLast[DiagnosticsSnapshot::NUM_SENSORS];
+    uint32_t i2cMax[DiagnosticsSnapshot::NUM_SENSORS];
+    uint32_t i2cSum[DiagnosticsSnapshot::NUM_SENSORS];
+    uint32_t i2cCount[DiagnosticsSnapshot::NUM_SENSORS];
+
+    const char* taskNames[DiagnosticsSnapshot::MAX_TASKS];
+    TaskHandle_t taskHandles[DiagnosticsSnapshot::MAX_TASKS];
+    int numTasks;
+
+    const char* queueNames[DiagnosticsSnapshot::MAX_QUEUES];
+    uint32_t queueDepths[DiagnosticsSnapshot::MAX_QUEUES];
+    int numQueues;
+
+    const char* counterNames[DiagnosticsSnapshot::MAX_COUNTERS];
+    uint32_t counterValues[DiagnosticsSnapshot::MAX_COUNTERS];
+    int numCounters;
+    bool counterDropReported;
+
+    const char* gaugeNames[DiagnosticsSnapshot::MAX_GAUGES];
+    uint32_t gaugeValues[DiagnosticsSnapshot::MAX_GAUGES];
+    int numGauges;
+    bool gaugeDropReported;
+
+    size_t wsClients;
+    bool postMortemPending;
+    int resetReason;
+};
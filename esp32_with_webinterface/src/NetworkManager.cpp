@@ -4,141 +4,79 @@
 const char* NetworkManager::AP_PASSWORD = "co2racer";
 
 NetworkManager::NetworkManager(Configuration& cfg) 
-    : config(cfg), apMode(false), connected(false), connecting(false),
-      lastCheck(0), connectStartTime(0), eventId(0) {
-    // Force configuration load on construction
-    config.begin();
+    : config(cfg), state(NET_IDLE), staConnected(false), apActive(false), hasCredentials(false),
+      gotIPEvent(false), disconnectedEvent(false), reconnectRequested(false),
+      stateSince(0), backoffMs(BACKOFF_MIN), nextAttemptAt(0), outageStart(0), recoveredAt(0),
+      eventId(0) {
+    memset(&stats, 0, sizeof(stats));
 }
 
 void NetworkManager::begin() {
-    // Initialize WiFi with clean state
-    WiFi.persistent(true);  // Enable settings storage in flash
-    WiFi.disconnect(true, true);  // Full disconnect
-    WiFi.mode(WIFI_OFF);    // Turn off WiFi
-    yield();
-    delay(100);
-    yield();
-    
-    // Ensure configuration is loaded and get credentials
+    // Credentials live in our own config store; don't let WiFi rewrite flash
+    WiFi.persistent(false);
+    WiFi.setAutoReconnect(false);  // Reconnects are paced by the backoff below
+
+    if (!eventId) {
+        eventId = WiFi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
+            this->onWiFiEvent(event, info);
+        });
+    }
+
     String ssid = config.getWiFiSSID();
-    String password = config.getWiFiPassword();
-    
     Serial.print("\n📱 WiFi SSID from config: ");
     Serial.println(ssid);
-    
-    if (ssid.length() > 0) {  // Only try to connect if we have an SSID
-        // Register event handler first
-        if (eventId) {
-            WiFi.removeEvent(eventId);
-        }
-        eventId = WiFi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
-            this->onWiFiEvent(event);
-        });
-        
-        // Try station mode
-        WiFi.mode(WIFI_STA);  // Set mode before anything else
-        yield();
-        delay(100);
-        yield();
-        
-        // Configure WiFi for stability
+
+    hasCredentials = ssid.length() > 0;
+    if (hasCredentials) {
+        WiFi.mode(WIFI_STA);
         esp_wifi_set_ps(WIFI_PS_NONE);  // Disable power saving
         WiFi.setTxPower(WIFI_POWER_19_5dBm);  // Max power
-        WiFi.setAutoReconnect(true);  // Enable auto-reconnect
-        
-        // Start connection
-        Serial.print("\n📱 Connecting to WiFi: ");
-        Serial.println(ssid);
-        
-        WiFi.begin(ssid.c_str(), password.c_str());
-        connecting = true;
-        connectStartTime = millis();
-        lastCheck = millis();
-        
-        // Let the event handler manage the connection
-        Serial.println("\nℹ Waiting for connection...");
+        startConnect();
     } else {
         // No credentials, go straight to AP mode
-        startAP();
+        Serial.println("\n⚠ No WiFi credentials configured");
+        Serial.println("📱 Please configure WiFi through the web interface");
+        state = NET_AP_ONLY;
+        stateSince = millis();
+        startFallbackAP();
     }
 }
 
-void NetworkManager::startStation() {
-    if (apMode) {
-        // Stop AP mode and DNS server
-        WiFi.softAPdisconnect(true);
-        dnsServer.stop();
-        apMode = false;
-        delay(100);  // Wait for AP to stop
-    }
-    
-    // Remove any existing event handler
-    if (eventId) {
-        WiFi.removeEvent(eventId);
-    }
-    
-    // Get WiFi credentials once
+void NetworkManager::startConnect() {
     String ssid = config.getWiFiSSID();
     String password = config.getWiFiPassword();
-    
-    if (ssid.length() == 0) {  // Only check for empty SSID
-        Serial.println("\n⚠ No WiFi credentials configured");
-        Serial.println("📱 Please configure WiFi through the web interface");
-        connecting = false;
-        connected = false;
-        startAP();  // Start AP mode immediately
-        return;
-    }
-    
-    // Configure WiFi station
-    wifi_config_t conf;
-    memset(&conf, 0, sizeof(conf));
-    memcpy(conf.sta.ssid, ssid.c_str(), ssid.length());
-    memcpy(conf.sta.password, password.c_str(), password.length());
-    conf.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
-    
-    esp_wifi_stop();
-    delay(100);
-    esp_wifi_set_config(WIFI_IF_STA, &conf);
-    esp_wifi_start();
-    delay(100);
-    
-    // Register WiFi event handler
-    eventId = WiFi.onEvent([this](WiFiEvent_t event, WiFiEventInfo_t info) {
-        this->onWiFiEvent(event);
-    });
 
     Serial.print("\n📱 Connecting to WiFi: ");
     Serial.println(ssid);
-    
-    WiFi.mode(WIFI_STA);
-    WiFi.persistent(true);  // Save WiFi settings to flash
-    WiFi.setAutoReconnect(true);  // Enable auto-reconnect
+
+    gotIPEvent = false;
+    disconnectedEvent = false;
     WiFi.begin(ssid.c_str(), password.c_str());
-    
-    connecting = true;
-    connectStartTime = millis();
+    stats.attempts++;
+    state = NET_CONNECTING;
+    stateSince = millis();
 }
 
-void NetworkManager::startAP() {
-    Serial.println("\n📡 Starting Access Point mode...");
-    
-    // Clean stop of any existing mode
-    WiFi.disconnect(true, true);  // Disconnect and clear settings
-    WiFi.softAPdisconnect(true);
-    delay(100);
-    
-    // Start AP mode
-    WiFi.mode(WIFI_AP);
-    delay(100);
-    
-    // Generate AP name
+void NetworkManager::scheduleRetry() {
+    WiFi.disconnect(false);  // Abandon the attempt, keep the radio on
+    nextAttemptAt = millis() + backoffMs;
+    Serial.printf("🔄 WiFi retry in %lu s\n", backoffMs / 1000);
+    backoffMs = backoffMs * 2 < BACKOFF_MAX ? backoffMs * 2 : BACKOFF_MAX;
+    state = NET_BACKOFF;
+    stateSince = millis();
+
+    // Keep the UI reachable while the station is down
+    startFallbackAP();
+}
+
+void NetworkManager::startFallbackAP() {
+    if (apActive) return;
+
+    // AP+STA so the station keeps retrying underneath
+    WiFi.mode(hasCredentials ? WIFI_AP_STA : WIFI_AP);
     String apName = generateAPName();
-    
-    // Configure AP
     if (WiFi.softAP(apName.c_str(), AP_PASSWORD)) {
-        apMode = true;
-        connected = true;
+        apActive = true;
         Serial.println("✅ AP started successfully");
         Serial.print("📍 AP IP: ");
         Serial.println(WiFi.softAPIP());
@@ -147,56 +85,92 @@ void NetworkManager::startAP() {
         Serial.print("🔑 Password: ");
         Serial.println(AP_PASSWORD);
         
-        // Start DNS server to redirect all requests to our web server
-        dnsServer.start(53, "*", WiFi.softAPIP());
+        // Answer every DNS query with our address from a background task
+        dnsServer.start(WiFi.softAPIP());
     } else {
-        apMode = false;
-        connected = false;
         Serial.println("❌ Failed to start AP");
     }
 }
 
+void NetworkManager::stopFallbackAP() {
+    if (!apActive) return;
+    dnsServer.stop();
+    WiFi.softAPdisconnect(true);
+    WiFi.mode(WIFI_STA);
+    apActive = false;
+    Serial.println("📡 Fallback AP stopped");
+}
+
 void NetworkManager::update() {
-    if (millis() - lastCheck >= CHECK_INTERVAL) {
-        lastCheck = millis();
-        yield();  // Feed watchdog
-        
-        if (!apMode) {
-            if (connecting && millis() - connectStartTime >= CONNECT_TIMEOUT) {
-                Serial.println("\n❌ WiFi connection timeout");
-                connecting = false;
-                startAP();
-            } else if (WiFi.status() == WL_CONNECTED) {
-                // Check if we have a valid IP
-                if (WiFi.localIP()[0] == 0) {
-                    Serial.println("\n⚠ Invalid IP detected, reconnecting...");
-                    connecting = true;
-                    WiFi.disconnect(false);
-                    yield();
-                    WiFi.reconnect();
-                }
-            } else if (!connecting) {
-                // Not connected and not trying to connect
-                Serial.println("\n🔄 Connection lost, attempting to reconnect...");
-                connecting = true;
-                WiFi.reconnect();
+    unsigned long now = millis();
+
+    if (reconnectRequested) {
+        reconnectRequested = false;
+        hasCredentials = config.getWiFiSSID().length() > 0;
+        backoffMs = BACKOFF_MIN;
+        Serial.println("\n🔄 Reconnecting with new WiFi settings...");
+        if (hasCredentials) {
+            if (apActive) {
+                WiFi.mode(WIFI_AP_STA);
             }
+            WiFi.disconnect(false);
+            startConnect();
+        } else {
+            WiFi.disconnect(false);
+            state = NET_AP_ONLY;
+            stateSince = now;
+            startFallbackAP();
         }
-        yield();  // Feed watchdog again
-    }
-    
-    if (apMode) {
-        dnsServer.processNextRequest();
     }
-    // Give other tasks a chance to run
-    yield();
-}
 
-void NetworkManager::checkConnection() {
-    if (!apMode && !connecting && WiFi.status() != WL_CONNECTED) {
-        connected = false;
-        Serial.println("\n🔄 WiFi disconnected, attempting to reconnect...");
-        startStation();
+    switch (state) {
+        case NET_CONNECTING:
+            if (gotIPEvent) {
+                gotIPEvent = false;
+                state = NET_CONNECTED;
+                stateSince = now;
+                backoffMs = BACKOFF_MIN;
+                recoveredAt = now;
+                if (outageStart) {
+                    stats.lastReconnectMs = now - outageStart;
+                    if (stats.lastReconnectMs > stats.maxReconnectMs) {
+                        stats.maxReconnectMs = stats.lastReconnectMs;
+                    }
+                    Serial.printf("✅ WiFi restored after %lu ms\n", (unsigned long)stats.lastReconnectMs);
+                    outageStart = 0;
+                }
+            } else if (disconnectedEvent || now - stateSince >= CONNECT_TIMEOUT) {
+                disconnectedEvent = false;
+                if (now - stateSince >= CONNECT_TIMEOUT) {
+                    Serial.println("\n❌ WiFi connection timeout");
+                }
+                scheduleRetry();
+            }
+            break;
+
+        case NET_CONNECTED:
+            if (disconnectedEvent) {
+                disconnectedEvent = false;
+                stats.outages++;
+                outageStart = now;
+                Serial.println("\n🔄 Connection lost, attempting to reconnect...");
+                startFallbackAP();
+                startConnect();
+            } else if (apActive && now - recoveredAt >= AP_LINGER && WiFi.softAPgetStationNum() == 0) {
+                // Only drop the fallback AP once nobody is using it
+                stopFallbackAP();
+            }
+            break;
+
+        case NET_BACKOFF:
+            if ((long)(now - nextAttemptAt) >= 0) {
+                startConnect();
+            }
+            break;
+
+        case NET_AP_ONLY:
+        case NET_IDLE:
+            break;
     }
 }
 
@@ -209,92 +183,62 @@ String NetworkManager::generateAPName() {
 }
 
 bool NetworkManager::isConnected() const {
-    return connected;
+    return staConnected || apActive;
 }
 
 bool NetworkManager::isAPMode() const {
-    return apMode;
+    return apActive && !staConnected;
 }
 
 String NetworkManager::getIP() const {
-    return apMode ? WiFi.softAPIP().toString() : WiFi.localIP().toString();
+    return isAPMode() ? WiFi.softAPIP().toString() : WiFi.localIP().toString();
 }
 
 String NetworkManager::getSSID() const {
-    return apMode ? WiFi.softAPSSID() : WiFi.SSID();
+    return isAPMode() ? WiFi.softAPSSID() : WiFi.SSID();
 }
 
 int NetworkManager::getRSSI() const {
-    return apMode ? 0 : WiFi.RSSI();
+    return isAPMode() ? 0 : WiFi.RSSI();
+}
+
+void NetworkManager::statsToJson(JsonObject obj) const {
+    static const char* STATE_NAMES[] = { "idle", "connecting", "connected", "backoff", "ap_only" };
+    obj["state"] = STATE_NAMES[state];
+    obj["fallback_ap"] = apActive;
+    obj["outages"] = stats.outages;
+    obj["attempts"] = stats.attempts;
+    obj["last_reconnect_ms"] = stats.lastReconnectMs;
+    obj["max_reconnect_ms"] = stats.maxReconnectMs;
+    if (state == NET_BACKOFF) {
+        obj["retry_in_ms"] = (long)(nextAttemptAt - millis()) > 0 ? nextAttemptAt - millis() : 0;
+    }
 }
 
-void NetworkManager::onWiFiEvent(WiFiEvent_t event) {
+void NetworkManager::onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info) {
+    // Runs in the WiFi event task: record what happened, update() acts on it
     switch (event) {
         case SYSTEM_EVENT_STA_GOT_IP:
             if (WiFi.localIP()[0] != 0) {  // Check for valid IP
                 Serial.println("\n✅ Connected to WiFi");
                 Serial.print("📍 IP: ");
                 Serial.println(WiFi.localIP());
-                connected = true;
-                connecting = false;
-                connectStartTime = 0;  // Reset timeout counter
-                
-                // Configure time
-                configTime(0, 0, "pool.ntp.org", "time.nist.gov");
-                Serial.println("🕒 Synchronizing NTP time");
-                
-                // Wait for time to be set
-                time_t now = time(nullptr);
-                int retries = 0;
-                while(now < 24*3600 && retries < 10) {
-                    delay(500);
-                    yield();
-                    now = time(nullptr);
-                    retries++;
-                }
-                
-                if (now > 24*3600) {
-                    Serial.println("✅ NTP time synchronized");
-                } else {
-                    Serial.println("⚠ NTP sync failed, continuing anyway");
-                }
-            } else {
-                // Invalid IP, trigger reconnect
-                Serial.println("\n⚠ Got invalid IP, retrying...");
-                WiFi.disconnect(false);
-                yield();
-                WiFi.reconnect();
+                staConnected = true;
+                gotIPEvent = true;
             }
             break;
             
         case SYSTEM_EVENT_STA_DISCONNECTED:
-            connected = false;
-            
-            // Only try to reconnect if we're not in AP mode and not already connecting
-            if (!apMode && !connecting) {
-                // If we've been trying too long, switch to AP
-                if (connectStartTime > 0 && millis() - connectStartTime > CONNECT_TIMEOUT) {
-                    Serial.println("\n❌ WiFi connection timeout");
-                    startAP();
-                } else {
-                    Serial.println("\n📱 Attempting to reconnect...");
-                    connecting = true;
-                    yield();
-                    WiFi.disconnect(false);  // Disconnect but keep settings
-                    yield();
-                    delay(100);
-                    yield();
-                    WiFi.reconnect();
-                }
+            staConnected = false;
+            // Our own WiFi.disconnect() reports ASSOC_LEAVE, often only after
+            // the next attempt has begun. That attempt is still running.
+            if (disconnectReason(info) != WIFI_REASON_ASSOC_LEAVE) {
+                disconnectedEvent = true;
             }
             break;
             
-        case SYSTEM_EVENT_STA_START:
-            WiFi.setAutoReconnect(true);
-            break;
-            
         case SYSTEM_EVENT_STA_STOP:
-            connecting = false;  // Reset connecting state
+            staConnected = false;
             break;
             
         default:
@@ -302,40 +246,15 @@ void NetworkManager::onWiFiEvent(WiFiEvent_t event) {
     }
 }
 
+uint8_t NetworkManager::disconnectReason(const WiFiEventInfo_t& info) {
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 2
+    return info.wifi_sta_disconnected.reason;
+#else
+    return info.disconnected.reason;
+#endif
+}
+
 void NetworkManager::reconnect() {
-    // Load current credentials
-    String ssid = config.getWiFiSSID();
-    
-    Serial.println("\n🔄 Reconnecting with new WiFi settings...");
-    Serial.print("📱 Using SSID: ");
-    Serial.println(ssid);
-    
-    // Stop all WiFi activity
-    WiFi.disconnect(true, true);  // Disconnect and clear settings
-    WiFi.softAPdisconnect(true); // Stop AP if running
-    WiFi.mode(WIFI_OFF);
-    delay(500);  // Longer delay to ensure cleanup
-    
-    connected = false;
-    connecting = false;
-    apMode = false;
-    
-    // Save current config to flash
-    WiFi.persistent(true);
-    
-    // Remove existing event handler
-    if (eventId) {
-        WiFi.removeEvent(eventId);
-        eventId = 0;
-    }
-    
-    // Only try to connect if we have valid credentials
-    if (ssid.length() > 0) {
-        // Start new connection attempt
-        begin();  // Use full initialization sequence
-    } else {
-        Serial.println("\n⚠ No WiFi credentials configured");
-        Serial.println("📱 Please configure WiFi through the web interface");
-        startAP();
-    }
+    // Called from the web server task; the switch happens in update()
+    reconnectRequested = true;
 }
@@ -1,10 +1,28 @@
 #pragma once
 
 #include <WiFi.h>
-#include <DNSServer.h>
 #include <esp_wifi.h>
 #include <time.h>
+#include <ArduinoJson.h>
 #include "Configuration.h"
+#include "CaptiveDNS.h"
+
+// Station connection states, advanced by update() from WiFi events.
+// Nothing in here waits: every transition is a WiFi call that returns at once.
+enum NetworkState {
+    NET_IDLE,         // Not started
+    NET_CONNECTING,   // WiFi.begin() issued, waiting for GOT_IP
+    NET_CONNECTED,    // Station has an IP
+    NET_BACKOFF,      // Last attempt failed, waiting before the next one
+    NET_AP_ONLY       // No credentials configured
+};
+
+struct NetworkStats {
+    uint32_t outages;            // Station connection lost after being up
+    uint32_t attempts;           // Connection attempts since boot
+    uint32_t lastReconnectMs;    // Outage length of the most recent recovery
+    uint32_t maxReconnectMs;     // Longest outage recovered from
+};
 
 class NetworkManager {
 public:
@@ -16,25 +34,45 @@ public:
     String getIP() const;
     String getSSID() const;
     int getRSSI() const;
-    void reconnect();  // Force reconnect with current config
+    void reconnect();  // Reconnect with the current config on the next update()
+
+    NetworkState getState() const { return state; }
+    const NetworkStats& getStats() const { return stats; }
+    void statsToJson(JsonObject obj) const;
+    const CaptiveDNS& getCaptiveDNS() const { return dnsServer; }
 
 private:
     static const char* AP_PASSWORD;
-    static const unsigned long CHECK_INTERVAL = 5000;  // Check connection every 5 seconds
-    static const unsigned long CONNECT_TIMEOUT = 30000;  // 30 seconds timeout for connection
-    
-    void startStation();
-    void startAP();
-    void checkConnection();
+    static const unsigned long CONNECT_TIMEOUT = 15000;     // Give up on one attempt after 15 s
+    static const unsigned long BACKOFF_MIN = 1000;          // First retry after 1 s...
+    static const unsigned long BACKOFF_MAX = 60000;         // ...doubling up to once a minute
+    static const unsigned long AP_LINGER = 30000;           // Keep the fallback AP this long after recovery
+
+    void startConnect();
+    void scheduleRetry();
+    void startFallbackAP();
+    void stopFallbackAP();
     String generateAPName();
-    void onWiFiEvent(WiFiEvent_t event);
+    void onWiFiEvent(WiFiEvent_t event, WiFiEventInfo_t info);
+    static uint8_t disconnectReason(const WiFiEventInfo_t& info);
     
     Configuration& config;
-    bool apMode;
-    bool connected;
-    bool connecting;
-    unsigned long lastCheck;
-    unsigned long connectStartTime;
-    DNSServer dnsServer;
+    volatile NetworkState state;
+    volatile bool staConnected;
+    volatile bool apActive;
+    bool hasCredentials;
+
+    // Set from the WiFi event task, consumed by update()
+    volatile bool gotIPEvent;
+    volatile bool disconnectedEvent;
+    volatile bool reconnectRequested;
+
+    unsigned long stateSince;
+    unsigned long backoffMs;
+    unsigned long nextAttemptAt;
+    unsigned long outageStart;     // 0 while the station is up
+    unsigned long recoveredAt;
+    NetworkStats stats;
+    CaptiveDNS dnsServer;
     WiFiEventId_t eventId;
 };
@@ -36,66 +36,95 @@ bool ensureFileExists() {
     return true;
 }
 
-RaceHistory::RaceHistory(TimeManager& tm) : timeManager(tm) {}
+RaceHistory::RaceHistory(TimeManager& tm) : timeManager(tm), loaded(false) {
+    mutex = xSemaphoreCreateMutex();
+}
 
 void RaceHistory::begin() {
+    std::vector<RaceResult> stored;
     if (!ensureFileExists()) {
         Serial.println("❌ Failed to initialize race history");
-        return;
+    } else {
+        loadFromFile(stored);
+    }
+
+    // Races run before the filesystem was mounted are newer than anything stored
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    size_t pending = races.size();
+    stored.insert(stored.end(), races.begin(), races.end());
+    if (stored.size() > MAX_RACES) {
+        stored.erase(stored.begin(), stored.end() - MAX_RACES);
+    }
+    races.swap(stored);
+    loaded = true;
+    xSemaphoreGive(mutex);
+
+    if (pending > 0) {
+        Serial.printf("🔄 Merged %u race(s) run during boot into history\n", (unsigned)pending);
+        requestSave();
     }
-    loadFromFile();
 }
 
-void RaceHistory::addRace(float lane1Time, float lane2Time) {
-    RaceResult result;
-    
+unsigned long RaceHistory::timestamp() const {
     // Ensure we have a valid timestamp
     if (!timeManager.isTimeSet()) {
         Serial.println("❌ Warning: Time not synchronized, using current millis as fallback");
-        result.timestamp = millis() / 1000; // Convert to seconds
-    } else {
-        result.timestamp = timeManager.getEpochTime();
+        return millis() / 1000; // Convert to seconds
     }
-    result.lane1Time = lane1Time;
-    result.lane2Time = lane2Time;
-    
-    // Consider times within 0.002 seconds (2ms) as a tie
-    float timeDiff = abs(lane1Time - lane2Time);
-    if (timeDiff <= 0.002) {
-        result.winner = 0; // Tie
-    } else {
-        result.winner = (lane1Time < lane2Time) ? 1 : 2;
-    }
-    
+    return timeManager.getEpochTime();
+}
+
+void RaceHistory::addRace(const RaceResult& result) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
     races.push_back(result);
-    if (races.size() > 50) { // Keep only last 50 races
+    if (races.size() > MAX_RACES) { // Keep only the most recent races
         races.erase(races.begin());
     }
-    saveToFile();
+    xSemaphoreGive(mutex);
+    requestSave();
+}
+
+void RaceHistory::toJson(const RaceResult& result, JsonObject obj) {
+    obj["timestamp"] = result.timestamp;
+    obj["lane1"] = result.lane1Time;
+    obj["lane2"] = result.lane2Time;
+    obj["winner"] = result.winner;
+    obj["lane1_raw"] = result.lane1Raw;
+    obj["lane2_raw"] = result.lane2Raw;
+    obj["lane1_corrected"] = result.lane1Corrected;
+    obj["lane2_corrected"] = result.lane2Corrected;
+    obj["margin"] = result.margin;
+    obj["confidence"] = result.confidence;
+}
+
+void RaceHistory::requestSave() {
+    if (persistHandler) {
+        persistHandler();
+    } else {
+        saveToFile();
+    }
 }
 
 void RaceHistory::getHistory(JsonDocument& doc, int limit) {
     doc.clear();
     JsonArray array = doc.to<JsonArray>();
     
+    xSemaphoreTake(mutex, portMAX_DELAY);
     int count = 0;
     for (auto it = races.rbegin(); it != races.rend() && count < limit; ++it, ++count) {
-        JsonObject race = array.createNestedObject();
-        race["timestamp"] = it->timestamp;
-        race["lane1"] = it->lane1Time;
-        race["lane2"] = it->lane2Time;
-        race["winner"] = it->winner;
+        toJson(*it, array.createNestedObject());
     }
+    xSemaphoreGive(mutex);
 }
 
 void RaceHistory::clear() {
+    xSemaphoreTake(mutex, portMAX_DELAY);
     races.clear();
-    saveToFile();
+    xSemaphoreGive(mutex);
+    requestSave();
 }
 
-void RaceHistory::loadFromFile() {
-    races.clear();
-    
+void RaceHistory::loadFromFile(std::vector<RaceResult>& stored) {
     File file = LittleFS.open(HISTORY_FILE, "r");
     if (!file) {
         Serial.println("❌ Failed to open race history file for reading");
@@ -110,7 +139,7 @@ void RaceHistory::loadFromFile() {
         return;
     }
     
-    StaticJsonDocument<4096> doc;
+    DynamicJsonDocument doc(FILE_JSON_CAPACITY);
     DeserializationError error = deserializeJson(doc, content);
     
     if (error) {
@@ -126,38 +155,50 @@ void RaceHistory::loadFromFile() {
         result.lane1Time = raceObj["lane1"] | 0.0f;
         result.lane2Time = raceObj["lane2"] | 0.0f;
         result.winner = raceObj["winner"] | 0;
-        races.push_back(result);
+        // Races stored before raw times were kept were never adjusted twice
+        result.lane1Raw = raceObj["lane1_raw"] | result.lane1Time;
+        result.lane2Raw = raceObj["lane2_raw"] | result.lane2Time;
+        result.lane1Corrected = raceObj["lane1_corrected"] | result.lane1Raw;
+        result.lane2Corrected = raceObj["lane2_corrected"] | result.lane2Raw;
+        result.margin = raceObj["margin"] | 0.0f;
+        result.confidence = raceObj["confidence"] | 100;
+        stored.push_back(result);
     }
     
     Serial.print("✅ Loaded ");
-    Serial.print(races.size());
+    Serial.print(stored.size());
     Serial.println(" races from history");
 }
 
-void RaceHistory::saveToFile() {
-    File file = LittleFS.open(HISTORY_FILE, "w");
-    if (!file) {
-        Serial.println("❌ Failed to open race history file for writing");
-        return;
+bool RaceHistory::saveToFile() {
+    if (!loaded) {
+        return true;  // begin() saves once the stored races have been merged
     }
-    
-    StaticJsonDocument<4096> doc;
+
+    DynamicJsonDocument doc(FILE_JSON_CAPACITY);
     JsonArray array = doc.to<JsonArray>();
     
+    // Serialize under the lock, write the file outside it
+    xSemaphoreTake(mutex, portMAX_DELAY);
     for (const auto& race : races) {
-        JsonObject raceObj = array.createNestedObject();
-        raceObj["timestamp"] = race.timestamp;
-        raceObj["lane1"] = race.lane1Time;
-        raceObj["lane2"] = race.lane2Time;
-        raceObj["winner"] = race.winner;
+        toJson(race, array.createNestedObject());
     }
+    size_t raceCount = races.size();
+    xSemaphoreGive(mutex);
     
     String output;
     serializeJson(doc, output);
-    file.print(output);
+    
+    File file = LittleFS.open(HISTORY_FILE, "w");
+    if (!file) {
+        Serial.println("❌ Failed to open race history file for writing");
+        return false;
+    }
+    size_t written = file.print(output);
     file.close();
     
     Serial.print("✅ Saved ");
-    Serial.print(races.size());
+    Serial.print(raceCount);
     Serial.println(" races to history");
+    return written == output.length();
 }
@@ -3,27 +3,40 @@
 #include <ArduinoJson.h>
 #include <LittleFS.h>
 #include <vector>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include "TimeManager.h"
-
-struct RaceResult {
-    unsigned long timestamp;
-    float lane1Time;
-    float lane2Time;
-    int winner;
-};
+#include "RaceResult.h"
 
 class RaceHistory {
 public:
     RaceHistory(TimeManager& timeManager);
     void begin();
-    void addRace(float lane1Time, float lane2Time);
+    // Stamp for a race that just finished
+    unsigned long timestamp() const;
+    void addRace(const RaceResult& result);
     void getHistory(JsonDocument& doc, int limit = 10);
     void clear();
 
+    // When set, saves are handed to the handler (e.g. the storage writer)
+    // instead of being written synchronously
+    void setPersistHandler(std::function<void()> handler) { persistHandler = handler; }
+    bool persist() { return saveToFile(); }
+
+    // Field names shared by the history file, get_history and race_complete
+    static void toJson(const RaceResult& result, JsonObject obj);
+
 private:
     static const char* HISTORY_FILE;
+    static const size_t MAX_RACES = 50;
+    static const size_t FILE_JSON_CAPACITY = 12288;
     std::vector<RaceResult> races;
     TimeManager& timeManager;
-    void loadFromFile();
-    void saveToFile();
+    SemaphoreHandle_t mutex;
+    std::function<void()> persistHandler;
+    volatile bool loaded;  // Races may be added before begin() has read the file
+    void loadFromFile(std::vector<RaceResult>& stored);
+    bool saveToFile();
+    void requestSave();
 };
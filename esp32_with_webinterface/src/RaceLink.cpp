@@ -0,0 +1,226 @@
+#include "RaceLink.h"
+#include <string.h>
+
+using namespace racelink;
+
+RaceLink::RaceLink(RaceLinkTransport& t)
+    : transport(t), role(RACE_LINK_STANDALONE), nodeId(0), seq(0), nextRaceId(1),
+      seenFrom(0), seenCount(0), seenIndex(0), startPending(false) {
+    memset(outbox, 0, sizeof(outbox));
+    memset(seen, 0, sizeof(seen));
+    memset(&stats, 0, sizeof(stats));
+    resetRace(0);
+}
+
+void RaceLink::begin(RaceLinkRole newRole, uint32_t id, uint16_t seed) {
+    role = newRole;
+    nodeId = id;
+    // A fresh starting point each boot keeps the peer's duplicate window and
+    // race ids from matching numbers used before a reset
+    seq = seed;
+    nextRaceId = (uint16_t)(seed ^ id ^ (id >> 16)) | 1;
+}
+
+void RaceLink::resetRace(uint16_t raceId) {
+    memset(&race, 0, sizeof(race));
+    race.raceId = raceId;
+}
+
+uint16_t RaceLink::recordStart(int64_t startUs, int64_t nowUs) {
+    uint16_t raceId = nextRaceId++;
+    if (nextRaceId == 0) nextRaceId = 1;
+
+    resetRace(raceId);
+    race.started = true;
+    race.startUs = startUs;
+    race.deadlineUs = nowUs + RACE_TIMEOUT_US;
+    dropStaleEvents();
+    queueEvent(MSG_START, 0, startUs, nowUs);
+    return raceId;
+}
+
+void RaceLink::recordFinish(int lane, int64_t finishUs, int64_t nowUs) {
+    if (lane < 0 || lane >= NUM_LANES || !race.started || race.reported || race.finished[lane]) return;
+
+    race.finished[lane] = true;
+    race.finishUs[lane] = finishUs;
+    queueEvent(MSG_FINISH, lane, finishUs, nowUs);
+}
+
+// A new race supersedes the last one: whatever of it the peer has not
+// acknowledged by now no longer matters
+void RaceLink::dropStaleEvents() {
+    for (int i = 0; i < OUTBOX_SIZE; i++) {
+        if (outbox[i].active && outbox[i].packet.raceId != race.raceId) {
+            outbox[i].active = false;
+            stats.lost++;
+        }
+    }
+}
+
+void RaceLink::queueEvent(MessageType type, uint8_t lane, int64_t timestampUs, int64_t nowUs) {
+    int slot = -1;
+    for (int i = 0; i < OUTBOX_SIZE; i++) {
+        if (!outbox[i].active) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        // Outbox full: drop the event that has been retrying the longest
+        slot = 0;
+        for (int i = 1; i < OUTBOX_SIZE; i++) {
+            if (outbox[i].tries > outbox[slot].tries) slot = i;
+        }
+        stats.lost++;
+    }
+
+    Outgoing& out = outbox[slot];
+    out.active = true;
+    out.packet.magic = MAGIC;
+    out.packet.version = PROTOCOL_VERSION;
+    out.packet.type = type;
+    out.packet.seq = ++seq;
+    out.packet.nodeId = nodeId;
+    out.packet.peerId = 0;
+    out.packet.raceId = race.raceId;
+    out.packet.lane = lane;
+    out.packet.reserved = 0;
+    out.packet.timestampUs = timestampUs;
+    out.tries = 1;
+    out.lastSendUs = nowUs;
+    transport.send((const uint8_t*)&out.packet, sizeof(out.packet));
+    stats.sent++;
+}
+
+void RaceLink::update(int64_t nowUs) {
+    if (role == RACE_LINK_STANDALONE) return;
+
+    uint8_t buffer[RaceLinkTransport::MAX_FRAME];
+    size_t length;
+    while ((length = transport.receive(buffer, sizeof(buffer))) > 0) {
+        if (length != sizeof(Packet)) continue;
+        Packet packet;
+        memcpy(&packet, buffer, sizeof(packet));
+        if (packet.magic != MAGIC || packet.version != PROTOCOL_VERSION || packet.nodeId == nodeId) {
+            continue;
+        }
+        handlePacket(packet, nowUs);
+    }
+
+    for (int i = 0; i < OUTBOX_SIZE; i++) {
+        Outgoing& out = outbox[i];
+        if (!out.active || nowUs - out.lastSendUs < RETRY_INTERVAL_US) continue;
+        transport.send((const uint8_t*)&out.packet, sizeof(out.packet));
+        out.tries++;
+        out.lastSendUs = nowUs;
+        stats.retransmits++;
+    }
+
+    if (startPending) {
+        startPending = false;
+        if (startHandler) startHandler(race.raceId, race.startUs);
+    }
+    checkComplete(nowUs);
+}
+
+void RaceLink::handlePacket(const Packet& packet, int64_t nowUs) {
+    if (packet.type == MSG_ACK) {
+        if (packet.peerId != nodeId) return;
+        for (int i = 0; i < OUTBOX_SIZE; i++) {
+            if (outbox[i].active && outbox[i].packet.seq == packet.seq) {
+                outbox[i].active = false;
+            }
+        }
+        return;
+    }
+
+    // Always acknowledge, the previous ACK may have been the one that was lost
+    sendAck(packet);
+    if (isDuplicate(packet.nodeId, packet.seq)) {
+        stats.duplicates++;
+        return;
+    }
+    stats.received++;
+
+    switch (packet.type) {
+        case MSG_START:
+            if (role != RACE_LINK_FINISH || (race.started && packet.raceId == race.raceId)) return;
+            resetRace(packet.raceId);
+            race.started = true;
+            race.startUs = packet.timestampUs;
+            race.deadlineUs = nowUs + RACE_TIMEOUT_US;
+            dropStaleEvents();
+            startPending = true;
+            break;
+
+        case MSG_FINISH:
+            if (role != RACE_LINK_START || packet.raceId != race.raceId || packet.lane >= NUM_LANES) return;
+            if (!race.finished[packet.lane]) {
+                race.finished[packet.lane] = true;
+                race.finishUs[packet.lane] = packet.timestampUs;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+void RaceLink::sendAck(const Packet& packet) {
+    Packet ack;
+    memset(&ack, 0, sizeof(ack));
+    ack.magic = MAGIC;
+    ack.version = PROTOCOL_VERSION;
+    ack.type = MSG_ACK;
+    ack.seq = packet.seq;
+    ack.nodeId = nodeId;
+    ack.peerId = packet.nodeId;
+    ack.raceId = packet.raceId;
+    transport.send((const uint8_t*)&ack, sizeof(ack));
+}
+
+bool RaceLink::isDuplicate(uint32_t sender, uint16_t packetSeq) {
+    if (sender != seenFrom) {
+        // New peer (or the peer rebooted with a new id): start a fresh window
+        seenFrom = sender;
+        seenCount = 0;
+        seenIndex = 0;
+    }
+    // Only filled entries count: any sequence number, 0 included, is valid
+    for (int i = 0; i < seenCount; i++) {
+        if (seen[i] == packetSeq) return true;
+    }
+    seen[seenIndex] = packetSeq;
+    seenIndex = (seenIndex + 1) % SEEN_WINDOW;
+    if (seenCount < SEEN_WINDOW) seenCount++;
+    return false;
+}
+
+void RaceLink::checkComplete(int64_t nowUs) {
+    if (race.reported || !race.started) return;
+    bool complete = true;
+    for (int lane = 0; lane < NUM_LANES; lane++) {
+        if (!race.finished[lane]) complete = false;
+    }
+    if (!complete) {
+        if (nowUs - race.deadlineUs < 0) return;
+        stats.timeouts++;
+    }
+    race.reported = true;
+
+    // A lane that never finished is reported as 0, a DNF
+    RaceResult result;
+    result.timestamp = 0;  // Filled in by the caller's wall clock
+    result.lane1Time = race.finished[0] ? (race.finishUs[0] - race.startUs) / 1000000.0f : 0;
+    result.lane2Time = race.finished[1] ? (race.finishUs[1] - race.startUs) / 1000000.0f : 0;
+    // Raw times only; the receiver's tie policy decides the winner
+    result.lane1Raw = result.lane1Time;
+    result.lane2Raw = result.lane2Time;
+    result.lane1Corrected = result.lane1Time;
+    result.lane2Corrected = result.lane2Time;
+    result.winner = 0;
+    result.margin = 0;
+    result.confidence = 0;
+    if (resultHandler) resultHandler(result);
+}
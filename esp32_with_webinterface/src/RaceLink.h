@@ -0,0 +1,130 @@
+#pragma once
+
+// Start-gate / finish-line split. The start node fires the relay and stamps
+// the start; the finish node watches the lane sensors. Both exchange events
+// stamped in the clock-sync timebase and join them into one RaceResult.
+// Portable: no Arduino dependencies, time is passed in by the caller.
+
+#include <functional>
+#include <stdint.h>
+#include "RaceLinkTransport.h"
+#include "RaceResult.h"
+
+namespace racelink {
+
+const uint32_t MAGIC = 0x524C4E4B;  // "RLNK"
+const uint8_t PROTOCOL_VERSION = 1;
+
+enum MessageType : uint8_t {
+    MSG_START = 1,   // Start node -> finish node: race id and start stamp
+    MSG_FINISH = 2,  // Finish node -> start node: lane and finish stamp
+    MSG_ACK = 3
+};
+
+struct __attribute__((packed)) Packet {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t type;
+    uint16_t seq;          // Sender's sequence number (acknowledged sequence for MSG_ACK)
+    uint32_t nodeId;       // Sender
+    uint32_t peerId;       // Node being acknowledged, 0 for events
+    uint16_t raceId;
+    uint8_t lane;
+    uint8_t reserved;
+    int64_t timestampUs;   // Shared timebase
+};
+
+}  // namespace racelink
+
+enum RaceLinkRole {
+    RACE_LINK_STANDALONE = 0,  // Relay and sensors on this unit
+    RACE_LINK_START,           // Relay only, finishes come from the network
+    RACE_LINK_FINISH           // Sensors only, the start comes from the network
+};
+
+struct RaceLinkStats {
+    uint32_t sent;
+    uint32_t received;
+    uint32_t retransmits;
+    uint32_t duplicates;
+    uint32_t lost;          // Superseded by a new race before it was acknowledged
+    uint32_t timeouts;      // Races reported with a lane that never finished
+};
+
+class RaceLink {
+public:
+    static const int NUM_LANES = 2;
+    static const int OUTBOX_SIZE = 8;
+    static const int64_t RETRY_INTERVAL_US = 50000;
+    // A lane that has not finished this long after the start is a DNF
+    static const int64_t RACE_TIMEOUT_US = 10000000;
+
+    typedef std::function<void(uint16_t raceId, int64_t startUs)> StartHandler;
+    typedef std::function<void(const RaceResult& result)> ResultHandler;
+
+    RaceLink(RaceLinkTransport& transport);
+    // seed should differ between boots, e.g. a hardware random number
+    void begin(RaceLinkRole role, uint32_t nodeId, uint16_t seed = 0);
+    RaceLinkRole getRole() const { return role; }
+
+    void onStart(StartHandler handler) { startHandler = handler; }
+    void onResult(ResultHandler handler) { resultHandler = handler; }
+
+    // Local events. The start node calls recordStart, the finish node recordFinish.
+    uint16_t recordStart(int64_t startUs, int64_t nowUs);
+    void recordFinish(int lane, int64_t finishUs, int64_t nowUs);
+
+    // Receives, acknowledges, retransmits and delivers joined results.
+    // Events are retried until acknowledged or superseded by the next race.
+    // A race still missing a lane after RACE_TIMEOUT_US is reported with that
+    // lane's time as 0. Handlers are only ever called from here.
+    void update(int64_t nowUs);
+
+    const RaceLinkStats& getStats() const { return stats; }
+
+private:
+    struct Outgoing {
+        bool active;
+        racelink::Packet packet;
+        int64_t lastSendUs;
+        int tries;
+    };
+
+    struct LinkedRace {
+        uint16_t raceId;
+        bool started;
+        bool finished[NUM_LANES];
+        int64_t startUs;
+        int64_t finishUs[NUM_LANES];
+        int64_t deadlineUs;     // Local time the race times out
+        bool reported;
+    };
+
+    void queueEvent(racelink::MessageType type, uint8_t lane, int64_t timestampUs, int64_t nowUs);
+    void handlePacket(const racelink::Packet& packet, int64_t nowUs);
+    void sendAck(const racelink::Packet& packet);
+    bool isDuplicate(uint32_t sender, uint16_t seq);
+    void resetRace(uint16_t raceId);
+    void dropStaleEvents();
+    void checkComplete(int64_t nowUs);
+
+    RaceLinkTransport& transport;
+    RaceLinkRole role;
+    uint32_t nodeId;
+    uint16_t seq;
+    uint16_t nextRaceId;
+    Outgoing outbox[OUTBOX_SIZE];
+
+    // Duplicate suppression: the last few sequence numbers seen from the peer
+    static const int SEEN_WINDOW = 16;
+    uint32_t seenFrom;
+    uint16_t seen[SEEN_WINDOW];
+    int seenCount;          // Entries of seen[] filled so far
+    int seenIndex;
+
+    LinkedRace race;
+    bool startPending;
+    StartHandler startHandler;
+    ResultHandler resultHandler;
+    RaceLinkStats stats;
+};
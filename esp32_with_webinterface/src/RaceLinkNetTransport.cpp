@@ -0,0 +1,90 @@
+#include "RaceLinkNetTransport.h"
+#include <WiFi.h>
+#include <esp_now.h>
+
+RaceLinkNetTransport* RaceLinkNetTransport::instance = nullptr;
+
+static const uint8_t BROADCAST_MAC[6] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+RaceLinkNetTransport::RaceLinkNetTransport()
+    : rxQueue(nullptr), espNow(false), udpOpen(false), rxDropped(0) {}
+
+bool RaceLinkNetTransport::begin() {
+    if (rxQueue) return true;
+
+    instance = this;
+    rxQueue = xQueueCreate(RX_QUEUE_DEPTH, sizeof(Frame));
+    if (!rxQueue) {
+        Serial.println("❌ Failed to create race link queue");
+        return false;
+    }
+
+    // UDP is always received, so a peer that fell back to it is still heard
+    if (udp.listen(PORT)) {
+        udpOpen = true;
+        udp.onPacket([this](AsyncUDPPacket packet) {
+            this->enqueue(packet.data(), packet.length());
+        });
+    }
+
+    espNow = beginEspNow();
+    Serial.printf("✅ Race link using %s\n", espNow ? "ESP-NOW" : "UDP");
+    return espNow || udpOpen;
+}
+
+bool RaceLinkNetTransport::beginEspNow() {
+    if (esp_now_init() != ESP_OK) {
+        return false;
+    }
+
+    esp_now_peer_info_t peer;
+    memset(&peer, 0, sizeof(peer));
+    memcpy(peer.peer_addr, BROADCAST_MAC, sizeof(BROADCAST_MAC));
+    peer.channel = 0;  // Follow the current WiFi channel
+    peer.ifidx = (WiFi.getMode() == WIFI_AP) ? WIFI_IF_AP : WIFI_IF_STA;
+    peer.encrypt = false;
+    if (esp_now_add_peer(&peer) != ESP_OK) {
+        esp_now_deinit();
+        return false;
+    }
+
+    esp_now_register_recv_cb(onEspNowReceive);
+    return true;
+}
+
+void RaceLinkNetTransport::onEspNowReceive(const uint8_t* mac, const uint8_t* data, int length) {
+    if (instance && length > 0) {
+        instance->enqueue(data, length);
+    }
+}
+
+void RaceLinkNetTransport::enqueue(const uint8_t* data, size_t length) {
+    if (!rxQueue || length > MAX_FRAME) return;
+
+    Frame frame;
+    frame.length = length;
+    memcpy(frame.data, data, length);
+    if (xQueueSend(rxQueue, &frame, 0) != pdTRUE) {
+        rxDropped++;
+    }
+}
+
+bool RaceLinkNetTransport::send(const uint8_t* data, size_t length) {
+    if (espNow) {
+        return esp_now_send(BROADCAST_MAC, data, length) == ESP_OK;
+    }
+    if (udpOpen) {
+        return udp.broadcastTo(const_cast<uint8_t*>(data), length, PORT) == length;
+    }
+    return false;
+}
+
+size_t RaceLinkNetTransport::receive(uint8_t* buffer, size_t capacity) {
+    Frame frame;
+    if (!rxQueue || xQueueReceive(rxQueue, &frame, 0) != pdTRUE) {
+        return 0;
+    }
+    size_t length = frame.length < capacity ? frame.length : capacity;
+    memcpy(buffer, frame.data, length);
+    return length;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+#include <AsyncUDP.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include "RaceLinkTransport.h"
+
+// RaceLink over the air: ESP-NOW broadcast when it can be started (no router
+// needed, lower latency), UDP broadcast otherwise. Frames arriving on either
+// are queued for RaceLink::update() so nothing runs in the WiFi tasks.
+class RaceLinkNetTransport : public RaceLinkTransport {
+public:
+    static const uint16_t PORT = 5301;
+
+    RaceLinkNetTransport();
+    bool begin();
+    bool send(const uint8_t* data, size_t length) override;
+    size_t receive(uint8_t* buffer, size_t capacity) override;
+    bool usingEspNow() const { return espNow; }
+    uint32_t getRxDropped() const { return rxDropped; }
+
+private:
+    static const int RX_QUEUE_DEPTH = 16;
+
+    struct Frame {
+        uint8_t length;
+        uint8_t data[MAX_FRAME];
+    };
+
+    static void onEspNowReceive(const uint8_t* mac, const uint8_t* data, int length);
+    void enqueue(const uint8_t* data, size_t length);
+    bool beginEspNow();
+
+    static RaceLinkNetTransport* instance;
+    AsyncUDP udp;
+    QueueHandle_t rxQueue;
+    bool espNow;
+    bool udpOpen;
+    volatile uint32_t rxDropped;
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Datagram transport between a start node and a finish node. Delivery is
+// best effort; RaceLink adds sequence numbers, ACKs and retransmission.
+class RaceLinkTransport {
+public:
+    static const size_t MAX_FRAME = 64;
+
+    virtual ~RaceLinkTransport() {}
+    virtual bool send(const uint8_t* data, size_t length) = 0;
+    // Copies the next received frame into buffer; returns 0 when none is waiting
+    virtual size_t receive(uint8_t* buffer, size_t capacity) = 0;
+};
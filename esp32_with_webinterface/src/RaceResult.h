@@ -0,0 +1,18 @@
+#pragma once
+
+// A finished race as stored in the history. Kept free of Arduino headers so
+// the portable race-link code can produce it too. The lane times are the
+// reported ones; the raw times are as measured, the corrected times have the
+// lane offset removed, and tie resolution works from those.
+struct RaceResult {
+    unsigned long timestamp;
+    float lane1Time;
+    float lane2Time;
+    int winner;
+    float lane1Raw;
+    float lane2Raw;
+    float margin;             // Raw difference between the lanes in seconds
+    int confidence;           // Percent certainty in the finishing order
+    float lane1Corrected;
+    float lane2Corrected;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+// In-memory transport for running a start node and a finish node in one host
+// process. Frames can be delayed, dropped and duplicated to exercise
+// RaceLink's retransmission.
+
+#include <deque>
+#include <stdlib.h>
+#include <string.h>
+#include "RaceLinkTransport.h"
+
+class SimulatedTransport : public RaceLinkTransport {
+public:
+    SimulatedTransport()
+        : peer(nullptr), nowUs(0), latencyUs(500), lossPercent(0), duplicatePercent(0),
+          sent(0), dropped(0) {}
+
+    static void connect(SimulatedTransport& a, SimulatedTransport& b) {
+        a.peer = &b;
+        b.peer = &a;
+    }
+
+    void setNow(int64_t now) { nowUs = now; }
+    void setLatency(int64_t us) { latencyUs = us; }
+    void setLossPercent(int percent) { lossPercent = percent; }
+    void setDuplicatePercent(int percent) { duplicatePercent = percent; }
+    uint32_t getSent() const { return sent; }
+    uint32_t getDropped() const { return dropped; }
+
+    bool send(const uint8_t* data, size_t length) override {
+        if (!peer || length > MAX_FRAME) return false;
+        sent++;
+        if (rand() % 100 < lossPercent) {
+            dropped++;
+            return true;  // Lost on the air, the sender can't tell
+        }
+        peer->inject(data, length, nowUs + latencyUs);
+        if (rand() % 100 < duplicatePercent) {
+            peer->inject(data, length, nowUs + 2 * latencyUs);
+        }
+        return true;
+    }
+
+    // Delivers the earliest frame that is due, so a late duplicate can
+    // arrive after frames sent behind it
+    size_t receive(uint8_t* buffer, size_t capacity) override {
+        std::deque<Frame>::iterator next = inbox.end();
+        for (std::deque<Frame>::iterator it = inbox.begin(); it != inbox.end(); ++it) {
+            if (it->deliverAtUs <= nowUs && (next == inbox.end() || it->deliverAtUs < next->deliverAtUs)) {
+                next = it;
+            }
+        }
+        if (next == inbox.end()) return 0;
+        Frame frame = *next;
+        inbox.erase(next);
+        size_t length = frame.length < capacity ? frame.length : capacity;
+        memcpy(buffer, frame.data, length);
+        return length;
+    }
+
+private:
+    struct Frame {
+        int64_t deliverAtUs;
+        size_t length;
+        uint8_t data[MAX_FRAME];
+    };
+
+    void inject(const uint8_t* data, size_t length, int64_t deliverAtUs) {
+        Frame frame;
+        frame.deliverAtUs = deliverAtUs;
+        frame.length = length;
+        memcpy(frame.data, data, length);
+        inbox.push_back(frame);
+    }
+
+    SimulatedTransport* peer;
+    std::deque<Frame> inbox;
+    int64_t nowUs;
+    int64_t latencyUs;
+    int lossPercent;
+    int duplicatePercent;
+    uint32_t sent;
+    uint32_t dropped;
+};
@@ -0,0 +1,226 @@
+#include "StorageWriter.h"
+#include <ArduinoJson.h>
+#include <SD.h>
+#include <time.h>
+
+StorageWriter::StorageWriter()
+    : queue(nullptr), taskHandle(nullptr), dirtyMask(0), hold(false),
+      sdAvailable(false), syncPolicy(SYNC_BATCHED) {
+    memset(&stats, 0, sizeof(stats));
+    for (int target = 0; target < STORAGE_TARGET_COUNT; target++) {
+        dueTick[target] = 0;
+    }
+}
+
+void StorageWriter::begin() {
+    if (taskHandle) return;
+
+    queue = xQueueCreate(QUEUE_DEPTH, sizeof(RaceLogEntry));
+    if (!queue) {
+        Serial.println("❌ Failed to create storage queue");
+        return;
+    }
+
+    // Core 0 keeps it off the core that runs loop() and finish detection
+    xTaskCreatePinnedToCore(taskEntry, "storage", TASK_STACK_SIZE, this,
+                            TASK_PRIORITY, &taskHandle, 0);
+    Serial.println("✅ Storage writer started");
+}
+
+bool StorageWriter::enqueueRaceLog(time_t timestamp, const RaceResult& result) {
+    if (!queue) return false;
+
+    static const char* WINNER_NAMES[] = { "tie", "car1", "car2" };
+    RaceLogEntry entry;
+    entry.timestamp = timestamp;
+    entry.car1Ms = lroundf(result.lane1Time * 1000);
+    entry.car2Ms = lroundf(result.lane2Time * 1000);
+    entry.car1RawMs = lroundf(result.lane1Raw * 1000);
+    entry.car2RawMs = lroundf(result.lane2Raw * 1000);
+    strlcpy(entry.winner, WINNER_NAMES[result.winner >= 0 && result.winner <= 2 ? result.winner : 0],
+            sizeof(entry.winner));
+
+    if (xQueueSend(queue, &entry, 0) != pdTRUE) {
+        stats.raceLogsDropped++;
+        Serial.println("❌ Storage queue full, race log dropped");
+        return false;
+    }
+    wake();
+    return true;
+}
+
+void StorageWriter::registerTarget(StorageTarget target, FlushHandler handler) {
+    if (target >= STORAGE_TARGET_COUNT) return;
+    handlers[target] = handler;
+}
+
+void StorageWriter::markDirty(StorageTarget target, uint32_t debounceMs) {
+    if (target >= STORAGE_TARGET_COUNT) return;
+    dueTick[target] = xTaskGetTickCount() + pdMS_TO_TICKS(debounceMs);
+    dirtyMask.fetch_or(1u << target);
+    wake();
+}
+
+TickType_t StorageWriter::nextDeadline() const {
+    uint32_t dirty = dirtyMask.load();
+    if (dirty == 0) {
+        return portMAX_DELAY;
+    }
+
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wait = portMAX_DELAY;
+    for (int target = 0; target < STORAGE_TARGET_COUNT; target++) {
+        if (!(dirty & (1u << target))) continue;
+        TickType_t remaining = (TickType_t)(dueTick[target] - now);
+        if ((int32_t)remaining <= 0) return 0;
+        if (remaining < wait) wait = remaining;
+    }
+    return wait;
+}
+
+size_t StorageWriter::queueDepth() const {
+    return queue ? uxQueueMessagesWaiting(queue) : 0;
+}
+
+void StorageWriter::wake() {
+    if (taskHandle) {
+        xTaskNotifyGive(taskHandle);
+    }
+}
+
+void StorageWriter::taskEntry(void* arg) {
+    static_cast<StorageWriter*>(arg)->run();
+}
+
+void StorageWriter::run() {
+    static RaceLogEntry batch[QUEUE_DEPTH];
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, nextDeadline());
+
+        if (syncPolicy == SYNC_BATCHED && uxQueueMessagesWaiting(queue) > 0) {
+            // Give closely spaced jobs a chance to land in the same batch
+            vTaskDelay(pdMS_TO_TICKS(BATCH_WINDOW_MS));
+        }
+
+        // Flash and SPI writes stall the other core, so wait for the race to end
+        while (hold) {
+            vTaskDelay(pdMS_TO_TICKS(50));
+        }
+
+        int count = 0;
+        while (count < QUEUE_DEPTH && xQueueReceive(queue, &batch[count], 0) == pdTRUE) {
+            count++;
+            if (syncPolicy == SYNC_EACH_JOB) {
+                writeRaceLogs(batch, count);
+                count = 0;
+            }
+        }
+        if (count > 0) {
+            writeRaceLogs(batch, count);
+        }
+
+        flushTargets();
+        stats.batches++;
+
+        // More work may have arrived while this batch was being written;
+        // debounced targets are picked up by the wait deadline
+        if (uxQueueMessagesWaiting(queue) > 0) {
+            xTaskNotifyGive(taskHandle);
+        }
+    }
+}
+
+void StorageWriter::flushTargets() {
+    TickType_t now = xTaskGetTickCount();
+    for (int target = 0; target < STORAGE_TARGET_COUNT; target++) {
+        uint32_t bit = 1u << target;
+        if (!(dirtyMask.load() & bit)) continue;
+        if ((int32_t)(dueTick[target] - now) > 0) continue;  // Still debouncing
+
+        dirtyMask.fetch_and(~bit);
+        if (!handlers[target]) continue;
+
+        if (handlers[target]()) {
+            stats.targetWrites[target]++;
+        } else {
+            stats.targetFailures[target]++;
+        }
+    }
+}
+
+void StorageWriter::writeRaceLogs(RaceLogEntry* entries, int count) {
+    if (!sdAvailable) {
+        stats.raceLogFailures += count;
+        return;
+    }
+
+    // Group consecutive entries by daily file so each file is opened once
+    int start = 0;
+    while (start < count) {
+        char filename[40];
+        char dateStr[11];
+        struct tm timeinfo;
+        time_t ts = entries[start].timestamp;
+        localtime_r(&ts, &timeinfo);
+        if (timeinfo.tm_year > (2024 - 1900)) {
+            strftime(dateStr, sizeof(dateStr), "%Y-%m-%d", &timeinfo);
+        } else {
+            strlcpy(dateStr, "undated", sizeof(dateStr));  // Clock not yet synchronized
+        }
+        snprintf(filename, sizeof(filename), "/race_history/%s.jsonl", dateStr);
+
+        int end = start + 1;
+        while (end < count) {
+            time_t nextTs = entries[end].timestamp;
+            struct tm nextInfo;
+            localtime_r(&nextTs, &nextInfo);
+            if (nextInfo.tm_yday != timeinfo.tm_yday || nextInfo.tm_year != timeinfo.tm_year) break;
+            end++;
+        }
+
+        if (appendToDailyFile(filename, &entries[start], end - start)) {
+            stats.raceLogsWritten += end - start;
+        } else {
+            stats.raceLogFailures += end - start;
+        }
+        start = end;
+    }
+}
+
+// One JSON object per line, appended, so a write costs the same however many
+// races the day already has and earlier races are never rewritten. A power
+// cut can at worst leave a partial last line, which readers skip.
+bool StorageWriter::appendToDailyFile(const char* filename, RaceLogEntry* entries, int count) {
+    File dailyFile = SD.open(filename, FILE_APPEND);
+    if (!dailyFile) {
+        Serial.println("❌ Failed to open daily file for appending");
+        return false;
+    }
+
+    bool ok = true;
+    for (int i = 0; i < count && ok; i++) {
+        StaticJsonDocument<256> race;
+        race["timestamp"] = entries[i].timestamp;
+        race["car1_time"] = entries[i].car1Ms / 1000.0;
+        race["car2_time"] = entries[i].car2Ms / 1000.0;
+        race["car1_raw"] = entries[i].car1RawMs / 1000.0;
+        race["car2_raw"] = entries[i].car2RawMs / 1000.0;
+        race["winner"] = entries[i].winner;
+
+        // Built in memory first so each record reaches the card in one write
+        char line[200];
+        size_t length = serializeJson(race, line, sizeof(line) - 1);
+        line[length++] = '\n';
+        ok = length > 1 && dailyFile.write((const uint8_t*)line, length) == length;
+    }
+
+    dailyFile.flush();
+    dailyFile.close();
+    if (!ok) {
+        Serial.println("❌ Failed to write race data");
+        return false;
+    }
+    Serial.printf("✅ %d race(s) saved to SD: %s\n", count, filename);
+    return true;
+}
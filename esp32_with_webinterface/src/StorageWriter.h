@@ -0,0 +1,91 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <functional>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include "RaceResult.h"
+
+// A single race result destined for the daily SD log
+struct RaceLogEntry {
+    time_t timestamp;
+    uint32_t car1Ms;
+    uint32_t car2Ms;
+    uint32_t car1RawMs;       // Before tie resolution
+    uint32_t car2RawMs;
+    char winner[8];
+};
+
+// Whole-file stores that are rewritten from memory when marked dirty
+enum StorageTarget {
+    STORAGE_HISTORY = 0,
+    STORAGE_CONFIG,
+    STORAGE_CAR_STATS,
+    STORAGE_BRACKET,
+    STORAGE_TARGET_COUNT
+};
+
+// Same numbering as the storageSync configuration field
+enum SyncPolicy {
+    SYNC_BATCHED = 0,   // Coalesce jobs for BATCH_WINDOW_MS, one flush per file
+    SYNC_EACH_JOB = 1   // Write and flush every job as soon as it arrives
+};
+
+struct StorageStats {
+    uint32_t raceLogsWritten;
+    uint32_t raceLogFailures;
+    uint32_t raceLogsDropped;
+    uint32_t targetWrites[STORAGE_TARGET_COUNT];
+    uint32_t targetFailures[STORAGE_TARGET_COUNT];
+    uint32_t batches;
+};
+
+// Low-priority background task that owns all persistence so the race loop
+// never blocks on SPI or flash writes.
+class StorageWriter {
+public:
+    typedef std::function<bool()> FlushHandler;
+
+    StorageWriter();
+    void begin();
+    void setSDAvailable(bool available) { sdAvailable = available; }
+    void setSyncPolicy(SyncPolicy policy) { syncPolicy = policy; }
+
+    bool enqueueRaceLog(time_t timestamp, const RaceResult& result);
+    void registerTarget(StorageTarget target, FlushHandler handler);
+    // Repeated calls within the debounce window coalesce into a single write
+    void markDirty(StorageTarget target, uint32_t debounceMs = 0);
+
+    // Holding defers all writes, e.g. while a race is being timed
+    void setHold(bool hold) { this->hold = hold; }
+
+    size_t queueDepth() const;
+    const StorageStats& getStats() const { return stats; }
+    TaskHandle_t getTaskHandle() const { return taskHandle; }
+
+private:
+    static const int QUEUE_DEPTH = 16;
+    static const uint32_t BATCH_WINDOW_MS = 250;
+    static const uint32_t TASK_STACK_SIZE = 8192;
+    static const UBaseType_t TASK_PRIORITY = 1;
+
+    static void taskEntry(void* arg);
+    void run();
+    void writeRaceLogs(RaceLogEntry* entries, int count);
+    bool appendToDailyFile(const char* filename, RaceLogEntry* entries, int count);
+    void flushTargets();
+    TickType_t nextDeadline() const;
+    void wake();
+
+    QueueHandle_t queue;
+    TaskHandle_t taskHandle;
+    FlushHandler handlers[STORAGE_TARGET_COUNT];
+    std::atomic<uint32_t> dirtyMask;
+    volatile TickType_t dueTick[STORAGE_TARGET_COUNT];
+    volatile bool hold;
+    volatile bool sdAvailable;
+    SyncPolicy syncPolicy;
+    StorageStats stats;
+};
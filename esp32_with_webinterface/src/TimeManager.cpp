@@ -1,26 +1,28 @@
 #include "TimeManager.h"
 #include <Arduino.h>
+#include <esp_timer.h>
+#include <esp_sntp.h>
+#include <sys/time.h>
+#include "Debug.h"
 
-TimeManager::TimeManager() : timeSet(false), lastNTPUpdate(0) {}
-
-void TimeManager::begin() {
-    configTime(gmtOffset_sec, daylightOffset_sec, ntpServer);
-    
-    // Wait for time to be set (timeout after 10 seconds)
-    int attempts = 0;
-    while (!isTimeSet() && attempts < 20) {
-        delay(500);
-        Serial.print(".");
-        attempts++;
-    }
-    
-    if (isTimeSet()) {
-        Serial.println("\n✅ NTP time synchronized");
-        timeSet = true;
-        lastNTPUpdate = millis();
-    } else {
-        Serial.println("\n❌ Failed to get time from NTP server");
-    }
+TimeManager* TimeManager::instance = nullptr;
+
+// Guards the sync anchor, which the SNTP callback updates from the lwIP task
+static portMUX_TYPE timeLock = portMUX_INITIALIZER_UNLOCKED;
+
+TimeManager::TimeManager()
+    : timeSet(false), syncPending(false),
+      anchorMonoUs(0), anchorWallUs(0), slewUs(0), syncMonoUs(0), syncWallUs(0),
+      lastOffsetUs(0), driftPpm(0), syncCount(0) {}
+
+void TimeManager::begin(const char* tz) {
+    instance = this;
+
+    // Starts SNTP and returns immediately; onTimeSync fires from the lwIP task
+    sntp_set_time_sync_notification_cb(onTimeSync);
+    sntp_set_sync_interval(SYNC_INTERVAL_MS);
+    configTzTime(tz, ntpServer1, ntpServer2);
+    Serial.printf("🕒 NTP sync started (TZ %s)\n", tz);
 }
 
 void TimeManager::setTimezone(const char* tz) {
@@ -28,25 +30,93 @@ void TimeManager::setTimezone(const char* tz) {
     tzset();
 }
 
-time_t TimeManager::getEpochTime() {
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return tv.tv_sec;
+void TimeManager::onTimeSync(struct timeval* tv) {
+    if (instance && tv) {
+        instance->recordSync(tv);
+    }
 }
 
-bool TimeManager::isTimeSet() {
-    struct tm timeinfo;
-    if (!getLocalTime(&timeinfo)) {
-        return false;
+void TimeManager::recordSync(const struct timeval* tv) {
+    int64_t monoUs = esp_timer_get_time();
+    int64_t wallUs = (int64_t)tv->tv_sec * 1000000LL + tv->tv_usec;
+
+    portENTER_CRITICAL(&timeLock);
+    int64_t predictedUs = wallUs;
+    if (timeSet) {
+        predictedUs = wallAt(monoUs);
+        lastOffsetUs = wallUs - predictedUs;
+
+        // Rate of wall time against esp_timer between the SNTP samples
+        int64_t monoSpan = monoUs - syncMonoUs;
+        if (monoSpan >= MIN_DRIFT_INTERVAL_US) {
+            float measured = ((float)(wallUs - syncWallUs) / monoSpan - 1.0f) * 1e6f;
+            if (fabsf(measured) <= MAX_DRIFT_PPM) {
+                driftPpm = driftPpm == 0 ? measured : driftPpm * 0.75f + measured * 0.25f;
+            }
+        }
+    }
+    syncMonoUs = monoUs;
+    syncWallUs = wallUs;
+
+    // Carry on from where the clock is and slew the correction in, unless it
+    // is too large to slew in reasonable time
+    anchorMonoUs = monoUs;
+    if (llabs(wallUs - predictedUs) <= MAX_SLEW_US) {
+        anchorWallUs = predictedUs;
+        slewUs = wallUs - predictedUs;
+    } else {
+        anchorWallUs = wallUs;
+        slewUs = 0;
     }
-    return timeinfo.tm_year > (2024 - 1900);  // Check if year is at least 2024
+    timeSet = true;
+    syncCount++;
+    syncPending = true;
+    portEXIT_CRITICAL(&timeLock);
+}
+
+int64_t TimeManager::getEpochMicros() {
+    if (!timeSet) {
+        // Not synced yet: system time, which starts near the epoch
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+    }
+
+    portENTER_CRITICAL(&timeLock);
+    int64_t wallUs = wallAt(esp_timer_get_time());
+    portEXIT_CRITICAL(&timeLock);
+    return wallUs;
+}
+
+// Wall clock at an esp_timer time, with as much of the pending correction as
+// the slew rate allows by then. Called under timeLock.
+int64_t TimeManager::wallAt(int64_t monoUs) const {
+    int64_t monoSpan = monoUs - anchorMonoUs;
+    int64_t wallUs = anchorWallUs + monoSpan + (int64_t)(monoSpan * (driftPpm / 1e6));
+    int64_t slewed = monoSpan * SLEW_RATE_PPM / 1000000;
+    if (slewUs >= 0) {
+        wallUs += slewed < slewUs ? slewed : slewUs;
+    } else {
+        wallUs -= slewed < -slewUs ? slewed : -slewUs;
+    }
+    return wallUs;
+}
+
+time_t TimeManager::getEpochTime() {
+    return (time_t)(getEpochMicros() / 1000000LL);
 }
 
 void TimeManager::update() {
-    // Update NTP time every hour
-    if (millis() - lastNTPUpdate >= NTP_UPDATE_INTERVAL) {
-        Serial.println("🕒 Updating NTP time...");
-        configTime(gmtOffset_sec, daylightOffset_sec, ntpServer);
-        lastNTPUpdate = millis();
+    // Report syncs here rather than from the lwIP callback
+    if (!syncPending) {
+        return;
+    }
+    syncPending = false;
+
+    if (syncCount == 1) {
+        Serial.println("✅ NTP time synchronized");
+    } else if (DEBUG) {
+        Serial.printf("🕒 NTP re-sync: offset %lld us, drift %.2f ppm\n",
+                      (long long)lastOffsetUs, driftPpm);
     }
 }
@@ -1,21 +1,51 @@
 #pragma once
 
 #include <time.h>
+#include <stdint.h>
 
+// Wall clock derived from the monotonic esp_timer. SNTP runs in the
+// background and reading the time never blocks. Each re-sync updates the
+// drift estimate and slews the clock onto the new time at no more than
+// SLEW_RATE_PPM, as ntpd does, so it stays continuous through a race. Only
+// the first sync and corrections beyond MAX_SLEW_US step it.
 class TimeManager {
 public:
     TimeManager();
-    void begin();
+    void begin(const char* tz);
     void setTimezone(const char* tz);
     time_t getEpochTime();
-    bool isTimeSet();
+    int64_t getEpochMicros();
+    bool isTimeSet() const { return timeSet; }
     void update();
 
+    // Last sync, for status reporting
+    int64_t getLastOffsetUs() const { return lastOffsetUs; }
+    float getDriftPpm() const { return driftPpm; }
+    uint32_t getSyncCount() const { return syncCount; }
+
 private:
-    bool timeSet;
-    const char* ntpServer = "pool.ntp.org";
-    const long gmtOffset_sec = 36000;     // GMT+10 (Sydney)
-    const int daylightOffset_sec = 3600;   // +1 hour for DST
-    unsigned long lastNTPUpdate;
-    const unsigned long NTP_UPDATE_INTERVAL = 3600000; // Update every hour
+    static void onTimeSync(struct timeval* tv);
+    void recordSync(const struct timeval* tv);
+    int64_t wallAt(int64_t monoUs) const;
+
+    static TimeManager* instance;
+    static const uint32_t SYNC_INTERVAL_MS = 3600000;   // SNTP re-sync every hour
+    static const int64_t MIN_DRIFT_INTERVAL_US = 60000000; // Ignore drift over short spans
+    static constexpr float MAX_DRIFT_PPM = 500.0f;       // Crystal spec is well inside this
+    static const int64_t SLEW_RATE_PPM = 500;            // 0.5 ms of correction per second
+    static const int64_t MAX_SLEW_US = 128000;           // Step the clock for larger corrections
+
+    const char* ntpServer1 = "pool.ntp.org";
+    const char* ntpServer2 = "time.nist.gov";
+
+    volatile bool timeSet;
+    volatile bool syncPending;
+    int64_t anchorMonoUs;   // esp_timer at the last sync
+    int64_t anchorWallUs;   // Derived wall clock at the last sync, before any slew
+    int64_t slewUs;         // Correction slewed in from the anchor on
+    int64_t syncMonoUs;     // esp_timer and SNTP time of the last sync, for the drift
+    int64_t syncWallUs;
+    int64_t lastOffsetUs;   // Wall clock correction made by the last sync
+    float driftPpm;         // Wall clock rate relative to esp_timer
+    uint32_t syncCount;
 };
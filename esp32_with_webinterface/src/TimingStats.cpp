@@ -0,0 +1,87 @@
+#include "TimingStats.h"
+
+// Upper bound of each bucket; the last bucket collects everything above 100 ms
+const uint32_t LatencyHistogram::BUCKET_LIMITS_US[LatencyHistogram::NUM_BUCKETS - 1] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000
+};
+
+void LatencyHistogram::record(uint32_t us) {
+    int bucket = 0;
+    while (bucket < NUM_BUCKETS - 1 && us > BUCKET_LIMITS_US[bucket]) {
+        bucket++;
+    }
+    counts[bucket]++;
+    count++;
+    sumUs += us;
+    if (us > maxUs) maxUs = us;
+}
+
+void LatencyHistogram::reset() {
+    memset(counts, 0, sizeof(counts));
+    count = 0;
+    maxUs = 0;
+    sumUs = 0;
+}
+
+void LatencyHistogram::toJson(JsonObject obj) const {
+    obj["count"] = count;
+    obj["max_us"] = maxUs;
+    obj["avg_us"] = count ? (uint32_t)(sumUs / count) : 0;
+
+    JsonArray buckets = obj.createNestedArray("buckets");
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        buckets.add(counts[i]);
+    }
+}
+
+TimingStats::TimingStats() : sessionStart(0) {
+    memset(lastReadyUs, 0, sizeof(lastReadyUs));
+}
+
+void TimingStats::beginRace() {
+    // Gaps between races are not sample gaps
+    memset(lastReadyUs, 0, sizeof(lastReadyUs));
+}
+
+void TimingStats::recordSample(int lane, unsigned long readyUs, uint32_t i2cUs) {
+    if (lane < 0 || lane >= NUM_LANES) return;
+    i2cTime[lane].record(i2cUs);
+    if (lastReadyUs[lane] != 0) {
+        sampleGap[lane].record(readyUs - lastReadyUs[lane]);
+    }
+    lastReadyUs[lane] = readyUs;
+}
+
+void TimingStats::recordDetection(int lane, unsigned long detectedUs) {
+    if (lane < 0 || lane >= NUM_LANES) return;
+    detectLatency[lane].record(detectedUs - lastReadyUs[lane]);
+}
+
+void TimingStats::reset() {
+    for (int i = 0; i < NUM_LANES; i++) {
+        detectLatency[i].reset();
+        i2cTime[i].reset();
+        sampleGap[i].reset();
+        lastReadyUs[i] = 0;
+    }
+    sessionStart = millis();
+}
+
+void TimingStats::toJson(JsonDocument& doc) const {
+    doc["type"] = "timing_stats";
+    doc["session_ms"] = millis() - sessionStart;
+
+    JsonArray limits = doc.createNestedArray("bucket_limits_us");
+    for (int i = 0; i < LatencyHistogram::NUM_BUCKETS - 1; i++) {
+        limits.add(LatencyHistogram::BUCKET_LIMITS_US[i]);
+    }
+
+    JsonArray lanes = doc.createNestedArray("lanes");
+    for (int i = 0; i < NUM_LANES; i++) {
+        JsonObject lane = lanes.createNestedObject();
+        lane["lane"] = i + 1;
+        detectLatency[i].toJson(lane.createNestedObject("detect_latency"));
+        i2cTime[i].toJson(lane.createNestedObject("i2c"));
+        sampleGap[i].toJson(lane.createNestedObject("sample_gap"));
+    }
+}
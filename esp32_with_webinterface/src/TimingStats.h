@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Fixed-bucket latency histogram, cheap enough for the race hot path
+class LatencyHistogram {
+public:
+    static const int NUM_BUCKETS = 12;
+    static const uint32_t BUCKET_LIMITS_US[NUM_BUCKETS - 1];
+
+    LatencyHistogram() { reset(); }
+    void record(uint32_t us);
+    void reset();
+    void toJson(JsonObject obj) const;
+
+private:
+    uint32_t counts[NUM_BUCKETS];
+    uint32_t count;
+    uint32_t maxUs;
+    uint64_t sumUs;
+};
+
+// Per-lane finish detection timing, kept in static memory for the whole session
+class TimingStats {
+public:
+    static const int NUM_LANES = 2;
+
+    TimingStats();
+    void beginRace();
+    // readyUs is when the sensor had the result, not when it was polled
+    void recordSample(int lane, unsigned long readyUs, uint32_t i2cUs);
+    void recordDetection(int lane, unsigned long detectedUs);
+    void reset();
+    void toJson(JsonDocument& doc) const;
+
+private:
+    LatencyHistogram detectLatency[NUM_LANES];  // Sensor data-ready to finish detection
+    LatencyHistogram i2cTime[NUM_LANES];        // I2C range read transaction
+    LatencyHistogram sampleGap[NUM_LANES];      // Time between successive samples
+    unsigned long lastReadyUs[NUM_LANES];
+    unsigned long sessionStart;
+};
@@ -1,10 +1,13 @@
 #include "WebServer.h"
 #include "Version.h"
 #include "Debug.h"
+#include "StorageWriter.h"
+#include <TiePolicy.h>
 
-WebServer::WebServer(TimeManager& tm, Configuration& cfg, NetworkManager& nm) 
+WebServer::WebServer(TimeManager& tm, Configuration& cfg, NetworkManager& nm, Diagnostics& diag, TimingStats& ts, CarStats& car, Bracket& br, ClockSync& cs) 
     : server(80), ws("/ws"), commandHandler(nullptr), 
-      timeManager(tm), raceHistory(tm), config(cfg), networkManager(nm) {}
+      timeManager(tm), raceHistory(tm), config(cfg), networkManager(nm), diagnostics(diag), timingStats(ts),
+      carStats(car), bracket(br), clockSync(cs) {}
 
 void WebServer::begin() {
     if (!LittleFS.begin(false)) {  // First try without formatting
@@ -28,6 +31,7 @@ void WebServer::begin() {
     }
     
     raceHistory.begin();
+    carStats.begin();
 
     ws.onEvent([this](AsyncWebSocket* server, AsyncWebSocketClient* client,
                      AwsEventType type, void* arg, uint8_t* data, size_t len) {
@@ -37,46 +41,109 @@ void WebServer::begin() {
     server.addHandler(&ws);
     setupRoutes();
     server.begin();
+    diagnostics.registerTask("async_tcp", xTaskGetHandle("async_tcp"));
     Serial.println("✅ Web server started");
 }
 
-void WebServer::setupRoutes() {
-    // Handle root path
-    server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
-        Serial.println("📄 Serving index.html");
-        if (LittleFS.exists("/index.html")) {
-            Serial.println("✅ Found index.html");
-            request->send(LittleFS, "/index.html", "text/html");
-        } else {
-            Serial.println("❌ index.html not found");
-            request->send(404, "text/plain", "index.html not found");
+// HTML is revalidated on every load (a 304 when unchanged); the vendored
+// stylesheets and scripts are cached for 30 days
+static const char* const CACHE_REVALIDATE = "no-cache";
+static const char* const CACHE_LONG = "public, max-age=2592000";
+
+static const char* contentTypeFor(const String& url) {
+    if (url.endsWith(".html")) return "text/html";
+    if (url.endsWith(".css")) return "text/css";
+    if (url.endsWith(".js")) return "application/javascript";
+    if (url.endsWith(".json")) return "application/json";
+    if (url.endsWith(".svg")) return "image/svg+xml";
+    return "application/octet-stream";
+}
+
+// Finds the .gz files the build put in the filesystem image. Each one's ETag
+// is read from its gzip trailer here, so requests never touch the
+// filesystem beyond opening the file they send.
+void WebServer::loadStaticAssets(const char* dir) {
+    File root = LittleFS.open(dir);
+    if (!root || !root.isDirectory()) return;
+
+    for (File file = root.openNextFile(); file; file = root.openNextFile()) {
+        String path = file.path();
+        if (file.isDirectory()) {
+            loadStaticAssets(path.c_str());
+            continue;
         }
-    });
+        if (!path.endsWith(".gz") || file.size() < 18) continue;
 
-    // Handle configuration page
-    server.on("/config", HTTP_GET, [](AsyncWebServerRequest *request) {
-        Serial.println("📄 Serving config.html");
-        if (LittleFS.exists("/config.html")) {
-            Serial.println("✅ Found config.html");
-            request->send(LittleFS, "/config.html", "text/html");
-        } else {
-            Serial.println("❌ config.html not found");
-            request->send(404, "text/plain", "config.html not found");
+        uint8_t trailer[8];
+        if (!file.seek(file.size() - sizeof(trailer)) || file.read(trailer, sizeof(trailer)) != sizeof(trailer)) {
+            continue;
         }
-    });
+        uint32_t crc = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+        uint32_t length = trailer[4] | trailer[5] << 8 | trailer[6] << 16 | (uint32_t)trailer[7] << 24;
+        char etag[24];
+        snprintf(etag, sizeof(etag), "\"%08x-%x\"", (unsigned)crc, (unsigned)length);
+
+        StaticAsset asset;
+        asset.url = path.substring(0, path.length() - 3);
+        asset.path = path;
+        asset.etag = etag;
+        asset.contentType = contentTypeFor(asset.url);
+        asset.cacheControl = asset.url.endsWith(".html") ? CACHE_REVALIDATE : CACHE_LONG;
+        staticAssets.push_back(asset);
+    }
+}
+
+void WebServer::serveStaticAsset(AsyncWebServerRequest *request, const StaticAsset& asset) {
+    AsyncWebServerResponse *response;
+    if (request->hasHeader("If-None-Match") && request->header("If-None-Match") == asset.etag) {
+        response = request->beginResponse(304);
+    } else {
+        File file = LittleFS.open(asset.path, "r");
+        if (!file) {
+            request->send(404);
+            return;
+        }
+        // Named by its URL, a .gz file is sent with Content-Encoding: gzip
+        response = request->beginResponse(file, asset.url, asset.contentType);
+    }
+    response->addHeader("ETag", asset.etag);
+    response->addHeader("Cache-Control", asset.cacheControl);
+    request->send(response);
+}
+
+void WebServer::setupRoutes() {
+    // Pages by their short names
+    server.rewrite("/", "/index.html");
+    server.rewrite("/config", "/config.html");
+
+    // Precompressed assets, one handler each; the vector is not changed after this
+    loadStaticAssets("/");
+    for (size_t i = 0; i < staticAssets.size(); i++) {
+        server.on(staticAssets[i].url.c_str(), HTTP_GET, [this, i](AsyncWebServerRequest *request) {
+            serveStaticAsset(request, staticAssets[i]);
+        });
+    }
+    Serial.printf("✅ Serving %u precompressed asset(s)\n", (unsigned)staticAssets.size());
 
     // Handle favicon.ico
     server.on("/favicon.ico", HTTP_GET, [](AsyncWebServerRequest *request) {
         request->send(204);
     });
 
-    // Serve static files
+    // Prometheus scrape endpoint
+    server.on("/api/metrics", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        request->send(200, "text/plain; version=0.0.4", diagnostics.toPrometheus());
+    });
+
+    // Anything else, e.g. an image uploaded without the compression step
     server.serveStatic("/", LittleFS, "/");
 
-    // Handle 404s
+    // Handle 404s; phones probing the captive portal hit this constantly
     server.onNotFound([](AsyncWebServerRequest *request) {
-        Serial.print("❌ 404 Not Found: ");
-        Serial.println(request->url());
+        if (DEBUG) {
+            Serial.print("❌ 404 Not Found: ");
+            Serial.println(request->url());
+        }
         String message = "File Not Found\n\n";
         message += "URI: " + request->url() + "\n";
         request->send(404, "text/plain", message);
@@ -124,6 +191,8 @@ void WebServer::onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *c
             // Send initial configuration
             sendVersionInfo(client);
             sendRaceHistory(client);
+            sendCarStats(client, LEADERBOARD_SIZE);
+            sendBracket(client);
             sendNetworkInfo(client);
             break;
         }
@@ -162,7 +231,7 @@ void WebServer::onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *c
 }
 
 void WebServer::handleWebSocketMessage(AsyncWebSocketClient *client, const char *data) {
-    StaticJsonDocument<512> doc;
+    DynamicJsonDocument doc(COMMAND_CAPACITY);
     DeserializationError error = deserializeJson(doc, data);
     
     if (error) {
@@ -170,6 +239,13 @@ void WebServer::handleWebSocketMessage(AsyncWebSocketClient *client, const char
         Serial.println(error.c_str());
         Serial.print("Message was: ");
         Serial.println(data);
+
+        StaticJsonDocument<128> response;
+        response["type"] = "error";
+        response["message"] = String("Command not understood: ") + error.c_str();
+        String output;
+        serializeJson(response, output);
+        client->text(output);
         return;
     }
     
@@ -183,7 +259,7 @@ void WebServer::handleWebSocketMessage(AsyncWebSocketClient *client, const char
         sendNetworkInfo(client);
     }
     else if (strcmp(command, "get_config") == 0) {
-        StaticJsonDocument<512> configDoc;
+        StaticJsonDocument<1024> configDoc;
         configDoc["type"] = "config";
         JsonObject wifi = configDoc.createNestedObject("wifi");
         wifi["ssid"] = config.getWiFiSSID();
@@ -195,6 +271,22 @@ void WebServer::handleWebSocketMessage(AsyncWebSocketClient *client, const char
         JsonObject timing = configDoc.createNestedObject("timing");
         timing["relay_ms"] = config.getRelayActivationTime();
         timing["tie_threshold"] = config.getTieThreshold();
+        timing["tie_mode"] = config.getTieMode();
+        timing["lane_correction"] = config.getLaneCorrection();
+        float offset1, offset2;
+        config.getLaneOffsets(offset1, offset2);
+        JsonArray laneOffsets = timing.createNestedArray("lane_offsets");
+        laneOffsets.add(offset1);
+        laneOffsets.add(offset2);
+
+        JsonObject timeSettings = configDoc.createNestedObject("time");
+        timeSettings["timezone"] = config.getTimezone();
+        timeSettings["synced"] = timeManager.isTimeSet();
+        timeSettings["clock_sync_role"] = config.getClockSyncRole();
+        timeSettings["race_node_role"] = config.getRaceNodeRole();
+
+        JsonObject storage = configDoc.createNestedObject("storage");
+        storage["sync"] = config.getStorageSync();
         
         String output;
         serializeJson(configDoc, output);
@@ -229,6 +321,41 @@ void WebServer::handleWebSocketMessage(AsyncWebSocketClient *client, const char
         else if (strcmp(section, "timing") == 0) {
             config.setRelayActivationTime(data["relay_ms"]);
             config.setTieThreshold(data["tie_threshold"]);
+            if (data.containsKey("lane_correction")) {
+                config.setLaneCorrection(data["lane_correction"]);
+            }
+            if (data.containsKey("tie_mode")) {
+                int mode = data["tie_mode"];
+                if (mode >= 0 && mode < timingcore::NUM_TIE_MODES) {
+                    config.setTieMode(mode);
+                }
+            }
+        }
+        else if (strcmp(section, "storage") == 0) {
+            int policy = data["sync"] | -1;
+            if (policy == SYNC_BATCHED || policy == SYNC_EACH_JOB) {
+                config.setStorageSync(policy);  // Takes effect after a restart
+            }
+        }
+        else if (strcmp(section, "time") == 0) {
+            const char* tz = data["timezone"];
+            if (tz && strlen(tz) > 0) {
+                config.setTimezone(tz);
+                timeManager.setTimezone(tz);
+            }
+            if (data.containsKey("clock_sync_role")) {
+                int role = data["clock_sync_role"];
+                if (role >= CLOCK_SYNC_OFF && role <= CLOCK_SYNC_SLAVE) {
+                    config.setClockSyncRole(role);
+                    clockSync.begin((ClockSyncRole)role);
+                }
+            }
+            if (data.containsKey("race_node_role")) {
+                int role = data["race_node_role"];
+                if (role >= RACE_LINK_STANDALONE && role <= RACE_LINK_FINISH) {
+                    config.setRaceNodeRole(role);  // Takes effect after a restart
+                }
+            }
         }
         
         // Send success response
@@ -256,6 +383,99 @@ void WebServer::handleWebSocketMessage(AsyncWebSocketClient *client, const char
         serializeJson(response, output);
         client->text(output);
     }
+    else if (strcmp(command, "get_diagnostics") == 0) {
+        updateWebSocketStats();
+        StaticJsonDocument<1024> diagDoc;
+        diagnostics.toJson(diagDoc);
+        String output;
+        serializeJson(diagDoc, output);
+        client->text(output);
+    }
+    else if (strcmp(command, "get_timing_stats") == 0) {
+        DynamicJsonDocument statsDoc(2048);
+        timingStats.toJson(statsDoc);
+        String output;
+        serializeJson(statsDoc, output);
+        client->text(output);
+    }
+    else if (strcmp(command, "get_clock_sync") == 0) {
+        StaticJsonDocument<384> syncDoc;
+        JsonObject syncInfo = syncDoc.to<JsonObject>();
+        syncInfo["type"] = "clock_sync";
+        clockSync.toJson(syncInfo);
+        String output;
+        serializeJson(syncDoc, output);
+        client->text(output);
+    }
+    else if (strcmp(command, "reset_timing_stats") == 0) {
+        timingStats.reset();
+        StaticJsonDocument<64> response;
+        response["type"] = "timing_stats_reset";
+        String output;
+        serializeJson(response, output);
+        client->text(output);
+    }
+    else if (strcmp(command, "set_lanes") == 0) {
+        // Car numbers for the next race; 0 or missing leaves a lane anonymous
+        carStats.setLanes(doc["lane1"] | 0, doc["lane2"] | 0);
+        notifyCarStats();
+    }
+    else if (strcmp(command, "get_car_stats") == 0) {
+        int limit = doc["limit"] | LEADERBOARD_SIZE;
+        sendCarStats(client, constrain(limit, 1, MAX_CAR_STATS_SENT), doc["car"] | 0);
+    }
+    else if (strcmp(command, "apply_lane_bias") == 0) {
+        // Split the estimated difference evenly so the average time is unchanged
+        LaneBiasEstimate estimate = carStats.laneBias();
+        if (estimate.cars < MIN_LANE_BIAS_CARS) {
+            StaticJsonDocument<128> response;
+            response["type"] = "error";
+            response["message"] = "Not enough cars have raced in both lanes";
+            String output;
+            serializeJson(response, output);
+            client->text(output);
+            return;
+        }
+        config.setLaneOffsets(-estimate.offset / 2, estimate.offset / 2);
+        config.setLaneCorrection(true);
+        notifyCarStats();
+    }
+    else if (strcmp(command, "clear_car_stats") == 0) {
+        carStats.clear();
+        notifyCarStats();
+    }
+    else if (strcmp(command, "create_bracket") == 0) {
+        // Cars are seeded in the order given
+        JsonArray cars = doc["cars"];
+        uint16_t carIds[tournament::MAX_CARS];
+        uint16_t count = 0;
+        for (JsonVariant car : cars) {
+            if (count == tournament::MAX_CARS) {
+                count++;   // Too many, rejected below
+                break;
+            }
+            carIds[count++] = car | 0;
+        }
+        if (count > tournament::MAX_CARS || !bracket.create(doc["format"], carIds, count)) {
+            StaticJsonDocument<192> response;
+            response["type"] = "error";
+            response["message"] = "Bracket needs a format and 2 to 256 distinct non-zero car numbers";
+            String output;
+            serializeJson(response, output);
+            client->text(output);
+            return;
+        }
+        armBracketHeat();
+    }
+    else if (strcmp(command, "get_bracket") == 0) {
+        sendBracket(client);
+    }
+    else if (strcmp(command, "clear_bracket") == 0) {
+        bracket.clear();
+        carStats.setLanes(0, 0);
+        notifyBracket();
+        notifyCarStats();
+    }
     else if (strcmp(command, "load") == 0 || strcmp(command, "start") == 0) {
         commandHandler(command);
     }
@@ -288,24 +508,87 @@ void WebServer::notifyTimes(float lane1, float lane2) {
     broadcastJson(doc);
 }
 
-void WebServer::notifyRaceComplete(float lane1, float lane2) {
-    // Consider times within 0.002 seconds (2ms) as a tie
-    float timeDiff = abs(lane1 - lane2);
-    if (timeDiff <= 0.002) {
-        // For ties, use the average of both times
-        float avgTime = (lane1 + lane2) / 2;
-        lane1 = lane2 = avgTime;
-    }
-    
-    raceHistory.addRace(lane1, lane2);
-    
-    StaticJsonDocument<200> doc;
+void WebServer::notifyRaceComplete(const RaceResult& result) {
+    // Ties were resolved when the finish was timed; this only reports them
+    RaceResult stamped = result;
+    stamped.timestamp = raceHistory.timestamp();
+
+    // Clients hear the result first, history is persisted afterwards
+    StaticJsonDocument<384> doc;
     doc["type"] = "race_complete";
-    doc["lane1"] = lane1;
-    doc["lane2"] = lane2;
-    doc["winner"] = (timeDiff <= 0.002) ? 0 : (lane1 < lane2 ? 1 : 2);
+    RaceHistory::toJson(stamped, doc.as<JsonObject>());
     
     broadcastJson(doc);
+    
+    raceHistory.addRace(stamped);
+}
+
+static size_t carStatsCapacity(int cars) {
+    return JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(CarStats::NUM_LANES) + JSON_ARRAY_SIZE(cars) +
+           cars * JSON_OBJECT_SIZE(9) + JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(2);
+}
+
+// The current estimate next to the correction actually being applied
+void WebServer::laneBiasToJson(JsonObject obj) {
+    LaneBiasEstimate estimate = carStats.laneBias();
+    obj["cars"] = estimate.cars;
+    obj["offset"] = estimate.offset;
+    obj["ci95"] = estimate.ci95;
+    obj["correction"] = config.getLaneCorrection();
+    float offset1, offset2;
+    config.getLaneOffsets(offset1, offset2);
+    JsonArray offsets = obj.createNestedArray("lane_offsets");
+    offsets.add(offset1);
+    offsets.add(offset2);
+}
+
+void WebServer::sendCarStats(AsyncWebSocketClient *client, int limit, uint16_t carId) {
+    DynamicJsonDocument statsDoc(carStatsCapacity(limit));
+    carStats.toJson(statsDoc, limit, carId);
+    laneBiasToJson(statsDoc.createNestedObject("lane_bias"));
+    String output;
+    serializeJson(statsDoc, output);
+    client->text(output);
+}
+
+// Pushes the leaderboard to every client, e.g. the projector after each heat
+void WebServer::notifyCarStats() {
+    DynamicJsonDocument statsDoc(carStatsCapacity(LEADERBOARD_SIZE));
+    carStats.toJson(statsDoc, LEADERBOARD_SIZE);
+    laneBiasToJson(statsDoc.createNestedObject("lane_bias"));
+    broadcastJson(statsDoc);
+}
+
+static size_t bracketCapacity() {
+    return JSON_OBJECT_SIZE(9) + JSON_OBJECT_SIZE(4) + JSON_ARRAY_SIZE(Bracket::STANDINGS_SIZE) +
+           Bracket::STANDINGS_SIZE * JSON_OBJECT_SIZE(5);
+}
+
+void WebServer::sendBracket(AsyncWebSocketClient *client) {
+    DynamicJsonDocument bracketDoc(bracketCapacity());
+    bracket.toJson(bracketDoc);
+    String output;
+    serializeJson(bracketDoc, output);
+    client->text(output);
+}
+
+void WebServer::notifyBracket() {
+    DynamicJsonDocument bracketDoc(bracketCapacity());
+    bracket.toJson(bracketDoc);
+    broadcastJson(bracketDoc);
+}
+
+// Assigns the next bracket heat to the lanes, so car statistics and the
+// bracket pick up the result, and pushes the matchup to the clients
+bool WebServer::armBracketHeat() {
+    if (!bracket.isActive()) return false;
+    uint16_t lane1Car, lane2Car;
+    if (bracket.nextHeat(lane1Car, lane2Car)) {
+        carStats.setLanes(lane1Car, lane2Car);
+    }
+    notifyBracket();
+    notifyCarStats();
+    return true;
 }
 
 void WebServer::broadcastJson(const JsonDocument& doc) {
@@ -321,7 +604,8 @@ void WebServer::broadcastJson(const JsonDocument& doc) {
         (DEBUG && (
             strcmp(type, "sensors") == 0 ||
             strcmp(type, "times") == 0 ||
-            strcmp(type, "network") == 0
+            strcmp(type, "network") == 0 ||
+            strcmp(type, "diagnostics") == 0
         ))
     )) {
         Serial.print("📣 Broadcasting: ");
@@ -344,13 +628,14 @@ void WebServer::setCommandHandler(CommandHandler handler) {
 }
 
 void WebServer::sendNetworkInfo(AsyncWebSocketClient *client) {
-    StaticJsonDocument<200> doc;
+    StaticJsonDocument<512> doc;
     doc["type"] = "network_status";
     doc["mode"] = networkManager.isAPMode() ? "AP" : "Station";
     doc["connected"] = networkManager.isConnected();
     doc["ssid"] = networkManager.getSSID();
     doc["ip"] = networkManager.getIP();
     doc["rssi"] = networkManager.getRSSI();
+    networkManager.statsToJson(doc.createNestedObject("link"));
     
     String output;
     serializeJson(doc, output);
@@ -358,13 +643,32 @@ void WebServer::sendNetworkInfo(AsyncWebSocketClient *client) {
 }
 
 void WebServer::notifyNetworkStatus() {
-    StaticJsonDocument<200> doc;
+    StaticJsonDocument<512> doc;
     doc["type"] = "network_status";
     doc["mode"] = networkManager.isAPMode() ? "AP" : "Station";
     doc["connected"] = networkManager.isConnected();
     doc["ssid"] = networkManager.getSSID();
     doc["ip"] = networkManager.getIP();
     doc["rssi"] = networkManager.getRSSI();
+    networkManager.statsToJson(doc.createNestedObject("link"));
     
     broadcastJson(doc);
 }
+
+void WebServer::updateWebSocketStats() {
+    size_t queued = 0;
+    for (auto client : clients) {
+        if (client->status() == WS_CONNECTED) {
+            queued += client->queueLen();
+        }
+    }
+    diagnostics.setWebSocketClients(ws.count());
+    diagnostics.reportQueueDepth("ws_tx", queued);
+}
+
+void WebServer::notifyDiagnostics() {
+    updateWebSocketStats();
+    StaticJsonDocument<1024> doc;
+    diagnostics.toJson(doc);
+    broadcastJson(doc);
+}
@@ -10,24 +10,51 @@
 #include "Version.h"
 #include "Configuration.h"
 #include "NetworkManager.h"
+#include "Diagnostics.h"
+#include "TimingStats.h"
+#include "CarStats.h"
+#include "Bracket.h"
+#include "ClockSync.h"
+#include "RaceLink.h"
 
 // Function pointer type for command handler
 typedef void (*CommandHandler)(const char* command);
 
 class WebServer {
 public:
-    WebServer(TimeManager& tm, Configuration& cfg, NetworkManager& nm);
+    WebServer(TimeManager& tm, Configuration& cfg, NetworkManager& nm, Diagnostics& diag, TimingStats& ts, CarStats& car, Bracket& br, ClockSync& cs);
     void begin();
     void handleWebSocketMessage(AsyncWebSocketClient *client, const char *data);
     void notifyStatus(const char* status);
     void notifySensorStates(bool sensor1, bool sensor2);
     void notifyTimes(float lane1, float lane2);
-    void notifyRaceComplete(float lane1, float lane2);
+    void notifyRaceComplete(const RaceResult& result);
+    void notifyCarStats();
+    // Puts the bracket's next heat on the lanes and tells every client;
+    // false when no bracket is running
+    bool armBracketHeat();
     void sendVersionInfo(AsyncWebSocketClient *client);
     void setCommandHandler(CommandHandler handler);
     void notifyNetworkStatus();
+    void notifyDiagnostics();
+    RaceHistory& getRaceHistory() { return raceHistory; }
     
 private:
+    static const int LEADERBOARD_SIZE = 20;     // Cars pushed after each race
+    static const int MAX_CAR_STATS_SENT = 64;   // Upper bound for get_car_stats
+    static const int MIN_LANE_BIAS_CARS = 3;    // Before a lane correction can be applied
+    // Largest incoming command: create_bracket with a full field of car numbers
+    static const size_t COMMAND_CAPACITY = JSON_OBJECT_SIZE(8) + JSON_ARRAY_SIZE(tournament::MAX_CARS) + 256;
+
+    // A precompressed file from the filesystem image, found once at boot
+    struct StaticAsset {
+        String url;
+        String path;               // The .gz file
+        String etag;               // From the gzip trailer: CRC-32 and size of the content
+        const char* contentType;
+        const char* cacheControl;
+    };
+
     AsyncWebServer server;
     TimeManager& timeManager;
     AsyncWebSocket ws;
@@ -36,10 +63,23 @@ private:
     RaceHistory raceHistory;  // Will be initialized in constructor
     Configuration& config;
     NetworkManager& networkManager;
+    Diagnostics& diagnostics;
+    TimingStats& timingStats;
+    CarStats& carStats;
+    Bracket& bracket;
+    ClockSync& clockSync;
+    std::vector<StaticAsset> staticAssets;
     void onWebSocketEvent(AsyncWebSocket *server, AsyncWebSocketClient *client,
                          AwsEventType type, void *arg, uint8_t *data, size_t len);
     void setupRoutes();
+    void loadStaticAssets(const char* dir);
+    void serveStaticAsset(AsyncWebServerRequest *request, const StaticAsset& asset);
     void broadcastJson(const JsonDocument& doc);
     void sendRaceHistory(AsyncWebSocketClient *client);
+    void sendCarStats(AsyncWebSocketClient *client, int limit, uint16_t carId = 0);
+    void laneBiasToJson(JsonObject obj);
+    void sendBracket(AsyncWebSocketClient *client);
+    void notifyBracket();
     void sendNetworkInfo(AsyncWebSocketClient *client);
+    void updateWebSocketStats();
 };
@@ -39,6 +39,16 @@ Web Interface:
 #include "Version.h"
 #include "TimeManager.h"
 #include "Configuration.h"
+#include "Diagnostics.h"
+#include "TimingStats.h"
+#include "CarStats.h"
+#include "Bracket.h"
+#include "StorageWriter.h"
+#include "ClockSync.h"
+#include "RaceLink.h"
+#include "RaceLinkNetTransport.h"
+#include <esp_timer.h>
+#include <TimingCore.h>
 #include "Debug.h"
 
 // Function prototypes
@@ -49,15 +59,32 @@ void declareWinner();
 void connectToWiFi();
 void handleWebSocketCommand(const char* command);
 bool initSDCard();
-bool writeRaceToSD(unsigned long car1Time, unsigned long car2Time, const char* winner);
+bool initSensors();
+void startServicesTask();
+void servicesTask(void* arg);
+void startServices();
+void resolveFinish();
+uint32_t correctLaneTime(uint32_t rawMs, float offsetSeconds);
+void beginLinkedRace(uint16_t raceId, int64_t startShared);
+void completeLinkedRace(const RaceResult& result);
+void logBootPhase(const char* phase, unsigned long phaseStart);
+bool sensorResponding(int lane);
+void recordLaneSample(int lane, uint32_t readyUs, uint32_t i2cUs);
+void armFinishLine(uint32_t raceStartUs);
 
 // Global instances
 TimeManager timeManager;
 Configuration config;
 NetworkManager networkManager(config);
-WebServer webServer(timeManager, config, networkManager);
-VL53L0X sensor1;
-VL53L0X sensor2;
+Diagnostics diagnostics;
+TimingStats timingStats;
+CarStats carStats;
+Bracket bracket;
+StorageWriter storageWriter;
+ClockSync clockSync(timeManager);
+RaceLinkNetTransport raceLinkTransport;
+RaceLink raceLink(raceLinkTransport);
+WebServer webServer(timeManager, config, networkManager, diagnostics, timingStats, carStats, bracket, clockSync);
 
 // Pin Definitions
 #define LOAD_BUTTON_PIN 4
@@ -71,6 +98,18 @@ VL53L0X sensor2;
 #define SD_CS 5
 #define BUZZER_PIN 33
 
+// VL53L0X sensors, one per lane, and the shared finish-line timing core.
+// The detection threshold is applied from config at each race start.
+const uint8_t SENSOR_XSHUT[2] = { XSHUT1, XSHUT2 };
+// GPIO1 (data ready) of each sensor, -1 if not wired. Wired, results are
+// stamped in the interrupt; otherwise from the ranging period.
+const int8_t SENSOR_GPIO1[2] = { -1, -1 };
+timingcore::VL53L0XLane laneSensors[2];
+timingcore::LaneCore<2, timingcore::VL53L0XLane> raceLanes(laneSensors, 0);
+
+// Settings changed together (e.g. a set_config for timing) are written once
+#define CONFIG_SAVE_DEBOUNCE_MS 500
+
 // RGB LED Pins
 const int LED_RED = 25;
 const int LED_GREEN = 26;
@@ -83,6 +122,10 @@ bool car1Finished = false;
 bool car2Finished = false;
 unsigned long car1Time = 0;
 unsigned long car2Time = 0;
+RaceResult raceResult;           // Raw and reported times of the race being finished
+int64_t raceStartShared = 0;     // Start and finish stamps in the clock-sync timebase (us)
+int64_t car1FinishShared = 0;
+int64_t car2FinishShared = 0;
 bool loadButtonPressed = false;
 bool loadButtonLastState = HIGH;
 bool carsLoaded = false;
@@ -90,6 +133,10 @@ bool startButtonPressed = false;
 bool startButtonLastState = HIGH;
 bool pauseUpdates = false;
 
+// Boot state: the race path is up first, network services follow in the background
+unsigned long bootStartMs = 0;
+volatile bool servicesReady = false;
+
 
 
 void handleWebSocketCommand(const char* command) {
@@ -119,102 +166,57 @@ bool initSDCard() {
     return true;
 }
 
-bool writeRaceToSD(unsigned long car1Time, unsigned long car2Time, const char* winner) {
-    // Create a JSON document for the race data
-    StaticJsonDocument<200> raceDoc;
-    raceDoc["timestamp"] = timeManager.getEpochTime();
-    raceDoc["car1_time"] = car1Time / 1000.0;
-    raceDoc["car2_time"] = car2Time / 1000.0;
-    raceDoc["winner"] = winner;
-    
-    // Get current date for filename
-    struct tm timeinfo;
-    if (!getLocalTime(&timeinfo)) {
-        Serial.println("❌ Failed to get local time");
-        return false;
-    }
-    
-    // Create filename in format YYYY-MM-DD.json
-    char dateStr[11];
-    strftime(dateStr, sizeof(dateStr), "%Y-%m-%d", &timeinfo);
-    String filename = "/race_history/" + String(dateStr) + ".json";
-    
-    // Open or create the daily file
-    File dailyFile = SD.open(filename, FILE_READ);
-    StaticJsonDocument<4096> dailyDoc;
-    
-    if (dailyFile) {
-        // File exists, read existing races
-        DeserializationError error = deserializeJson(dailyDoc, dailyFile);
-        dailyFile.close();
-        
-        if (error) {
-            Serial.println("❌ Failed to parse existing daily file, creating new one");
-            dailyDoc.clear();
-            dailyDoc.to<JsonArray>();
+void logBootPhase(const char* phase, unsigned long phaseStart) {
+    unsigned long now = millis();
+    Serial.printf("⏱ Boot %-10s %5lu ms (at %lu ms)\n", phase, now - phaseStart, now - bootStartMs);
+}
+
+bool initSensors() {
+    Serial.println("🔄 Starting VL53L0X sensors...");
+
+    timingcore::VL53L0XLane::beginAll(laneSensors, SENSOR_XSHUT, 2);
+    for (int n = 0; n < 2; n++) {
+        if (!laneSensors[n].isOk()) {
+            Serial.printf("❌ ERROR: Sensor %d not detected!\n", n + 1);
+            return false;
         }
-    } else {
-        // File doesn't exist, create new array
-        dailyDoc.to<JsonArray>();
+        Serial.printf("✔ Sensor %d initialized at 0x%02X.\n", n + 1, 0x30 + n);
     }
-    
-    // Add new race to the array
-    JsonArray races = dailyDoc.as<JsonArray>();
-    races.add(raceDoc);
-    
-    // Write updated file
-    dailyFile = SD.open(filename, FILE_WRITE);
-    if (!dailyFile) {
-        Serial.println("❌ Failed to open daily file for writing");
-        return false;
-    }
-    
-    if (serializeJson(dailyDoc, dailyFile) == 0) {
-        Serial.println("❌ Failed to write race data");
-        dailyFile.close();
-        return false;
+
+    for (int n = 0; n < 2; n++) {
+        laneSensors[n].start();
+        if (SENSOR_GPIO1[n] >= 0) {
+            laneSensors[n].attachReadyInterrupt(SENSOR_GPIO1[n]);
+        }
     }
-    
-    dailyFile.close();
-    Serial.println("✅ Race data saved to SD: " + filename);
+    timingcore::VL53L0XLane::onSample(recordLaneSample);
+    Serial.println("✔ Sensors are now active.");
     return true;
 }
 
 void setup() {
+    bootStartMs = millis();
     Serial.begin(115200);
     Serial.println("\n=== CO₂ Car Race Timer ===");
     Serial.printf("Version: %s (Built: %s)\n", "0.8.3", "08-04-2025");
     Serial.println("=========================");
     Serial.println("Initializing system...");
 
-    // Initialize LEDC for buzzer
-    ledcSetup(0, 2000, 8);  // Channel 0, 2000 Hz, 8-bit resolution
-    ledcAttachPin(BUZZER_PIN, 0);
+    // Start diagnostics first so a post-mortem from the previous run is kept
+    unsigned long phaseStart = millis();
+    diagnostics.begin();
+    CaptiveDNS::onTaskStarted([](const char* name, TaskHandle_t handle) {
+        diagnostics.registerTask(name, handle);
+    });
 
-    // Initialize network
-    networkManager.begin();
-    
-    // Initialize NTP if connected in station mode
-    if (networkManager.isConnected() && !networkManager.isAPMode()) {
-        Serial.print("🕒 Synchronizing NTP time");
-        timeManager.begin();
-    }
-    
-    // Initialize web server (this will mount LittleFS)
-    webServer.setCommandHandler(handleWebSocketCommand);
-    webServer.begin();
-    
-    // Initialize configuration (after LittleFS is mounted)
+    // Load configuration once, before anything reads it (NVS, no filesystem needed)
     config.begin();
+    logBootPhase("config", phaseStart);
 
-    // Initialize SPI for SD card
-    SPI.begin(SD_SCK, SD_MISO, SD_MOSI, SD_CS);
-    if (!initSDCard()) {
-        Serial.println("⚠️ System will continue without SD card logging");
-    }
-    
-    Wire.begin(21, 22);  // SDA = 21, SCL = 22
-    delay(100);
+    // GPIO and outputs
+    phaseStart = millis();
+    ledcSetup(0, 2000, 8);  // Channel 0, 2000 Hz, 8-bit resolution
+    ledcAttachPin(BUZZER_PIN, 0);
 
     pinMode(LED_RED, OUTPUT);
     pinMode(LED_GREEN, OUTPUT);
@@ -228,57 +230,120 @@ void setup() {
     pinMode(BUZZER_PIN, OUTPUT);
     digitalWrite(BUZZER_PIN, LOW);
 
-    pinMode(XSHUT1, OUTPUT);
-    pinMode(XSHUT2, OUTPUT);
     pinMode(LOAD_BUTTON_PIN, INPUT_PULLUP);
     pinMode(START_BUTTON_PIN, INPUT_PULLUP);
+    logBootPhase("gpio", phaseStart);
 
-    digitalWrite(XSHUT1, LOW);
-    digitalWrite(XSHUT2, LOW);
-    delay(10);
+    // Sensors
+    phaseStart = millis();
+    Wire.begin(21, 22);  // SDA = 21, SCL = 22
+    bool sensorsOk = initSensors();
+    logBootPhase("sensors", phaseStart);
+
+    // Hand all persistence to the background writer from here on
+    storageWriter.setSyncPolicy(config.getStorageSync() == SYNC_EACH_JOB ? SYNC_EACH_JOB : SYNC_BATCHED);
+    storageWriter.begin();
+    diagnostics.registerTask("storage", storageWriter.getTaskHandle());
+    storageWriter.registerTarget(STORAGE_HISTORY, []() { return webServer.getRaceHistory().persist(); });
+    storageWriter.registerTarget(STORAGE_CONFIG, []() { return config.persist(); });
+    webServer.getRaceHistory().setPersistHandler([]() { storageWriter.markDirty(STORAGE_HISTORY); });
+    config.setPersistHandler([]() { storageWriter.markDirty(STORAGE_CONFIG, CONFIG_SAVE_DEBOUNCE_MS); });
+    storageWriter.registerTarget(STORAGE_CAR_STATS, []() { return carStats.persist(); });
+    carStats.setPersistHandler([]() { storageWriter.markDirty(STORAGE_CAR_STATS); });
+    storageWriter.registerTarget(STORAGE_BRACKET, []() { return bracket.persist(); });
+    bracket.setPersistHandler([]() { storageWriter.markDirty(STORAGE_BRACKET); });
+
+    // Split start/finish units exchange events once the radio is up
+    raceLink.begin((RaceLinkRole)config.getRaceNodeRole(), ClockSync::generateNodeId(), esp_random());
+    raceLink.onStart(beginLinkedRace);
+    raceLink.onResult(completeLinkedRace);
+    if (raceLink.getRole() == RACE_LINK_START) {
+        Serial.println("🔗 Start node: finish times come from the finish node");
+    } else if (raceLink.getRole() == RACE_LINK_FINISH) {
+        Serial.println("🔗 Finish node: races are started from the start node");
+    }
 
-    Serial.println("🔄 Starting VL53L0X sensors...");
+    // SD, WiFi, SNTP and the web server come up in the background
+    startServicesTask();
 
-    digitalWrite(XSHUT1, HIGH);
-    delay(10);
-    if (sensor1.init()) {
-        sensor1.setAddress(0x30);
-        Serial.println("✔ Sensor 1 initialized at 0x30.");
-    } else {
-        Serial.println("❌ ERROR: Sensor 1 not detected!");
+    if (!sensorsOk) {
+        Serial.println("❌ Sensor initialization failed, races cannot be timed");
         return;
     }
 
-    digitalWrite(XSHUT2, HIGH);
-    delay(10);
-    if (sensor2.init()) {
-        sensor2.setAddress(0x31);
-        Serial.println("✔ Sensor 2 initialized at 0x31.");
+    logBootPhase("race-ready", bootStartMs);
+    Serial.println("\n✅ System Ready!");
+    Serial.println("Press 'L' via Serial or press the load button to load cars.");
+}
+
+void startServicesTask() {
+    // Core 0 alongside the WiFi stack, leaving core 1 to loop()
+    TaskHandle_t handle = nullptr;
+    if (xTaskCreatePinnedToCore(servicesTask, "boot_services", 10240, nullptr, 1, &handle, 0) != pdPASS) {
+        Serial.println("⚠ Failed to start services task, starting services inline");
+        startServices();
+    }
+}
+
+void servicesTask(void* arg) {
+    startServices();
+    vTaskDelete(nullptr);
+}
+
+void startServices() {
+    // Initialize SPI for SD card
+    unsigned long phaseStart = millis();
+    SPI.begin(SD_SCK, SD_MISO, SD_MOSI, SD_CS);
+    bool sdOk = initSDCard();
+    if (!sdOk) {
+        Serial.println("⚠️ System will continue without SD card logging");
     } else {
-        Serial.println("❌ ERROR: Sensor 2 not detected!");
-        return;
+        storageWriter.setSDAvailable(true);
+        if (diagnostics.hasPostMortem()) {
+            diagnostics.writePostMortem(SD);
+        }
     }
+    bracket.begin(sdOk);
+    logBootPhase("sd", phaseStart);
 
-    sensor1.startContinuous();
-    sensor2.startContinuous();
-    Serial.println("✔ Sensors are now active.");
+    // Start WiFi; the connection itself completes from WiFi events
+    phaseStart = millis();
+    networkManager.begin();
 
-    Serial.println("\n✅ System Ready!");
-    Serial.println("Press 'L' via Serial or press the load button to load cars.");
+    // SNTP runs in the background and syncs once the station has an IP
+    timeManager.begin(config.getTimezone().c_str());
+    clockSync.begin((ClockSyncRole)config.getClockSyncRole());
+    if (raceLink.getRole() != RACE_LINK_STANDALONE) {
+        raceLinkTransport.begin();
+    }
+    logBootPhase("network", phaseStart);
+
+    // Initialize web server (this will mount LittleFS and load race history)
+    phaseStart = millis();
+    webServer.setCommandHandler(handleWebSocketCommand);
+    webServer.begin();
+    webServer.armBracketHeat();
+    logBootPhase("webserver", phaseStart);
+
+    servicesReady = true;
+    logBootPhase("services", bootStartMs);
 }
 
 void loop() {
-    if (!pauseUpdates) {
+    unsigned long loopStart = micros();
+
+    if (!pauseUpdates && servicesReady) {
         networkManager.update();
         timeManager.update();
+        clockSync.update();
     }
     static unsigned long lastSensorCheck = 0;
     
     // Update sensor status every second when not racing
-    if (!pauseUpdates && millis() - lastSensorCheck > 1000) {
+    if (!pauseUpdates && servicesReady && millis() - lastSensorCheck > 1000) {
         lastSensorCheck = millis();
-        bool sensor1Ok = sensor1.readRangeContinuousMillimeters() != 65535;
-        bool sensor2Ok = sensor2.readRangeContinuousMillimeters() != 65535;
+        bool sensor1Ok = sensorResponding(0);
+        bool sensor2Ok = sensorResponding(1);
         webServer.notifySensorStates(sensor1Ok, sensor2Ok);
     }
 
@@ -334,24 +399,96 @@ void loop() {
         } else if (command == 'S' && !carsLoaded) {
             Serial.println("⚠ Please load the cars first by pressing 'L' or pressing the load button.");
         }
+
+        if (command == 'D') {
+            StaticJsonDocument<1024> diagDoc;
+            diagnostics.toJson(diagDoc);
+            serializeJson(diagDoc, Serial);
+            Serial.println();
+        }
     }
 
     // Update network status every 5 seconds when not racing
     static unsigned long lastNetworkCheck = 0;
-    if (!pauseUpdates && millis() - lastNetworkCheck >= 5000) {
+    if (!pauseUpdates && servicesReady && millis() - lastNetworkCheck >= 5000) {
         lastNetworkCheck = millis();
         webServer.notifyNetworkStatus();
     }
 
-    if (raceStarted) {
+    // Sample and publish diagnostics when not racing. Queue depths and
+    // counters are only gathered when a sample is due.
+    if (!pauseUpdates && diagnostics.isSampleDue()) {
+        const StorageStats& storageStats = storageWriter.getStats();
+        diagnostics.reportQueueDepth("storage", storageWriter.queueDepth());
+        diagnostics.reportCounter("sd_write_fail", storageStats.raceLogFailures);
+        diagnostics.reportCounter("sd_log_dropped", storageStats.raceLogsDropped);
+        diagnostics.reportCounter("history_write_fail", storageStats.targetFailures[STORAGE_HISTORY]);
+        diagnostics.reportCounter("config_write_fail", storageStats.targetFailures[STORAGE_CONFIG]);
+        diagnostics.reportCounter("stats_write_fail", storageStats.targetFailures[STORAGE_CAR_STATS]);
+        diagnostics.reportCounter("bracket_write_fail", storageStats.targetFailures[STORAGE_BRACKET]);
+        diagnostics.reportCounter("wifi_outages", networkManager.getStats().outages);
+        diagnostics.reportGauge("wifi_reconnect_ms", networkManager.getStats().lastReconnectMs);
+        diagnostics.reportCounter("dns_dropped", networkManager.getCaptiveDNS().getDropped());
+        if (raceLink.getRole() != RACE_LINK_STANDALONE) {
+            diagnostics.reportCounter("link_retransmits", raceLink.getStats().retransmits);
+            diagnostics.reportCounter("link_lost", raceLink.getStats().lost);
+            diagnostics.reportCounter("link_timeouts", raceLink.getStats().timeouts);
+        }
+
+        diagnostics.update();
+        if (servicesReady) {
+            webServer.notifyDiagnostics();
+        }
+    }
+
+    // Runs while racing too: start and finish events must not wait
+    raceLink.update(esp_timer_get_time());
+
+    // A start node has no sensors, its finishes arrive over the race link
+    if (raceStarted && raceLink.getRole() != RACE_LINK_START) {
         checkFinish();
     }
+
+    diagnostics.recordLoopTime(micros() - loopStart);
+}
+
+// Every sensor result. Only those collected while racing go into the
+// timing statistics.
+void recordLaneSample(int lane, uint32_t readyUs, uint32_t i2cUs) {
+    if (raceStarted) {
+        timingStats.recordSample(lane, readyUs, i2cUs);
+    }
+    diagnostics.recordI2CRead(lane, i2cUs);
+}
+
+// Starts the timing core on a race that began at raceStartUs (micros())
+void armFinishLine(uint32_t raceStartUs) {
+    timingcore::DetectionFilter filter = timingcore::DetectionFilter::below(config.getSensorThreshold());
+    raceLanes.setFilter(0, filter);
+    raceLanes.setFilter(1, filter);
+    raceLanes.start(raceStartUs);
+}
+
+// Collects a lane's latest result outside a race. Goes through the lane's
+// poll like the timing core does, so the data-ready stamp the next race
+// starts from is not left stale. True if the sensor produced a result
+// within the lane timeout.
+bool sensorResponding(int lane) {
+    uint16_t distance;
+    uint32_t captureUs;
+    laneSensors[lane].poll(distance, captureUs);
+    return micros() - laneSensors[lane].getLastSampleUs() <= timingcore::VL53L0XLane::TIMEOUT_US;
 }
 
 void startRace() {
     if (!carsLoaded || raceStarted) return;
+    if (raceLink.getRole() == RACE_LINK_FINISH) {
+        Serial.println("⚠ This is a finish node, start the race from the start gate.");
+        return;
+    }
 
     pauseUpdates = true; // Pause network and time manager updates during race timing
+    storageWriter.setHold(true);  // No flash or SD writes while timing
     raceStarted = true;
     Serial.println("\n🚦 Race Starting...");
     Serial.println("📍 Firing CO₂ Relay...");
@@ -373,7 +510,14 @@ void startRace() {
     car2Finished = false;
     car1Time = 0;
     car2Time = 0;
+    timingStats.beginRace();
     startTime = millis();
+    armFinishLine(micros());
+    raceStartShared = clockSync.sharedMicros();
+    car1FinishShared = car2FinishShared = 0;
+    if (raceLink.getRole() == RACE_LINK_START) {
+        raceLink.recordStart(raceStartShared, esp_timer_get_time());
+    }
     
     // Update web interface
     webServer.notifyTimes(0, 0);
@@ -386,72 +530,133 @@ void startRace() {
 void checkFinish() {
     if (!raceStarted) return;
     
-    // Read both sensors first to get readings as close together as possible
-    int dist1 = sensor1.readRangeContinuousMillimeters();
-    int dist2 = sensor2.readRangeContinuousMillimeters();
-    unsigned long currentTime = millis();
-    bool finishedThisCheck = false;
+    // One pass over both lanes; each finish is timed from the sample that
+    // saw it, so simultaneous crossings need no special handling
+    timingcore::StepResult step = raceLanes.step();
+    if (!step.finished) return;
     
-    // Check both sensors before updating times to handle simultaneous finishes
-    bool car1CrossedLine = !car1Finished && dist1 < config.getSensorThreshold();
-    bool car2CrossedLine = !car2Finished && dist2 < config.getSensorThreshold();
-    
-    // If both cars cross the line within the tie threshold window, consider it simultaneous
-    if (car1CrossedLine && car2CrossedLine) {
-        car1Time = currentTime - startTime;
-        car2Time = currentTime - startTime;
-        car1Finished = car2Finished = true;
-        finishedThisCheck = true;
-        
-        Serial.println("🏁 Both cars finished simultaneously!");
+    unsigned long detectedUs = micros();
+    if (step.finished & 0x01) {
+        timingStats.recordDetection(0, detectedUs);
+        car1FinishShared = clockSync.sharedMicros();
+        raceLink.recordFinish(0, car1FinishShared, esp_timer_get_time());
+        car1Time = raceLanes.result(0).time / 1000;
+        car1Finished = true;
         Serial.printf("🏁 Car 1 Raw Time: %lu ms\n", car1Time);
+    }
+    if (step.finished & 0x02) {
+        timingStats.recordDetection(1, detectedUs);
+        car2FinishShared = clockSync.sharedMicros();
+        raceLink.recordFinish(1, car2FinishShared, esp_timer_get_time());
+        car2Time = raceLanes.result(1).time / 1000;
+        car2Finished = true;
         Serial.printf("🏁 Car 2 Raw Time: %lu ms\n", car2Time);
-    } else {
-        // Handle individual finishes
-        if (car1CrossedLine) {
-            car1Time = currentTime - startTime;
-            car1Finished = true;
-            finishedThisCheck = true;
-            Serial.printf("🏁 Car 1 Raw Time: %lu ms\n", car1Time);
-            
-            // If car 2 already finished, check for tie based on threshold
-            if (car2Finished) {
-                int timeDiff = abs((int)car1Time - (int)car2Time);
-                if (timeDiff <= (config.getTieThreshold() * 1000)) {
-                    // For ties, use the average of both times
-                    unsigned long avgTime = (car1Time + car2Time) / 2;
-                    car1Time = car2Time = avgTime;
-                    Serial.printf("⚖️ Times within %d ms threshold - Car1: %lu ms, Car2: %lu ms\n", config.getTieThreshold() * 1000, car1Time, car2Time);
-                    Serial.printf("Adjusted to tie time: %lu ms\n", avgTime);
-                }
-            }
-        }
-        
-        if (car2CrossedLine) {
-            car2Time = currentTime - startTime;
-            car2Finished = true;
-            finishedThisCheck = true;
-            Serial.printf("🏁 Car 2 Raw Time: %lu ms\n", car2Time);
-            
-            // If car 1 already finished, check for tie based on threshold
-            if (car1Finished) {
-                int timeDiff = abs((int)car1Time - (int)car2Time);
-                if (timeDiff <= (config.getTieThreshold() * 1000)) {
-                    // For ties, use the average of both times
-                    unsigned long avgTime = (car1Time + car2Time) / 2;
-                    car1Time = car2Time = avgTime;
-                    Serial.printf("⚖️ Times within %d ms threshold - Car1: %lu ms, Car2: %lu ms\n", config.getTieThreshold() * 1000, car1Time, car2Time);
-                    Serial.printf("Adjusted to tie time: %lu ms\n", avgTime);
-                }
-            }
-        }
     }
     
     if (car1Finished && car2Finished) {
-        // Send final times and declare winner
-        webServer.notifyTimes(car1Time / 1000.0, car2Time / 1000.0);
-        declareWinner();
+        resolveFinish();
+        
+        // A finish node waits for the joined result, timed against the start node's edge
+        if (raceLink.getRole() == RACE_LINK_STANDALONE) {
+            webServer.notifyTimes(car1Time / 1000.0, car2Time / 1000.0);
+            declareWinner();
+        }
+    }
+}
+
+// Removes a lane's systematic offset from its raw time in ms
+uint32_t correctLaneTime(uint32_t rawMs, float offsetSeconds) {
+    if (rawMs == 0) return rawMs;
+    int32_t corrected = (int32_t)rawMs - lroundf(offsetSeconds * 1000);
+    return corrected > 0 ? corrected : 1;  // Still a finish
+}
+
+// The one place ties are decided: remove the lane offset from the raw times
+// and apply the configured tie policy once both lanes are in.
+// car1Time/car2Time become the reported times.
+void resolveFinish() {
+    float offset1 = 0, offset2 = 0;
+    if (config.getLaneCorrection()) {
+        config.getLaneOffsets(offset1, offset2);
+    }
+    uint32_t corrected1 = correctLaneTime(car1Time, offset1);
+    uint32_t corrected2 = correctLaneTime(car2Time, offset2);
+    timingcore::TiePolicy policy = { (uint8_t)config.getTieMode(),
+                                     (uint32_t)lroundf(config.getTieThreshold() * 1000) };
+    timingcore::TieDecision decision = policy.apply(corrected1, corrected2);
+
+    raceResult.timestamp = 0;  // Stamped when the race is stored
+    raceResult.lane1Raw = car1Time / 1000.0f;
+    raceResult.lane2Raw = car2Time / 1000.0f;
+    raceResult.lane1Corrected = decision.raw[0] / 1000.0f;
+    raceResult.lane2Corrected = decision.raw[1] / 1000.0f;
+    raceResult.lane1Time = decision.time[0] / 1000.0f;
+    raceResult.lane2Time = decision.time[1] / 1000.0f;
+    raceResult.winner = decision.winner;
+    raceResult.margin = decision.margin / 1000.0f;
+    raceResult.confidence = decision.confidence;
+
+    if (corrected1 != car1Time || corrected2 != car2Time) {
+        Serial.printf("📐 Lane corrected - Car1: %lu ms, Car2: %lu ms\n",
+                      (unsigned long)corrected1, (unsigned long)corrected2);
+    }
+    if (decision.time[0] != decision.raw[0] || decision.time[1] != decision.raw[1]) {
+        Serial.printf("⚖️ Times within %lu ms threshold - Car1: %lu ms, Car2: %lu ms\n",
+                      (unsigned long)policy.threshold, (unsigned long)corrected1,
+                      (unsigned long)corrected2);
+        Serial.printf("Adjusted to tie time: %lu ms\n", (unsigned long)decision.time[0]);
+    } else if (policy.mode == timingcore::TIE_MARGIN && decision.winner != timingcore::WINNER_TIE) {
+        Serial.printf("⚖️ Margin %lu ms, %u%% confidence\n",
+                      (unsigned long)decision.margin, decision.confidence);
+    }
+    car1Time = decision.time[0];
+    car2Time = decision.time[1];
+}
+
+// Finish node: the start gate fired, time the lanes against its edge
+void beginLinkedRace(uint16_t raceId, int64_t startShared) {
+    if (raceStarted) {
+        Serial.println("⚠ New start received while racing, restarting timing");
     }
+    pauseUpdates = true;
+    storageWriter.setHold(true);
+    raceStarted = true;
+    carsLoaded = false;
+    car1Finished = false;
+    car2Finished = false;
+    car1Time = 0;
+    car2Time = 0;
+    raceStartShared = startShared;
+    car1FinishShared = car2FinishShared = 0;
+
+    // Line local millis() up with the start edge so live times match
+    int64_t elapsedUs = clockSync.sharedMicros() - startShared;
+    if (elapsedUs < 0) elapsedUs = 0;
+    startTime = millis() - (unsigned long)(elapsedUs / 1000);
+    timingStats.beginRace();
+    armFinishLine(micros() - (uint32_t)elapsedUs);
+
+    setLEDState("racing");
+    webServer.notifyTimes(0, 0);
+    Serial.printf("🔗 Race %u started by the start node\n", raceId);
+}
+
+// Start or finish node: both finishes and the start are known, or the race
+// timed out and the lanes that never finished are DNFs (time 0)
+void completeLinkedRace(const RaceResult& result) {
+    if (!raceStarted) return;
+
+    car1Time = lroundf(result.lane1Time * 1000);
+    car2Time = lroundf(result.lane2Time * 1000);
+    car1Finished = car2Finished = true;
+    if (car1Time == 0) Serial.println("⏱ Car 1 did not finish before the race timed out");
+    if (car2Time == 0) Serial.println("⏱ Car 2 did not finish before the race timed out");
+    Serial.printf("🔗 Joined result: C1=%lu ms, C2=%lu ms%s\n", car1Time, car2Time,
+                  clockSync.isLocked() ? "" : " (clock sync not locked)");
+    resolveFinish();
+
+    webServer.notifyTimes(car1Time / 1000.0, car2Time / 1000.0);
+    declareWinner();
 }
 
 void declareWinner() {
@@ -462,22 +667,27 @@ void declareWinner() {
     delay(500);
     ledcWrite(0, 0);
 
-    // Times have already been adjusted for ties in checkFinish()
-    // Just determine the winner based on final times
-    const char* winner;
-    if (car1Time == car2Time) {
+    // The winner was decided with the times in resolveFinish()
+    if (raceResult.winner == timingcore::WINNER_TIE) {
         Serial.println("🤝 It's a tie!");
-        winner = "tie";
-    } else if (car1Time < car2Time) {
+    } else if (raceResult.winner == timingcore::WINNER_LANE1) {
         Serial.println("🏆 Car 1 Wins!");
-        winner = "car1";
     } else {
         Serial.println("🏆 Car 2 Wins!");
-        winner = "car2";
     }
     
-    // Save race data to SD card
-    writeRaceToSD(car1Time, car2Time, winner);
+    // Broadcast the result first, storage happens in the background
+    webServer.notifyRaceComplete(raceResult);
+    uint16_t lane1Car = carStats.getLaneCar(0);
+    uint16_t lane2Car = carStats.getLaneCar(1);
+    bool statsRecorded = carStats.recordRace(raceResult);
+    bracket.recordRace(raceResult, lane1Car, lane2Car);
+    // Recording cleared the lanes; a running bracket puts its next heat back on them
+    if (!webServer.armBracketHeat() && statsRecorded) {
+        webServer.notifyCarStats();
+    }
+    storageWriter.enqueueRaceLog(timeManager.getEpochTime(), raceResult);
+    storageWriter.setHold(false);
 
     Serial.print("📊 RESULT: C1=");
     Serial.print(car1Time);
@@ -485,8 +695,11 @@ void declareWinner() {
     Serial.print(car2Time);
     Serial.println("ms");
 
-    // Notify race completion to save to history
-    webServer.notifyRaceComplete(car1Time / 1000.0, car2Time / 1000.0);
+    if (clockSync.getRole() != CLOCK_SYNC_OFF) {
+        Serial.printf("🕒 Shared timebase%s: start=%lld us, C1=%lld us, C2=%lld us\n",
+                      clockSync.isLocked() ? "" : " (unlocked)", (long long)raceStartShared,
+                      (long long)car1FinishShared, (long long)car2FinishShared);
+    }
 
     Serial.println("\n🔄 Getting ready for next race...");
     delay(2000);
@@ -0,0 +1,330 @@
+// Plays tournaments through BracketEngine the way Bracket does on the timer:
+// ask for the current heat, race it, record the result.
+//
+// Races are decided by a fixed rule so every bracket plays out the same
+// way: the lower entrant index (the higher seed) wins, except where a test
+// forces the other lane or a tie.
+//
+// Checks advancement through single elimination, double elimination and
+// round robin, byes for fields that are not a power of two, an elimination
+// tie being raced again, the grand final reset, remainingHeats() against
+// the heats actually run, and restore() turning away inconsistent states.
+
+#include <stdio.h>
+#include <string.h>
+#include "BracketEngine.h"
+
+using namespace tournament;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            failures++;                                                     \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                    \
+    do {                                                                              \
+        long long a_ = (long long)(actual), e_ = (long long)(expected);               \
+        if (a_ != e_) {                                                               \
+            failures++;                                                               \
+            printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, \
+                   a_, e_);                                                           \
+        }                                                                             \
+    } while (0)
+
+static const uint16_t CAR_IDS[] = {101, 102, 103, 104, 105, 106, 107, 108};
+
+// ---------------------------------------------------------------------------
+
+// Lane that wins when the higher seed takes the heat
+static uint8_t seedWins(const Heat& heat) {
+    return heat.entrant[0] < heat.entrant[1] ? 1 : 2;
+}
+
+// Races the current heat with the given winning lane (0 for a tie)
+static bool race(BracketEngine& engine, uint8_t winnerLane, Heat* raced = NULL) {
+    Heat heat;
+    if (!engine.currentHeat(heat)) return false;
+    if (raced) *raced = heat;
+    float lane1 = winnerLane == 2 ? 2.2f : 2.0f;
+    float lane2 = winnerLane == 1 ? 2.2f : 2.0f;
+    return engine.recordResult(heat, winnerLane, lane1, lane2);
+}
+
+// Runs the bracket to the end with the higher seed winning every heat,
+// checking remainingHeats() before each one. Returns the heats run.
+static int playOut(BracketEngine& engine) {
+    int heats = 0;
+    Heat heat;
+    while (engine.currentHeat(heat)) {
+        uint32_t remaining = engine.remainingHeats();
+        CHECK(remaining > 0);
+        CHECK(engine.recordResult(heat, seedWins(heat), 2.0f, 2.0f));
+        CHECK(engine.isFinished() ? engine.remainingHeats() == 0
+                                  : engine.remainingHeats() == remaining - 1);
+        heats++;
+    }
+    return heats;
+}
+
+static uint16_t championCar(const BracketEngine& engine) {
+    return engine.getState().entrants[engine.getState().champion].carId;
+}
+
+// ---------------------------------------------------------------------------
+
+static void testCreate() {
+    BracketEngine engine;
+    const uint16_t repeated[] = {101, 102, 101};
+    const uint16_t zero[] = {101, 0};
+
+    CHECK(!engine.isActive());
+    CHECK(!engine.create(FORMAT_SINGLE_ELIMINATION, CAR_IDS, 1));
+    CHECK(!engine.create(FORMAT_DOUBLE_ELIMINATION, repeated, 3));
+    CHECK(!engine.create(FORMAT_ROUND_ROBIN, zero, 2));
+    CHECK(!engine.create(FORMAT_NONE, CAR_IDS, 4));
+    CHECK(!engine.isActive());
+    CHECK_EQ(engine.remainingHeats(), 0);
+
+    CHECK(engine.create(FORMAT_SINGLE_ELIMINATION, CAR_IDS, 2));
+    CHECK(engine.isActive());
+    CHECK_EQ(engine.remainingHeats(), 1);
+    engine.clear();
+    CHECK(!engine.isActive());
+}
+
+// 5 cars in a bracket of 8: the top three seeds have byes
+static void testSingleEliminationByes() {
+    BracketEngine engine;
+    CHECK(engine.create(FORMAT_SINGLE_ELIMINATION, CAR_IDS, 5));
+    CHECK_EQ(engine.getState().matchCount, 7);
+
+    // Only seeds 4 and 5 race in the first round
+    Heat heat;
+    CHECK(engine.currentHeat(heat));
+    CHECK_EQ(heat.entrant[0], 3);
+    CHECK_EQ(heat.entrant[1], 4);
+    CHECK_EQ(heat.side, SIDE_WINNERS);
+    CHECK_EQ(heat.round, 0);
+    CHECK_EQ(engine.remainingHeats(), 4);
+
+    // A stale heat is turned away
+    Heat stale = heat;
+    stale.entrant[1] = 2;
+    CHECK(!engine.recordResult(stale, 1, 2.0f, 2.1f));
+    CHECK_EQ(engine.getState().heatsRun, 0);
+
+    // The winner meets the top seed in the semi-final
+    CHECK(race(engine, 2));
+    CHECK(engine.currentHeat(heat));
+    CHECK_EQ(heat.entrant[0], 0);
+    CHECK_EQ(heat.entrant[1], 4);
+    CHECK_EQ(heat.round, 1);
+
+    CHECK_EQ(playOut(engine), 3);
+    CHECK(engine.isFinished());
+    CHECK_EQ(championCar(engine), 101);
+    CHECK_EQ(engine.getState().heatsRun, 4);
+    CHECK(!engine.currentHeat(heat));
+    CHECK(!race(engine, 1));
+}
+
+// A tied elimination heat is raced again by the same cars
+static void testEliminationTieRerun() {
+    BracketEngine engine;
+    CHECK(engine.create(FORMAT_SINGLE_ELIMINATION, CAR_IDS, 4));
+
+    Heat before, after;
+    CHECK(race(engine, 0, &before));
+    CHECK(engine.currentHeat(after));
+    CHECK_EQ(after.id, before.id);
+    CHECK_EQ(after.entrant[0], before.entrant[0]);
+    CHECK_EQ(after.entrant[1], before.entrant[1]);
+    CHECK_EQ(engine.getState().entrants[before.entrant[0]].ties, 1);
+    CHECK_EQ(engine.getState().entrants[before.entrant[1]].ties, 1);
+    CHECK_EQ(engine.getState().heatsRun, 1);
+    CHECK_EQ(engine.remainingHeats(), 3);
+
+    // Both finishes of the tie count towards the cars' averages
+    CHECK_EQ(engine.getState().entrants[before.entrant[0]].finishes, 1);
+
+    CHECK(race(engine, 1));
+    CHECK(engine.currentHeat(after));
+    CHECK(after.id != before.id);
+    CHECK_EQ(engine.remainingHeats(), 2);
+}
+
+// 4 cars: the losers' champion wins the grand final, which forces a reset
+static void testDoubleEliminationReset() {
+    BracketEngine engine;
+    CHECK(engine.create(FORMAT_DOUBLE_ELIMINATION, CAR_IDS, 4));
+    CHECK_EQ(engine.getState().matchCount, 7);
+    // 3 winners' matches, 2 losers' matches and the grand final; the reset
+    // is not counted until it is needed
+    CHECK_EQ(engine.remainingHeats(), 6);
+
+    Heat heat;
+    int losersHeats = 0;
+    while (engine.currentHeat(heat) && heat.side != SIDE_FINAL) {
+        if (heat.side == SIDE_LOSERS) losersHeats++;
+        CHECK(race(engine, seedWins(heat)));
+    }
+    CHECK_EQ(losersHeats, 2);
+
+    // Unbeaten seed 1 against seed 2, who lost only to seed 1
+    CHECK(engine.currentHeat(heat));
+    CHECK_EQ(heat.side, SIDE_FINAL);
+    CHECK_EQ(heat.round, 0);
+    CHECK_EQ(heat.entrant[0], 0);
+    CHECK_EQ(heat.entrant[1], 1);
+    CHECK_EQ(engine.remainingHeats(), 1);
+
+    CHECK(race(engine, 2));
+    CHECK(!engine.isFinished());
+    CHECK(engine.currentHeat(heat));
+    CHECK_EQ(heat.side, SIDE_FINAL);
+    CHECK_EQ(heat.round, 1);
+    CHECK_EQ(engine.remainingHeats(), 1);
+    CHECK_EQ(engine.getState().entrants[0].losses, 1);
+
+    // Seed 2 wins the reset too, handing seed 1 a second loss
+    CHECK(race(engine, heat.entrant[0] == 1 ? 1 : 2));
+    CHECK(engine.isFinished());
+    CHECK_EQ(championCar(engine), 102);
+    CHECK_EQ(engine.getState().entrants[0].losses, 2);
+    CHECK_EQ(engine.getState().heatsRun, 7);
+    CHECK_EQ(engine.remainingHeats(), 0);
+}
+
+// The unbeaten car winning the grand final ends it without a reset
+static void testDoubleEliminationNoReset() {
+    BracketEngine engine;
+    CHECK(engine.create(FORMAT_DOUBLE_ELIMINATION, CAR_IDS, 8));
+    CHECK_EQ(playOut(engine), 14);
+    CHECK(engine.isFinished());
+    CHECK_EQ(championCar(engine), 101);
+    CHECK_EQ(engine.getState().entrants[0].losses, 0);
+
+    // Every car but the champion was knocked out by two losses
+    for (uint16_t i = 1; i < 8; i++) {
+        CHECK_EQ(engine.getState().entrants[i].losses, 2);
+    }
+}
+
+// 3 cars in a bracket of 4: seed 1 has a bye, and so does the losers'
+// bracket slot its bye would have dropped into
+static void testDoubleEliminationByes() {
+    BracketEngine engine;
+    CHECK(engine.create(FORMAT_DOUBLE_ELIMINATION, CAR_IDS, 3));
+    CHECK_EQ(engine.remainingHeats(), 4);
+
+    Heat heat;
+    CHECK(engine.currentHeat(heat));
+    CHECK_EQ(heat.entrant[0], 1);
+    CHECK_EQ(heat.entrant[1], 2);
+
+    CHECK_EQ(playOut(engine), 4);
+    CHECK(engine.isFinished());
+    CHECK_EQ(championCar(engine), 101);
+    CHECK_EQ(engine.getState().entrants[0].wins, 2);
+    CHECK_EQ(engine.getState().entrants[2].losses, 2);
+}
+
+// Every pairing races once in each lane; an odd field skips the bye pairings
+static void testRoundRobin(uint16_t cars) {
+    BracketEngine engine;
+    CHECK(engine.create(FORMAT_ROUND_ROBIN, CAR_IDS, cars));
+    uint32_t pairings = (uint32_t)cars * (cars - 1);
+    CHECK_EQ(engine.remainingHeats(), pairings);
+
+    bool raced[8][8];
+    memset(raced, 0, sizeof(raced));
+    Heat heat;
+    uint32_t heats = 0;
+    while (engine.currentHeat(heat)) {
+        CHECK_EQ(heat.side, SIDE_ROUND_ROBIN);
+        CHECK(heat.entrant[0] < cars && heat.entrant[1] < cars);
+        CHECK(heat.entrant[0] != heat.entrant[1]);
+        CHECK(!raced[heat.entrant[0]][heat.entrant[1]]);
+        raced[heat.entrant[0]][heat.entrant[1]] = true;
+
+        // A tie still completes a round-robin heat
+        uint8_t winner = heats == 0 ? 0 : seedWins(heat);
+        CHECK(engine.recordResult(heat, winner, 2.0f, 2.0f));
+        heats++;
+        CHECK_EQ(engine.remainingHeats(), pairings - heats);
+    }
+    CHECK_EQ(heats, pairings);
+    CHECK(engine.isFinished());
+    CHECK_EQ(championCar(engine), 101);
+
+    // Standings follow the seeds, each car beating everyone below it twice
+    uint16_t order[8];
+    CHECK_EQ(engine.standings(order, 8), cars);
+    for (uint16_t i = 0; i < cars; i++) {
+        CHECK_EQ(order[i], i);
+    }
+    CHECK_EQ(engine.standings(order, 2), 2);
+}
+
+static State savedState;
+static State badState;
+
+static void testRestore() {
+    BracketEngine engine;
+    CHECK(engine.create(FORMAT_DOUBLE_ELIMINATION, CAR_IDS, 6));
+    CHECK(race(engine, 1));
+    CHECK(race(engine, 2));
+    memcpy(&savedState, &engine.getState(), sizeof(State));
+
+    // A consistent state resumes where it left off
+    BracketEngine resumed;
+    CHECK(resumed.restore(savedState));
+    Heat expected, heat;
+    CHECK(engine.currentHeat(expected));
+    CHECK(resumed.currentHeat(heat));
+    CHECK_EQ(heat.id, expected.id);
+    CHECK_EQ(heat.entrant[0], expected.entrant[0]);
+    CHECK_EQ(heat.entrant[1], expected.entrant[1]);
+    CHECK_EQ(resumed.remainingHeats(), engine.remainingHeats());
+    CHECK_EQ(playOut(resumed), playOut(engine));
+    CHECK_EQ(championCar(resumed), championCar(engine));
+
+    // Each of these is rejected and leaves the engine as it was
+    BracketEngine target;
+    for (int fault = 0; fault < 7; fault++) {
+        memcpy(&badState, &savedState, sizeof(State));
+        switch (fault) {
+            case 0: badState.format = FORMAT_NONE; break;
+            case 1: badState.format = 9; break;
+            case 2: badState.carCount = 1; break;
+            case 3: badState.matches[0].slot[1] = badState.carCount; break;
+            case 4: badState.matches[0].next = badState.matchCount; break;
+            case 5: badState.matches[1].loserSlot = 2; break;
+            case 6: badState.finished = 1; badState.champion = badState.carCount; break;
+        }
+        CHECK(!target.restore(badState));
+        CHECK(!target.isActive());
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+int main() {
+    testCreate();
+    testSingleEliminationByes();
+    testEliminationTieRerun();
+    testDoubleEliminationReset();
+    testDoubleEliminationNoReset();
+    testDoubleEliminationByes();
+    testRoundRobin(3);
+    testRoundRobin(4);
+    testRestore();
+
+    printf("%s\n", failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
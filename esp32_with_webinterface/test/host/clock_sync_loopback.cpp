@@ -0,0 +1,226 @@
+// Runs a master and a slave ClockSyncEngine against each other over UDP on
+// 127.0.0.1, the same exchange the timers run over WiFi.
+//
+// The slave's clock is offset from the master's by CLOCK_OFFSET_US. Every
+// packet is held for PATH_DELAY_US plus up to PATH_JITTER_US before it is
+// sent, and every fifth one is also held behind QUEUE_DELAY_US of simulated
+// queuing, so the engine has slow exchanges to filter out.
+//
+// Checks that the slave finds the master, locks after MIN_SAMPLES_FOR_LOCK
+// exchanges, recovers the injected offset and path delay, reports jitter in
+// the range the injected noise produces, and unlocks when the master goes
+// quiet.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <deque>
+#include "ClockSyncEngine.h"
+
+static const int64_t CLOCK_OFFSET_US = 7340123;    // Master clock minus slave clock
+static const int64_t PATH_DELAY_US = 2000;          // One-way delay, both directions
+static const int64_t PATH_JITTER_US = 300;
+static const int64_t QUEUE_DELAY_US = 6000;
+static const int QUEUE_EVERY = 5;
+static const int64_t RUN_US = 4000000;
+
+static const int64_t OFFSET_TOLERANCE_US = 500;
+static const int64_t DELAY_TOLERANCE_US = 500;
+static const int64_t MAX_JITTER_US = 2000;
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            failures++;                                                     \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        }                                                                   \
+    } while (0)
+
+// ---------------------------------------------------------------------------
+
+static int64_t monotonicUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// The two units' monotonic clocks
+static int64_t masterNow() { return monotonicUs() + 1000000000LL; }
+static int64_t slaveNow() { return masterNow() - CLOCK_OFFSET_US; }
+
+static int64_t llabs64(int64_t v) { return v < 0 ? -v : v; }
+
+// One unit: its engine, its UDP socket and its clock
+struct Node {
+    const char* name;
+    ClockSyncEngine engine;
+    int64_t (*now)();
+    int fd;
+    sockaddr_in addr;
+
+    Node(const char* name, uint32_t nodeId, int64_t (*now)())
+        : name(name), engine(nodeId), now(now), fd(-1) {}
+
+    bool open() {
+        fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) return false;
+
+        addr.sin_family = AF_INET;
+        addr.sin_port = 0;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        return bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0 &&
+               getsockname(fd, (sockaddr*)&addr, &len) == 0;
+    }
+};
+
+// Packets waiting out their injected delay before they are sent
+struct Delayed {
+    int64_t sendAtUs;       // On the real clock
+    const Node* from;
+    const Node* to;
+    clocksync::Packet packet;
+};
+
+static std::deque<Delayed> inFlight;
+static int packetsSent = 0;
+static bool linkUp = true;
+
+static void transmit(const Node& from, const Node& to, const uint8_t* data, size_t length) {
+    if (!linkUp || length != sizeof(clocksync::Packet)) return;
+
+    int64_t delay = PATH_DELAY_US + rand() % (PATH_JITTER_US + 1);
+    if (++packetsSent % QUEUE_EVERY == 0) delay += QUEUE_DELAY_US;
+
+    Delayed d;
+    d.sendAtUs = monotonicUs() + delay;
+    d.from = &from;
+    d.to = &to;
+    memcpy(&d.packet, data, length);
+    inFlight.push_back(d);
+}
+
+// Sends everything that has waited long enough. Returns how long until the
+// next packet is due, at most maxWaitUs.
+static int64_t release(int64_t maxWaitUs) {
+    int64_t now = monotonicUs();
+    int64_t waitUs = maxWaitUs;
+    for (std::deque<Delayed>::iterator it = inFlight.begin(); it != inFlight.end();) {
+        if (it->sendAtUs > now) {
+            if (it->sendAtUs - now < waitUs) waitUs = it->sendAtUs - now;
+            ++it;
+            continue;
+        }
+        sendto(it->from->fd, &it->packet, sizeof(it->packet), 0,
+               (const sockaddr*)&it->to->addr, sizeof(it->to->addr));
+        it = inFlight.erase(it);
+    }
+    return waitUs;
+}
+
+// Reads one datagram if there is one and hands it to the node's engine,
+// sending any reply back through the delay line
+static void receive(Node& node, Node& peer) {
+    uint8_t data[64];
+    ssize_t length = recv(node.fd, data, sizeof(data), MSG_DONTWAIT);
+    if (length <= 0) return;
+
+    int64_t rxUs = node.now();
+    uint8_t reply[sizeof(clocksync::Packet)];
+    size_t replyLength = node.engine.handlePacket(data, (size_t)length, rxUs, node.now(),
+                                                  reply, sizeof(reply));
+    if (replyLength > 0) transmit(node, peer, reply, replyLength);
+}
+
+static void runFor(Node& master, Node& slave, int64_t durationUs) {
+    int64_t end = monotonicUs() + durationUs;
+    while (monotonicUs() < end) {
+        uint8_t out[sizeof(clocksync::Packet)];
+        size_t length = master.engine.poll(master.now(), out, sizeof(out));
+        if (length > 0) transmit(master, slave, out, length);
+        length = slave.engine.poll(slave.now(), out, sizeof(out));
+        if (length > 0) transmit(slave, master, out, length);
+
+        // Wake for the next arrival or the next packet due out, whichever
+        // comes first, so the delay line adds no latency of its own
+        int64_t waitUs = release(1000);
+        struct timespec timeout = {0, (long)waitUs * 1000};
+        pollfd fds[2] = {{master.fd, POLLIN, 0}, {slave.fd, POLLIN, 0}};
+        if (ppoll(fds, 2, &timeout, NULL) > 0) {
+            if (fds[0].revents & POLLIN) receive(master, slave);
+            if (fds[1].revents & POLLIN) receive(slave, master);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+int main() {
+    srand(1);
+
+    Node master("master", 0x1001, masterNow);
+    Node slave("slave", 0x2002, slaveNow);
+    if (!master.open() || !slave.open()) {
+        printf("cannot open loopback UDP sockets\n");
+        return 1;
+    }
+    master.engine.setRole(CLOCK_SYNC_MASTER);
+    slave.engine.setRole(CLOCK_SYNC_SLAVE);
+
+    // First SYNC is sent on the first poll: the slave hears the master but
+    // has no exchange yet
+    runFor(master, slave, 2 * PATH_DELAY_US + 20000);
+    CHECK(slave.engine.hasMaster());
+    CHECK(slave.engine.getMasterId() == 0x1001);
+    CHECK(!slave.engine.isLocked(slave.now()));
+
+    runFor(master, slave, RUN_US);
+
+    int64_t offset = slave.engine.getOffsetUs();
+    int64_t delay = slave.engine.getDelayUs();
+    int64_t jitter = slave.engine.getJitterUs();
+    printf("%u exchanges: offset %lld us (injected %lld), delay %lld us (injected %lld), jitter %lld us\n",
+           slave.engine.getExchanges(), (long long)offset, (long long)CLOCK_OFFSET_US,
+           (long long)delay, (long long)PATH_DELAY_US, (long long)jitter);
+
+    CHECK(slave.engine.getExchanges() >= (uint32_t)ClockSyncEngine::MIN_SAMPLES_FOR_LOCK);
+    CHECK(slave.engine.isLocked(slave.now()));
+    CHECK(master.engine.isLocked(master.now()));
+
+    // The fastest exchange sets the offset: queued ones are filtered out
+    CHECK(llabs64(offset - CLOCK_OFFSET_US) <= OFFSET_TOLERANCE_US);
+    CHECK(llabs64(delay - PATH_DELAY_US) <= DELAY_TOLERANCE_US);
+
+    // Raw offsets move with the path jitter and the queued exchanges, and
+    // the smoothed jitter shows it without running away
+    CHECK(jitter > 0);
+    CHECK(jitter <= MAX_JITTER_US);
+
+    // Slave stamps converted to the shared timebase match the master's clock
+    int64_t shared = slave.engine.toShared(slave.now());
+    int64_t reference = master.now();
+    CHECK(llabs64(shared - reference) <= OFFSET_TOLERANCE_US);
+    CHECK(master.engine.toShared(reference) == reference);
+
+    // Master goes quiet: the lock holds until LOCK_TIMEOUT_US without a response
+    linkUp = false;
+    inFlight.clear();
+    int64_t lastUs = slave.now();
+    runFor(master, slave, 100000);
+    CHECK(slave.engine.isLocked(slave.now()));
+    CHECK(!slave.engine.isLocked(lastUs + ClockSyncEngine::LOCK_TIMEOUT_US));
+
+    close(master.fd);
+    close(slave.fd);
+
+    printf("%s\n", failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,264 @@
+// Runs a start node and a finish node against each other over
+// SimulatedTransport, the same exchange the split timers run over ESP-NOW.
+//
+// Both nodes run on one simulated clock advanced STEP_US at a time. The
+// link can lose, duplicate and delay frames. The sequence numbers are
+// seeded at the 16-bit wrap: the start node's first START goes out as seq 0
+// and the finish node's FINISH events wrap from 0xFFFF to 0 mid-run.
+//
+// Checks that both nodes join the same RaceResult for every race on a clean
+// link and on a lossy one, and that only the lossy link retransmits and
+// sees duplicates. Also checks that events keep retrying until they are
+// acknowledged, that a new race supersedes the old race's events, and that a
+// lane that never finishes is reported as a DNF when the race times out.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "RaceLink.h"
+#include "SimulatedTransport.h"
+
+static const uint32_t START_NODE_ID = 0x1001;
+static const uint32_t FINISH_NODE_ID = 0x2002;
+static const uint16_t START_SEED = 0xFFFF;     // First START is seq 0
+static const uint16_t FINISH_SEED = 0xFFF8;
+static const int64_t STEP_US = 1000;
+static const int64_t LATENCY_US = 4000;
+static const int LOSS_PERCENT = 30;
+static const int DUPLICATE_PERCENT = 20;
+static const int LOSSY_RACES = 20;
+static const int64_t SHARED_OFFSET_US = 5000000000LL;  // Shared timebase minus the simulated clock
+
+static int failures = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            failures++;                                                     \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        }                                                                   \
+    } while (0)
+
+// ---------------------------------------------------------------------------
+
+// Records every event sequence number that goes out, to see the wrap
+class TappedTransport : public SimulatedTransport {
+public:
+    TappedTransport() : sentSeqZero(false), sentSeqWrap(false), lastSeq(0), events(0) {}
+
+    bool send(const uint8_t* data, size_t length) override {
+        racelink::Packet packet;
+        if (length == sizeof(packet)) {
+            memcpy(&packet, data, sizeof(packet));
+            if (packet.type != racelink::MSG_ACK) {
+                if (packet.seq == 0) sentSeqZero = true;
+                if (events > 0 && packet.seq < lastSeq) sentSeqWrap = true;
+                lastSeq = packet.seq;
+                events++;
+            }
+        }
+        return SimulatedTransport::send(data, length);
+    }
+
+    bool sentSeqZero;
+    bool sentSeqWrap;
+    uint16_t lastSeq;
+    uint32_t events;
+};
+
+// One unit: its link and what its handlers were given
+struct Node {
+    TappedTransport transport;
+    RaceLink link;
+    int starts;
+    uint16_t startRaceId;
+    int64_t startUs;
+    int results;
+    RaceResult result;
+
+    Node() : link(transport), starts(0), startRaceId(0), startUs(0), results(0) {
+        memset(&result, 0, sizeof(result));
+    }
+
+    void begin(RaceLinkRole role, uint32_t nodeId, uint16_t seed) {
+        link.begin(role, nodeId, seed);
+        link.onStart([this](uint16_t raceId, int64_t start) {
+            starts++;
+            startRaceId = raceId;
+            startUs = start;
+        });
+        link.onResult([this](const RaceResult& r) {
+            results++;
+            result = r;
+        });
+    }
+};
+
+static Node startNode;
+static Node finishNode;
+static int64_t nowUs = 0;
+
+static void setLink(int64_t latencyUs, int lossPercent, int duplicatePercent) {
+    Node* nodes[2] = {&startNode, &finishNode};
+    for (int i = 0; i < 2; i++) {
+        nodes[i]->transport.setLatency(latencyUs);
+        nodes[i]->transport.setLossPercent(lossPercent);
+        nodes[i]->transport.setDuplicatePercent(duplicatePercent);
+    }
+}
+
+static void runFor(int64_t durationUs) {
+    int64_t end = nowUs + durationUs;
+    while (nowUs < end) {
+        nowUs += STEP_US;
+        startNode.transport.setNow(nowUs);
+        finishNode.transport.setNow(nowUs);
+        startNode.link.update(nowUs);
+        finishNode.link.update(nowUs);
+    }
+}
+
+static bool near(float a, float b) { return fabsf(a - b) < 0.0001f; }
+
+// Starts a race on the start node, crosses the finish line on the finish
+// node laneUs[] after the start (0 for a lane that never finishes) and runs
+// until both nodes have had time to join the result. Returns the race id.
+static uint16_t runRace(const int64_t laneUs[2], int64_t settleUs) {
+    int64_t startShared = nowUs + SHARED_OFFSET_US;
+    int finishStarts = finishNode.starts;
+    uint16_t raceId = startNode.link.recordStart(startShared, nowUs);
+
+    // The finish node only times lanes once it has heard the start
+    int64_t giveUpUs = nowUs + 1000000;
+    while (finishNode.starts == finishStarts && nowUs < giveUpUs) runFor(STEP_US);
+    CHECK(finishNode.starts == finishStarts + 1);
+    CHECK(finishNode.startRaceId == raceId);
+    CHECK(finishNode.startUs == startShared);
+
+    for (int lane = 0; lane < 2; lane++) {
+        if (laneUs[lane] == 0) continue;
+        int64_t crossUs = startShared + laneUs[lane];
+        if (nowUs + SHARED_OFFSET_US < crossUs) runFor(crossUs - SHARED_OFFSET_US - nowUs);
+        finishNode.link.recordFinish(lane, crossUs, nowUs);
+    }
+    runFor(settleUs);
+    return raceId;
+}
+
+static void checkResult(const Node& node, const int64_t laneUs[2]) {
+    CHECK(near(node.result.lane1Time, laneUs[0] / 1000000.0f));
+    CHECK(near(node.result.lane2Time, laneUs[1] / 1000000.0f));
+    CHECK(node.result.lane1Raw == node.result.lane1Time);
+    CHECK(node.result.lane2Raw == node.result.lane2Time);
+}
+
+// ---------------------------------------------------------------------------
+
+int main() {
+    srand(1);
+
+    SimulatedTransport::connect(startNode.transport, finishNode.transport);
+    startNode.begin(RACE_LINK_START, START_NODE_ID, START_SEED);
+    finishNode.begin(RACE_LINK_FINISH, FINISH_NODE_ID, FINISH_SEED);
+
+    // Clean link: one send per event, nothing repeated
+    setLink(LATENCY_US, 0, 0);
+    const int64_t clean[2] = {2100000, 2345000};
+    runRace(clean, 100000);
+    CHECK(startNode.transport.sentSeqZero);
+    CHECK(startNode.results == 1);
+    CHECK(finishNode.results == 1);
+    checkResult(startNode, clean);
+    checkResult(finishNode, clean);
+    CHECK(startNode.link.getStats().retransmits == 0);
+    CHECK(finishNode.link.getStats().retransmits == 0);
+    CHECK(startNode.link.getStats().duplicates == 0);
+    CHECK(finishNode.link.getStats().duplicates == 0);
+    CHECK(startNode.link.getStats().received == 2);
+    CHECK(finishNode.link.getStats().received == 1);
+
+    // Lossy link: every race still joins once, on both nodes, with the
+    // times the finish node stamped
+    setLink(LATENCY_US, LOSS_PERCENT, DUPLICATE_PERCENT);
+    for (int race = 0; race < LOSSY_RACES; race++) {
+        int64_t lanes[2] = {1800000 + rand() % 800000, 1800000 + rand() % 800000};
+        int startResults = startNode.results;
+        int finishResults = finishNode.results;
+        int finishStarts = finishNode.starts;
+        runRace(lanes, 1000000);
+        CHECK(finishNode.starts == finishStarts + 1);
+        CHECK(startNode.results == startResults + 1);
+        CHECK(finishNode.results == finishResults + 1);
+        checkResult(startNode, lanes);
+        checkResult(finishNode, lanes);
+    }
+
+    const RaceLinkStats& startStats = startNode.link.getStats();
+    const RaceLinkStats& finishStats = finishNode.link.getStats();
+    printf("%d lossy races: start node %u retransmits, %u duplicates; "
+           "finish node %u retransmits, %u duplicates; %u of %u frames dropped\n",
+           LOSSY_RACES, startStats.retransmits, startStats.duplicates, finishStats.retransmits,
+           finishStats.duplicates, startNode.transport.getDropped() + finishNode.transport.getDropped(),
+           startNode.transport.getSent() + finishNode.transport.getSent());
+
+    CHECK(startStats.retransmits > 0);
+    CHECK(finishStats.retransmits > 0);
+    CHECK(startStats.duplicates > 0);
+    CHECK(finishStats.duplicates > 0);
+    // Duplicates are acknowledged but never delivered twice
+    CHECK(startStats.received == 2 * (1 + LOSSY_RACES));
+    CHECK(finishStats.received == 1 + LOSSY_RACES);
+    CHECK(startStats.lost == 0);
+    CHECK(finishStats.lost == 0);
+    CHECK(startStats.timeouts == 0);
+    CHECK(finishStats.timeouts == 0);
+
+    // The finish node's sequence numbers went through 0xFFFF -> 0
+    CHECK(finishNode.transport.sentSeqWrap);
+    CHECK(finishNode.transport.sentSeqZero);
+
+    // Link down: the START keeps retrying well past a fixed retry budget
+    // and gets through once the link is back
+    setLink(LATENCY_US, 100, 0);
+    int finishStarts = finishNode.starts;
+    uint32_t retransmits = startStats.retransmits;
+    uint16_t raceId = startNode.link.recordStart(nowUs + SHARED_OFFSET_US, nowUs);
+    runFor(100 * RaceLink::RETRY_INTERVAL_US);
+    CHECK(startStats.retransmits - retransmits >= 99);
+    CHECK(finishNode.starts == finishStarts);
+    setLink(LATENCY_US, 0, 0);
+    runFor(2 * RaceLink::RETRY_INTERVAL_US);
+    CHECK(finishNode.starts == finishStarts + 1);
+    CHECK(finishNode.startRaceId == raceId);
+
+    // Timeout: lane 2 never finishes, both nodes report it as a DNF
+    runFor(RaceLink::RACE_TIMEOUT_US);
+    CHECK(startStats.timeouts == 1);
+    CHECK(finishStats.timeouts == 1);
+    CHECK(near(startNode.result.lane1Time, 0) && near(startNode.result.lane2Time, 0));
+
+    int startResults = startNode.results;
+    const int64_t dnf[2] = {2200000, 0};
+    runRace(dnf, RaceLink::RACE_TIMEOUT_US);
+    CHECK(startNode.results == startResults + 1);
+    checkResult(startNode, dnf);
+    checkResult(finishNode, dnf);
+    CHECK(startStats.timeouts == 2);
+    CHECK(finishStats.timeouts == 2);
+
+    // A new race supersedes an unacknowledged START
+    setLink(LATENCY_US, 100, 0);
+    startNode.link.recordStart(nowUs + SHARED_OFFSET_US, nowUs);
+    runFor(RaceLink::RETRY_INTERVAL_US);
+    raceId = startNode.link.recordStart(nowUs + SHARED_OFFSET_US, nowUs);
+    CHECK(startStats.lost == 1);
+    setLink(LATENCY_US, 0, 0);
+    finishStarts = finishNode.starts;
+    runFor(2 * RaceLink::RETRY_INTERVAL_US);
+    CHECK(finishNode.starts == finishStarts + 1);
+    CHECK(finishNode.startRaceId == raceId);
+
+    printf("%s\n", failures == 0 ? "ok" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
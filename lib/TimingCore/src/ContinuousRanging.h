@@ -0,0 +1,104 @@
+#pragma once
+
+// Non-blocking result reads for a VL53L0X in continuous mode.
+//
+// This is what readRangeContinuousMillimeters() does once its wait loop sees
+// the interrupt, without the wait: the range registers are only touched once
+// the sensor reports a new measurement, so a lane never waits on its own or
+// another lane's ranging. Templated on the sensor so it builds without the
+// Pololu library (any type with its register interface will do).
+
+#include <stdint.h>
+
+namespace timingcore {
+
+// True once the sensor has a measurement waiting
+template <class Sensor>
+bool resultReady(Sensor& sensor) {
+    return (sensor.readReg(Sensor::RESULT_INTERRUPT_STATUS) & 0x07) != 0;
+}
+
+// Reads the waiting measurement and re-arms the interrupt. Returns false on
+// an I2C error.
+template <class Sensor>
+bool readResult(Sensor& sensor, uint16_t& distanceMm) {
+    uint16_t range = sensor.readReg16Bit(Sensor::RESULT_RANGE_STATUS + 10);
+    sensor.writeReg(Sensor::SYSTEM_INTERRUPT_CLEAR, 0x01);
+    if (sensor.last_status != 0) {
+        return false;
+    }
+    distanceMm = range;
+    return true;
+}
+
+template <class Sensor>
+bool pollRange(Sensor& sensor, uint16_t& distanceMm) {
+    return resultReady(sensor) && readResult(sensor, distanceMm);
+}
+
+// When each result became ready, for sensors whose interrupt line is not
+// wired. Polling only shows a result landed somewhere after the previous
+// poll, so the estimate is one ranging period after the previous result,
+// kept inside that window. Consecutive results whose windows are tight refine
+// the period.
+//
+// Portable: the caller supplies the poll times.
+class ReadyEstimator {
+public:
+    static const uint32_t TIGHT_WINDOW_US = 1000;
+
+    ReadyEstimator() : periodUs(0), lastReadyUs(0), lastPollUs(0), haveReady(false), lastTight(false) {}
+
+    // Ranging (re)started at nowUs with a nominal period, 0 if unknown
+    void begin(uint32_t nowUs, uint32_t nominalPeriodUs) {
+        periodUs = nominalPeriodUs;
+        lastPollUs = nowUs;
+        haveReady = false;
+        lastTight = false;
+    }
+
+    // A poll found no result
+    void idle(uint32_t pollUs) { lastPollUs = pollUs; }
+
+    // A poll found a result: returns when it became ready
+    uint32_t ready(uint32_t pollUs) {
+        uint32_t readyUs = pollUs;
+        if (haveReady && periodUs != 0) {
+            uint32_t predicted = lastReadyUs + periodUs;
+            if (after(lastPollUs, predicted)) {
+                readyUs = lastPollUs;          // Later than predicted: a result was missed or slow
+            } else if (after(pollUs, predicted)) {
+                readyUs = predicted;
+            }
+        }
+
+        bool tight = pollUs - lastPollUs <= TIGHT_WINDOW_US;
+        if (haveReady && tight && lastTight) {
+            uint32_t measured = readyUs - lastReadyUs;
+            if (periodUs == 0) {
+                periodUs = measured;
+            } else if (measured > periodUs / 2 && measured < periodUs + periodUs / 2) {
+                periodUs += (int32_t)(measured - periodUs) / 8;
+            }
+        }
+
+        lastReadyUs = readyUs;
+        lastPollUs = pollUs;
+        haveReady = true;
+        lastTight = tight;
+        return readyUs;
+    }
+
+    uint32_t getPeriodUs() const { return periodUs; }
+
+private:
+    static bool after(uint32_t a, uint32_t b) { return (int32_t)(a - b) > 0; }
+
+    uint32_t periodUs;
+    uint32_t lastReadyUs;
+    uint32_t lastPollUs;       // Any result not yet read landed after this
+    bool haveReady;
+    bool lastTight;            // The previous result was pinned down by its polls
+};
+
+}  // namespace timingcore
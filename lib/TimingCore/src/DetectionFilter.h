@@ -0,0 +1,34 @@
+#pragma once
+
+// Decides whether a range sample means a car is under the sensor.
+//
+// A lane triggers when the distance drops below its level: either a fixed
+// threshold (sensor above the track, nothing in view when clear) or a margin
+// below a calibrated baseline (sensor looking across at a far wall).
+//
+// Portable: no Arduino dependencies.
+
+#include <stdint.h>
+
+namespace timingcore {
+
+// What the VL53L0X reports with nothing in range
+const uint16_t RANGE_NO_TARGET = 8190;
+
+struct DetectionFilter {
+    uint16_t levelMm;          // Distances below this are a car
+
+    static DetectionFilter below(uint16_t thresholdMm) {
+        DetectionFilter filter = {thresholdMm};
+        return filter;
+    }
+
+    static DetectionFilter belowBaseline(uint16_t baselineMm, uint16_t marginMm) {
+        DetectionFilter filter = {(uint16_t)(baselineMm > marginMm ? baselineMm - marginMm : 0)};
+        return filter;
+    }
+
+    bool triggered(uint16_t distanceMm) const { return distanceMm < levelMm; }
+};
+
+}  // namespace timingcore
@@ -0,0 +1,266 @@
+#pragma once
+
+// Lane-generic finish-line core shared by the timer firmwares.
+//
+// The lane count, sensor type and display type are template parameters: the
+// per-pass lane loop is unrolled at compile time, each lane's sensor and
+// state are addressed directly, and a build without displays carries no
+// display code at all.
+//
+// Sensor provides
+//   bool poll(uint16_t& distanceMm, uint32_t& captureUs);
+// which returns true with a new measurement and never waits for one.
+//
+// Display provides
+//   static const bool ENABLED;
+//   void blank(int lane);
+//   void result(int lane, int place, uint32_t timeUs);
+// NoDisplay is the default for timers without lane displays.
+//
+// Portable: no Arduino dependencies, so it also builds on a host against
+// simulated sensors for benchmarking.
+
+#include <stdint.h>
+#include "DetectionFilter.h"
+#include "RaceClock.h"
+
+namespace timingcore {
+
+const int MAX_LANES = 8;
+
+struct LaneResult {
+    uint32_t time;             // Finish time in µs from the start, 0 if not finished
+    uint32_t early;            // Earliest possible finish time (last clear sample)
+    uint32_t raw;              // Capture time of the detecting sample
+    uint16_t samples;          // Sensor samples taken during the race
+    uint16_t pre;              // Last clear distance before the crossing (mm), 0 if none
+    uint16_t det;              // Distance of the detecting sample (mm)
+    uint8_t conf;              // Detection confidence, 0-100
+    uint8_t place;             // 0 if not finished
+    bool photo;                // Crossing window overlaps another lane's
+};
+
+struct NoDisplay {
+    static const bool ENABLED = false;
+    void blank(int) {}
+    void result(int, int, uint32_t) {}
+};
+
+struct StepResult {
+    bool sampled;              // At least one lane produced a new sample
+    uint8_t finished;          // Bit per lane that finished in this pass
+};
+
+namespace detail {
+
+// Expands to one stepLane<I>() call per lane
+template <int I, int N>
+struct LaneLoop {
+    template <class Core>
+    static inline void step(Core& core, StepResult& result) {
+        core.template stepLane<I>(result);
+        LaneLoop<I + 1, N>::step(core, result);
+    }
+};
+
+template <int N>
+struct LaneLoop<N, N> {
+    template <class Core>
+    static inline void step(Core&, StepResult&) {}
+};
+
+}  // namespace detail
+
+template <int N, class Sensor, class Display = NoDisplay>
+class LaneCore {
+public:
+    static_assert(N >= 1 && N <= MAX_LANES, "LaneCore supports 1 to 8 lanes");
+    static const int LANES = N;
+
+    LaneCore(Sensor* sensors, uint16_t thresholdMm, const Display& display = Display())
+        : sensors(sensors), display(display), lanesLeft(0) {
+        for (int n = 0; n < N; n++) filters[n] = DetectionFilter::below(thresholdMm);
+        unmaskAll();
+        reset();
+    }
+
+    // Replaces a lane's filter, e.g. after calibrating its baseline
+    void setFilter(int lane, const DetectionFilter& filter) {
+        if (lane >= 0 && lane < N) filters[lane] = filter;
+    }
+
+    // Clears all results
+    void reset() {
+        for (int n = 0; n < N; n++) {
+            results[n] = LaneResult();
+            active[n] = false;
+            prevUs[n] = 0;
+            prevDistance[n] = 0;
+            pending[n] = DISP_NONE;
+        }
+        lanesLeft = 0;
+        raceClock.stop();
+    }
+
+    // Starts timing a race that began at raceStartUs. Masked lanes sit it out.
+    void start(uint32_t raceStartUs) {
+        reset();
+        raceClock.start(raceStartUs);
+        for (int n = 0; n < N; n++) {
+            active[n] = !masked[n];
+            if (active[n]) lanesLeft++;
+            pending[n] = DISP_BLANK;
+        }
+    }
+
+    // One pass over the lanes; never waits on a sensor
+    StepResult step() {
+        StepResult result = {false, 0};
+        detail::LaneLoop<0, N>::step(*this, result);
+        if (result.finished) updatePlaces();
+        return result;
+    }
+
+    // Ends the race with any unfinished lanes left without a time
+    void end() {
+        for (int n = 0; n < N; n++) active[n] = false;
+        lanesLeft = 0;
+        raceClock.stop();
+    }
+
+    // Writes queued display updates: the first pending lane, or all of them.
+    // The displays share the I2C bus with the sensors, so during a race this
+    // is only called on passes where no lane sampled.
+    void flushDisplays(bool all) {
+        if (!Display::ENABLED) return;
+
+        for (int n = 0; n < N; n++) {
+            if (pending[n] == DISP_NONE) continue;
+
+            if (pending[n] == DISP_RESULT) {
+                display.result(n, results[n].place, results[n].time);
+            } else {
+                display.blank(n);
+            }
+            pending[n] = DISP_NONE;
+
+            if (!all) break;
+        }
+    }
+
+    void mask(int lane) {
+        if (lane < 0 || lane >= N) return;
+        masked[lane] = true;
+        if (active[lane]) {
+            active[lane] = false;
+            lanesLeft--;
+        }
+    }
+
+    void unmaskAll() {
+        for (int n = 0; n < N; n++) masked[n] = false;
+    }
+
+    bool isMasked(int lane) const { return masked[lane]; }
+    int remaining() const { return lanesLeft; }
+    const RaceClock& clock() const { return raceClock; }
+    uint32_t startTime() const { return raceClock.startTime(); }
+    const LaneResult& result(int lane) const { return results[lane]; }
+
+private:
+    template <int, int> friend struct detail::LaneLoop;
+
+    enum : uint8_t { DISP_NONE, DISP_BLANK, DISP_RESULT };
+
+    template <int I>
+    inline void stepLane(StepResult& result) {
+        if (!active[I]) return;
+
+        uint16_t distance;
+        uint32_t captureUs;
+        if (!sensors[I].poll(distance, captureUs)) return;
+
+        result.sampled = true;
+        results[I].samples++;
+
+        if (filters[I].triggered(distance)) {
+            finishLane(I, distance, captureUs);
+            active[I] = false;
+            if (--lanesLeft == 0) raceClock.stop();
+            result.finished |= 1 << I;
+        }
+
+        prevUs[I] = captureUs;
+        prevDistance[I] = distance;
+    }
+
+    // Times the lane from its own samples: the car crossed between the last
+    // clear sample and this one, so interpolate where the distance passed the
+    // threshold rather than using the time the pass happened to reach it.
+    void finishLane(int n, uint16_t distance, uint32_t lateUs) {
+        LaneResult& r = results[n];
+        uint16_t level = filters[n].levelMm;
+        bool havePrev = prevUs[n] != 0;
+        uint32_t earlyUs = havePrev ? prevUs[n] : raceClock.startTime();
+        uint32_t crossUs = lateUs;
+
+        if (havePrev && prevDistance[n] > distance) {
+            float frac = (float)(prevDistance[n] - level) / (prevDistance[n] - distance);
+            crossUs = earlyUs + (uint32_t)(frac * (lateUs - earlyUs));
+        }
+
+        r.time = raceClock.since(crossUs);
+        if (r.time == 0) r.time = 1;      // 0 means "not finished"
+        r.early = raceClock.since(earlyUs);
+        r.raw = raceClock.since(lateUs);
+        r.det = distance;
+
+        // Confidence: how far the distance dropped across the level,
+        // relative to the level itself; 0 without a clear sample
+        r.pre = 0;
+        r.conf = 0;
+        if (havePrev && level > 0) {
+            int32_t drop = 100L * (prevDistance[n] - distance) / level;
+            r.pre = prevDistance[n];
+            r.conf = drop > 100 ? 100 : (drop < 0 ? 0 : drop);
+        }
+    }
+
+    // Ranks finished lanes by crossing time and flags overlapping windows,
+    // which the samples cannot tell apart
+    void updatePlaces() {
+        for (int n = 0; n < N; n++) {
+            if (results[n].time == 0) continue;
+
+            uint8_t place = 1;
+            for (int m = 0; m < N; m++) {
+                if (m == n || results[m].time == 0) continue;
+
+                if (results[m].time < results[n].time) place++;
+                if (results[m].early < results[n].time && results[n].early < results[m].time) {
+                    results[n].photo = true;
+                }
+            }
+
+            if (place != results[n].place) {
+                results[n].place = place;
+                pending[n] = DISP_RESULT;
+            }
+        }
+    }
+
+    Sensor* sensors;
+    Display display;
+    RaceClock raceClock;
+    int lanesLeft;
+
+    DetectionFilter filters[N];
+    LaneResult results[N];
+    bool active[N];            // Racing and not yet finished
+    bool masked[N];
+    uint32_t prevUs[N];        // Capture time of the previous sample, 0 if none yet
+    uint16_t prevDistance[N];
+    uint8_t pending[N];        // Queued display update
+};
+
+}  // namespace timingcore
@@ -0,0 +1,37 @@
+#pragma once
+
+// Race start and elapsed time on the microsecond clock. The caller supplies
+// the time, so a 32-bit micros() wrap mid-race is handled by the unsigned
+// arithmetic.
+//
+// Portable: no Arduino dependencies.
+
+#include <stdint.h>
+
+namespace timingcore {
+
+class RaceClock {
+public:
+    RaceClock() : startUs(0), running(false) {}
+
+    void start(uint32_t nowUs) {
+        startUs = nowUs;
+        running = true;
+    }
+
+    void stop() { running = false; }
+
+    bool isRunning() const { return running; }
+    uint32_t startTime() const { return startUs; }
+
+    // Time since the start of a timestamp taken during the race
+    uint32_t since(uint32_t timeUs) const { return timeUs - startUs; }
+
+    uint32_t elapsedMs(uint32_t nowUs) const { return (nowUs - startUs) / 1000; }
+
+private:
+    uint32_t startUs;
+    bool running;
+};
+
+}  // namespace timingcore
@@ -0,0 +1,75 @@
+#pragma once
+
+// Decides the winner of a two-lane race. This is the only place ties are
+// judged: firmwares apply it once, when both finishes are known, and report
+// what it returns. Times are in whatever unit the caller reports them in, so
+// a tie is judged at the resolution the racers see; a time of 0 means the
+// lane did not finish.
+//
+// Portable: no Arduino dependencies.
+
+#include <stdint.h>
+
+namespace timingcore {
+
+// Same numbering as the race management serial protocol
+enum Winner : uint8_t {
+    WINNER_TIE = 0,
+    WINNER_LANE1 = 1,
+    WINNER_LANE2 = 2
+};
+
+enum TieMode : uint8_t {
+    TIE_EXACT = 0,             // Only identical times tie
+    TIE_THRESHOLD = 1,         // Finishes within the threshold tie and share their average time
+    TIE_MARGIN = 2             // Always name a winner; the threshold only scales the confidence
+};
+
+const uint8_t NUM_TIE_MODES = 3;
+
+// The outcome of one race. raw[] is always what was measured; time[] is what
+// gets reported and differs from it only for a threshold tie.
+struct TieDecision {
+    uint8_t winner;            // Winner
+    uint32_t raw[2];
+    uint32_t time[2];
+    uint32_t margin;           // Raw difference between the lanes, 0 unless both finished
+    uint8_t confidence;        // Percent certainty in the order: 50 for a dead heat,
+                               // 100 at or beyond the threshold or for a DNF
+};
+
+struct TiePolicy {
+    uint8_t mode;              // TieMode
+    uint32_t threshold;        // Tie window, or timing uncertainty in TIE_MARGIN
+
+    TieDecision apply(uint32_t lane1, uint32_t lane2) const {
+        TieDecision d;
+        d.raw[0] = d.time[0] = lane1;
+        d.raw[1] = d.time[1] = lane2;
+        d.margin = 0;
+        d.confidence = 100;
+
+        if (lane1 == 0 || lane2 == 0) {
+            d.winner = lane1 == lane2 ? WINNER_TIE : (lane1 != 0 ? WINNER_LANE1 : WINNER_LANE2);
+            return d;
+        }
+
+        d.margin = lane1 > lane2 ? lane1 - lane2 : lane2 - lane1;
+        if (d.margin < threshold) {
+            d.confidence = (uint8_t)(50 + (uint64_t)d.margin * 50 / threshold);
+        } else if (d.margin == 0) {
+            d.confidence = 50;
+        }
+
+        bool tie = d.margin == 0 || (mode == TIE_THRESHOLD && d.margin <= threshold);
+        if (!tie) {
+            d.winner = lane1 < lane2 ? WINNER_LANE1 : WINNER_LANE2;
+            return d;
+        }
+        d.winner = WINNER_TIE;
+        d.time[0] = d.time[1] = (uint32_t)(((uint64_t)lane1 + lane2) / 2);
+        return d;
+    }
+};
+
+}  // namespace timingcore
@@ -0,0 +1,16 @@
+#pragma once
+
+// Timing core shared by the race timer firmwares: sensor sampling, the
+// detection filter, the race clock, the tie policy and the lane results.
+//
+// Everything but the VL53L0X lane adapter is portable and builds on a host.
+
+#include "ContinuousRanging.h"
+#include "DetectionFilter.h"
+#include "LaneCore.h"
+#include "RaceClock.h"
+#include "TiePolicy.h"
+
+#ifdef ARDUINO
+#include "VL53L0XLane.h"
+#endif
@@ -0,0 +1,106 @@
+#ifdef ARDUINO
+
+#include "VL53L0XLane.h"
+#include "ContinuousRanging.h"
+#include "DetectionFilter.h"
+
+namespace timingcore {
+
+VL53L0XLane::SampleHook VL53L0XLane::sampleHook = nullptr;
+
+VL53L0XLane::VL53L0XLane()
+    : lane(0), ok(false), distance(RANGE_NO_TARGET), lastSampleUs(0), lastResultUs(0),
+      interruptPin(-1), interruptUs(0), interruptPending(false) {}
+
+int VL53L0XLane::beginAll(VL53L0XLane* lanes, const uint8_t* xshutPins, int count, uint8_t firstAddress) {
+    // Hold every sensor in reset so they do not all answer at the default address
+    for (int n = 0; n < count; n++) {
+        pinMode(xshutPins[n], OUTPUT);
+        digitalWrite(xshutPins[n], LOW);
+    }
+    delay(10);
+
+    int found = 0;
+    for (int n = 0; n < count; n++) {
+        VL53L0XLane& lane = lanes[n];
+        lane.lane = n;
+
+        digitalWrite(xshutPins[n], HIGH);
+        delay(10);
+        lane.sensor.setTimeout(500);
+        lane.ok = lane.sensor.init();
+        if (lane.ok) {
+            lane.sensor.setAddress(firstAddress + n);
+            found++;
+        }
+    }
+    return found;
+}
+
+void VL53L0XLane::setLongRange() {
+    sensor.setSignalRateLimit(0.1);
+    sensor.setVcselPulsePeriod(VL53L0X::VcselPeriodPreRange, 18);
+    sensor.setVcselPulsePeriod(VL53L0X::VcselPeriodFinalRange, 14);
+}
+
+void VL53L0XLane::start() {
+    sensor.startContinuous();
+    interruptPending = false;
+    lastResultUs = micros();
+    // Back to back, a result is due every timing budget
+    readyEstimator.begin(lastResultUs, sensor.getMeasurementTimingBudget());
+}
+
+void VL53L0XLane::attachReadyInterrupt(uint8_t pin) {
+    interruptPin = pin;
+    pinMode(pin, INPUT_PULLUP);
+    attachInterruptArg(digitalPinToInterrupt(pin), onReadyInterrupt, this, FALLING);
+}
+
+void IRAM_ATTR VL53L0XLane::onReadyInterrupt(void* arg) {
+    VL53L0XLane* self = static_cast<VL53L0XLane*>(arg);
+    // The line stays low until the result is read, so one edge per result
+    self->interruptUs = micros();
+    self->interruptPending = true;
+}
+
+uint32_t VL53L0XLane::readyTime(uint32_t pollUs) {
+    // Keep the estimator current either way, it takes over if the line fails
+    uint32_t estimatedUs = readyEstimator.ready(pollUs);
+    if (interruptPending) {
+        interruptPending = false;
+        return interruptUs;
+    }
+    return estimatedUs;
+}
+
+bool VL53L0XLane::poll(uint16_t& distanceMm, uint32_t& captureUs) {
+    uint32_t pollUs = micros();
+    if (!resultReady(sensor)) {
+        readyEstimator.idle(pollUs);
+        if (pollUs - lastResultUs > TIMEOUT_US) {
+            // No result for a while: restart ranging on this sensor
+            start();
+        }
+        return false;
+    }
+
+    uint32_t readyUs = readyTime(pollUs);
+    uint32_t readStart = micros();
+    if (!readResult(sensor, distanceMm)) {
+        return false;
+    }
+    uint32_t i2cUs = micros() - readStart;
+
+    distance = distanceMm;
+    lastSampleUs = captureUs = readyUs;
+    lastResultUs = pollUs;
+    if (sampleHook) {
+        sampleHook(lane, readyUs, i2cUs);
+    }
+    return true;
+}
+
+}  // namespace timingcore
+
+#endif  // ARDUINO
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <Arduino.h>
+#include <VL53L0X.h>
+#include "ContinuousRanging.h"
+
+namespace timingcore {
+
+// A VL53L0X on its own XSHUT pin, ranging continuously. Satisfies LaneCore's
+// Sensor interface, and can be polled directly outside a race.
+//
+// Results are stamped with the time the sensor had them ready, not the time
+// a poll got round to them: from the GPIO1 interrupt when it is wired,
+// otherwise estimated from the ranging period.
+class VL53L0XLane {
+public:
+    // Called for every result with its data-ready time and how long the I2C
+    // read took, for latency statistics
+    typedef void (*SampleHook)(int lane, uint32_t readyUs, uint32_t i2cUs);
+
+    static const uint32_t TIMEOUT_US = 500000;   // Restart ranging after this long without a result
+
+    // Brings the sensors up one at a time on their XSHUT pins and moves each
+    // off the shared default address to firstAddress + lane. Ranging is not
+    // started, so each sensor can be configured first. Returns the number of
+    // sensors that answered.
+    static int beginAll(VL53L0XLane* lanes, const uint8_t* xshutPins, int count,
+                        uint8_t firstAddress = 0x30);
+    static void onSample(SampleHook hook) { sampleHook = hook; }
+
+    VL53L0XLane();
+
+    void setLongRange();                 // Lower signal limit, longer VCSEL pulses
+    void start();                        // Continuous back-to-back ranging
+
+    // Stamps results from the sensor's GPIO1 output (new sample ready, active
+    // low) on this pin. Call once the sensor is up.
+    void attachReadyInterrupt(uint8_t pin);
+    bool hasReadyInterrupt() const { return interruptPin >= 0; }
+
+    bool poll(uint16_t& distanceMm, uint32_t& captureUs);
+
+    bool isOk() const { return ok; }
+    int getLane() const { return lane; }
+    uint16_t getDistance() const { return distance; }   // RANGE_NO_TARGET before the first result
+    uint32_t getLastSampleUs() const { return lastSampleUs; }   // Data-ready time of the latest result
+    uint32_t getPeriodUs() const { return readyEstimator.getPeriodUs(); }
+    bool isFresh(uint32_t nowUs) const { return nowUs - lastResultUs <= TIMEOUT_US; }
+
+    VL53L0X sensor;
+
+private:
+    static SampleHook sampleHook;
+    static void IRAM_ATTR onReadyInterrupt(void* arg);
+
+    uint32_t readyTime(uint32_t pollUs);
+
+    int lane;
+    bool ok;
+    uint16_t distance;
+    uint32_t lastSampleUs;               // Data-ready time of the latest result
+    uint32_t lastResultUs;               // Latest result or restart, for the timeout
+    int8_t interruptPin;                 // -1 without GPIO1
+    volatile uint32_t interruptUs;       // Set by the GPIO1 interrupt
+    volatile bool interruptPending;
+    ReadyEstimator readyEstimator;
+};
+
+}  // namespace timingcore
@@ -0,0 +1,244 @@
+// Finish-order benchmark: the Pinewood timer's original racing loop against
+// LaneCore, on the same simulated sensors.
+//
+// Each lane's VL53L0X ranges back to back, one result every PERIOD_US at its
+// own phase. A car's nose takes the distance from the floor reading down to
+// the car top over NOSE_US, passing the threshold at the true crossing time.
+//
+// Old scheme: one micros() before the lane loop, each lane read in turn with
+// a blocking read, so a pass waits on every lane's next result and lanes
+// detected in the same pass share its time and place.
+// New scheme: LaneCore polls without waiting, stamps each sample when the
+// poll finds it and interpolates the crossing between the last clear sample
+// and the detecting one.
+//
+// Reports, per true finish margin, how often each scheme gets the order
+// wrong (a shared place counts as wrong: the true margin is never zero), how
+// many of LaneCore's errors carried the photo-finish flag, and the mean
+// timing error. Exits non-zero if LaneCore orders worse than the old loop.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "LaneCore.h"
+
+using namespace timingcore;
+
+static const int LANES = 2;
+static const uint32_t PERIOD_US = 20000;        // Sensor result interval
+static const uint32_t I2C_US = 300;             // Reading one result over I2C
+static const uint32_t PASS_US = 50;             // Rest of a LaneCore pass
+static const uint32_t NOSE_US = 8000;           // Floor to car top at race speed
+static const uint16_t FLOOR_MM = 300;
+static const uint16_t CAR_MM = 40;
+static const uint16_t THRESHOLD_MM = 150;
+static const uint32_t RACE_US = 2500000;        // Typical finish time
+static const int32_t MAX_MARGIN_US = 25000;     // Finish margins drawn from +-this
+static const int RACES = 20000;
+
+// ---------------------------------------------------------------------------
+
+static uint32_t rngState = 0x2545F491;
+
+static uint32_t nextRandom() {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static uint32_t randomBelow(uint32_t limit) { return nextRandom() % limit; }
+
+// One simulated lane: its sensor phase and the car's true crossing time
+struct SimLane {
+    uint32_t phaseUs;
+    uint32_t crossUs;
+
+    // Distance the sensor reports for a measurement completing at t
+    uint16_t distanceAt(uint32_t t) const {
+        double mm = THRESHOLD_MM - ((double)t - crossUs) * (FLOOR_MM - CAR_MM) / NOSE_US;
+        if (mm > FLOOR_MM) mm = FLOOR_MM;
+        if (mm < CAR_MM) mm = CAR_MM;
+        return (uint16_t)mm;
+    }
+
+    // Completion time of the first result at or after t
+    uint32_t nextResultAt(uint32_t t) const {
+        if (t <= phaseUs) return phaseUs;
+        return phaseUs + (t - phaseUs + PERIOD_US - 1) / PERIOD_US * PERIOD_US;
+    }
+};
+
+struct Outcome {
+    uint32_t time[LANES];
+    uint8_t place[LANES];
+    bool photo;
+};
+
+// ---------------------------------------------------------------------------
+// Old scheme
+
+static Outcome runOldLoop(const SimLane* lanes, uint32_t startUs) {
+    Outcome out = {{0, 0}, {0, 0}, false};
+    uint32_t now = startUs;
+    uint32_t lastRead[LANES];
+    int finishOrder = 0;
+    uint32_t lastFinishTime = 0;
+    int lanesLeft = LANES;
+
+    for (int n = 0; n < LANES; n++) lastRead[n] = startUs;
+
+    while (lanesLeft > 0) {
+        uint32_t currentTime = now;
+        for (int n = 0; n < LANES; n++) {
+            if (out.time[n] != 0) continue;
+
+            // Blocks until the lane's next result, then reads it
+            uint32_t ready = lanes[n].nextResultAt(lastRead[n] + 1);
+            if (ready > now) now = ready;
+            lastRead[n] = ready;
+            now += I2C_US;
+
+            if (lanes[n].distanceAt(ready) < THRESHOLD_MM) {
+                lanesLeft--;
+                out.time[n] = currentTime - startUs;
+                if (out.time[n] > lastFinishTime) {
+                    finishOrder++;
+                    lastFinishTime = out.time[n];
+                }
+                out.place[n] = finishOrder;
+            }
+        }
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// New scheme
+
+struct SimClock {
+    uint32_t now;
+};
+
+// LaneCore sensor over a SimLane: a result is available once it has
+// completed, and is stamped with the time the poll found it
+struct SimSensor {
+    const SimLane* lane;
+    SimClock* clock;
+    uint32_t nextReady;
+
+    bool poll(uint16_t& distanceMm, uint32_t& captureUs) {
+        if (clock->now < nextReady) return false;
+
+        uint32_t ready = lane->nextResultAt(clock->now - PERIOD_US + 1);
+        captureUs = clock->now;
+        distanceMm = lane->distanceAt(ready);
+        nextReady = ready + PERIOD_US;
+        clock->now += I2C_US;
+        return true;
+    }
+};
+
+static Outcome runLaneCore(const SimLane* lanes, uint32_t startUs) {
+    SimClock clock = {startUs};
+    SimSensor sensors[LANES];
+    for (int n = 0; n < LANES; n++) {
+        sensors[n].lane = &lanes[n];
+        sensors[n].clock = &clock;
+        sensors[n].nextReady = lanes[n].nextResultAt(startUs);
+    }
+
+    LaneCore<LANES, SimSensor> core(sensors, THRESHOLD_MM);
+    core.start(startUs);
+    while (core.remaining() > 0) {
+        core.step();
+        clock.now += PASS_US;
+    }
+
+    Outcome out;
+    out.photo = false;
+    for (int n = 0; n < LANES; n++) {
+        out.time[n] = core.result(n).time;
+        out.place[n] = core.result(n).place;
+        out.photo = out.photo || core.result(n).photo;
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+
+struct Tally {
+    int races;
+    int wrong;
+    int wrongFlagged;
+    double absErrorUs;
+};
+
+// True finish margin buckets, in µs
+static const int32_t BUCKET_LIMITS[] = {1000, 5000, 10000, 20000, MAX_MARGIN_US + 1};
+static const char* const BUCKET_NAMES[] = {"< 1 ms", "1-5 ms", "5-10 ms", "10-20 ms", "20-25 ms"};
+static const int BUCKETS = sizeof(BUCKET_LIMITS) / sizeof(BUCKET_LIMITS[0]);
+
+static void score(Tally& tally, const Outcome& out, const SimLane* lanes, uint32_t startUs) {
+    tally.races++;
+    bool lane1First = lanes[0].crossUs < lanes[1].crossUs;
+    bool correct = lane1First ? out.place[0] < out.place[1] : out.place[1] < out.place[0];
+    if (!correct) {
+        tally.wrong++;
+        if (out.photo) tally.wrongFlagged++;
+    }
+    for (int n = 0; n < LANES; n++) {
+        tally.absErrorUs += fabs((double)out.time[n] - (lanes[n].crossUs - startUs));
+    }
+}
+
+static double percent(int part, int whole) { return whole ? 100.0 * part / whole : 0.0; }
+
+int main() {
+    Tally oldTally[BUCKETS] = {};
+    Tally newTally[BUCKETS] = {};
+    Tally oldTotal = {}, newTotal = {};
+
+    for (int race = 0; race < RACES; race++) {
+        uint32_t startUs = 1000000 + randomBelow(PERIOD_US);
+        int32_t margin = 1 + (int32_t)randomBelow(MAX_MARGIN_US);
+        bool lane1First = randomBelow(2) == 0;
+
+        SimLane lanes[LANES];
+        for (int n = 0; n < LANES; n++) lanes[n].phaseUs = randomBelow(PERIOD_US);
+        uint32_t first = startUs + RACE_US + randomBelow(100000);
+        lanes[0].crossUs = lane1First ? first : first + margin;
+        lanes[1].crossUs = lane1First ? first + margin : first;
+
+        int bucket = 0;
+        while (margin >= BUCKET_LIMITS[bucket]) bucket++;
+
+        Outcome before = runOldLoop(lanes, startUs);
+        Outcome after = runLaneCore(lanes, startUs);
+        score(oldTally[bucket], before, lanes, startUs);
+        score(oldTotal, before, lanes, startUs);
+        score(newTally[bucket], after, lanes, startUs);
+        score(newTotal, after, lanes, startUs);
+    }
+
+    printf("%d two-lane races, results every %u ms per lane, margins up to %d ms\n\n",
+           RACES, PERIOD_US / 1000, MAX_MARGIN_US / 1000);
+    printf("%-10s %8s | %11s %13s | %11s %13s %9s\n", "margin", "races",
+           "old wrong", "old error", "new wrong", "new error", "flagged");
+
+    for (int b = 0; b <= BUCKETS; b++) {
+        const Tally& o = b < BUCKETS ? oldTally[b] : oldTotal;
+        const Tally& n = b < BUCKETS ? newTally[b] : newTotal;
+        printf("%-10s %8d | %10.1f%% %10.0f us | %10.1f%% %10.0f us %8.1f%%\n",
+               b < BUCKETS ? BUCKET_NAMES[b] : "all", o.races,
+               percent(o.wrong, o.races), o.races ? o.absErrorUs / (2.0 * o.races) : 0.0,
+               percent(n.wrong, n.races), n.races ? n.absErrorUs / (2.0 * n.races) : 0.0,
+               percent(n.wrongFlagged, n.wrong));
+    }
+
+    if (newTotal.wrong >= oldTotal.wrong) {
+        printf("\nLaneCore orders no better than the old loop\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,529 @@
+// Host tests for the portable timing core: tie policy, detection filter,
+// race clock, data-ready estimate and the lane core's interpolated crossing
+// times.
+
+#include <stdio.h>
+#include "ContinuousRanging.h"
+#include "DetectionFilter.h"
+#include "LaneCore.h"
+#include "RaceClock.h"
+#include "TiePolicy.h"
+
+using namespace timingcore;
+
+static int failures = 0;
+static int checks = 0;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        checks++;                                                           \
+        if (!(cond)) {                                                      \
+            failures++;                                                     \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        }                                                                   \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                           \
+    do {                                                                     \
+        checks++;                                                            \
+        long long a_ = (long long)(actual), e_ = (long long)(expected);      \
+        if (a_ != e_) {                                                      \
+            failures++;                                                      \
+            printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, \
+                   #actual, a_, e_);                                         \
+        }                                                                    \
+    } while (0)
+
+// ---------------------------------------------------------------------------
+// Scripted sensor: hands out one entry per poll, a not-ready entry or the end
+// of the script returning false like a sensor with no new result
+
+struct Sample {
+    bool ready;
+    uint16_t distance;
+    uint32_t captureUs;
+};
+
+static const Sample NOT_READY = {false, 0, 0};
+
+static Sample at(uint16_t distance, uint32_t captureUs) {
+    Sample s = {true, distance, captureUs};
+    return s;
+}
+
+struct ScriptedSensor {
+    const Sample* script;
+    int length;
+    int next;
+    int polls;
+
+    ScriptedSensor() : script(0), length(0), next(0), polls(0) {}
+
+    template <int L>
+    void load(const Sample (&samples)[L]) {
+        script = samples;
+        length = L;
+        next = 0;
+        polls = 0;
+    }
+
+    bool poll(uint16_t& distanceMm, uint32_t& captureUs) {
+        polls++;
+        if (next >= length) return false;
+        const Sample& s = script[next++];
+        if (!s.ready) return false;
+        distanceMm = s.distance;
+        captureUs = s.captureUs;
+        return true;
+    }
+};
+
+// The core keeps its own copy of the display, so calls go to a shared log
+struct DisplayLog {
+    int blanks;
+    int results;
+    int lastLane;
+    int lastPlace;
+    uint32_t lastTime;
+};
+
+struct RecordingDisplay {
+    static const bool ENABLED = true;
+    DisplayLog* log;
+
+    explicit RecordingDisplay(DisplayLog* log) : log(log) {}
+    void blank(int) { log->blanks++; }
+    void result(int lane, int place, uint32_t timeUs) {
+        log->results++;
+        log->lastLane = lane;
+        log->lastPlace = place;
+        log->lastTime = timeUs;
+    }
+};
+
+typedef LaneCore<2, ScriptedSensor> TwoLanes;
+
+// Steps until every lane has finished or the scripts run out
+static void runToEnd(TwoLanes& core) {
+    for (int pass = 0; pass < 100 && core.remaining() > 0; pass++) {
+        core.step();
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+static void testTieExact() {
+    TiePolicy policy = {TIE_EXACT, 1000};
+
+    TieDecision d = policy.apply(1000, 1001);
+    CHECK_EQ(d.winner, WINNER_LANE1);
+    CHECK_EQ(d.margin, 1);
+    CHECK_EQ(d.confidence, 50);            // 1 µs of a 1000 µs uncertainty
+    CHECK_EQ(d.time[0], 1000);
+    CHECK_EQ(d.time[1], 1001);
+
+    d = policy.apply(1500, 1500);
+    CHECK_EQ(d.winner, WINNER_TIE);
+    CHECK_EQ(d.confidence, 50);
+    CHECK_EQ(d.time[0], 1500);
+
+    d = policy.apply(5000, 2000);
+    CHECK_EQ(d.winner, WINNER_LANE2);
+    CHECK_EQ(d.confidence, 100);           // Beyond the threshold
+
+    // No threshold: a dead heat still reports 50
+    TiePolicy strict = {TIE_EXACT, 0};
+    d = strict.apply(700, 700);
+    CHECK_EQ(d.winner, WINNER_TIE);
+    CHECK_EQ(d.confidence, 50);
+    d = strict.apply(700, 701);
+    CHECK_EQ(d.winner, WINNER_LANE1);
+    CHECK_EQ(d.confidence, 100);
+}
+
+static void testTieThreshold() {
+    TiePolicy policy = {TIE_THRESHOLD, 2000};
+
+    TieDecision d = policy.apply(1000, 2500);
+    CHECK_EQ(d.winner, WINNER_TIE);
+    CHECK_EQ(d.margin, 1500);
+    CHECK_EQ(d.confidence, 87);
+    CHECK_EQ(d.time[0], 1750);             // Both share the average
+    CHECK_EQ(d.time[1], 1750);
+    CHECK_EQ(d.raw[0], 1000);              // What was measured is kept
+    CHECK_EQ(d.raw[1], 2500);
+
+    d = policy.apply(1000, 3000);          // On the threshold still ties
+    CHECK_EQ(d.winner, WINNER_TIE);
+    CHECK_EQ(d.time[0], 2000);
+
+    d = policy.apply(3001, 1000);
+    CHECK_EQ(d.winner, WINNER_LANE2);
+    CHECK_EQ(d.time[0], 3001);
+    CHECK_EQ(d.time[1], 1000);
+
+    // The average of an odd sum rounds down, and cannot overflow
+    d = policy.apply(1000, 1001);
+    CHECK_EQ(d.time[0], 1000);
+    d = policy.apply(0xFFFFFFF0u, 0xFFFFFFFEu);
+    CHECK_EQ(d.time[0], 0xFFFFFFF7u);
+}
+
+static void testTieMargin() {
+    TiePolicy policy = {TIE_MARGIN, 2000};
+
+    TieDecision d = policy.apply(2500, 1000);
+    CHECK_EQ(d.winner, WINNER_LANE2);
+    CHECK_EQ(d.confidence, 87);
+    CHECK_EQ(d.time[0], 2500);             // Never averaged
+    CHECK_EQ(d.time[1], 1000);
+
+    d = policy.apply(1000, 1000);
+    CHECK_EQ(d.winner, WINNER_TIE);
+    CHECK_EQ(d.confidence, 50);
+}
+
+static void testTieDnf() {
+    for (uint8_t mode = 0; mode < NUM_TIE_MODES; mode++) {
+        TiePolicy policy = {mode, 2000};
+
+        TieDecision d = policy.apply(0, 5000);
+        CHECK_EQ(d.winner, WINNER_LANE2);
+        CHECK_EQ(d.margin, 0);
+        CHECK_EQ(d.confidence, 100);
+
+        d = policy.apply(5000, 0);
+        CHECK_EQ(d.winner, WINNER_LANE1);
+
+        d = policy.apply(0, 0);
+        CHECK_EQ(d.winner, WINNER_TIE);
+        CHECK_EQ(d.time[0], 0);
+    }
+}
+
+static void testDetectionFilter() {
+    DetectionFilter fixed = DetectionFilter::below(150);
+    CHECK_EQ(fixed.levelMm, 150);
+    CHECK(fixed.triggered(149));
+    CHECK(!fixed.triggered(150));
+    CHECK(!fixed.triggered(RANGE_NO_TARGET));
+
+    DetectionFilter wall = DetectionFilter::belowBaseline(800, 100);
+    CHECK_EQ(wall.levelMm, 700);
+    CHECK(wall.triggered(699));
+    CHECK(!wall.triggered(700));
+
+    // A margin larger than the baseline never triggers
+    DetectionFilter none = DetectionFilter::belowBaseline(50, 100);
+    CHECK_EQ(none.levelMm, 0);
+    CHECK(!none.triggered(0));
+}
+
+static void testRaceClock() {
+    RaceClock clock;
+    CHECK(!clock.isRunning());
+
+    clock.start(1000);
+    CHECK(clock.isRunning());
+    CHECK_EQ(clock.startTime(), 1000);
+    CHECK_EQ(clock.since(4500), 3500);
+    CHECK_EQ(clock.elapsedMs(2501000), 2500);
+
+    // micros() wrapping mid-race
+    clock.start(0xFFFFFF00u);
+    CHECK_EQ(clock.since(0x100), 0x200);
+    CHECK_EQ(clock.elapsedMs(0xFFFFFF00u + 5000000u), 5000);
+
+    clock.stop();
+    CHECK(!clock.isRunning());
+    CHECK_EQ(clock.startTime(), 0xFFFFFF00u);
+}
+
+static void testLaneCoreInterpolation() {
+    static const Sample lane1[] = {at(300, 1000), at(100, 21000)};
+    static const Sample lane2[] = {at(300, 2000), at(250, 22000), at(190, 42000)};
+    ScriptedSensor sensors[2];
+    sensors[0].load(lane1);
+    sensors[1].load(lane2);
+
+    TwoLanes core(sensors, 200);
+    core.start(500);
+    CHECK_EQ(core.remaining(), 2);
+    CHECK(core.clock().isRunning());
+
+    StepResult step = core.step();
+    CHECK(step.sampled);
+    CHECK_EQ(step.finished, 0);
+
+    step = core.step();
+    CHECK_EQ(step.finished, 1 << 0);
+    CHECK_EQ(core.remaining(), 1);
+
+    // Crossed halfway between 300 mm at 1000 µs and 100 mm at 21000 µs
+    const LaneResult& r1 = core.result(0);
+    CHECK_EQ(r1.time, 10500);
+    CHECK_EQ(r1.early, 500);
+    CHECK_EQ(r1.raw, 20500);
+    CHECK_EQ(r1.samples, 2);
+    CHECK_EQ(r1.pre, 300);
+    CHECK_EQ(r1.det, 100);
+    CHECK_EQ(r1.conf, 100);
+    CHECK_EQ(r1.place, 1);
+
+    step = core.step();
+    CHECK_EQ(step.finished, 1 << 1);
+    CHECK_EQ(core.remaining(), 0);
+    CHECK(!core.clock().isRunning());
+
+    // 250 mm to 190 mm across a 200 mm level: 5/6 of the 20 ms gap
+    const LaneResult& r2 = core.result(1);
+    CHECK_EQ(r2.time, 38166);
+    CHECK_EQ(r2.early, 21500);
+    CHECK_EQ(r2.raw, 41500);
+    CHECK_EQ(r2.samples, 3);
+    CHECK_EQ(r2.conf, 30);
+    CHECK_EQ(r2.place, 2);
+
+    CHECK(!r1.photo);
+    CHECK(!r2.photo);
+
+    // A finished lane is not polled again
+    int polls = sensors[0].polls;
+    core.step();
+    CHECK_EQ(sensors[0].polls, polls);
+}
+
+static void testLaneCoreFirstSample() {
+    // Already under the sensor on the first sample: no clear sample to
+    // interpolate from, so the window runs from the start
+    static const Sample lane1[] = {NOT_READY, at(100, 3000)};
+    static const Sample lane2[] = {at(400, 3500), at(400, 23500)};
+    ScriptedSensor sensors[2];
+    sensors[0].load(lane1);
+    sensors[1].load(lane2);
+
+    TwoLanes core(sensors, 200);
+    core.start(500);
+
+    core.step();
+    CHECK_EQ(core.result(0).samples, 0);   // Not-ready polls are not samples
+
+    core.step();
+    const LaneResult& r = core.result(0);
+    CHECK_EQ(r.time, 2500);
+    CHECK_EQ(r.early, 0);
+    CHECK_EQ(r.raw, 2500);
+    CHECK_EQ(r.pre, 0);
+    CHECK_EQ(r.conf, 0);
+    CHECK_EQ(r.place, 1);
+
+    // Lane 2 never crosses: ending the race leaves it without a time
+    core.step();
+    core.end();
+    CHECK_EQ(core.remaining(), 0);
+    CHECK_EQ(core.result(1).time, 0);
+    CHECK_EQ(core.result(1).place, 0);
+    CHECK_EQ(core.result(1).samples, 2);
+}
+
+static void testLaneCorePhotoFinish() {
+    // Lane 1 crosses at 11000 µs, lane 2 at 15000 µs, but lane 2's last clear
+    // sample came before lane 1's crossing: the samples cannot order them
+    static const Sample lane1[] = {at(300, 1000), at(100, 21000)};
+    static const Sample lane2[] = {at(300, 5000), at(100, 25000)};
+    ScriptedSensor sensors[2];
+    sensors[0].load(lane1);
+    sensors[1].load(lane2);
+
+    TwoLanes core(sensors, 200);
+    core.start(500);
+    runToEnd(core);
+
+    CHECK_EQ(core.result(0).time, 10500);
+    CHECK_EQ(core.result(1).time, 14500);
+    CHECK_EQ(core.result(0).place, 1);
+    CHECK_EQ(core.result(1).place, 2);
+    CHECK(core.result(0).photo);
+    CHECK(core.result(1).photo);
+
+    // Identical times share a place
+    static const Sample same[] = {at(300, 1000), at(100, 21000)};
+    sensors[0].load(same);
+    sensors[1].load(same);
+    core.start(500);
+    runToEnd(core);
+    CHECK_EQ(core.result(0).place, 1);
+    CHECK_EQ(core.result(1).place, 1);
+}
+
+static void testLaneCoreMask() {
+    static const Sample lane1[] = {at(300, 1000), at(100, 21000)};
+    static const Sample lane2[] = {at(300, 1000), at(100, 21000)};
+    ScriptedSensor sensors[2];
+    sensors[0].load(lane1);
+    sensors[1].load(lane2);
+
+    TwoLanes core(sensors, 200);
+    core.mask(1);
+    CHECK(core.isMasked(1));
+    core.start(500);
+    CHECK_EQ(core.remaining(), 1);
+
+    runToEnd(core);
+    CHECK_EQ(core.remaining(), 0);
+    CHECK_EQ(core.result(0).place, 1);
+    CHECK_EQ(core.result(1).time, 0);
+    CHECK_EQ(sensors[1].polls, 0);         // A masked lane is never polled
+
+    // Masking mid-race drops the lane from the remaining count
+    core.unmaskAll();
+    sensors[0].load(lane1);
+    sensors[1].load(lane2);
+    core.start(500);
+    CHECK_EQ(core.remaining(), 2);
+    core.mask(0);
+    CHECK_EQ(core.remaining(), 1);
+    core.mask(0);
+    CHECK_EQ(core.remaining(), 1);
+    core.mask(5);                          // Out of range is ignored
+    CHECK_EQ(core.remaining(), 1);
+}
+
+static void testLaneCoreBaselineFilter() {
+    // Sensor looking across at a wall 800 mm away; a car in front reads 400
+    static const Sample lane1[] = {at(800, 1000), at(400, 21000)};
+    static const Sample lane2[] = {at(800, 1000), at(790, 21000)};
+    ScriptedSensor sensors[2];
+    sensors[0].load(lane1);
+    sensors[1].load(lane2);
+
+    TwoLanes core(sensors, 200);
+    core.setFilter(0, DetectionFilter::belowBaseline(800, 100));
+    core.setFilter(1, DetectionFilter::belowBaseline(800, 100));
+    core.start(0);
+    core.step();
+    core.step();
+
+    // 800 to 400 across a 700 mm level: a quarter of the way through
+    CHECK_EQ(core.result(0).time, 6000);
+    CHECK_EQ(core.remaining(), 1);         // 790 mm is within the margin
+}
+
+static void testLaneCoreDisplays() {
+    static const Sample lane1[] = {at(300, 1000), at(100, 21000)};
+    static const Sample lane2[] = {at(300, 1000), at(300, 21000), at(100, 41000)};
+    ScriptedSensor sensors[2];
+    sensors[0].load(lane1);
+    sensors[1].load(lane2);
+
+    DisplayLog log = {0, 0, -1, 0, 0};
+    LaneCore<2, ScriptedSensor, RecordingDisplay> core(sensors, 200, RecordingDisplay(&log));
+    core.start(0);
+
+    // Blanks are queued at the start; one lane per call unless flushing all
+    core.flushDisplays(false);
+    CHECK_EQ(log.blanks, 1);
+    core.flushDisplays(true);
+    CHECK_EQ(log.blanks, 2);
+
+    core.step();
+    core.step();
+    core.flushDisplays(true);
+    CHECK_EQ(log.results, 1);
+    CHECK_EQ(log.lastLane, 0);
+    CHECK_EQ(log.lastPlace, 1);
+    CHECK_EQ(log.lastTime, 11000);
+
+    // Lane 2 finishing second does not change lane 1's place, so only lane 2
+    // is redrawn
+    core.step();
+    core.flushDisplays(true);
+    CHECK_EQ(log.results, 2);
+    CHECK_EQ(log.lastLane, 1);
+    CHECK_EQ(log.lastPlace, 2);
+    CHECK_EQ(log.lastTime, 31000);
+
+    core.flushDisplays(true);
+    CHECK_EQ(log.results, 2);
+}
+
+static void testReadyEstimator() {
+    ReadyEstimator ready;
+    ready.begin(0, 20000);
+
+    // First result: nothing to predict from, so the poll time
+    ready.idle(5000);
+    CHECK_EQ(ready.ready(20500), 20500);
+
+    // One period on, found 700 µs late
+    ready.idle(40000);
+    CHECK_EQ(ready.ready(41200), 40500);
+
+    // The loop was busy for 15 ms: still one period on, not the poll time
+    ready.idle(45000);
+    CHECK_EQ(ready.ready(75000), 60500);
+
+    // Earlier than predicted: the poll time is the latest it can have been
+    ready.idle(79000);
+    CHECK_EQ(ready.ready(79500), 79500);
+
+    // Later than predicted (a result was missed): no earlier than the last
+    // poll that found nothing
+    ready.idle(140000);
+    CHECK_EQ(ready.ready(150000), 140000);
+    CHECK_EQ(ready.getPeriodUs(), 20000);  // Wide windows teach nothing
+
+    // micros() wrapping between results
+    ready.begin(0xFFFFF000u, 20000);
+    ready.ready(0xFFFFF100u);
+    ready.idle(0x3000);
+    CHECK_EQ(ready.ready(0x5000), 0xFFFFF100u + 20000);
+}
+
+static void testReadyEstimatorLearnsPeriod() {
+    // The sensor actually delivers every 20400 µs; a loop polling every
+    // 300 µs pins each result to within a poll and corrects the period
+    const uint32_t actualUs = 20400;
+    ReadyEstimator ready;
+    ready.begin(0, 20000);
+
+    uint32_t now = 0;
+    uint32_t nextResult = 1000;
+    for (int result = 0; result < 200; result++) {
+        while (now < nextResult) {
+            ready.idle(now);
+            now += 300;
+        }
+        ready.ready(now);
+        nextResult += actualUs;
+    }
+    CHECK(ready.getPeriodUs() > actualUs - 300 && ready.getPeriodUs() < actualUs + 300);
+
+    // Then a 15 ms stall: the estimate lands near the true ready time
+    // rather than at the poll
+    uint32_t truth = nextResult;
+    ready.idle(truth - 5000);
+    uint32_t estimate = ready.ready(truth + 15000);
+    int32_t error = (int32_t)(estimate - truth);
+    CHECK(error > -600 && error < 600);
+}
+
+int main() {
+    testTieExact();
+    testTieThreshold();
+    testTieMargin();
+    testTieDnf();
+    testDetectionFilter();
+    testRaceClock();
+    testReadyEstimator();
+    testReadyEstimatorLearnsPeriod();
+    testLaneCoreInterpolation();
+    testLaneCoreFirstSample();
+    testLaneCorePhotoFinish();
+    testLaneCoreMask();
+    testLaneCoreBaselineFilter();
+    testLaneCoreDisplays();
+
+    printf("%d checks, %d failed\n", checks, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -152,7 +152,7 @@ def calibrate_sensors_frontend():
     try:
         # First try the direct 'calibrate' command
         logger.info("[DEBUG] About to write 'calibrate\\n' to serial port")
-        serial_manager.serial_port.write(b'calibrate\n')
+        serial_manager.send_direct('calibrate')
         logger.info("[DEBUG] Successfully sent direct 'calibrate' command")
         success = True
     except Exception as e:
@@ -221,7 +221,7 @@ def reset_timer_frontend():
     
     # Send the direct 'resetTimer' command
     try:
-        serial_manager.serial_port.write(b'resetTimer\n')
+        serial_manager.send_direct('resetTimer')
         logger.info("Sent direct 'resetTimer' command")
         success = True
     except Exception as e:
@@ -261,7 +261,7 @@ def test_race_frontend():
     try:
         # First try the direct 'testrace' command
         logger.info("[DEBUG] About to write 'testrace\\n' to serial port")
-        serial_manager.serial_port.write(b'testrace\n')
+        serial_manager.send_direct('testrace')
         logger.info("[DEBUG] Successfully sent direct 'testrace' command")
         success = True
     except Exception as e:
@@ -271,7 +271,7 @@ def test_race_frontend():
         # Try fallback using direct socket write
         try:
             logger.info("[DEBUG] Trying fallback: Writing raw bytes directly to serial port")
-            serial_manager.serial_port.write(b'testrace\n')
+            serial_manager.send_direct('testrace')
             logger.info("[DEBUG] Successfully sent fallback 'testrace' command")
             success = True
         except Exception as e2:
@@ -327,7 +327,7 @@ def car_loaded_frontend():
     try:
         # First try the direct 'carLoaded' command
         logger.info("[DEBUG] About to write 'carLoaded\\n' to serial port")
-        serial_manager.serial_port.write(b'carLoaded\n')
+        serial_manager.send_direct('carLoaded')
         logger.info("[DEBUG] Successfully sent direct 'carLoaded' command")
         success = True
     except Exception as e:
@@ -385,7 +385,7 @@ def force_reset_frontend():
     
     # Send the direct 'forceReset' command
     try:
-        serial_manager.serial_port.write(b'forceReset\n')
+        serial_manager.send_direct('forceReset')
         logger.info("Sent direct 'forceReset' command")
         success = True
     except Exception as e:
@@ -454,8 +454,7 @@ def handle_direct_command(data):
     
     # Send the raw command (without JSON wrapping)
     try:
-        serial_manager.serial_port.write((command + "\n").encode())
-        logger.info(f"Sent direct command: {command}")
+        serial_manager.send_direct(command)
         
         # Emit acknowledgement
         socketio.emit('command_sent', {
@@ -1,4 +1,6 @@
 import json
+import os
+import struct
 import serial
 import serial.tools.list_ports
 import threading
@@ -12,17 +14,38 @@ from app import db
 from flask import _app_ctx_stack
 import importlib
 from app import flask_app
+from app.utils import serial_protocol as proto
 
 # Set up logging
 logger = logging.getLogger(__name__)
 logger.setLevel(logging.INFO)
 
+# Must match SERIAL_BAUD in the controller firmware
+DEFAULT_BAUDRATE = 921600
+
+PROTOCOL_JSON = 'json'
+PROTOCOL_BINARY = 'binary'
+
+# Binary commands are sent one at a time and retransmitted until acknowledged.
+# The retry budget also covers a controller that is still booting.
+ACK_TIMEOUT = 0.5
+MAX_COMMAND_TRIES = 10
+
+# The controller may still be booting when the port opens
+HELLO_INTERVAL = 2.0
+MAX_HELLO_ATTEMPTS = 5
+
 class SerialManager:
     """
     Manages serial communication with the ESP32 hardware
     Provides methods for sending commands and processing responses
+
+    The link starts as JSON lines and is upgraded to the framed binary
+    protocol in serial_protocol.py when the controller answers our hello.
+    Controllers without binary support simply never answer, and the link
+    stays on JSON.
     """
-    def __init__(self, socketio=None, baudrate=115200, timeout=1):
+    def __init__(self, socketio=None, baudrate=DEFAULT_BAUDRATE, timeout=1):
         self.serial_port = None
         self.port_name = None
         self.baudrate = baudrate
@@ -34,6 +57,21 @@ class SerialManager:
         self.last_status = {}
         self.available_ports = []
         
+        # Link protocol state, guarded by _lock
+        self._lock = threading.Lock()
+        self.protocol = PROTOCOL_JSON
+        self._rx_buffer = bytearray()
+        self._tx_seq = 0
+        self._rx_seq = None
+        self._command_queue = []
+        self._inflight = None
+        self._hello_attempts = 0
+        self._last_hello = 0
+        self.link_stats = {}
+        
+        # Stream subscriptions requested by the app, kept across reconnects
+        self.subscriptions = {}
+        
         # Initialize logger
         self.logger = logging.getLogger(__name__)
         self.logger.setLevel(logging.INFO)
@@ -77,6 +115,7 @@ class SerialManager:
             self.port_name = port
             self.connected = True
             self.logger.info(f"Connected to ESP32 on port {port}")
+            self._reset_link()
             
             # Start the read thread
             self.running = True
@@ -87,6 +126,10 @@ class SerialManager:
             # Send initial status request
             self.send_command("status")
             
+            # Offer the binary protocol last: any JSON line after it would
+            # drop the controller straight back to JSON
+            self._send_hello()
+            
             # Emit connection success
             if self.socketio:
                 self.socketio.emit('hardware_status', {
@@ -135,6 +178,11 @@ class SerialManager:
             return False
         
         try:
+            # Also accept a complete command object
+            if isinstance(command, dict):
+                params = command
+                command = command.get("cmd")
+            
             cmd_obj = {"cmd": command}
             if params:
                 cmd_obj.update(params)
@@ -143,8 +191,11 @@ class SerialManager:
             if command == "startRace" and "skip_confirm" not in cmd_obj:
                 cmd_obj["skip_confirm"] = True  # Default to skipping confirmation for web-initiated starts
             
+            if self.protocol == PROTOCOL_BINARY:
+                return self._queue_binary_command(command, cmd_obj)
+            
             cmd_str = json.dumps(cmd_obj) + "\n"
-            self.serial_port.write(cmd_str.encode())
+            self._write(cmd_str.encode())
             logger.info(f"Sent command: {cmd_str.strip()}")
             return True
         
@@ -152,6 +203,130 @@ class SerialManager:
             logger.error(f"Error sending command: {e}")
             return False
     
+    def send_direct(self, command):
+        """Send one of the controller's plain-text commands (e.g. 'calibrate')"""
+        if not self.connected:
+            logger.error("Cannot send command: Not connected to ESP32")
+            return False
+        
+        if self.protocol == PROTOCOL_BINARY:
+            return self._queue_binary_command(command)
+        
+        self._write(f"{command}\n".encode())
+        logger.info(f"Sent direct command: {command}")
+        return True
+    
+    def subscribe(self, stream, enabled=True, mode=None, interval_ms=None,
+                  threshold=None, while_racing=None):
+        """Configure one of the controller's streams ('sensor', 'status' or
+        'race_update'). Options left as None keep the controller's setting.
+        The subscription is re-applied whenever the link is renegotiated."""
+        params = {"stream": stream, "enabled": enabled}
+        for key, value in (("mode", mode), ("interval_ms", interval_ms),
+                           ("threshold", threshold), ("while_racing", while_racing)):
+            if value is not None:
+                params[key] = value
+        self.subscriptions[stream] = dict(self.subscriptions.get(stream, {}), **params)
+        return self.send_command("subscribe", params)
+    
+    def get_link_stats(self):
+        """Protocol and frame counters for the serial link"""
+        with self._lock:
+            return dict(self.link_stats, protocol=self.protocol)
+    
+    def _write(self, data):
+        with self._lock:
+            self.serial_port.write(data)
+    
+    def _reset_link(self):
+        with self._lock:
+            self.protocol = PROTOCOL_JSON
+            self._rx_buffer = bytearray()
+            self._tx_seq = 0
+            self._rx_seq = None
+            self._command_queue = []
+            self._inflight = None
+            self._hello_attempts = 0
+            self._last_hello = 0
+            self.link_stats = {
+                'frames': 0,
+                'crc_errors': 0,
+                'lost': 0,
+                'duplicates': 0,
+                'retransmits': 0,
+                'unacknowledged': 0,
+            }
+    
+    def _send_hello(self):
+        """Offer the binary protocol; the reply arrives as a JSON 'hello'"""
+        self._hello_attempts += 1
+        self._last_hello = time.time()
+        hello = {"cmd": "hello", "protocol": PROTOCOL_BINARY, "version": proto.PROTOCOL_VERSION}
+        self._write((json.dumps(hello) + "\n").encode())
+    
+    def _queue_binary_command(self, command, params=None):
+        with self._lock:
+            frame = proto.encode_command(command, self._tx_seq, params)
+            if frame is None:
+                logger.error(f"Command {command} has no binary form")
+                return False
+            self._command_queue.append({
+                'command': command,
+                'seq': self._tx_seq,
+                'frame': frame,
+                'tries': 0,
+                'sent_at': 0,
+            })
+            self._tx_seq = (self._tx_seq + 1) & 0xFFFF
+            self._service_commands_locked()
+        logger.info(f"Queued binary command: {command}")
+        return True
+    
+    def _service_commands_locked(self):
+        """Sends the next command, or retransmits the one awaiting its ACK"""
+        now = time.time()
+        if self._inflight is None and self._command_queue:
+            self._inflight = self._command_queue.pop(0)
+        
+        cmd = self._inflight
+        if cmd is None or (cmd['tries'] > 0 and now - cmd['sent_at'] < ACK_TIMEOUT):
+            return
+        
+        if cmd['tries'] >= MAX_COMMAND_TRIES:
+            self.link_stats['unacknowledged'] += 1
+            self._inflight = None
+            logger.error(f"Command {cmd['command']} was never acknowledged")
+            if self.socketio:
+                self.socketio.emit('esp32_error', {
+                    'type': 'error',
+                    'message': f"Command {cmd['command']} was not acknowledged by the controller"
+                })
+            return
+        
+        if cmd['tries'] > 0:
+            self.link_stats['retransmits'] += 1
+        cmd['tries'] += 1
+        cmd['sent_at'] = now
+        self.serial_port.write(cmd['frame'])
+    
+    def _handle_ack(self, payload):
+        seq, status = struct.unpack('<HB', payload)
+        with self._lock:
+            cmd = self._inflight
+            if cmd is None or cmd['seq'] != seq:
+                return  # Late ACK for a retransmit
+            self._inflight = None
+            self._service_commands_locked()
+        
+        if status != proto.ACK_OK:
+            reason = proto.ACK_STATUS_NAMES.get(status, status)
+            self.logger.error(f"Controller rejected {cmd['command']}: {reason}")
+            if self.socketio:
+                self.socketio.emit('esp32_error', {
+                    'type': 'error',
+                    'message': f"Controller rejected {cmd['command']}: {reason}"
+                })
+    
     def _read_serial_data(self):
         """Background thread to read data from the serial port"""
         logger.info("Serial read thread started")
@@ -159,18 +334,241 @@ class SerialManager:
         while self.running:
             try:
                 if self.serial_port and self.serial_port.is_open:
-                    if self.serial_port.in_waiting > 0:
-                        line = self.serial_port.readline().decode('utf-8').strip()
-                        if line:
-                            self._process_serial_data(line)
+                    waiting = self.serial_port.in_waiting
+                    if waiting > 0:
+                        self._feed(self.serial_port.read(waiting))
+                    self._service_link()
                 time.sleep(0.01)  # Small delay to prevent CPU hogging
             
             except Exception as e:
                 logger.error(f"Error reading from serial port: {e}")
                 time.sleep(1)  # Longer delay on error
     
+    def _service_link(self):
+        """Hello retries while negotiating, command retransmits once binary"""
+        if self.protocol == PROTOCOL_JSON:
+            if (self._hello_attempts < MAX_HELLO_ATTEMPTS and
+                    time.time() - self._last_hello > HELLO_INTERVAL):
+                self._send_hello()
+            return
+        with self._lock:
+            self._service_commands_locked()
+    
+    def _feed(self, data):
+        """Splits received bytes into JSON lines or binary frames"""
+        self._rx_buffer.extend(data)
+        while self._rx_buffer:
+            if self.protocol == PROTOCOL_BINARY:
+                if not self._take_frame():
+                    break
+                continue
+            
+            end = self._rx_buffer.find(b'\n')
+            if end < 0:
+                break
+            line = bytes(self._rx_buffer[:end])
+            del self._rx_buffer[:end + 1]
+            text = line.decode('utf-8', errors='replace').strip()
+            if text:
+                self._process_serial_data(text)
+    
+    def _take_frame(self):
+        """Handles the next frame in binary mode; returns False if incomplete"""
+        buffer = self._rx_buffer
+        zero = buffer.find(b'\x00')
+        
+        # A JSON line before the next delimiter means the controller went back
+        # to JSON, usually because it rebooted
+        start = 0
+        while True:
+            end = buffer.find(b'\n', start)
+            if end < 0 or (zero >= 0 and end > zero):
+                break
+            line = bytes(buffer[start:end]).rstrip(b'\r')
+            if line.startswith(b'{') and line.endswith(b'}'):
+                try:
+                    json.loads(line)
+                except ValueError:
+                    pass
+                else:
+                    self.logger.warning("Controller fell back to JSON; renegotiating")
+                    del buffer[:start]
+                    with self._lock:
+                        self.protocol = PROTOCOL_JSON
+                        self._hello_attempts = 0
+                        self._last_hello = 0
+                        self._inflight = None
+                        self._command_queue = []
+                    return True
+            start = end + 1
+        
+        if zero < 0:
+            if len(buffer) > 4096:
+                del buffer[:start]  # Boot noise that never reached a delimiter
+            return False
+        
+        block = bytes(buffer[:zero])
+        del buffer[:zero + 1]
+        if not block:
+            return True
+        
+        try:
+            msg_type, seq, payload = proto.decode_frame(block)
+        except proto.FrameError as e:
+            self.link_stats['crc_errors'] += 1
+            self.logger.warning(f"Discarding serial frame: {e}")
+            return True
+        
+        self.link_stats['frames'] += 1
+        if self._rx_seq is not None:
+            expected = (self._rx_seq + 1) & 0xFFFF
+            if seq == self._rx_seq:
+                self.link_stats['duplicates'] += 1
+                self.logger.warning(f"Duplicate serial frame {seq} ignored")
+                return True
+            if seq != expected:
+                missed = (seq - expected) & 0xFFFF
+                self.link_stats['lost'] += missed
+                self.logger.warning(f"{missed} serial frame(s) lost before frame {seq}")
+        self._rx_seq = seq
+        
+        try:
+            if msg_type == proto.MSG_ACK:
+                self._handle_ack(payload)
+                return True
+            message = proto.frame_to_message(msg_type, payload)
+        except (struct.error, ValueError) as e:
+            self.logger.error(f"Malformed serial frame type {msg_type:#04x}: {e}")
+            return True
+        
+        if message is not None:
+            self._handle_message(message)
+        return True
+    
+    def _handle_message(self, json_data):
+        """Dispatch one message, whether it arrived as JSON or as a frame"""
+        # Force-add the port name to all messages for the frontend
+        json_data['port'] = self.port_name
+        
+        # Protocol negotiation
+        if json_data.get("type") == "hello":
+            if json_data.get("protocol") == PROTOCOL_BINARY:
+                with self._lock:
+                    self.protocol = PROTOCOL_BINARY
+                    self._rx_seq = None
+                self.logger.info("Serial link switched to binary frames")
+            # The controller may have rebooted with its default streams
+            for params in list(self.subscriptions.values()):
+                self.send_command("subscribe", params)
+            return
+        if json_data.get("type") == "protocol" and json_data.get("protocol") == PROTOCOL_JSON:
+            return
+        if json_data.get("type") == "subscription":
+            self.logger.info(f"Stream subscription: {json_data}")
+            return
+        
+        # Always maintain last status for hardware status requests
+        if "type" in json_data and json_data["type"] == "status":
+            self.last_status = json_data
+        
+            # Create hardware status message
+            hardware_status = {
+                'connected': True,
+                'port': self.port_name,
+                'status': json_data
+            }
+        
+            # Emit hardware status update
+            if self.socketio:
+                self.logger.info(f"Emitting hardware_status: {hardware_status}")
+                self.socketio.emit('hardware_status', hardware_status)
+        
+        # Handle specific message types
+        if "type" in json_data:
+            msg_type = json_data["type"]
+        
+            # 1. Sensor readings
+            if msg_type == "sensor_reading":
+                if self.socketio:
+                    self.logger.info(f"Emitting sensor reading: {json_data}")
+                    self.socketio.emit('sensor_reading', json_data)
+        
+            # 2. Race events
+            elif msg_type == "race_start":
+                if self.socketio:
+                    self.logger.info(f"Emitting race start: {json_data}")
+                    self.socketio.emit('race_start', json_data)
+        
+            elif msg_type == "race_update":
+                if self.socketio:
+                    self.logger.info(f"Emitting race update: {json_data}")
+                    self.socketio.emit('race_update', json_data)
+        
+            elif msg_type == "race_result":
+                if self.socketio:
+                    self.logger.info(f"Emitting race result as race_completed: {json_data}")
+                    self.socketio.emit('race_completed', json_data)
+        
+                    # Update race results in the database
+                    try:
+                        self.logger.info(f"Updating race results in database: {json_data}")
+                        # Add a race/heat ID to the data if not present
+                        if 'heat_id' not in json_data and 'race_id' not in json_data:
+                            # Log the race result with a warning about missing IDs
+                            self.logger.warning(f"Race result received without heat_id or race_id: {json_data}")
+                            # Try to find the most recent in-progress race
+                            from app.models.race import Race
+                            active_race = Race.query.filter_by(status='in_progress').order_by(Race.id.desc()).first()
+                            if active_race:
+                                json_data['race_id'] = active_race.id
+                                self.logger.info(f"Using most recent in-progress race ID: {active_race.id}")
+        
+                        self._update_race_results(json_data)
+                    except Exception as e:
+                        self.logger.error(f"Error updating race results: {e}")
+        
+            elif msg_type == "race_completed":
+                if self.socketio:
+                    self.logger.info(f"Emitting race completed: {json_data}")
+                    self.socketio.emit('race_completed', json_data)
+        
+                    # Update race results in the database 
+                    try:
+                        self.logger.info(f"Updating race results in database: {json_data}")
+                        # Add a race/heat ID to the data if not present
+                        if 'heat_id' not in json_data and 'race_id' not in json_data:
+                            # Log the race result with a warning about missing IDs
+                            self.logger.warning(f"Race result received without heat_id or race_id: {json_data}")
+                            # Try to find the most recent in-progress race
+                            from app.models.race import Race
+                            active_race = Race.query.filter_by(status='in_progress').order_by(Race.id.desc()).first()
+                            if active_race:
+                                json_data['race_id'] = active_race.id
+                                self.logger.info(f"Using most recent in-progress race ID: {active_race.id}")
+        
+                        self._update_race_results(json_data)
+                    except Exception as e:
+                        self.logger.error(f"Error updating race results: {e}")
+        
+            elif msg_type == "race_finish":
+                if self.socketio:
+                    self.logger.info(f"Emitting race finish: {json_data}")
+                    self.socketio.emit('race_finish', json_data)
+        
+            # 3. Error messages
+            elif msg_type == "error":
+                if self.socketio:
+                    self.logger.error(f"ESP32 error: {json_data.get('message', 'Unknown error')}")
+                    self.socketio.emit('esp32_error', json_data)
+        
+        # Fallback for legacy messages
+        elif all(key in json_data for key in ['sensor1', 'sensor2']):
+            if self.socketio:
+                self.logger.info(f"Emitting legacy sensor reading: {json_data}")
+                self.socketio.emit('sensor_reading', json_data)
+
     def _process_serial_data(self, data):
-        """Process data received from the ESP32"""
+        """Process a line of text received from the ESP32"""
         self.logger.info(f"Received data: {data}")
         
         try:
@@ -179,109 +577,7 @@ class SerialManager:
                 # Parse JSON data
                 json_data = json.loads(data)
                 self.logger.info(f"Parsed JSON: {json_data}")
-                
-                # Force-add the port name to all messages for the frontend
-                json_data['port'] = self.port_name
-                
-                # Always maintain last status for hardware status requests
-                if "type" in json_data and json_data["type"] == "status":
-                    self.last_status = json_data
-                    
-                    # Create hardware status message
-                    hardware_status = {
-                        'connected': True,
-                        'port': self.port_name,
-                        'status': json_data
-                    }
-                    
-                    # Emit hardware status update
-                    if self.socketio:
-                        self.logger.info(f"Emitting hardware_status: {hardware_status}")
-                        self.socketio.emit('hardware_status', hardware_status)
-                
-                # Handle specific message types
-                if "type" in json_data:
-                    msg_type = json_data["type"]
-                    
-                    # 1. Sensor readings
-                    if msg_type == "sensor_reading":
-                        if self.socketio:
-                            self.logger.info(f"Emitting sensor reading: {json_data}")
-                            self.socketio.emit('sensor_reading', json_data)
-                    
-                    # 2. Race events
-                    elif msg_type == "race_start":
-                        if self.socketio:
-                            self.logger.info(f"Emitting race start: {json_data}")
-                            self.socketio.emit('race_start', json_data)
-                    
-                    elif msg_type == "race_update":
-                        if self.socketio:
-                            self.logger.info(f"Emitting race update: {json_data}")
-                            self.socketio.emit('race_update', json_data)
-                    
-                    elif msg_type == "race_result":
-                        if self.socketio:
-                            self.logger.info(f"Emitting race result as race_completed: {json_data}")
-                            self.socketio.emit('race_completed', json_data)
-                            
-                            # Update race results in the database
-                            try:
-                                self.logger.info(f"Updating race results in database: {json_data}")
-                                # Add a race/heat ID to the data if not present
-                                if 'heat_id' not in json_data and 'race_id' not in json_data:
-                                    # Log the race result with a warning about missing IDs
-                                    self.logger.warning(f"Race result received without heat_id or race_id: {json_data}")
-                                    # Try to find the most recent in-progress race
-                                    from app.models.race import Race
-                                    active_race = Race.query.filter_by(status='in_progress').order_by(Race.id.desc()).first()
-                                    if active_race:
-                                        json_data['race_id'] = active_race.id
-                                        self.logger.info(f"Using most recent in-progress race ID: {active_race.id}")
-                                
-                                self._update_race_results(json_data)
-                            except Exception as e:
-                                self.logger.error(f"Error updating race results: {e}")
-                    
-                    elif msg_type == "race_completed":
-                        if self.socketio:
-                            self.logger.info(f"Emitting race completed: {json_data}")
-                            self.socketio.emit('race_completed', json_data)
-                            
-                            # Update race results in the database 
-                            try:
-                                self.logger.info(f"Updating race results in database: {json_data}")
-                                # Add a race/heat ID to the data if not present
-                                if 'heat_id' not in json_data and 'race_id' not in json_data:
-                                    # Log the race result with a warning about missing IDs
-                                    self.logger.warning(f"Race result received without heat_id or race_id: {json_data}")
-                                    # Try to find the most recent in-progress race
-                                    from app.models.race import Race
-                                    active_race = Race.query.filter_by(status='in_progress').order_by(Race.id.desc()).first()
-                                    if active_race:
-                                        json_data['race_id'] = active_race.id
-                                        self.logger.info(f"Using most recent in-progress race ID: {active_race.id}")
-                                
-                                self._update_race_results(json_data)
-                            except Exception as e:
-                                self.logger.error(f"Error updating race results: {e}")
-                    
-                    elif msg_type == "race_finish":
-                        if self.socketio:
-                            self.logger.info(f"Emitting race finish: {json_data}")
-                            self.socketio.emit('race_finish', json_data)
-                    
-                    # 3. Error messages
-                    elif msg_type == "error":
-                        if self.socketio:
-                            self.logger.error(f"ESP32 error: {json_data.get('message', 'Unknown error')}")
-                            self.socketio.emit('esp32_error', json_data)
-                
-                # Fallback for legacy messages
-                elif all(key in json_data for key in ['sensor1', 'sensor2']):
-                    if self.socketio:
-                        self.logger.info(f"Emitting legacy sensor reading: {json_data}")
-                        self.socketio.emit('sensor_reading', json_data)
+                self._handle_message(json_data)
             else:
                 # It's not JSON, check if it's a boot message or other debug output we can handle
                 if any(boot_msg in data for boot_msg in ['rst:', 'boot:', 'mode:', 'load:', 'entry', 'configsip']):
@@ -474,9 +770,10 @@ class SerialManager:
         
         # Format the response correctly for the dashboard
         if self.last_status:
-            return {'connected': True, 'port': self.port_name, 'status': self.last_status}
+            return {'connected': True, 'port': self.port_name, 'status': self.last_status,
+                    'link': self.get_link_stats()}
         else:
-            return {'connected': True, 'port': self.port_name}
+            return {'connected': True, 'port': self.port_name, 'link': self.get_link_stats()}
     
     def is_connected(self):
         """Check if the serial manager is connected to hardware"""
@@ -517,7 +814,8 @@ serial_manager = None
 def init_serial_manager(socketio_instance):
     """Initialize the serial manager with the SocketIO instance"""
     global serial_manager
-    serial_manager = SerialManager(socketio=socketio_instance)
+    baudrate = int(os.environ.get('ESP32_BAUDRATE', DEFAULT_BAUDRATE))
+    serial_manager = SerialManager(socketio=socketio_instance, baudrate=baudrate)
     return serial_manager
 
 def get_serial_manager():
@@ -0,0 +1,238 @@
+"""
+Binary framing for the serial link to the race controller.
+
+Mirrors co2_race_controller/SerialProtocol.h: a frame is
+[type:u8][seq:u16][payload][crc16:u16], COBS-encoded and terminated by 0x00,
+little-endian, CRC-16/CCITT-FALSE over type, seq and payload.
+"""
+import binascii
+import json
+import struct
+
+PROTOCOL_VERSION = 1
+MAX_HOST_FRAME = 64
+
+# Host -> controller
+MSG_COMMAND = 0x10
+
+# Controller -> host
+MSG_ACK = 0x02
+MSG_STATUS = 0x20
+MSG_SENSOR = 0x21
+MSG_SENSOR_WINDOW = 0x22
+MSG_RACE_START = 0x23
+MSG_RACE_STARTED = 0x24
+MSG_RACE_UPDATE = 0x25
+MSG_RACE_RESULT = 0x26
+MSG_CALIBRATION = 0x27
+MSG_JSON = 0x30
+
+# Command names accepted by send_command, including the legacy spellings
+COMMANDS = {
+    'status': 1,
+    'ping': 2,
+    'start_race': 3,
+    'startRace': 3,
+    'reset_timer': 4,
+    'resetTimer': 4,
+    'calibrate': 5,
+    'car_loaded': 6,
+    'carLoaded': 6,
+    'force_reset': 7,
+    'forceReset': 7,
+    'fire_relay': 8,
+    'test_race': 9,
+    'testrace': 9,
+    'subscribe': 10,
+}
+CMD_START_RACE = 3
+CMD_SUBSCRIBE = 10
+
+# Subscribable streams and their modes
+STREAMS = {'sensor': 0, 'status': 1, 'race_update': 2}
+STREAM_MODES = {'raw': 0, 'minmax': 1, 'on_change': 2}
+MODE_KEEP = 0xFF
+SUB_ENABLED = 0x01
+SUB_WHILE_RACING = 0x02
+SUB_SET_WHILE_RACING = 0x04
+
+ACK_OK = 0
+ACK_STATUS_NAMES = {0: 'ok', 1: 'unknown command', 2: 'bad length'}
+
+FLAG_CARS_LOADED = 0x01
+FLAG_RACE_STARTED = 0x02
+FLAG_CAR1_FINISHED = 0x04
+FLAG_CAR2_FINISHED = 0x08
+FLAG_SENSORS_CALIBRATED = 0x10
+
+# Index is the controller's SystemState
+STATE_NAMES = ['IDLE', 'CARS_LOADED', 'RACE_READY', 'COUNTDOWN', 'RACING', 'RACE_FINISHED']
+WINNER_NAMES = {0: 'tie', 1: 'car1', 2: 'car2'}
+
+
+class FrameError(ValueError):
+    """Raised for a malformed COBS block or a CRC mismatch"""
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE"""
+    return binascii.crc_hqx(data, 0xFFFF)
+
+
+def cobs_encode(data):
+    out = bytearray([0])
+    code_index = 0
+    code = 1
+    for byte in data:
+        if byte == 0:
+            out[code_index] = code
+            code_index = len(out)
+            out.append(0)
+            code = 1
+            continue
+        out.append(byte)
+        code += 1
+        if code == 0xFF:
+            out[code_index] = code
+            code_index = len(out)
+            out.append(0)
+            code = 1
+    out[code_index] = code
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        i += 1
+        if code == 0 or i + code - 1 > len(data):
+            raise FrameError('malformed COBS block')
+        out += data[i:i + code - 1]
+        i += code - 1
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def encode_frame(msg_type, seq, payload=b''):
+    """Returns the encoded frame including its 0x00 delimiter"""
+    raw = struct.pack('<BH', msg_type, seq & 0xFFFF) + payload
+    raw += struct.pack('<H', crc16(raw))
+    return cobs_encode(raw) + b'\x00'
+
+
+def decode_frame(block):
+    """Decodes one block (without delimiter) into (type, seq, payload)"""
+    raw = cobs_decode(block)
+    if len(raw) < 5:
+        raise FrameError('frame too short')
+    body, (crc,) = raw[:-2], struct.unpack('<H', raw[-2:])
+    if crc16(body) != crc:
+        raise FrameError('CRC mismatch')
+    msg_type, seq = struct.unpack('<BH', body[:3])
+    return msg_type, seq, body[3:]
+
+
+def encode_command(name, seq, params=None):
+    """Encodes a command frame, or returns None for a command with no binary form"""
+    command = COMMANDS.get(name)
+    if command is None:
+        return None
+    params = params or {}
+    payload = struct.pack('<B', command)
+    if command == CMD_START_RACE:
+        payload += struct.pack('<i', int(params.get('race_id') or 0))
+    elif command == CMD_SUBSCRIBE:
+        stream = STREAMS.get(params.get('stream'))
+        if stream is None:
+            return None
+        flags = SUB_ENABLED if params.get('enabled', True) else 0
+        if 'while_racing' in params:
+            flags |= SUB_SET_WHILE_RACING
+            if params['while_racing']:
+                flags |= SUB_WHILE_RACING
+        payload += struct.pack('<BBBHH', stream,
+                               STREAM_MODES.get(params.get('mode'), MODE_KEEP), flags,
+                               int(params.get('interval_ms') or 0), int(params.get('threshold') or 0))
+    return encode_frame(MSG_COMMAND, seq, payload)
+
+
+def frame_to_message(msg_type, payload):
+    """Converts a controller frame into the dict its JSON form would have produced"""
+    if msg_type == MSG_STATUS:
+        (state, flags, car1, car2, base1, base2, timestamp,
+         tx_dropped, rx_dropped) = struct.unpack('<BBIIHHIII', payload)
+        return {
+            'type': 'status',
+            'race_state': STATE_NAMES[state] if state < len(STATE_NAMES) else 'UNKNOWN',
+            'cars_loaded': bool(flags & FLAG_CARS_LOADED),
+            'race_started': bool(flags & FLAG_RACE_STARTED),
+            'car1_finished': bool(flags & FLAG_CAR1_FINISHED),
+            'car2_finished': bool(flags & FLAG_CAR2_FINISHED),
+            'car1_time': car1,
+            'car2_time': car2,
+            'sensors_calibrated': bool(flags & FLAG_SENSORS_CALIBRATED),
+            'sensor1_baseline': base1,
+            'sensor2_baseline': base2,
+            'timestamp': timestamp,
+            'tx_dropped': tx_dropped,
+            'rx_dropped': rx_dropped,
+        }
+    if msg_type == MSG_SENSOR:
+        timestamp, sensor1, sensor2 = struct.unpack('<IHH', payload)
+        return {'type': 'sensor_reading', 'sensor1': sensor1, 'sensor2': sensor2, 'timestamp': timestamp}
+    if msg_type == MSG_SENSOR_WINDOW:
+        (timestamp, sensor1, sensor2, min1, max1, min2, max2,
+         samples) = struct.unpack('<IHHHHHHH', payload)
+        return {
+            'type': 'sensor_reading',
+            'sensor1': sensor1,
+            'sensor2': sensor2,
+            'sensor1_min': min1,
+            'sensor1_max': max1,
+            'sensor2_min': min2,
+            'sensor2_max': max2,
+            'samples': samples,
+            'timestamp': timestamp,
+        }
+    if msg_type == MSG_RACE_START:
+        race_id, countdown = struct.unpack('<iB', payload)
+        return {'type': 'race_start', 'countdown': countdown, 'race_id': race_id}
+    if msg_type == MSG_RACE_STARTED:
+        race_id, timestamp = struct.unpack('<iI', payload)
+        return {'type': 'race_started', 'countdown': 0, 'race_id': race_id, 'timestamp': timestamp}
+    if msg_type == MSG_RACE_UPDATE:
+        flags, car1, car2, elapsed = struct.unpack('<BIII', payload)
+        return {
+            'type': 'race_update',
+            'car1_finished': bool(flags & FLAG_CAR1_FINISHED),
+            'car2_finished': bool(flags & FLAG_CAR2_FINISHED),
+            'car1_time': car1,
+            'car2_time': car2,
+            'elapsed_time': elapsed,
+        }
+    if msg_type == MSG_RACE_RESULT:
+        race_id, car1, car2, winner = struct.unpack('<iIIB', payload)
+        return {
+            'type': 'race_result',
+            'car1_time': car1,
+            'car2_time': car2,
+            'winner': WINNER_NAMES.get(winner, 'tie'),
+            'race_id': race_id,
+        }
+    if msg_type == MSG_CALIBRATION:
+        success, base1, base2, valid1, valid2 = struct.unpack('<BHHBB', payload)
+        return {
+            'type': 'calibration',
+            'sensor1_baseline': base1,
+            'sensor2_baseline': base2,
+            'success': bool(success),
+            'valid_readings_1': valid1,
+            'valid_readings_2': valid2,
+            'sensors_calibrated': bool(success),
+        }
+    if msg_type == MSG_JSON:
+        return json.loads(payload.decode('utf-8'))
+    return None
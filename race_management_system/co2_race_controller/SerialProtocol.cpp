@@ -0,0 +1,81 @@
+#include "SerialProtocol.h"
+#include <string.h>
+
+namespace serialproto {
+
+uint16_t crc16(const uint8_t* data, size_t length) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+size_t encodeFrame(uint8_t type, uint16_t seq, const void* payload, size_t length,
+                   uint8_t* out, size_t capacity) {
+    uint8_t raw[MAX_FRAME];
+    size_t rawLength = HEADER_SIZE + length + CRC_SIZE;
+    if (rawLength > sizeof(raw) || capacity < encodedSize(length)) return 0;
+
+    raw[0] = type;
+    raw[1] = seq & 0xFF;
+    raw[2] = seq >> 8;
+    if (length > 0) memcpy(raw + HEADER_SIZE, payload, length);
+    uint16_t crc = crc16(raw, HEADER_SIZE + length);
+    raw[HEADER_SIZE + length] = crc & 0xFF;
+    raw[HEADER_SIZE + length + 1] = crc >> 8;
+
+    // COBS: each code byte gives the distance to the next zero
+    size_t codeIndex = 0;
+    size_t written = 1;
+    uint8_t code = 1;
+    for (size_t i = 0; i < rawLength; i++) {
+        if (raw[i] == 0) {
+            out[codeIndex] = code;
+            codeIndex = written++;
+            code = 1;
+            continue;
+        }
+        out[written++] = raw[i];
+        if (++code == 0xFF) {
+            out[codeIndex] = code;
+            codeIndex = written++;
+            code = 1;
+        }
+    }
+    out[codeIndex] = code;
+    out[written++] = 0;
+    return written;
+}
+
+bool decodeFrame(uint8_t* data, size_t length, Frame& frame) {
+    // In place: the write position never overtakes the read position
+    size_t read = 0;
+    size_t written = 0;
+    while (read < length) {
+        uint8_t code = data[read++];
+        if (code == 0 || read + code - 1 > length) return false;
+        for (uint8_t i = 1; i < code; i++) {
+            data[written++] = data[read++];
+        }
+        if (code != 0xFF && read < length) {
+            data[written++] = 0;
+        }
+    }
+
+    if (written < HEADER_SIZE + CRC_SIZE) return false;
+    size_t body = written - CRC_SIZE;
+    uint16_t crc = data[body] | (uint16_t)data[body + 1] << 8;
+    if (crc != crc16(data, body)) return false;
+
+    frame.type = data[0];
+    frame.seq = data[1] | (uint16_t)data[2] << 8;
+    frame.payload = data + HEADER_SIZE;
+    frame.length = body - HEADER_SIZE;
+    return true;
+}
+
+}  // namespace serialproto
@@ -0,0 +1,203 @@
+#pragma once
+
+// Binary framing for the race-management serial link.
+//
+// A frame is [type:u8][seq:u16][payload...][crc16:u16], COBS-encoded and
+// terminated by a 0x00 byte. Multi-byte fields are little-endian. The CRC is
+// CRC-16/CCITT-FALSE over type, seq and payload.
+//
+// The link starts in JSON lines. The host switches it to frames by sending
+// {"cmd":"hello","protocol":"binary","version":1}; the controller answers
+// with a JSON hello of its own and frames everything after that. Any other
+// JSON line from the host drops the controller back to JSON, so an older
+// host keeps working unchanged.
+//
+// Portable: no Arduino dependencies.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace serialproto {
+
+const uint8_t PROTOCOL_VERSION = 1;
+
+// Host frames are kept short enough that their COBS code byte is always below
+// '{', which lets the controller tell a JSON hello apart from a frame.
+const size_t MAX_HOST_FRAME = 64;
+const size_t MAX_FRAME = 250;
+const size_t HEADER_SIZE = 3;
+const size_t CRC_SIZE = 2;
+
+// Worst-case encoded size of a frame with the given payload, delimiter included
+constexpr size_t encodedSize(size_t payloadLength) {
+    return (HEADER_SIZE + payloadLength + CRC_SIZE) + (HEADER_SIZE + payloadLength + CRC_SIZE) / 254 + 2;
+}
+
+enum MessageType : uint8_t {
+    // Host -> controller
+    MSG_COMMAND = 0x10,
+
+    // Controller -> host
+    MSG_ACK = 0x02,
+    MSG_STATUS = 0x20,
+    MSG_SENSOR = 0x21,
+    MSG_SENSOR_WINDOW = 0x22,  // Min/max over a subscription window
+    MSG_RACE_START = 0x23,     // Countdown tick
+    MSG_RACE_STARTED = 0x24,
+    MSG_RACE_UPDATE = 0x25,
+    MSG_RACE_RESULT = 0x26,
+    MSG_CALIBRATION = 0x27,
+    MSG_JSON = 0x30            // Anything without a binary form, as JSON text
+};
+
+enum Command : uint8_t {
+    CMD_STATUS = 1,
+    CMD_PING = 2,
+    CMD_START_RACE = 3,        // Payload: race id
+    CMD_RESET_TIMER = 4,
+    CMD_CALIBRATE = 5,
+    CMD_CAR_LOADED = 6,
+    CMD_FORCE_RESET = 7,
+    CMD_FIRE_RELAY = 8,
+    CMD_TEST_RACE = 9,
+    CMD_SUBSCRIBE = 10         // Payload: SubscribePayload
+};
+
+// Periodic output the host can subscribe to. Finish events and results are
+// always sent regardless of subscriptions.
+enum Stream : uint8_t {
+    STREAM_SENSOR = 0,
+    STREAM_STATUS = 1,
+    STREAM_RACE_UPDATE = 2,
+    NUM_STREAMS = 3
+};
+
+enum StreamMode : uint8_t {
+    MODE_RAW = 0,              // Latest value once per interval
+    MODE_MINMAX = 1,           // Min/max over each interval (sensor stream)
+    MODE_ON_CHANGE = 2,        // Only when the value changes, at most once per interval
+    MODE_KEEP = 0xFF           // In SubscribePayload: leave unchanged
+};
+
+enum SubscribeFlags : uint8_t {
+    SUB_ENABLED = 0x01,
+    SUB_WHILE_RACING = 0x02,
+    SUB_SET_WHILE_RACING = 0x04   // SUB_WHILE_RACING is meaningful
+};
+
+// An ACK confirms the command frame arrived intact and was accepted. Whether
+// the command succeeded in the current race state is reported separately,
+// exactly as in JSON mode.
+enum AckStatus : uint8_t {
+    ACK_OK = 0,
+    ACK_UNKNOWN_COMMAND = 1,
+    ACK_BAD_LENGTH = 2
+};
+
+enum StatusFlags : uint8_t {
+    FLAG_CARS_LOADED = 0x01,
+    FLAG_RACE_STARTED = 0x02,
+    FLAG_CAR1_FINISHED = 0x04,
+    FLAG_CAR2_FINISHED = 0x08,
+    FLAG_SENSORS_CALIBRATED = 0x10
+};
+
+struct __attribute__((packed)) CommandPayload {
+    uint8_t command;
+    int32_t raceId;            // Optional, only for CMD_START_RACE
+};
+
+struct __attribute__((packed)) SubscribePayload {
+    uint8_t command;           // CMD_SUBSCRIBE
+    uint8_t stream;
+    uint8_t mode;              // StreamMode, MODE_KEEP to leave unchanged
+    uint8_t flags;             // SubscribeFlags
+    uint16_t intervalMs;       // 0 to leave unchanged
+    uint16_t threshold;        // On-change threshold in mm, 0 to leave unchanged
+};
+
+struct __attribute__((packed)) AckPayload {
+    uint16_t seq;              // Sequence number of the acknowledged command
+    uint8_t status;
+};
+
+struct __attribute__((packed)) StatusPayload {
+    uint8_t state;             // SystemState
+    uint8_t flags;             // StatusFlags
+    uint32_t car1TimeMs;
+    uint32_t car2TimeMs;
+    uint16_t sensor1Baseline;
+    uint16_t sensor2Baseline;
+    uint32_t timestampMs;
+    uint32_t txDropped;        // Messages dropped for lack of TX buffer space
+    uint32_t rxDropped;        // Oversized or corrupt input discarded
+};
+
+struct __attribute__((packed)) SensorPayload {
+    uint32_t timestampMs;
+    uint16_t sensor1;
+    uint16_t sensor2;
+};
+
+struct __attribute__((packed)) SensorWindowPayload {
+    uint32_t timestampMs;
+    uint16_t sensor1;          // Latest readings
+    uint16_t sensor2;
+    uint16_t sensor1Min;
+    uint16_t sensor1Max;
+    uint16_t sensor2Min;
+    uint16_t sensor2Max;
+    uint16_t samples;
+};
+
+struct __attribute__((packed)) RaceStartPayload {
+    int32_t raceId;
+    uint8_t countdown;
+};
+
+struct __attribute__((packed)) RaceStartedPayload {
+    int32_t raceId;
+    uint32_t timestampMs;
+};
+
+struct __attribute__((packed)) RaceUpdatePayload {
+    uint8_t flags;             // FLAG_CAR1_FINISHED / FLAG_CAR2_FINISHED
+    uint32_t car1TimeMs;
+    uint32_t car2TimeMs;
+    uint32_t elapsedMs;
+};
+
+struct __attribute__((packed)) RaceResultPayload {
+    int32_t raceId;
+    uint32_t car1TimeMs;
+    uint32_t car2TimeMs;
+    uint8_t winner;            // 0 tie, 1 car1, 2 car2
+};
+
+struct __attribute__((packed)) CalibrationPayload {
+    uint8_t success;
+    uint16_t sensor1Baseline;
+    uint16_t sensor2Baseline;
+    uint8_t validReadings1;
+    uint8_t validReadings2;
+};
+
+struct Frame {
+    uint8_t type;
+    uint16_t seq;
+    const uint8_t* payload;    // Points into the decode buffer
+    size_t length;
+};
+
+uint16_t crc16(const uint8_t* data, size_t length);
+
+// Encodes a frame into out, returns its length including the trailing 0x00,
+// or 0 if it does not fit.
+size_t encodeFrame(uint8_t type, uint16_t seq, const void* payload, size_t length,
+                   uint8_t* out, size_t capacity);
+
+// Decodes one COBS block (without its delimiter) in place. Returns false on a
+// malformed block or CRC mismatch.
+bool decodeFrame(uint8_t* data, size_t length, Frame& frame);
+
+}  // namespace serialproto
@@ -7,11 +7,15 @@
  * - Car loaded button must be pressed before race can start
  * - Start button to begin race
  * - RGB LED status indicator
+ * - JSON lines on serial, or COBS-framed binary messages once the host
+ *   negotiates them (see SerialProtocol.h)
  */
 
 #include <Wire.h>
 #include <VL53L0X.h>
 #include <ArduinoJson.h>
+#include <TimingCore.h>
+#include "SerialProtocol.h"
 
 // Pin definitions
 #define I2C_SDA             21
@@ -25,9 +29,18 @@
 #define LED_GREEN           26  // Active HIGH
 #define LED_BLUE            33  // Active HIGH
 
-// VL53L0X sensors
-VL53L0X sensor1;
-VL53L0X sensor2;
+// Serial link. The host must use the same baud rate (ESP32_BAUDRATE in the
+// race management system's .env). Most USB bridges handle 921600; CP2102N
+// and CH9102 bridges also run at 2000000.
+#ifndef SERIAL_BAUD
+#define SERIAL_BAUD         921600
+#endif
+#define SERIAL_RX_BUFFER    1024   // UART driver ring buffers, in bytes
+#define SERIAL_TX_BUFFER    4096
+
+// VL53L0X sensors, one per lane, at 0x30 and 0x31
+const uint8_t SENSOR_XSHUT[2] = { SENSOR1_XSHUT, SENSOR2_XSHUT };
+timingcore::VL53L0XLane laneSensors[2];
 
 // System state
 enum SystemState {
@@ -60,6 +73,45 @@ bool lastStartButtonState = HIGH;
 bool sensorCalibrated = false;
 StaticJsonDocument<256> lastCommandParams; // Store last command parameters
 
+// Serial link state. JSON lines until the host negotiates binary frames.
+const size_t RX_BUFFER_SIZE = 256;
+uint8_t rxBuffer[RX_BUFFER_SIZE];
+size_t rxLength = 0;
+bool rxOverflow = false;
+bool binaryProtocol = false;
+uint16_t txSeq = 0;
+int32_t lastCommandSeq = -1;   // Sequence of the last binary command run, for retransmits
+uint8_t lastCommandStatus = serialproto::ACK_OK;
+char txText[512];              // Serialized JSON waiting to be written
+uint32_t txDropped = 0;        // Messages dropped because the TX buffer was full
+uint32_t rxDropped = 0;        // Oversized or corrupt input discarded
+
+// Stream subscriptions, set by the host with the "subscribe" command. While
+// racing only finish events and results go out unless a stream opts in.
+struct Subscription {
+  bool enabled;
+  uint8_t mode;                // serialproto::StreamMode
+  uint16_t intervalMs;
+  uint16_t threshold;          // Sensor on-change threshold in mm
+  bool whileRacing;
+  unsigned long lastSentMs;
+};
+
+Subscription streams[serialproto::NUM_STREAMS] = {
+  { true,  serialproto::MODE_RAW,       100,  10, false, 0 },  // Sensor readings
+  { false, serialproto::MODE_ON_CHANGE, 1000, 0,  false, 0 },  // Status
+  { true,  serialproto::MODE_ON_CHANGE, 100,  0,  true,  0 }   // Race updates: finishes only
+};
+
+const char* STREAM_NAMES[] = { "sensor", "status", "race_update" };
+const char* MODE_NAMES[] = { "raw", "minmax", "on_change" };
+
+// Sensor window for MODE_MINMAX and the last values sent for MODE_ON_CHANGE
+int sensorMin[2], sensorMax[2];
+uint16_t sensorSamples = 0;
+int lastSentReading[2] = { -1, -1 };
+uint8_t lastStatusSignature = 0xFF;
+
 // Distance threshold for car detection (in mm)
 const int DETECTION_THRESHOLD = 100;
 
@@ -67,9 +119,70 @@ const int DETECTION_THRESHOLD = 100;
 int sensor1DefaultReading = 0;
 int sensor2DefaultReading = 0;
 
+// Both sensors range continuously and in parallel; loop() collects each
+// result as it becomes ready instead of waiting for a measurement. While
+// racing the timing core does the collecting and times each finish from the
+// sample that saw it. Lanes trigger DETECTION_THRESHOLD below their baseline
+// once calibration has armed them.
+const unsigned long SENSOR_POLL_US = 1000;     // Minimum time between result polls
+unsigned long lastSensorPollUs = 0;
+
+timingcore::LaneCore<2, timingcore::VL53L0XLane> raceLanes(laneSensors, 0);
+const timingcore::TiePolicy TIE_POLICY = { timingcore::TIE_EXACT, 0 };   // Identical times (ms) only
+const char* WINNER_NAMES[] = { "tie", "car1", "car2" };
+
+// Timed phases. These are advanced from loop() against millis() deadlines so
+// serial commands, buttons and sensors are serviced throughout.
+const int COUNTDOWN_SECONDS = 3;
+const unsigned long COUNTDOWN_BLINK_MS = 500;  // One purple blink per remaining second
+const unsigned long RELAY_PULSE_MS = 500;      // Long enough for reliable relay activation
+const unsigned long RESULT_DISPLAY_MS = 4200;  // Winner flashes, then auto-reset to IDLE
+const int CALIBRATION_SAMPLES = 15;
+const unsigned long CALIBRATION_INTERVAL_MS = 100;
+
+int countdownRemaining = 0;        // Seconds left; 0 while the relay fires
+unsigned long phaseStartMs = 0;    // Start of the countdown step, or of RACE_FINISHED
+bool relayActive = false;
+unsigned long relayStartMs = 0;
+unsigned long relayPulseMs = 0;
+
+struct Calibration {
+  bool active;
+  int samples;
+  long sum1, sum2;
+  int validReadings1, validReadings2;
+  unsigned long lastSampleMs;
+};
+Calibration calibration = { false, 0, 0, 0, 0, 0, 0 };
+
+// RGB LED colors as red/green/blue bits. Each state has a color; short
+// confirmation patterns override it until they have played out.
+enum LedColor : uint8_t {
+  COLOR_OFF = 0,
+  COLOR_RED = 1,
+  COLOR_GREEN = 2,
+  COLOR_YELLOW = 3,
+  COLOR_BLUE = 4,
+  COLOR_PURPLE = 5,
+  COLOR_CYAN = 6,
+  COLOR_WHITE = 7
+};
+
+const uint8_t SEQUENCE_COMMAND[] = { COLOR_RED, COLOR_GREEN, COLOR_BLUE };
+const uint8_t SEQUENCE_RELAY[] = { COLOR_RED };
+uint8_t ledPattern[8];
+uint8_t ledPatternLength = 0;
+uint16_t ledStepMs = 0;
+unsigned long ledPatternStartMs = 0;
+uint8_t shownColor = 0xFF;
+
 void setup() {
   // Initialize serial communication
-  Serial.begin(115200);
+  // With a TX ring buffer the UART driver drains output from its interrupt,
+  // so writes only copy into the buffer instead of waiting on the FIFO
+  Serial.setRxBufferSize(SERIAL_RX_BUFFER);
+  Serial.setTxBufferSize(SERIAL_TX_BUFFER);
+  Serial.begin(SERIAL_BAUD);
   Serial.println("CO2 Car Race Controller starting...");
   
   // Configure pins
@@ -95,16 +208,14 @@ void setup() {
   
   // Initialize I2C
   Wire.begin(I2C_SDA, I2C_SCL);
+  Wire.setClock(400000);  // Fast mode keeps the result polls short
   
   // Initialize VL53L0X sensors with different addresses
   initSensors();
   
-  // Calibrate sensors
+  // Calibrate sensors (finishes in the background from loop())
   calibrateSensors();
   
-  // Set LED to BLUE (system ready, waiting for cars)
-  setLedColor(false, false, true);
-  
   // Reset race data
   resetRaceData();
   
@@ -116,164 +227,158 @@ void loop() {
   // Process any incoming serial commands
   checkSerial();
   
-  // Read sensors
-  int distance1 = sensor1.readRangeSingleMillimeters();
-  int distance2 = sensor2.readRangeSingleMillimeters();
+  // Collect any new sensor results (and time finishes while racing)
+  bool newSample = readSensors();
+  int distance1 = laneSensors[0].getDistance();
+  int distance2 = laneSensors[1].getDistance();
   
   // Handle button presses
   handleButtons();
   
+  // Timed work that runs in any state
+  updateRelay();
+  updateCalibration(distance1, distance2);
+  
   // State machine
   switch (currentState) {
     case STATE_IDLE:
-      // In idle state, waiting for cars to be loaded
-      setLedColor(false, false, true);  // BLUE
-      break;
-      
     case STATE_CARS_LOADED:
-      // Cars are loaded, waiting for start button
-      setLedColor(false, true, false);  // GREEN
-      break;
-      
     case STATE_RACE_READY:
-      // Ready to start race, waiting for start button
-      setLedColor(false, true, true);   // CYAN
+      // Waiting for the buttons or a command
       break;
       
     case STATE_COUNTDOWN:
-      // Currently in countdown before race start
-      // This is handled by the startRace() function
+      // Counting down, then firing the relay
+      updateCountdown();
       break;
       
     case STATE_RACING:
-      // Race in progress, check for finish
-      setLedColor(true, true, false);   // YELLOW
-      
-      // Check if car 1 has crossed the finish line
-      if (!raceData.car1_finished && 
-          distance1 < (sensor1DefaultReading - DETECTION_THRESHOLD)) {
-        raceData.car1_finished = true;
-        raceData.car1_time = millis() - raceData.race_start_time;
-        sendRaceUpdate();
-      }
-      
-      // Check if car 2 has crossed the finish line
-      if (!raceData.car2_finished && 
-          distance2 < (sensor2DefaultReading - DETECTION_THRESHOLD)) {
-        raceData.car2_finished = true;
-        raceData.car2_time = millis() - raceData.race_start_time;
-        sendRaceUpdate();
-      }
+      // Race in progress; finishes are recorded by readSensors()
       
       // Check if race is complete
-      if (raceData.car1_finished && raceData.car2_finished) {
+      if (raceLanes.remaining() == 0) {
         currentState = STATE_RACE_FINISHED;
         finishRace();
       }
       break;
       
     case STATE_RACE_FINISHED:
-      // Race completed, flash LED based on winner
-      if (raceData.winner == "car1") {
-        blinkLed(LED_RED);
-      } else if (raceData.winner == "car2") {
-        blinkLed(LED_GREEN);
-      } else {
-        blinkLed(LED_BLUE);  // Tie or error
+      // Show the result for a while, then get ready for the next race
+      if (millis() - phaseStartMs >= RESULT_DISPLAY_MS) {
+        autoReset();
       }
       break;
   }
   
-  // Send sensor data every 100ms
-  static unsigned long lastSensorUpdateTime = 0;
-  if (millis() - lastSensorUpdateTime > 100) {
-    sendSensorData(distance1, distance2);
-    lastSensorUpdateTime = millis();
-  }
+  updateLed();
   
-  // Small delay to avoid overwhelming the serial port
-  delay(5); // Reduced from 10ms to 5ms for better responsiveness
+  // Subscribed sensor, status and race update streams
+  updateStreams(distance1, distance2, newSample);
 }
 
 void initSensors() {
-  // Reset both sensors
-  digitalWrite(SENSOR1_XSHUT, LOW);
-  digitalWrite(SENSOR2_XSHUT, LOW);
-  delay(10);
-  
-  // Initialize first sensor with address 0x30
-  digitalWrite(SENSOR1_XSHUT, HIGH);
-  delay(10);
-  sensor1.init();
-  sensor1.setTimeout(500);
-  sensor1.setAddress(0x30);
+  // One at a time on their XSHUT pins, each moved to its own address
+  timingcore::VL53L0XLane::beginAll(laneSensors, SENSOR_XSHUT, 2);
   
-  // Initialize second sensor with address 0x31
-  digitalWrite(SENSOR2_XSHUT, HIGH);
-  delay(10);
-  sensor2.init();
-  sensor2.setTimeout(500);
-  sensor2.setAddress(0x31);
-  
-  // Set long range mode for both sensors
-  sensor1.setSignalRateLimit(0.1);
-  sensor1.setVcselPulsePeriod(VL53L0X::VcselPeriodPreRange, 18);
-  sensor1.setVcselPulsePeriod(VL53L0X::VcselPeriodFinalRange, 14);
-  
-  sensor2.setSignalRateLimit(0.1);
-  sensor2.setVcselPulsePeriod(VL53L0X::VcselPeriodPreRange, 18);
-  sensor2.setVcselPulsePeriod(VL53L0X::VcselPeriodFinalRange, 14);
+  for (int n = 0; n < 2; n++) {
+    // Long range mode, back-to-back continuous ranging polled from loop()
+    laneSensors[n].setLongRange();
+    laneSensors[n].start();
+  }
 }
 
-void calibrateSensors() {
-  setLedColor(true, true, true); // WHITE during calibration
+// Polls both sensors, returns true if either produced a new result
+bool readSensors() {
+  if (micros() - lastSensorPollUs < SENSOR_POLL_US) {
+    return false;
+  }
+  lastSensorPollUs = micros();
   
-  // Take multiple readings and average them for better accuracy
-  const int numReadings = 15; // Increased from 10 to 15 readings for better accuracy
-  int sum1 = 0, sum2 = 0;
-  int validReadings1 = 0;
-  int validReadings2 = 0;
+  if (currentState == STATE_RACING) {
+    timingcore::StepResult step = raceLanes.step();
+    if (step.finished) {
+      recordFinishes();
+    }
+    return step.sampled;
+  }
   
+  bool newSample = false;
+  uint16_t distance;
+  uint32_t captureUs;
+  for (int n = 0; n < 2; n++) {
+    newSample |= laneSensors[n].poll(distance, captureUs);
+  }
+  return newSample;
+}
+
+// Copies lane finishes from the timing core into the race data
+void recordFinishes() {
+  const timingcore::LaneResult& lane1 = raceLanes.result(0);
+  const timingcore::LaneResult& lane2 = raceLanes.result(1);
+  
+  raceData.car1_finished = lane1.time != 0;
+  raceData.car2_finished = lane2.time != 0;
+  raceData.car1_time = lane1.time / 1000;
+  raceData.car2_time = lane2.time / 1000;
+  sendRaceUpdate();
+}
+
+// Arms finish detection DETECTION_THRESHOLD below each lane's baseline
+void armDetection() {
+  raceLanes.setFilter(0, timingcore::DetectionFilter::belowBaseline(sensor1DefaultReading, DETECTION_THRESHOLD));
+  raceLanes.setFilter(1, timingcore::DetectionFilter::belowBaseline(sensor2DefaultReading, DETECTION_THRESHOLD));
+}
+
+// Starts a baseline calibration. Samples are taken from loop() every
+// CALIBRATION_INTERVAL_MS and the result is reported when they are all in.
+void calibrateSensors() {
   // Reset calibration flag initially
   sensorCalibrated = false;
   
+  calibration.active = true;
+  calibration.samples = 0;
+  calibration.sum1 = 0;
+  calibration.sum2 = 0;
+  calibration.validReadings1 = 0;
+  calibration.validReadings2 = 0;
+  calibration.lastSampleMs = millis() - CALIBRATION_INTERVAL_MS;
+  
   // Send calibration start message
   StaticJsonDocument<200> startDoc;
   startDoc["type"] = "calibration_start";
-  String startJson;
-  serializeJson(startDoc, startJson);
-  Serial.println(startJson);
-  
-  // Take multiple readings with error checking
-  for (int i = 0; i < numReadings; i++) {
-    int reading1 = sensor1.readRangeSingleMillimeters();
-    int reading2 = sensor2.readRangeSingleMillimeters();
-    
-    // Check if readings are valid (not timeout)
-    if (!sensor1.timeoutOccurred() && reading1 > 0 && reading1 < 8000) {
-      sum1 += reading1;
-      validReadings1++;
-    }
-    
-    if (!sensor2.timeoutOccurred() && reading2 > 0 && reading2 < 8000) {
-      sum2 += reading2;
-      validReadings2++;
-    }
-    
-    // Flash LED to indicate calibration in progress
-    if (i % 2 == 0) {
-      setLedColor(true, true, true); // WHITE
-    } else {
-      setLedColor(false, false, false); // OFF
-    }
-    
-    delay(100); // Increased from 50ms to 100ms for more stable readings
+  sendJson(startDoc);
+}
+
+void updateCalibration(int reading1, int reading2) {
+  if (!calibration.active || millis() - calibration.lastSampleMs < CALIBRATION_INTERVAL_MS) {
+    return;
+  }
+  calibration.lastSampleMs = millis();
+  
+  // Check if readings are valid (recent and in range)
+  unsigned long now = micros();
+  if (laneSensors[0].isFresh(now) && reading1 > 0 && reading1 < 8000) {
+    calibration.sum1 += reading1;
+    calibration.validReadings1++;
+  }
+  
+  if (laneSensors[1].isFresh(now) && reading2 > 0 && reading2 < 8000) {
+    calibration.sum2 += reading2;
+    calibration.validReadings2++;
   }
   
+  if (++calibration.samples >= CALIBRATION_SAMPLES) {
+    finishCalibration();
+  }
+}
+
+void finishCalibration() {
+  calibration.active = false;
+  
   // Calculate averages if we have valid readings
-  if (validReadings1 > 0 && validReadings2 > 0) {
-    sensor1DefaultReading = sum1 / validReadings1;
-    sensor2DefaultReading = sum2 / validReadings2;
+  if (calibration.validReadings1 > 0 && calibration.validReadings2 > 0) {
+    sensor1DefaultReading = calibration.sum1 / calibration.validReadings1;
+    sensor2DefaultReading = calibration.sum2 / calibration.validReadings2;
     sensorCalibrated = true;
   } else {
     // If calibration failed, set some default values and mark as not calibrated
@@ -281,39 +386,33 @@ void calibrateSensors() {
     sensor2DefaultReading = 500; // Default value
     sensorCalibrated = false;
   }
+  armDetection();
   
   // Send calibration results
-  StaticJsonDocument<256> doc;
-  doc["type"] = "calibration";
-  doc["sensor1_baseline"] = sensor1DefaultReading;
-  doc["sensor2_baseline"] = sensor2DefaultReading;
-  doc["success"] = sensorCalibrated;
-  doc["valid_readings_1"] = validReadings1;
-  doc["valid_readings_2"] = validReadings2;
-  doc["sensors_calibrated"] = sensorCalibrated;
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  Serial.println(jsonString);
-  
-  // Set LED based on calibration result
-  if (sensorCalibrated) {
-    // Blink green 3 times to indicate success
-    for (int i = 0; i < 3; i++) {
-      setLedColor(false, true, false); // GREEN
-      delay(200);
-      setLedColor(false, false, false); // OFF
-      delay(200);
-    }
+  if (binaryProtocol) {
+    serialproto::CalibrationPayload payload;
+    payload.success = sensorCalibrated;
+    payload.sensor1Baseline = sensor1DefaultReading;
+    payload.sensor2Baseline = sensor2DefaultReading;
+    payload.validReadings1 = calibration.validReadings1;
+    payload.validReadings2 = calibration.validReadings2;
+    sendFrame(serialproto::MSG_CALIBRATION, &payload, sizeof(payload));
   } else {
-    // Blink red 3 times to indicate failure
-    for (int i = 0; i < 3; i++) {
-      setLedColor(true, false, false); // RED
-      delay(200);
-      setLedColor(false, false, false); // OFF
-      delay(200);
-    }
+    StaticJsonDocument<256> doc;
+    doc["type"] = "calibration";
+    doc["sensor1_baseline"] = sensor1DefaultReading;
+    doc["sensor2_baseline"] = sensor2DefaultReading;
+    doc["success"] = sensorCalibrated;
+    doc["valid_readings_1"] = calibration.validReadings1;
+    doc["valid_readings_2"] = calibration.validReadings2;
+    doc["sensors_calibrated"] = sensorCalibrated;
+    sendJson(doc);
   }
+  
+  // Blink green 3 times for success, red for failure
+  flashLed(sensorCalibrated ? COLOR_GREEN : COLOR_RED, 3, 200);
+  
+  sendStatus();
 }
 
 void resetRaceData() {
@@ -324,6 +423,7 @@ void resetRaceData() {
   raceData.race_start_time = 0;
   raceData.winner = "";
   raceData.race_id = 0;
+  raceLanes.reset();
 }
 
 void handleButtons() {
@@ -333,16 +433,16 @@ void handleButtons() {
     bool carLoadedReading = digitalRead(CAR_LOADED_BUTTON);
     bool startButtonReading = digitalRead(START_BUTTON);
     
-    // Report button states via serial
-    StaticJsonDocument<128> btnDoc;
-    btnDoc["type"] = "button_status";
-    btnDoc["car_loaded_button"] = carLoadedReading == LOW ? "PRESSED" : "RELEASED";
-    btnDoc["start_button"] = startButtonReading == LOW ? "PRESSED" : "RELEASED";
-    btnDoc["car_loaded_state"] = lastCarLoadedState == LOW ? "PRESSED" : "RELEASED";
-    btnDoc["start_button_state"] = lastStartButtonState == LOW ? "PRESSED" : "RELEASED";
-    String btnJson;
-    serializeJson(btnDoc, btnJson);
-    Serial.println(btnJson);
+    // Report button states via serial (not while racing, the link is kept quiet)
+    if (currentState != STATE_RACING) {
+      StaticJsonDocument<128> btnDoc;
+      btnDoc["type"] = "button_status";
+      btnDoc["car_loaded_button"] = carLoadedReading == LOW ? "PRESSED" : "RELEASED";
+      btnDoc["start_button"] = startButtonReading == LOW ? "PRESSED" : "RELEASED";
+      btnDoc["car_loaded_state"] = lastCarLoadedState == LOW ? "PRESSED" : "RELEASED";
+      btnDoc["start_button_state"] = lastStartButtonState == LOW ? "PRESSED" : "RELEASED";
+      sendJson(btnDoc);
+    }
     
     // If button has been held down for multiple debug cycles, force state change
     if (carLoadedReading == LOW && lastCarLoadedState == LOW && currentState == STATE_IDLE) {
@@ -350,9 +450,7 @@ void handleButtons() {
       btnHoldDoc["type"] = "button_hold_detected";
       btnHoldDoc["button"] = "car_loaded";
       btnHoldDoc["action"] = "forcing_state_change";
-      String btnHoldJson;
-      serializeJson(btnHoldDoc, btnHoldJson);
-      Serial.println(btnHoldJson);
+      sendJson(btnHoldDoc);
       
       // Force state change
       setStateToLoaded();
@@ -376,9 +474,7 @@ void handleButtons() {
     btnDoc["type"] = "button_pressed_edge";
     btnDoc["button"] = "car_loaded";
     btnDoc["previous_state"] = getStateString(currentState);
-    String btnJson;
-    serializeJson(btnDoc, btnJson);
-    Serial.println(btnJson);
+    sendJson(btnDoc);
     
     // Change state immediately on button press
     setStateToLoaded();
@@ -391,9 +487,7 @@ void handleButtons() {
     btnDoc["type"] = "button_pressed_edge";
     btnDoc["button"] = "start";
     btnDoc["previous_state"] = getStateString(currentState);
-    String btnJson;
-    serializeJson(btnDoc, btnJson);
-    Serial.println(btnJson);
+    sendJson(btnDoc);
     
     // Handle start button press immediately
     if (currentState == STATE_CARS_LOADED) {
@@ -429,39 +523,16 @@ void handleButtons() {
           btnDoc["type"] = "button_pressed";
           btnDoc["button"] = "car_loaded";
           btnDoc["previous_state"] = getStateString(currentState);
-          String btnJson;
-          serializeJson(btnDoc, btnJson);
-          Serial.println(btnJson);
+          sendJson(btnDoc);
           
           // Change state to cars loaded
           currentState = STATE_CARS_LOADED;
           
           // Flash green LED to confirm
-          for (int i = 0; i < 3; i++) {
-            digitalWrite(LED_GREEN, HIGH);
-            delay(100);
-            digitalWrite(LED_GREEN, LOW);
-            delay(100);
-          }
+          flashLed(COLOR_GREEN, 3, 100);
           
           // Send immediate status update with new state
-          StaticJsonDocument<256> statusDoc;
-          statusDoc["type"] = "status";
-          statusDoc["race_state"] = getStateString(currentState);
-          statusDoc["cars_loaded"] = true; // Explicitly set cars_loaded to true
-          statusDoc["race_started"] = false;
-          statusDoc["car1_finished"] = false;
-          statusDoc["car2_finished"] = false;
-          statusDoc["car1_time"] = 0;
-          statusDoc["car2_time"] = 0;
-          statusDoc["sensors_calibrated"] = sensorCalibrated;
-          statusDoc["sensor1_baseline"] = sensor1DefaultReading;
-          statusDoc["sensor2_baseline"] = sensor2DefaultReading;
-          statusDoc["timestamp"] = millis();
-          
-          String statusJson;
-          serializeJson(statusDoc, statusJson);
-          Serial.println(statusJson);
+          sendStatus();
         }
       }
     }
@@ -484,9 +555,7 @@ void handleButtons() {
         StaticJsonDocument<128> btnDoc;
         btnDoc["type"] = "button_pressed";
         btnDoc["button"] = "start";
-        String btnJson;
-        serializeJson(btnDoc, btnJson);
-        Serial.println(btnJson);
+        sendJson(btnDoc);
         
         if (currentState == STATE_CARS_LOADED) {
           currentState = STATE_RACE_READY;
@@ -504,9 +573,9 @@ void handleButtons() {
   lastStartButtonState = startButtonReading;
 }
 
+// Begins the countdown. updateCountdown() blinks the LED once per remaining
+// second, fires the relay and starts the race clock when the pulse ends.
 void startRace() {
-  setLedColor(true, false, true); // PURPLE for countdown
-  
   // Get race ID from the last command if available
   if (lastCommandParams.containsKey("race_id")) {
     raceData.race_id = lastCommandParams["race_id"].as<int>();
@@ -516,59 +585,92 @@ void startRace() {
     raceData.race_id = 0; // Default if no ID provided
   }
   
+  currentState = STATE_COUNTDOWN;
+  countdownRemaining = COUNTDOWN_SECONDS;
+  phaseStartMs = millis();
+  
   // Send race start notification
-  StaticJsonDocument<200> doc;
-  doc["type"] = "race_start";
-  doc["countdown"] = 3;
-  doc["race_id"] = raceData.race_id;
-  
-  String jsonString;
-  serializeJson(doc, jsonString);
-  Serial.println(jsonString);
-  
-  // Countdown from 3
-  for (int i = 3; i > 0; i--) {
-    // Blink LED according to countdown
-    for (int j = 0; j < i; j++) {
-      setLedColor(true, false, true); // PURPLE
-      delay(250);
-      setLedColor(false, false, false); // OFF
-      delay(250);
+  sendRaceStart(countdownRemaining);
+}
+
+void updateCountdown() {
+  if (countdownRemaining > 0) {
+    // The step for n remaining seconds lasts n blinks
+    if (millis() - phaseStartMs < countdownRemaining * COUNTDOWN_BLINK_MS) {
+      return;
     }
+    countdownRemaining--;
+    phaseStartMs = millis();
     
     // Send countdown update
-    doc["countdown"] = i - 1;
-    jsonString = "";
-    serializeJson(doc, jsonString);
-    Serial.println(jsonString);
+    sendRaceStart(countdownRemaining);
+    
+    if (countdownRemaining == 0) {
+      // Fire the relay to release CO2
+      pulseRelay(RELAY_PULSE_MS);
+    }
+    return;
   }
   
-  // Fire the relay to release CO2
-  digitalWrite(RELAY_PIN, LOW);  // Active LOW
-  delay(500);  // Increased from 100ms to 500ms for more reliable relay activation
-  digitalWrite(RELAY_PIN, HIGH); // Turn off relay
+  // The race clock starts when the relay pulse ends
+  if (relayActive) {
+    return;
+  }
   
   // Set race state and start time
   currentState = STATE_RACING;
   raceData.race_start_time = millis();
+  raceLanes.start(micros());
   
   // Send race started message
-  doc["type"] = "race_started";
-  doc["timestamp"] = raceData.race_start_time;
-  jsonString = "";
-  serializeJson(doc, jsonString);
-  Serial.println(jsonString);
+  if (binaryProtocol) {
+    serialproto::RaceStartedPayload payload;
+    payload.raceId = raceData.race_id;
+    payload.timestampMs = raceData.race_start_time;
+    sendFrame(serialproto::MSG_RACE_STARTED, &payload, sizeof(payload));
+  } else {
+    StaticJsonDocument<200> doc;
+    doc["type"] = "race_started";
+    doc["countdown"] = 0;
+    doc["race_id"] = raceData.race_id;
+    doc["timestamp"] = raceData.race_start_time;
+    sendJson(doc);
+  }
 }
 
-void finishRace() {
-  // Determine winner
-  if (raceData.car1_time < raceData.car2_time) {
-    raceData.winner = "car1";
-  } else if (raceData.car2_time < raceData.car1_time) {
-    raceData.winner = "car2";
+void sendRaceStart(int countdown) {
+  if (binaryProtocol) {
+    serialproto::RaceStartPayload payload;
+    payload.raceId = raceData.race_id;
+    payload.countdown = countdown;
+    sendFrame(serialproto::MSG_RACE_START, &payload, sizeof(payload));
   } else {
-    raceData.winner = "tie";
+    StaticJsonDocument<200> doc;
+    doc["type"] = "race_start";
+    doc["countdown"] = countdown;
+    doc["race_id"] = raceData.race_id;
+    sendJson(doc);
   }
+}
+
+// Drives the relay (active LOW) for durationMs; updateRelay() releases it
+void pulseRelay(unsigned long durationMs) {
+  digitalWrite(RELAY_PIN, LOW);
+  relayActive = true;
+  relayStartMs = millis();
+  relayPulseMs = durationMs;
+}
+
+void updateRelay() {
+  if (relayActive && millis() - relayStartMs >= relayPulseMs) {
+    digitalWrite(RELAY_PIN, HIGH); // Turn off relay
+    relayActive = false;
+  }
+}
+
+void finishRace() {
+  // Determine winner on the reported (ms) times
+  raceData.winner = WINNER_NAMES[TIE_POLICY.apply(raceData.car1_time, raceData.car2_time).winner];
   
   // Create the JSON document for results
   StaticJsonDocument<256> doc;
@@ -577,69 +679,228 @@ void finishRace() {
   doc["winner"] = raceData.winner;
   doc["race_id"] = raceData.race_id;  // Include the race ID
   
-  String jsonString;
-  
-  // Send race_result message (original)
-  doc["type"] = "race_result";
-  jsonString = "";
-  serializeJson(doc, jsonString);
-  Serial.println(jsonString);
-  
-  // Send race_completed message (for frontend compatibility)
-  doc["type"] = "race_completed";
-  jsonString = "";
-  serializeJson(doc, jsonString);
-  Serial.println(jsonString);
-  
-  // Flash LEDs to indicate race completion
-  for (int i = 0; i < 3; i++) {
-    if (raceData.winner == "car1") {
-      setLedColor(true, false, false); // RED for car1
-    } else if (raceData.winner == "car2") {
-      setLedColor(false, true, false); // GREEN for car2
-    } else {
-      setLedColor(false, false, true); // BLUE for tie
-    }
-    delay(200);
-    setLedColor(false, false, false); // OFF
-    delay(200);
+  if (binaryProtocol) {
+    // One sequenced frame; the host derives both JSON message types from it
+    serialproto::RaceResultPayload payload;
+    payload.raceId = raceData.race_id;
+    payload.car1TimeMs = raceData.car1_time;
+    payload.car2TimeMs = raceData.car2_time;
+    payload.winner = raceData.winner == "car1" ? 1 : (raceData.winner == "car2" ? 2 : 0);
+    sendFrame(serialproto::MSG_RACE_RESULT, &payload, sizeof(payload));
+  } else {
+    // Send race_result message (original)
+    doc["type"] = "race_result";
+    sendJson(doc);
+    
+    // Send race_completed message (for frontend compatibility)
+    doc["type"] = "race_completed";
+    sendJson(doc);
   }
   
-  // Wait 3 seconds to show the race result before auto-resetting
-  delay(3000);
-  
+  // Flash the winner's color, then keep blinking it until the auto-reset
+  flashLed(winnerColor(), 3, 200);
+  phaseStartMs = millis();
+}
+
+// Called RESULT_DISPLAY_MS after the finish
+void autoReset() {
   // Send message about auto-reset
   StaticJsonDocument<128> resetDoc;
   resetDoc["type"] = "auto_reset";
   resetDoc["message"] = "Auto-resetting to IDLE state";
-  jsonString = "";
-  serializeJson(resetDoc, jsonString);
-  Serial.println(jsonString);
+  sendJson(resetDoc);
   
   // Reset race data and return to IDLE state
   resetRaceData();
   currentState = STATE_IDLE;
   
-  // Set LED back to BLUE (system ready)
-  setLedColor(false, false, true);
-  
   // Send status update with the new state
   sendStatus();
 }
 
 void sendSensorData(int distance1, int distance2) {
+  if (binaryProtocol) {
+    serialproto::SensorPayload payload;
+    payload.timestampMs = millis();
+    payload.sensor1 = distance1;
+    payload.sensor2 = distance2;
+    sendFrame(serialproto::MSG_SENSOR, &payload, sizeof(payload));
+    return;
+  }
+  
   StaticJsonDocument<200> doc;
   doc["type"] = "sensor_reading";
   doc["sensor1"] = distance1;
   doc["sensor2"] = distance2;
   doc["timestamp"] = millis();
   
-  String jsonString;
-  serializeJson(doc, jsonString);
-  Serial.println(jsonString);
+  sendJson(doc);
+}
+
+void sendSensorWindow(int distance1, int distance2) {
+  if (binaryProtocol) {
+    serialproto::SensorWindowPayload payload;
+    payload.timestampMs = millis();
+    payload.sensor1 = distance1;
+    payload.sensor2 = distance2;
+    payload.sensor1Min = sensorMin[0];
+    payload.sensor1Max = sensorMax[0];
+    payload.sensor2Min = sensorMin[1];
+    payload.sensor2Max = sensorMax[1];
+    payload.samples = sensorSamples;
+    sendFrame(serialproto::MSG_SENSOR_WINDOW, &payload, sizeof(payload));
+    return;
+  }
+  
+  StaticJsonDocument<256> doc;
+  doc["type"] = "sensor_reading";
+  doc["sensor1"] = distance1;
+  doc["sensor2"] = distance2;
+  doc["sensor1_min"] = sensorMin[0];
+  doc["sensor1_max"] = sensorMax[0];
+  doc["sensor2_min"] = sensorMin[1];
+  doc["sensor2_max"] = sensorMax[1];
+  doc["samples"] = sensorSamples;
+  doc["timestamp"] = millis();
+  
+  sendJson(doc);
+}
+
+// Emits whatever the subscriptions call for on this pass through loop().
+// newSample is set when the readings include a new sensor result.
+void updateStreams(int distance1, int distance2, bool newSample) {
+  unsigned long now = millis();
+  bool racing = currentState == STATE_COUNTDOWN || currentState == STATE_RACING;
+  
+  // Sensor readings
+  Subscription& sensor = streams[serialproto::STREAM_SENSOR];
+  if (sensor.enabled && (!racing || sensor.whileRacing)) {
+    if (newSample) {
+      if (sensorSamples == 0) {
+        sensorMin[0] = sensorMax[0] = distance1;
+        sensorMin[1] = sensorMax[1] = distance2;
+      } else {
+        sensorMin[0] = min(sensorMin[0], distance1);
+        sensorMax[0] = max(sensorMax[0], distance1);
+        sensorMin[1] = min(sensorMin[1], distance2);
+        sensorMax[1] = max(sensorMax[1], distance2);
+      }
+      if (sensorSamples < 0xFFFF) {
+        sensorSamples++;
+      }
+    }
+    
+    if (now - sensor.lastSentMs >= sensor.intervalMs) {
+      bool send = true;
+      if (sensor.mode == serialproto::MODE_MINMAX) {
+        send = sensorSamples > 0;
+      } else if (sensor.mode == serialproto::MODE_ON_CHANGE) {
+        send = lastSentReading[0] < 0 ||
+               abs(distance1 - lastSentReading[0]) >= sensor.threshold ||
+               abs(distance2 - lastSentReading[1]) >= sensor.threshold;
+      }
+      if (send) {
+        if (sensor.mode == serialproto::MODE_MINMAX) {
+          sendSensorWindow(distance1, distance2);
+        } else {
+          sendSensorData(distance1, distance2);
+        }
+        lastSentReading[0] = distance1;
+        lastSentReading[1] = distance2;
+        sensor.lastSentMs = now;
+        sensorSamples = 0;
+      }
+    }
+  } else {
+    sensorSamples = 0;
+  }
+  
+  // Status
+  Subscription& status = streams[serialproto::STREAM_STATUS];
+  if (status.enabled && (!racing || status.whileRacing) && now - status.lastSentMs >= status.intervalMs) {
+    uint8_t signature = currentState << 3 | raceData.car1_finished << 2 |
+                        raceData.car2_finished << 1 | sensorCalibrated;
+    if (status.mode != serialproto::MODE_ON_CHANGE || signature != lastStatusSignature) {
+      sendStatus();
+      lastStatusSignature = signature;
+      status.lastSentMs = now;
+    }
+  }
+  
+  // Elapsed-time race updates; the finishes themselves are always sent
+  Subscription& update = streams[serialproto::STREAM_RACE_UPDATE];
+  if (update.enabled && update.mode != serialproto::MODE_ON_CHANGE && currentState == STATE_RACING &&
+      now - update.lastSentMs >= update.intervalMs) {
+    sendRaceUpdate();
+    update.lastSentMs = now;
+  }
+}
+
+// {"cmd":"subscribe","stream":"sensor","mode":"minmax","interval_ms":50,
+//  "threshold":10,"while_racing":false,"enabled":true}. Omitted fields keep
+// their current value; the reply reports the resulting subscription.
+void handleSubscribe(JsonDocument& doc) {
+  const char* name = doc["stream"] | "";
+  int stream = -1;
+  for (int i = 0; i < serialproto::NUM_STREAMS; i++) {
+    if (strcmp(name, STREAM_NAMES[i]) == 0) {
+      stream = i;
+    }
+  }
+  if (stream < 0) {
+    sendJson("{\"type\":\"error\",\"message\":\"Unknown stream\"}");
+    return;
+  }
+  
+  Subscription& sub = streams[stream];
+  if (doc.containsKey("mode")) {
+    const char* mode = doc["mode"] | "";
+    for (int i = 0; i < 3; i++) {
+      if (strcmp(mode, MODE_NAMES[i]) == 0) {
+        sub.mode = i;
+      }
+    }
+  }
+  if (doc.containsKey("interval_ms")) {
+    sub.intervalMs = doc["interval_ms"];
+  }
+  if (doc.containsKey("threshold")) {
+    sub.threshold = doc["threshold"];
+  }
+  if (doc.containsKey("while_racing")) {
+    sub.whileRacing = doc["while_racing"];
+  }
+  sub.enabled = doc["enabled"] | true;
+  
+  // Start the new settings from a clean window
+  sub.lastSentMs = 0;
+  sensorSamples = 0;
+  lastSentReading[0] = lastSentReading[1] = -1;
+  lastStatusSignature = 0xFF;
+  
+  StaticJsonDocument<192> reply;
+  reply["type"] = "subscription";
+  reply["stream"] = STREAM_NAMES[stream];
+  reply["enabled"] = sub.enabled;
+  reply["mode"] = MODE_NAMES[sub.mode];
+  reply["interval_ms"] = sub.intervalMs;
+  reply["threshold"] = sub.threshold;
+  reply["while_racing"] = sub.whileRacing;
+  sendJson(reply);
 }
 
 void sendRaceUpdate() {
+  if (binaryProtocol) {
+    serialproto::RaceUpdatePayload payload;
+    payload.flags = (raceData.car1_finished ? serialproto::FLAG_CAR1_FINISHED : 0) |
+                    (raceData.car2_finished ? serialproto::FLAG_CAR2_FINISHED : 0);
+    payload.car1TimeMs = raceData.car1_time;
+    payload.car2TimeMs = raceData.car2_time;
+    payload.elapsedMs = millis() - raceData.race_start_time;
+    sendFrame(serialproto::MSG_RACE_UPDATE, &payload, sizeof(payload));
+    return;
+  }
+  
   StaticJsonDocument<256> doc;
   doc["type"] = "race_update";
   doc["car1_finished"] = raceData.car1_finished;
@@ -648,25 +909,42 @@ void sendRaceUpdate() {
   doc["car2_time"] = raceData.car2_time;
   doc["elapsed_time"] = millis() - raceData.race_start_time;
   
-  String jsonString;
-  serializeJson(doc, jsonString);
-  Serial.println(jsonString);
+  sendJson(doc);
 }
 
 void sendStatus() {
-  StaticJsonDocument<256> doc;
-  doc["type"] = "status";
-  doc["race_state"] = getStateString(currentState);
-  
   // Explicitly set cars_loaded based on current state
   bool carsLoaded = (currentState == STATE_CARS_LOADED || 
                     currentState == STATE_RACE_READY || 
                     currentState == STATE_COUNTDOWN || 
                     currentState == STATE_RACING || 
                     currentState == STATE_RACE_FINISHED);
-  doc["cars_loaded"] = carsLoaded;
+  bool raceStarted = (currentState == STATE_RACING || currentState == STATE_RACE_FINISHED);
+  
+  if (binaryProtocol) {
+    serialproto::StatusPayload payload;
+    payload.state = currentState;
+    payload.flags = (carsLoaded ? serialproto::FLAG_CARS_LOADED : 0) |
+                    (raceStarted ? serialproto::FLAG_RACE_STARTED : 0) |
+                    (raceData.car1_finished ? serialproto::FLAG_CAR1_FINISHED : 0) |
+                    (raceData.car2_finished ? serialproto::FLAG_CAR2_FINISHED : 0) |
+                    (sensorCalibrated ? serialproto::FLAG_SENSORS_CALIBRATED : 0);
+    payload.car1TimeMs = raceData.car1_time;
+    payload.car2TimeMs = raceData.car2_time;
+    payload.sensor1Baseline = sensor1DefaultReading;
+    payload.sensor2Baseline = sensor2DefaultReading;
+    payload.timestampMs = millis();
+    payload.txDropped = txDropped;
+    payload.rxDropped = rxDropped;
+    sendFrame(serialproto::MSG_STATUS, &payload, sizeof(payload));
+    return;
+  }
   
-  doc["race_started"] = (currentState == STATE_RACING || currentState == STATE_RACE_FINISHED);
+  StaticJsonDocument<384> doc;
+  doc["type"] = "status";
+  doc["race_state"] = getStateString(currentState);
+  doc["cars_loaded"] = carsLoaded;
+  doc["race_started"] = raceStarted;
   doc["car1_finished"] = raceData.car1_finished;
   doc["car2_finished"] = raceData.car2_finished;
   doc["car1_time"] = raceData.car1_time;
@@ -675,10 +953,10 @@ void sendStatus() {
   doc["sensor1_baseline"] = sensor1DefaultReading;
   doc["sensor2_baseline"] = sensor2DefaultReading;
   doc["timestamp"] = millis();
+  doc["tx_dropped"] = txDropped;
+  doc["rx_dropped"] = rxDropped;
   
-  String jsonString;
-  serializeJson(doc, jsonString);
-  Serial.println(jsonString);
+  sendJson(doc);
 }
 
 String getStateString(SystemState state) {
@@ -699,351 +977,551 @@ void setLedColor(bool red, bool green, bool blue) {
   digitalWrite(LED_BLUE, blue ? HIGH : LOW);
 }
 
-void blinkLed(int pin) {
-  static unsigned long lastBlinkTime = 0;
-  static bool ledState = false;
+// Flashes a color on and off, stepMs per half-cycle
+void flashLed(uint8_t color, uint8_t times, uint16_t stepMs) {
+  ledPatternLength = 0;
+  for (uint8_t i = 0; i < times && (size_t)ledPatternLength + 2 <= sizeof(ledPattern); i++) {
+    ledPattern[ledPatternLength++] = color;
+    ledPattern[ledPatternLength++] = COLOR_OFF;
+  }
+  ledStepMs = stepMs;
+  ledPatternStartMs = millis();
+}
+
+// Shows each color in turn for stepMs
+void playLedSequence(const uint8_t* colors, uint8_t length, uint16_t stepMs) {
+  ledPatternLength = min((size_t)length, sizeof(ledPattern));
+  memcpy(ledPattern, colors, ledPatternLength);
+  ledStepMs = stepMs;
+  ledPatternStartMs = millis();
+}
+
+uint8_t winnerColor() {
+  if (raceData.winner == "car1") {
+    return COLOR_RED;
+  } else if (raceData.winner == "car2") {
+    return COLOR_GREEN;
+  }
+  return COLOR_BLUE;  // Tie or error
+}
+
+// The LED color for the current state and phase
+uint8_t stateColor() {
+  unsigned long now = millis();
+  if (calibration.active) {
+    // Flash white while calibration samples are taken
+    return calibration.samples % 2 == 0 ? COLOR_WHITE : COLOR_OFF;
+  }
   
-  if (millis() - lastBlinkTime > 300) {
-    ledState = !ledState;
-    digitalWrite(pin, ledState ? HIGH : LOW);
-    lastBlinkTime = millis();
+  switch (currentState) {
+    case STATE_IDLE: return COLOR_BLUE;
+    case STATE_CARS_LOADED: return COLOR_GREEN;
+    case STATE_RACE_READY: return COLOR_CYAN;
+    case STATE_COUNTDOWN:
+      if (countdownRemaining == 0) {
+        return COLOR_PURPLE;  // Relay firing
+      }
+      return (now - phaseStartMs) % COUNTDOWN_BLINK_MS < COUNTDOWN_BLINK_MS / 2 ? COLOR_PURPLE : COLOR_OFF;
+    case STATE_RACING: return COLOR_YELLOW;
+    case STATE_RACE_FINISHED:
+      return (now - phaseStartMs) / 300 % 2 == 0 ? winnerColor() : COLOR_OFF;
+    default: return COLOR_OFF;
   }
 }
 
-// Check for serial commands - called from loop and can be called more frequently
+// Plays the active pattern, otherwise shows the state color. The pins are
+// only written when the color changes.
+void updateLed() {
+  uint8_t color;
+  unsigned long elapsed = millis() - ledPatternStartMs;
+  if (ledPatternLength > 0 && elapsed < (unsigned long)ledPatternLength * ledStepMs) {
+    color = ledPattern[elapsed / ledStepMs];
+  } else {
+    ledPatternLength = 0;
+    color = stateColor();
+  }
+  
+  if (color != shownColor) {
+    setLedColor(color & COLOR_RED, color & COLOR_GREEN, color & COLOR_BLUE);
+    shownColor = color;
+  }
+}
+
+// Reads whatever serial input is available without blocking. JSON mode
+// collects newline-terminated lines; binary mode collects 0x00-terminated
+// COBS frames, but still accepts a JSON line so the host can renegotiate.
+// At most one buffer's worth is taken per call so a flood of input cannot
+// hold up the race state machine.
 void checkSerial() {
-  if (Serial.available()) {
-    String input = Serial.readStringUntil('\n');
-    input.trim();  // Remove any whitespace
+  for (size_t budget = RX_BUFFER_SIZE; budget > 0 && Serial.available(); budget--) {
+    uint8_t c = Serial.read();
     
-    // Debug - echo back the received command
-    StaticJsonDocument<128> echoDoc;
-    echoDoc["type"] = "echo";
-    echoDoc["received"] = input;
-    String echoJson;
-    serializeJson(echoDoc, echoJson);
-    Serial.println(echoJson);
-    
-    // First check for direct string commands (non-JSON)
-    // This allows for simpler command handling from the web UI
-    if (input == "testrace") {
-      // This is a direct command for testing race start
-      Serial.println("{\"type\":\"direct_command\",\"cmd\":\"testrace\",\"message\":\"Starting test race\"}");
-      
-      // Always set cars loaded first if needed
-      if (currentState == STATE_IDLE) {
-        currentState = STATE_CARS_LOADED;
-        // Flash green LED to confirm
-        for (int i = 0; i < 3; i++) {
-          digitalWrite(LED_GREEN, HIGH);
-          delay(100);
-          digitalWrite(LED_GREEN, LOW);
-          delay(100);
+    bool textLine = !binaryProtocol || (rxLength > 0 && rxBuffer[0] == '{');
+    if (textLine && (c == '\n' || c == '\r')) {
+      if (rxOverflow) {
+        rxDropped++;
+      } else if (rxLength > 0) {
+        rxBuffer[rxLength] = '\0';
+        String input = (const char*)rxBuffer;
+        input.trim();  // Remove any whitespace
+        if (input.length() > 0) {
+          handleLine(input);
         }
       }
-      
-      if (currentState == STATE_CARS_LOADED) {
-        currentState = STATE_RACE_READY;
-        startRace();
-        Serial.println("{\"type\":\"success\",\"message\":\"Test race started\"}");
-      } else {
-        Serial.println("{\"type\":\"error\",\"message\":\"Cannot start test race in current state\"}");
+      rxLength = 0;
+      rxOverflow = false;
+      continue;
+    }
+    
+    if (binaryProtocol && c == 0) {
+      if (rxOverflow) {
+        rxDropped++;
+      } else if (rxLength > 0) {
+        handleFrame(rxBuffer, rxLength);
       }
-      return;
+      rxLength = 0;
+      rxOverflow = false;
+      continue;
     }
-    else if (input == "calibrate") {
-      // Direct command for sensor calibration
-      Serial.println("{\"type\":\"direct_command\",\"cmd\":\"calibrate\",\"message\":\"Starting calibration\"}");
-      
-      // Visual feedback
-      digitalWrite(LED_RED, HIGH);
-      delay(200);
-      digitalWrite(LED_RED, LOW);
-      digitalWrite(LED_GREEN, HIGH);
-      delay(200);
-      digitalWrite(LED_GREEN, LOW);
-      digitalWrite(LED_BLUE, HIGH);
-      delay(200);
-      digitalWrite(LED_BLUE, LOW);
-      
-      calibrateSensors();
-      sendStatus();
-      Serial.println("{\"type\":\"success\",\"message\":\"Calibration complete\"}");
-      return;
+    
+    // Drop oversized input up to the next delimiter
+    if (rxLength < RX_BUFFER_SIZE - 1) {
+      rxBuffer[rxLength++] = c;
+    } else {
+      rxOverflow = true;
     }
-    else if (input == "resetTimer") {
-      // Direct command for resetting the timer
-      Serial.println("{\"type\":\"direct_command\",\"cmd\":\"resetTimer\",\"message\":\"Resetting timer\"}");
-      
-      resetRaceData();
-      currentState = STATE_IDLE;
-      sendStatus();
-      Serial.println("{\"type\":\"success\",\"message\":\"Timer reset complete\"}");
-      return;
+  }
+}
+
+// Serial writes must never wait for the UART: a message that does not fit
+// in the TX buffer right now is dropped and counted instead.
+bool reserveTx(size_t length) {
+  if ((size_t)Serial.availableForWrite() >= length) {
+    return true;
+  }
+  txDropped++;
+  return false;
+}
+
+// Sends a JSON message as a line, or wrapped in a frame in binary mode
+void sendJson(JsonDocument& doc) {
+  size_t length = measureJson(doc);
+  if (length >= sizeof(txText)) {
+    txDropped++;
+    return;
+  }
+  serializeJson(doc, txText, sizeof(txText));
+  sendText(txText, length);
+}
+
+void sendJson(const char* json) {
+  sendText(json, strlen(json));
+}
+
+void sendText(const char* text, size_t length) {
+  if (binaryProtocol) {
+    sendFrame(serialproto::MSG_JSON, text, length);
+  } else if (reserveTx(length + 2)) {
+    Serial.write((const uint8_t*)text, length);
+    Serial.write((const uint8_t*)"\r\n", 2);
+  }
+}
+
+void sendFrame(uint8_t type, const void* payload, size_t length) {
+  uint8_t frame[serialproto::encodedSize(serialproto::MAX_FRAME)];
+  size_t frameLength = serialproto::encodeFrame(type, txSeq, payload, length, frame, sizeof(frame));
+  
+  // The sequence number advances even for a dropped frame so the host sees the gap
+  txSeq++;
+  if (frameLength == 0) {
+    txDropped++;
+  } else if (reserveTx(frameLength)) {
+    Serial.write(frame, frameLength);
+  }
+}
+
+void sendAck(uint16_t seq, uint8_t status) {
+  serialproto::AckPayload payload;
+  payload.seq = seq;
+  payload.status = status;
+  sendFrame(serialproto::MSG_ACK, &payload, sizeof(payload));
+}
+
+// {"cmd":"hello","protocol":"binary","version":1} switches to binary frames.
+// The reply always goes out as JSON so the host can read it either way.
+void handleHello(JsonDocument& doc) {
+  const char* protocol = doc["protocol"] | "json";
+  int version = doc["version"] | 0;
+  bool binary = strcmp(protocol, "binary") == 0 && version == serialproto::PROTOCOL_VERSION;
+  
+  if (binaryProtocol) {
+    // Ends whatever partial line the host has assembled from our frames
+    if (reserveTx(2)) {
+      Serial.write((const uint8_t*)"\r\n", 2);
     }
-    else if (input == "carLoaded") {
-      // Direct command for setting cars loaded
-      Serial.println("{\"type\":\"direct_command\",\"cmd\":\"carLoaded\",\"message\":\"Setting cars loaded\"}");
-      
-      if (currentState == STATE_IDLE) {
-        currentState = STATE_CARS_LOADED;
-        
-        // Flash green LED to confirm
-        for (int i = 0; i < 3; i++) {
-          digitalWrite(LED_GREEN, HIGH);
-          delay(100);
-          digitalWrite(LED_GREEN, LOW);
-          delay(100);
-        }
-        
-        sendStatus();
-        Serial.println("{\"type\":\"success\",\"message\":\"Cars loaded successfully\"}");
-      } else {
-        Serial.println("{\"type\":\"error\",\"message\":\"Can only set cars loaded in IDLE state\"}");
-      }
-      return;
+    binaryProtocol = false;
+  }
+  StaticJsonDocument<128> reply;
+  reply["type"] = "hello";
+  reply["protocol"] = binary ? "binary" : "json";
+  reply["version"] = serialproto::PROTOCOL_VERSION;
+  reply["max_frame"] = serialproto::MAX_HOST_FRAME;
+  sendJson(reply);
+  
+  binaryProtocol = binary;
+  txSeq = 0;
+  lastCommandSeq = -1;
+}
+
+const char* binaryCommandName(uint8_t command) {
+  switch (command) {
+    case serialproto::CMD_START_RACE: return "start_race";
+    case serialproto::CMD_RESET_TIMER: return "reset_timer";
+    case serialproto::CMD_CALIBRATE: return "calibrate";
+    case serialproto::CMD_CAR_LOADED: return "car_loaded";
+    case serialproto::CMD_FORCE_RESET: return "force_reset";
+    case serialproto::CMD_FIRE_RELAY: return "fire_relay";
+    case serialproto::CMD_SUBSCRIBE: return "subscribe";
+    default: return NULL;
+  }
+}
+
+// Handles one COBS block received in binary mode
+void handleFrame(uint8_t* data, size_t length) {
+  serialproto::Frame frame;
+  if (length > serialproto::encodedSize(serialproto::MAX_HOST_FRAME) ||
+      !serialproto::decodeFrame(data, length, frame)) {
+    rxDropped++;
+    return;  // Corrupt: no ACK, so the host retransmits
+  }
+  if (frame.type != serialproto::MSG_COMMAND) {
+    return;
+  }
+  
+  // A retransmit of the command we just ran: the ACK was lost, not the command
+  if ((int32_t)frame.seq == lastCommandSeq) {
+    sendAck(frame.seq, lastCommandStatus);
+    return;
+  }
+  
+  uint8_t command = frame.length > 0 ? frame.payload[0] : 0;
+  int32_t raceId = 0;
+  uint8_t status = serialproto::ACK_OK;
+  if (frame.length == 0) {
+    status = serialproto::ACK_BAD_LENGTH;
+  } else if (command == serialproto::CMD_START_RACE) {
+    if (frame.length < sizeof(serialproto::CommandPayload)) {
+      status = serialproto::ACK_BAD_LENGTH;
+    } else {
+      memcpy(&raceId, frame.payload + 1, sizeof(raceId));
     }
-    else if (input == "forceReset") {
-      // Direct command for force reset
-      Serial.println("{\"type\":\"direct_command\",\"cmd\":\"forceReset\",\"message\":\"Force resetting system\"}");
-      
-      resetRaceData();
-      currentState = STATE_IDLE;
-      
-      // Flash all LEDs to confirm reset
-      for (int i = 0; i < 3; i++) {
-        setLedColor(true, true, true); // WHITE
-        delay(200);
-        setLedColor(false, false, false); // OFF
-        delay(200);
+  } else if (command == serialproto::CMD_SUBSCRIBE) {
+    if (frame.length < sizeof(serialproto::SubscribePayload) ||
+        frame.payload[1] >= serialproto::NUM_STREAMS) {
+      status = serialproto::ACK_BAD_LENGTH;
+    }
+  } else if (command != serialproto::CMD_STATUS && command != serialproto::CMD_PING &&
+             command != serialproto::CMD_TEST_RACE && binaryCommandName(command) == NULL) {
+    status = serialproto::ACK_UNKNOWN_COMMAND;
+  }
+  
+  lastCommandSeq = frame.seq;
+  lastCommandStatus = status;
+  
+  // Acknowledge before running, so the ACK precedes any reply to the command
+  sendAck(frame.seq, status);
+  if (status != serialproto::ACK_OK) {
+    return;
+  }
+  
+  if (command == serialproto::CMD_STATUS) {
+    sendStatus();
+  } else if (command == serialproto::CMD_PING) {
+    sendJson("{\"type\":\"pong\",\"message\":\"ESP32 is alive\"}");
+  } else if (command == serialproto::CMD_TEST_RACE) {
+    handleLine("testrace");
+  } else {
+    StaticJsonDocument<192> cmdDoc;
+    cmdDoc["cmd"] = binaryCommandName(command);
+    if (command == serialproto::CMD_START_RACE) {
+      cmdDoc["race_id"] = raceId;
+    } else if (command == serialproto::CMD_SUBSCRIBE) {
+      serialproto::SubscribePayload sub;
+      memcpy(&sub, frame.payload, sizeof(sub));
+      cmdDoc["stream"] = STREAM_NAMES[sub.stream];
+      cmdDoc["enabled"] = (sub.flags & serialproto::SUB_ENABLED) != 0;
+      if (sub.mode < 3) {
+        cmdDoc["mode"] = MODE_NAMES[sub.mode];
       }
+      if (sub.intervalMs > 0) {
+        cmdDoc["interval_ms"] = sub.intervalMs;
+      }
+      if (sub.threshold > 0) {
+        cmdDoc["threshold"] = sub.threshold;
+      }
+      if (sub.flags & serialproto::SUB_SET_WHILE_RACING) {
+        cmdDoc["while_racing"] = (sub.flags & serialproto::SUB_WHILE_RACING) != 0;
+      }
+    }
+    handleJsonCommand(cmdDoc);
+  }
+}
+
+// Handles one line of text: a direct command or a JSON command
+void handleLine(String input) {
+  input.trim();  // Remove any whitespace
+  
+  // First check for direct string commands (non-JSON)
+  // This allows for simpler command handling from the web UI
+  if (input == "testrace") {
+    // This is a direct command for testing race start
+    sendJson("{\"type\":\"direct_command\",\"cmd\":\"testrace\",\"message\":\"Starting test race\"}");
+    
+    // Always set cars loaded first if needed
+    if (currentState == STATE_IDLE) {
+      currentState = STATE_CARS_LOADED;
+      // Flash green LED to confirm
+      flashLed(COLOR_GREEN, 3, 100);
+    }
+    
+    if (currentState == STATE_CARS_LOADED) {
+      currentState = STATE_RACE_READY;
+      startRace();
+      sendJson("{\"type\":\"success\",\"message\":\"Test race started\"}");
+    } else {
+      sendJson("{\"type\":\"error\",\"message\":\"Cannot start test race in current state\"}");
+    }
+    return;
+  }
+  else if (input == "calibrate") {
+    // Direct command for sensor calibration
+    sendJson("{\"type\":\"direct_command\",\"cmd\":\"calibrate\",\"message\":\"Starting calibration\"}");
+    
+    // Visual feedback
+    playLedSequence(SEQUENCE_COMMAND, sizeof(SEQUENCE_COMMAND), 200);
+    
+    // Results and a status update follow when the samples are in
+    calibrateSensors();
+    sendJson("{\"type\":\"success\",\"message\":\"Calibration started\"}");
+    return;
+  }
+  else if (input == "resetTimer") {
+    // Direct command for resetting the timer
+    sendJson("{\"type\":\"direct_command\",\"cmd\":\"resetTimer\",\"message\":\"Resetting timer\"}");
+    
+    resetRaceData();
+    currentState = STATE_IDLE;
+    sendStatus();
+    sendJson("{\"type\":\"success\",\"message\":\"Timer reset complete\"}");
+    return;
+  }
+  else if (input == "carLoaded") {
+    // Direct command for setting cars loaded
+    sendJson("{\"type\":\"direct_command\",\"cmd\":\"carLoaded\",\"message\":\"Setting cars loaded\"}");
+    
+    if (currentState == STATE_IDLE) {
+      currentState = STATE_CARS_LOADED;
       
-      // Set back to BLUE (system ready, waiting for cars)
-      setLedColor(false, false, true);
+      // Flash green LED to confirm
+      flashLed(COLOR_GREEN, 3, 100);
       
       sendStatus();
-      Serial.println("{\"type\":\"success\",\"message\":\"System forcibly reset to IDLE\"}");
-      return;
+      sendJson("{\"type\":\"success\",\"message\":\"Cars loaded successfully\"}");
+    } else {
+      sendJson("{\"type\":\"error\",\"message\":\"Can only set cars loaded in IDLE state\"}");
     }
-    else if (input == "status") {
-      // Direct command for status update
-      Serial.println("{\"type\":\"direct_command\",\"cmd\":\"status\",\"message\":\"Requesting status\"}");
-      sendStatus();
+    return;
+  }
+  else if (input == "forceReset") {
+    // Direct command for force reset
+    sendJson("{\"type\":\"direct_command\",\"cmd\":\"forceReset\",\"message\":\"Force resetting system\"}");
+    
+    resetRaceData();
+    currentState = STATE_IDLE;
+    
+    // Flash all LEDs to confirm reset, then back to BLUE
+    flashLed(COLOR_WHITE, 3, 200);
+    
+    sendStatus();
+    sendJson("{\"type\":\"success\",\"message\":\"System forcibly reset to IDLE\"}");
+    return;
+  }
+  else if (input == "status") {
+    // Direct command for status update
+    sendJson("{\"type\":\"direct_command\",\"cmd\":\"status\",\"message\":\"Requesting status\"}");
+    sendStatus();
+    return;
+  }
+  else if (input == "ping") {
+    // Simple ping command for testing connection
+    sendJson("{\"type\":\"pong\",\"message\":\"ESP32 is alive\"}");
+    return;
+  }
+  
+  // If we get here, it wasn't a direct command, so try to parse as JSON
+  try {
+    // Parse JSON command
+    StaticJsonDocument<256> doc;
+    DeserializationError error = deserializeJson(doc, input);
+    
+    if (error) {
+      // Failed to parse as JSON
+      sendJson("{\"type\":\"error\",\"message\":\"Invalid JSON command\"}");
       return;
     }
-    else if (input == "ping") {
-      // Simple ping command for testing connection
-      Serial.println("{\"type\":\"pong\",\"message\":\"ESP32 is alive\"}");
+    
+    const char* cmd = doc["cmd"];
+    if (cmd && strcmp(cmd, "hello") == 0) {
+      handleHello(doc);
       return;
     }
+    if (binaryProtocol) {
+      // The host has gone back to JSON lines (e.g. it was restarted)
+      binaryProtocol = false;
+      sendJson("{\"type\":\"protocol\",\"protocol\":\"json\"}");
+    }
     
-    // If we get here, it wasn't a direct command, so try to parse as JSON
-    try {
-      // Parse JSON command
-      StaticJsonDocument<256> doc;
-      DeserializationError error = deserializeJson(doc, input);
-      
-      if (error) {
-        // Failed to parse as JSON
-        Serial.println("{\"type\":\"error\",\"message\":\"Invalid JSON command\"}");
-        return;
-      }
+    handleJsonCommand(doc);
+  } catch (const std::exception& e) {
+    // Handle any exceptions that might occur during JSON parsing
+    StaticJsonDocument<128> errDoc;
+    errDoc["type"] = "error";
+    errDoc["message"] = "Exception occurred during command processing";
+    errDoc["exception"] = e.what();
+    
+    sendJson(errDoc);
+  }
+}
+
+// Dispatches a parsed JSON command (also used for binary commands)
+void handleJsonCommand(JsonDocument& doc) {
+  // Extract command
+  const char* cmd = doc["cmd"];
+  
+  // Store the command parameters for later use
+  lastCommandParams = doc;
+  
+  if (!cmd) {
+    return;
+  }
+  
+  // Handle commands
+  if (strcmp(cmd, "status") == 0) {
+    sendStatus();
+  }
+  else if (strcmp(cmd, "subscribe") == 0) {
+    handleSubscribe(doc);
+  }
+  else if (strcmp(cmd, "start_race") == 0 || strcmp(cmd, "startRace") == 0) {
+    // Log the start race command
+    sendJson("{\"type\":\"command_received\",\"cmd\":\"start_race\"}");
+    
+    // Start a race (if in correct state)
+    if (currentState == STATE_CARS_LOADED || currentState == STATE_RACE_READY) {
+      currentState = STATE_RACE_READY;
+      startRace();
+    } else {
+      sendJson("{\"type\":\"error\",\"message\":\"Cannot start race in current state\"}");
+    }
+  }
+  else if (strcmp(cmd, "reset_timer") == 0) {
+    // Reset the race timer
+    sendJson("{\"type\":\"command_received\",\"cmd\":\"reset_timer\"}");
+    resetRaceData();
+    currentState = STATE_IDLE;
+    sendStatus();
+  }
+  else if (strcmp(cmd, "calibrate") == 0) {
+    // Immediately show visual feedback that command was received
+    // Flash RED-GREEN-BLUE in sequence to show command received
+    playLedSequence(SEQUENCE_COMMAND, sizeof(SEQUENCE_COMMAND), 200);
+    
+    // Send acknowledgment before starting calibration
+    StaticJsonDocument<128> ackDoc;
+    ackDoc["type"] = "calibrate_ack";
+    ackDoc["message"] = "Starting calibration...";
+    sendJson(ackDoc);
+    
+    // Recalibrate sensors; results and a status update follow when done
+    calibrateSensors();
+  }
+  else if (strcmp(cmd, "car_loaded") == 0) {
+    // Simulate car loaded button press
+    StaticJsonDocument<128> ackDoc;
+    ackDoc["type"] = "car_loaded_ack";
+    ackDoc["message"] = "Setting cars loaded status...";
+    ackDoc["previous_state"] = getStateString(currentState);
+    sendJson(ackDoc);
+    
+    // Set state to cars loaded
+    if (currentState == STATE_IDLE) {
+      currentState = STATE_CARS_LOADED;
       
-      // Extract command
-      const char* cmd = doc["cmd"];
+      // Flash green LED to confirm
+      flashLed(COLOR_GREEN, 3, 100);
       
-      // Store the command parameters for later use
-      lastCommandParams = doc;
+      // Send immediate status update with new state
+      sendStatus();
       
-      if (cmd) {
-        // Handle commands
-        if (strcmp(cmd, "start_race") == 0 || strcmp(cmd, "startRace") == 0) {
-          // Log the start race command
-          Serial.println("{\"type\":\"command_received\",\"cmd\":\"start_race\"}");
-          
-          // Start a race (if in correct state)
-          if (currentState == STATE_CARS_LOADED || currentState == STATE_RACE_READY) {
-            currentState = STATE_RACE_READY;
-            startRace();
-          } else {
-            Serial.println("{\"type\":\"error\",\"message\":\"Cannot start race in current state\"}");
-          }
-        }
-        else if (strcmp(cmd, "reset_timer") == 0) {
-          // Reset the race timer
-          Serial.println("{\"type\":\"command_received\",\"cmd\":\"reset_timer\"}");
-          resetRaceData();
-          currentState = STATE_IDLE;
-          sendStatus();
-        }
-        else if (strcmp(cmd, "calibrate") == 0) {
-          // Immediately show visual feedback that command was received
-          // Flash RED-GREEN-BLUE in sequence to show command received
-          digitalWrite(LED_RED, HIGH);
-          delay(200);
-          digitalWrite(LED_RED, LOW);
-          digitalWrite(LED_GREEN, HIGH);
-          delay(200);
-          digitalWrite(LED_GREEN, LOW);
-          digitalWrite(LED_BLUE, HIGH);
-          delay(200);
-          digitalWrite(LED_BLUE, LOW);
-          
-          // Send acknowledgment before starting calibration
-          StaticJsonDocument<128> ackDoc;
-          ackDoc["type"] = "calibrate_ack";
-          ackDoc["message"] = "Starting calibration...";
-          String ackJson;
-          serializeJson(ackDoc, ackJson);
-          Serial.println(ackJson);
-          
-          // Recalibrate sensors
-          calibrateSensors();
-          sendStatus();
-        }
-        else if (strcmp(cmd, "car_loaded") == 0) {
-          // Simulate car loaded button press
-          StaticJsonDocument<128> ackDoc;
-          ackDoc["type"] = "car_loaded_ack";
-          ackDoc["message"] = "Setting cars loaded status...";
-          ackDoc["previous_state"] = getStateString(currentState);
-          String ackJson;
-          serializeJson(ackDoc, ackJson);
-          Serial.println(ackJson);
-          
-          // Set state to cars loaded
-          if (currentState == STATE_IDLE) {
-            currentState = STATE_CARS_LOADED;
-            
-            // Flash green LED to confirm
-            for (int i = 0; i < 3; i++) {
-              digitalWrite(LED_GREEN, HIGH);
-              delay(100);
-              digitalWrite(LED_GREEN, LOW);
-              delay(100);
-            }
-            
-            // Send immediate status update with new state
-            StaticJsonDocument<256> statusDoc;
-            statusDoc["type"] = "status";
-            statusDoc["race_state"] = getStateString(currentState);
-            statusDoc["cars_loaded"] = true; // Explicitly set cars_loaded to true
-            statusDoc["race_started"] = false;
-            statusDoc["car1_finished"] = false;
-            statusDoc["car2_finished"] = false;
-            statusDoc["car1_time"] = 0;
-            statusDoc["car2_time"] = 0;
-            statusDoc["sensors_calibrated"] = sensorCalibrated;
-            statusDoc["sensor1_baseline"] = sensor1DefaultReading;
-            statusDoc["sensor2_baseline"] = sensor2DefaultReading;
-            statusDoc["timestamp"] = millis();
-            
-            String statusJson;
-            serializeJson(statusDoc, statusJson);
-            Serial.println(statusJson);
-            
-            // Send success confirmation
-            StaticJsonDocument<128> successDoc;
-            successDoc["type"] = "success";
-            successDoc["message"] = "Cars loaded successfully";
-            successDoc["new_state"] = getStateString(currentState);
-            String successJson;
-            serializeJson(successDoc, successJson);
-            Serial.println(successJson);
-          } else {
-            // Send error if not in idle state
-            StaticJsonDocument<128> errDoc;
-            errDoc["type"] = "error";
-            errDoc["message"] = "Can only set cars loaded in IDLE state";
-            errDoc["current_state"] = getStateString(currentState);
-            
-            String errJson;
-            serializeJson(errDoc, errJson);
-            Serial.println(errJson);
-          }
-        }
-        else if (strcmp(cmd, "force_reset") == 0) {
-          // Force reset the system to IDLE state
-          StaticJsonDocument<128> resetAckDoc;
-          resetAckDoc["type"] = "force_reset_ack";
-          resetAckDoc["previous_state"] = getStateString(currentState);
-          String resetAckJson;
-          serializeJson(resetAckDoc, resetAckJson);
-          Serial.println(resetAckJson);
-          
-          // Reset the system
-          resetRaceData();
-          currentState = STATE_IDLE;
-          
-          // Flash all LEDs to confirm reset
-          for (int i = 0; i < 3; i++) {
-            setLedColor(true, true, true); // WHITE
-            delay(200);
-            setLedColor(false, false, false); // OFF
-            delay(200);
-          }
-          
-          // Set back to BLUE (system ready, waiting for cars)
-          setLedColor(false, false, true);
-          
-          // Send immediate status update
-          sendStatus();
-          
-          // Send success confirmation
-          StaticJsonDocument<128> resetSuccessDoc;
-          resetSuccessDoc["type"] = "success";
-          resetSuccessDoc["message"] = "System forcibly reset to IDLE";
-          resetSuccessDoc["new_state"] = getStateString(currentState);
-          String resetSuccessJson;
-          serializeJson(resetSuccessDoc, resetSuccessJson);
-          Serial.println(resetSuccessJson);
-        }
-        else if (strcmp(cmd, "fire_relay") == 0) {
-          // Fire the relay directly without starting a race
-          StaticJsonDocument<128> relayAckDoc;
-          relayAckDoc["type"] = "relay_ack";
-          relayAckDoc["message"] = "Firing relay...";
-          String relayAckJson;
-          serializeJson(relayAckDoc, relayAckJson);
-          Serial.println(relayAckJson);
-          
-          // Flash RED LED briefly to indicate relay firing
-          setLedColor(true, false, false); // RED
-          delay(100);
-          
-          // Fire the relay
-          digitalWrite(RELAY_PIN, LOW);  // Active LOW
-          delay(500);  // 500ms for reliable relay activation
-          digitalWrite(RELAY_PIN, HIGH); // Turn off relay
-          
-          // Revert LED color to current state
-          if (currentState == STATE_RACING) {
-            setLedColor(true, true, false); // YELLOW for racing
-          } else {
-            setLedColor(false, false, true); // BLUE default
-          }
-          
-          // Send success confirmation
-          StaticJsonDocument<128> relaySuccessDoc;
-          relaySuccessDoc["type"] = "success";
-          relaySuccessDoc["message"] = "Relay fired successfully";
-          String relaySuccessJson;
-          serializeJson(relaySuccessDoc, relaySuccessJson);
-          Serial.println(relaySuccessJson);
-        }
-      }
-    } catch (const std::exception& e) {
-      // Handle any exceptions that might occur during JSON parsing
+      // Send success confirmation
+      StaticJsonDocument<128> successDoc;
+      successDoc["type"] = "success";
+      successDoc["message"] = "Cars loaded successfully";
+      successDoc["new_state"] = getStateString(currentState);
+      sendJson(successDoc);
+    } else {
+      // Send error if not in idle state
       StaticJsonDocument<128> errDoc;
       errDoc["type"] = "error";
-      errDoc["message"] = "Exception occurred during command processing";
-      errDoc["exception"] = e.what();
+      errDoc["message"] = "Can only set cars loaded in IDLE state";
+      errDoc["current_state"] = getStateString(currentState);
       
-      String errJson;
-      serializeJson(errDoc, errJson);
-      Serial.println(errJson);
+      sendJson(errDoc);
     }
   }
+  else if (strcmp(cmd, "force_reset") == 0) {
+    // Force reset the system to IDLE state
+    StaticJsonDocument<128> resetAckDoc;
+    resetAckDoc["type"] = "force_reset_ack";
+    resetAckDoc["previous_state"] = getStateString(currentState);
+    sendJson(resetAckDoc);
+    
+    // Reset the system
+    resetRaceData();
+    currentState = STATE_IDLE;
+    
+    // Flash all LEDs to confirm reset, then back to BLUE
+    flashLed(COLOR_WHITE, 3, 200);
+    
+    // Send immediate status update
+    sendStatus();
+    
+    // Send success confirmation
+    StaticJsonDocument<128> resetSuccessDoc;
+    resetSuccessDoc["type"] = "success";
+    resetSuccessDoc["message"] = "System forcibly reset to IDLE";
+    resetSuccessDoc["new_state"] = getStateString(currentState);
+    sendJson(resetSuccessDoc);
+  }
+  else if (strcmp(cmd, "fire_relay") == 0) {
+    // Fire the relay directly without starting a race
+    StaticJsonDocument<128> relayAckDoc;
+    relayAckDoc["type"] = "relay_ack";
+    relayAckDoc["message"] = "Firing relay...";
+    sendJson(relayAckDoc);
+    
+    // Show RED while the relay fires
+    playLedSequence(SEQUENCE_RELAY, sizeof(SEQUENCE_RELAY), RELAY_PULSE_MS);
+    
+    // Fire the relay
+    pulseRelay(RELAY_PULSE_MS);
+    
+    // Send success confirmation
+    StaticJsonDocument<128> relaySuccessDoc;
+    relaySuccessDoc["type"] = "success";
+    relaySuccessDoc["message"] = "Relay fired successfully";
+    sendJson(relaySuccessDoc);
+  }
 }
 
 // Test LEDs and hardware components
@@ -1052,9 +1530,7 @@ void testHardware() {
   StaticJsonDocument<128> testDoc;
   testDoc["type"] = "hardware_test";
   testDoc["message"] = "Testing hardware...";
-  String testJson;
-  serializeJson(testDoc, testJson);
-  Serial.println(testJson);
+  sendJson(testDoc);
   
   // Test each LED individually
   digitalWrite(LED_RED, HIGH);
@@ -1089,9 +1565,7 @@ void testHardware() {
   btnDoc["start_button"] = startBtnState == LOW ? "PRESSED" : "RELEASED";
   btnDoc["car_loaded_pin"] = CAR_LOADED_BUTTON;
   btnDoc["start_button_pin"] = START_BUTTON;
-  String btnJson;
-  serializeJson(btnDoc, btnJson);
-  Serial.println(btnJson);
+  sendJson(btnDoc);
   
   // Send a simulated car_loaded command to test the functionality
   StaticJsonDocument<128> testCmd;
@@ -1113,9 +1587,7 @@ void testHardware() {
     currentState = STATE_CARS_LOADED;
     
     testResponse["state_after"] = getStateString(currentState);
-    String testResponseJson;
-    serializeJson(testResponse, testResponseJson);
-    Serial.println(testResponseJson);
+    sendJson(testResponse);
     
     // Revert to previous state
     currentState = previousState;
@@ -1123,9 +1595,7 @@ void testHardware() {
   
   // Test complete
   testDoc["message"] = "Hardware test complete";
-  testJson = "";
-  serializeJson(testDoc, testJson);
-  Serial.println(testJson);
+  sendJson(testDoc);
 }
 
 // Add a new function to directly set the cars loaded state
@@ -1141,17 +1611,10 @@ void setStateToLoaded() {
     currentState = STATE_CARS_LOADED;
     
     stateDoc["new_state"] = getStateString(currentState);
-    String stateJson;
-    serializeJson(stateDoc, stateJson);
-    Serial.println(stateJson);
+    sendJson(stateDoc);
     
     // Flash green LED to confirm
-    for (int i = 0; i < 3; i++) {
-      digitalWrite(LED_GREEN, HIGH);
-      delay(100);
-      digitalWrite(LED_GREEN, LOW);
-      delay(100);
-    }
+    flashLed(COLOR_GREEN, 3, 100);
     
     // Send immediate status update with new state
     sendStatus();